@@ -132,6 +132,20 @@ int lfs_emubd_create(const struct lfs_config *cfg,
     bd->ooo_block = -1;
     bd->ooo_data = NULL;
     bd->disk = NULL;
+    bd->time = 0;
+    bd->busy = NULL;
+
+    // simulating latency? track when each block is next idle
+    if (bd->cfg->read_latency
+            || bd->cfg->prog_latency
+            || bd->cfg->erase_latency) {
+        bd->busy = malloc(bd->cfg->erase_count * sizeof(lfs_emubd_sleep_t));
+        if (!bd->busy) {
+            LFS_EMUBD_TRACE("lfs_emubd_create -> %d", LFS_ERR_NOMEM);
+            return LFS_ERR_NOMEM;
+        }
+        memset(bd->busy, 0, bd->cfg->erase_count * sizeof(lfs_emubd_sleep_t));
+    }
 
     if (bd->cfg->disk_path) {
         bd->disk = malloc(sizeof(lfs_emubd_disk_t));
@@ -197,6 +211,7 @@ int lfs_emubd_destroy(const struct lfs_config *cfg) {
     free(bd->blocks);
 
     // clean up other resources 
+    free(bd->busy);
     lfs_emubd_decblock(bd->ooo_data);
     if (bd->disk) {
         bd->disk->rc -= 1;
@@ -284,6 +299,19 @@ static int lfs_emubd_powerloss(const struct lfs_config *cfg) {
 
 // block device API
 
+// simulate latency, an operation waits for its block to be idle, and we
+// wait for the operation to complete
+static void lfs_emubd_latency(lfs_emubd_t *bd,
+        lfs_block_t block, lfs_emubd_sleep_t latency) {
+    if (bd->busy) {
+        if (bd->busy[block] > bd->time) {
+            bd->time = bd->busy[block];
+        }
+        bd->time += latency;
+        bd->busy[block] = bd->time;
+    }
+}
+
 int lfs_emubd_read(const struct lfs_config *cfg, lfs_block_t block,
         lfs_off_t off, void *buffer, lfs_size_t size) {
     LFS_EMUBD_TRACE("lfs_emubd_read(%p, "
@@ -296,6 +324,7 @@ int lfs_emubd_read(const struct lfs_config *cfg, lfs_block_t block,
     LFS_ASSERT(off  % bd->cfg->read_size == 0);
     LFS_ASSERT(size % bd->cfg->read_size == 0);
     LFS_ASSERT(off+size <= bd->cfg->erase_size);
+    lfs_emubd_latency(bd, block, bd->cfg->read_latency);
 
     // get the block
     const lfs_emubd_block_t *b = bd->blocks[block];
@@ -346,6 +375,7 @@ int lfs_emubd_prog(const struct lfs_config *cfg, lfs_block_t block,
     LFS_ASSERT(off  % bd->cfg->prog_size == 0);
     LFS_ASSERT(size % bd->cfg->prog_size == 0);
     LFS_ASSERT(off+size <= bd->cfg->erase_size);
+    lfs_emubd_latency(bd, block, bd->cfg->prog_latency);
 
     // get the block
     lfs_emubd_block_t *b = lfs_emubd_mutblock(cfg, &bd->blocks[block]);
@@ -435,6 +465,7 @@ int lfs_emubd_erase(const struct lfs_config *cfg, lfs_block_t block) {
 
     // check if erase is valid
     LFS_ASSERT(block < bd->cfg->erase_count);
+    lfs_emubd_latency(bd, block, bd->cfg->erase_latency);
 
     // emulate out-of-order writes? save first write
     if (bd->cfg->powerloss_behavior == LFS_EMUBD_POWERLOSS_OOO
@@ -540,6 +571,45 @@ int lfs_emubd_sync(const struct lfs_config *cfg) {
     return 0;
 }
 
+int lfs_emubd_submit(const struct lfs_config *cfg, struct lfs_bd_io *io) {
+    LFS_EMUBD_TRACE("lfs_emubd_submit(%p, %p {.type=%"PRIu8", "
+                ".block=0x%"PRIx32", .off=%"PRIu32", .buffer=%p, "
+                ".size=%"PRIu32"})",
+            (void*)cfg, (void*)io, io->type,
+            io->block, io->off, io->buffer, io->size);
+    lfs_emubd_t *bd = cfg->context;
+
+    // do the operation now, but don't wait for it
+    lfs_emubd_sleep_t time = bd->time;
+    int err;
+    if (io->type == LFS_BD_IO_READ) {
+        err = lfs_emubd_read(cfg, io->block, io->off, io->buffer, io->size);
+    } else if (io->type == LFS_BD_IO_PROG) {
+        err = lfs_emubd_prog(cfg, io->block, io->off, io->buffer, io->size);
+    } else {
+        LFS_ASSERT(io->type == LFS_BD_IO_ERASE);
+        err = lfs_emubd_erase(cfg, io->block);
+    }
+    io->token = (uintptr_t)bd->time;
+    bd->time = time;
+
+    LFS_EMUBD_TRACE("lfs_emubd_submit -> %d", err);
+    return err;
+}
+
+int lfs_emubd_wait(const struct lfs_config *cfg, struct lfs_bd_io *io) {
+    LFS_EMUBD_TRACE("lfs_emubd_wait(%p, %p)", (void*)cfg, (void*)io);
+    lfs_emubd_t *bd = cfg->context;
+
+    // wait until the operation completes
+    if ((lfs_emubd_sleep_t)io->token > bd->time) {
+        bd->time = io->token;
+    }
+
+    LFS_EMUBD_TRACE("lfs_emubd_wait -> %d", 0);
+    return 0;
+}
+
 
 /// Additional extended API for driving test features ///
 
@@ -642,6 +712,13 @@ int lfs_emubd_seterased(const struct lfs_config *cfg, lfs_emubd_io_t erased) {
     return 0;
 }
 
+lfs_emubd_ssleep_t lfs_emubd_time(const struct lfs_config *cfg) {
+    LFS_EMUBD_TRACE("lfs_emubd_time(%p)", (void*)cfg);
+    lfs_emubd_t *bd = cfg->context;
+    LFS_EMUBD_TRACE("lfs_emubd_time -> %"PRIu64, bd->time);
+    return bd->time;
+}
+
 lfs_emubd_swear_t lfs_emubd_wear(const struct lfs_config *cfg,
         lfs_block_t block) {
     LFS_EMUBD_TRACE("lfs_emubd_wear(%p, %"PRIu32")", (void*)cfg, block);
@@ -731,6 +808,17 @@ int lfs_emubd_copy(const struct lfs_config *cfg, lfs_emubd_t *copy) {
     if (copy->disk) {
         copy->disk->rc += 1;
     }
+    copy->time = bd->time;
+    copy->busy = NULL;
+    if (bd->busy) {
+        copy->busy = malloc(bd->cfg->erase_count * sizeof(lfs_emubd_sleep_t));
+        if (!copy->busy) {
+            LFS_EMUBD_TRACE("lfs_emubd_copy -> %d", LFS_ERR_NOMEM);
+            return LFS_ERR_NOMEM;
+        }
+        memcpy(copy->busy, bd->busy,
+                bd->cfg->erase_count * sizeof(lfs_emubd_sleep_t));
+    }
     copy->cfg = bd->cfg;
 
     LFS_EMUBD_TRACE("lfs_emubd_copy -> %d", 0);
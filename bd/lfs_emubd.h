@@ -126,6 +126,18 @@ struct lfs_emubd_config {
     // Artificial delay in nanoseconds, there is no purpose for this other
     // than slowing down the simulation.
     lfs_emubd_sleep_t erase_sleep;
+
+    // Simulated latency of a read in nanoseconds. Simulated time only
+    // advances when waiting on the block device, see lfs_emubd_time.
+    // Operations on different blocks may overlap when submitted with
+    // lfs_emubd_submit, operations on the same block never do.
+    lfs_emubd_sleep_t read_latency;
+
+    // Simulated latency of a prog in nanoseconds.
+    lfs_emubd_sleep_t prog_latency;
+
+    // Simulated latency of an erase in nanoseconds.
+    lfs_emubd_sleep_t erase_latency;
 };
 
 // A reference counted block
@@ -156,6 +168,8 @@ typedef struct lfs_emubd {
     lfs_ssize_t ooo_block;
     lfs_emubd_block_t *ooo_data;
     lfs_emubd_disk_t *disk;
+    lfs_emubd_sleep_t time;
+    lfs_emubd_sleep_t *busy;
 
     const struct lfs_emubd_config *cfg;
 } lfs_emubd_t;
@@ -189,6 +203,15 @@ int lfs_emubd_erase(const struct lfs_config *cfg, lfs_block_t block);
 // Sync the block device
 int lfs_emubd_sync(const struct lfs_config *cfg);
 
+// Submit an asynchronous read, prog, or erase
+//
+// The operation takes effect immediately, but only completes in simulated
+// time when waited on.
+int lfs_emubd_submit(const struct lfs_config *cfg, struct lfs_bd_io *io);
+
+// Wait for an asynchronous operation to complete
+int lfs_emubd_wait(const struct lfs_config *cfg, struct lfs_bd_io *io);
+
 
 /// Additional extended API for driving test features ///
 
@@ -217,6 +240,9 @@ int lfs_emubd_setproged(const struct lfs_config *cfg, lfs_emubd_io_t proged);
 // Manually set amount of bytes erased
 int lfs_emubd_seterased(const struct lfs_config *cfg, lfs_emubd_io_t erased);
 
+// Get simulated time in nanoseconds
+lfs_emubd_ssleep_t lfs_emubd_time(const struct lfs_config *cfg);
+
 // Get simulated wear on a given block
 lfs_emubd_swear_t lfs_emubd_wear(const struct lfs_config *cfg,
         lfs_block_t block);
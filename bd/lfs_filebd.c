@@ -5,6 +5,12 @@
  * Copyright (c) 2017, Arm Limited. All rights reserved.
  * SPDX-License-Identifier: BSD-3-Clause
  */
+
+// ftruncate is POSIX, and hidden by strict -std=c99 without this
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "bd/lfs_filebd.h"
 
 #include <fcntl.h>
@@ -13,6 +19,9 @@
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 int lfs_filebd_create(const struct lfs_config *cfg, const char *path,
@@ -21,16 +30,18 @@ int lfs_filebd_create(const struct lfs_config *cfg, const char *path,
                 ".read=%p, .prog=%p, .erase=%p, .sync=%p}, "
                 "\"%s\", "
                 "%p {.read_size=%"PRIu32", .prog_size=%"PRIu32", "
-                ".erase_size=%"PRIu32", .erase_count=%"PRIu32"})",
+                ".erase_size=%"PRIu32", .erase_count=%"PRIu32", "
+                ".mmap=%d})",
             (void*)cfg, cfg->context,
             (void*)(uintptr_t)cfg->read, (void*)(uintptr_t)cfg->prog,
             (void*)(uintptr_t)cfg->erase, (void*)(uintptr_t)cfg->sync,
             path,
             (void*)bdcfg,
             bdcfg->read_size, bdcfg->prog_size, bdcfg->erase_size,
-            bdcfg->erase_count);
+            bdcfg->erase_count, bdcfg->mmap);
     lfs_filebd_t *bd = cfg->context;
     bd->cfg = bdcfg;
+    bd->map = NULL;
 
     // open file
     #ifdef _WIN32
@@ -45,6 +56,34 @@ int lfs_filebd_create(const struct lfs_config *cfg, const char *path,
         return err;
     }
 
+    #ifndef _WIN32
+    if (bdcfg->mmap) {
+        // grow the file to cover the whole device, mapping past the end
+        // of a file isn't allowed
+        off_t size = (off_t)bdcfg->erase_size*bdcfg->erase_count;
+        struct stat st;
+        int err = fstat(bd->fd, &st);
+        if (!err && st.st_size < size) {
+            err = ftruncate(bd->fd, size);
+        }
+
+        void *map = NULL;
+        if (!err) {
+            map = mmap(NULL, size,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, bd->fd, 0);
+        }
+
+        if (err || map == MAP_FAILED) {
+            err = -errno;
+            close(bd->fd);
+            LFS_FILEBD_TRACE("lfs_filebd_create -> %d", err);
+            return err;
+        }
+
+        bd->map = map;
+    }
+    #endif
+
     LFS_FILEBD_TRACE("lfs_filebd_create -> %d", 0);
     return 0;
 }
@@ -52,6 +91,13 @@ int lfs_filebd_create(const struct lfs_config *cfg, const char *path,
 int lfs_filebd_destroy(const struct lfs_config *cfg) {
     LFS_FILEBD_TRACE("lfs_filebd_destroy(%p)", (void*)cfg);
     lfs_filebd_t *bd = cfg->context;
+    #ifndef _WIN32
+    if (bd->map) {
+        munmap(bd->map, (size_t)bd->cfg->erase_size*bd->cfg->erase_count);
+        bd->map = NULL;
+    }
+    #endif
+
     int err = close(bd->fd);
     if (err < 0) {
         err = -errno;
@@ -75,6 +121,14 @@ int lfs_filebd_read(const struct lfs_config *cfg, lfs_block_t block,
     LFS_ASSERT(size % bd->cfg->read_size == 0);
     LFS_ASSERT(off+size <= bd->cfg->erase_size);
 
+    // read from our mapping?
+    if (bd->map) {
+        memcpy(buffer, &bd->map[(size_t)block*bd->cfg->erase_size + off],
+                size);
+        LFS_FILEBD_TRACE("lfs_filebd_read -> %d", 0);
+        return 0;
+    }
+
     // zero for reproducibility (in case file is truncated)
     memset(buffer, 0, size);
 
@@ -111,6 +165,14 @@ int lfs_filebd_prog(const struct lfs_config *cfg, lfs_block_t block,
     LFS_ASSERT(size % bd->cfg->prog_size == 0);
     LFS_ASSERT(off+size <= bd->cfg->erase_size);
 
+    // program our mapping?
+    if (bd->map) {
+        memcpy(&bd->map[(size_t)block*bd->cfg->erase_size + off], buffer,
+                size);
+        LFS_FILEBD_TRACE("lfs_filebd_prog -> %d", 0);
+        return 0;
+    }
+
     // program data
     off_t res1 = lseek(bd->fd,
             (off_t)block*bd->cfg->erase_size + (off_t)off, SEEK_SET);
@@ -154,7 +216,14 @@ int lfs_filebd_sync(const struct lfs_config *cfg) {
     #ifdef _WIN32
     int err = FlushFileBuffers((HANDLE) _get_osfhandle(bd->fd)) ? 0 : -1;
     #else
-    int err = fsync(bd->fd);
+    int err = 0;
+    if (bd->map) {
+        err = msync(bd->map,
+                (size_t)bd->cfg->erase_size*bd->cfg->erase_count, MS_SYNC);
+    }
+    if (!err) {
+        err = fsync(bd->fd);
+    }
     #endif
     if (err) {
         err = -errno;
@@ -165,3 +234,21 @@ int lfs_filebd_sync(const struct lfs_config *cfg) {
     LFS_FILEBD_TRACE("lfs_filebd_sync -> %d", 0);
     return 0;
 }
+
+int lfs_filebd_map(const struct lfs_config *cfg, lfs_block_t block,
+        const void **buffer) {
+    LFS_FILEBD_TRACE("lfs_filebd_map(%p, 0x%"PRIx32", %p)",
+            (void*)cfg, block, (void*)buffer);
+    lfs_filebd_t *bd = cfg->context;
+
+    // check if map is valid
+    LFS_ASSERT(block < bd->cfg->erase_count);
+
+    // not mapped? fall back to reads
+    *buffer = (bd->map)
+            ? &bd->map[(size_t)block*bd->cfg->erase_size]
+            : NULL;
+
+    LFS_FILEBD_TRACE("lfs_filebd_map -> %d", 0);
+    return 0;
+}
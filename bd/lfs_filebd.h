@@ -39,11 +39,17 @@ struct lfs_filebd_config {
 
     // Number of erase blocks on the device.
     lfs_size_t erase_count;
+
+    // Optionally map the file into memory, serving reads and progs from
+    // the mapping and allowing lfs_filebd_map. The file is grown to the
+    // size of the device. Ignored where mmap isn't available.
+    bool mmap;
 };
 
 // filebd state
 typedef struct lfs_filebd {
     int fd;
+    uint8_t *map;
     const struct lfs_filebd_config *cfg;
 } lfs_filebd_t;
 
@@ -74,6 +80,13 @@ int lfs_filebd_erase(const struct lfs_config *cfg, lfs_block_t block);
 // Sync the block device
 int lfs_filebd_sync(const struct lfs_config *cfg);
 
+// Map a block into memory
+//
+// Points buffer directly at the block's data if the file is mapped,
+// otherwise sets buffer to NULL.
+int lfs_filebd_map(const struct lfs_config *cfg, lfs_block_t block,
+        const void **buffer);
+
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -116,3 +116,19 @@ int lfs_rambd_sync(const struct lfs_config *cfg) {
     LFS_RAMBD_TRACE("lfs_rambd_sync -> %d", 0);
     return 0;
 }
+
+int lfs_rambd_map(const struct lfs_config *cfg, lfs_block_t block,
+        const void **buffer) {
+    LFS_RAMBD_TRACE("lfs_rambd_map(%p, 0x%"PRIx32", %p)",
+            (void*)cfg, block, (void*)buffer);
+    lfs_rambd_t *bd = cfg->context;
+
+    // check if map is valid
+    LFS_ASSERT(block < bd->cfg->erase_count);
+
+    // our data is already in memory
+    *buffer = &bd->buffer[block*bd->cfg->erase_size];
+
+    LFS_RAMBD_TRACE("lfs_rambd_map -> %d", 0);
+    return 0;
+}
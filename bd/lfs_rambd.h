@@ -77,6 +77,12 @@ int lfs_rambd_erase(const struct lfs_config *cfg, lfs_block_t block);
 // Sync the block device
 int lfs_rambd_sync(const struct lfs_config *cfg);
 
+// Map a block into memory
+//
+// Points buffer directly at the block's data in RAM.
+int lfs_rambd_map(const struct lfs_config *cfg, lfs_block_t block,
+        const void **buffer);
+
 
 #ifdef __cplusplus
 } /* extern "C" */
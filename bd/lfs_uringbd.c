@@ -0,0 +1,527 @@
+/*
+ * Block device in a file, using positioned I/O and io_uring batching for
+ * high throughput on hosts
+ *
+ * Copyright (c) 2022, The littlefs authors.
+ * Copyright (c) 2017, Arm Limited. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "bd/lfs_uringbd.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if defined(__linux__) && !defined(LFS_URINGBD_NO_URING)
+#define LFS_URINGBD_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// alignment of our own buffers, enough for direct I/O on common hosts
+#define LFS_URINGBD_ALIGN 4096
+
+// maximum number of progs we queue, and so the size of our ring
+#define LFS_URINGBD_ENTRIES 256
+
+
+// positioned I/O, going through our bounce buffer when direct I/O needs
+// an aligned buffer
+static int lfs_uringbd_pread(lfs_uringbd_t *bd,
+        uint8_t *buffer, lfs_size_t size, uint64_t off) {
+    while (size > 0) {
+        uint8_t *buffer_ = buffer;
+        lfs_size_t size_ = size;
+        if (bd->bounce && (uintptr_t)buffer % LFS_URINGBD_ALIGN != 0) {
+            buffer_ = bd->bounce;
+            size_ = lfs_min(size, bd->cfg->erase_size);
+        }
+
+        ssize_t res = pread(bd->fd, buffer_, size_, (off_t)off);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+
+        // zero for reproducibility past the end of the file
+        if (res == 0) {
+            memset(buffer, 0, size);
+            return 0;
+        }
+
+        if (buffer_ != buffer) {
+            memcpy(buffer, buffer_, res);
+        }
+        buffer += res;
+        size -= res;
+        off += res;
+    }
+
+    return 0;
+}
+
+static int lfs_uringbd_pwrite(lfs_uringbd_t *bd,
+        const uint8_t *buffer, lfs_size_t size, uint64_t off) {
+    while (size > 0) {
+        const uint8_t *buffer_ = buffer;
+        lfs_size_t size_ = size;
+        if (bd->bounce && (uintptr_t)buffer % LFS_URINGBD_ALIGN != 0) {
+            size_ = lfs_min(size, bd->cfg->erase_size);
+            memcpy(bd->bounce, buffer, size_);
+            buffer_ = bd->bounce;
+        }
+
+        ssize_t res = pwrite(bd->fd, buffer_, size_, (off_t)off);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+
+        buffer += res;
+        size -= res;
+        off += res;
+    }
+
+    return 0;
+}
+
+#ifdef LFS_URINGBD_URING
+static void lfs_uringbd_ring_destroy(lfs_uringbd_t *bd) {
+    if (bd->sqes) {
+        munmap(bd->sqes, bd->sqes_size);
+    }
+    if (bd->cq_map) {
+        munmap(bd->cq_map, bd->cq_map_size);
+    }
+    if (bd->sq_map) {
+        munmap(bd->sq_map, bd->sq_map_size);
+    }
+    if (bd->ring >= 0) {
+        close(bd->ring);
+    }
+    bd->sqes = NULL;
+    bd->cq_map = NULL;
+    bd->sq_map = NULL;
+    bd->ring = -1;
+}
+
+static int lfs_uringbd_ring_create(lfs_uringbd_t *bd, uint32_t entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    bd->ring = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (bd->ring < 0) {
+        return -errno;
+    }
+    bd->ring_entries = p.sq_entries;
+
+    // map the submission and completion rings
+    bd->sq_map_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    bd->sq_map = mmap(NULL, bd->sq_map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, bd->ring, IORING_OFF_SQ_RING);
+    if (bd->sq_map == MAP_FAILED) {
+        bd->sq_map = NULL;
+        goto cleanup;
+    }
+
+    bd->cq_map_size = p.cq_off.cqes
+            + p.cq_entries*sizeof(struct io_uring_cqe);
+    bd->cq_map = mmap(NULL, bd->cq_map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, bd->ring, IORING_OFF_CQ_RING);
+    if (bd->cq_map == MAP_FAILED) {
+        bd->cq_map = NULL;
+        goto cleanup;
+    }
+
+    bd->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    bd->sqes = mmap(NULL, bd->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, bd->ring, IORING_OFF_SQES);
+    if (bd->sqes == MAP_FAILED) {
+        bd->sqes = NULL;
+        goto cleanup;
+    }
+
+    uint8_t *sq = bd->sq_map;
+    uint8_t *cq = bd->cq_map;
+    bd->sq_tail  = (unsigned*)&sq[p.sq_off.tail];
+    bd->sq_mask  = (unsigned*)&sq[p.sq_off.ring_mask];
+    bd->sq_array = (unsigned*)&sq[p.sq_off.array];
+    bd->cq_head  = (unsigned*)&cq[p.cq_off.head];
+    bd->cq_tail  = (unsigned*)&cq[p.cq_off.tail];
+    bd->cq_mask  = (unsigned*)&cq[p.cq_off.ring_mask];
+    bd->cqes     = &cq[p.cq_off.cqes];
+    return 0;
+
+cleanup:;
+    int err = -errno;
+    lfs_uringbd_ring_destroy(bd);
+    return err;
+}
+
+// write out queued progs [i, i+n) with one io_uring_enter, waiting for
+// them all to complete
+static int lfs_uringbd_ring_write(lfs_uringbd_t *bd,
+        lfs_size_t i, lfs_size_t n) {
+    struct io_uring_sqe *sqes = bd->sqes;
+    struct io_uring_cqe *cqes = bd->cqes;
+
+    unsigned tail = *bd->sq_tail;
+    for (lfs_size_t j = 0; j < n; j++) {
+        const struct lfs_uringbd_prog *q = &bd->queue[i+j];
+        unsigned k = tail & *bd->sq_mask;
+        struct io_uring_sqe *sqe = &sqes[k];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = bd->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&bd->buffer[q->pos];
+        sqe->len = q->size;
+        sqe->off = q->off;
+        sqe->user_data = i+j;
+        bd->sq_array[k] = k;
+        tail += 1;
+    }
+    __atomic_store_n(bd->sq_tail, tail, __ATOMIC_RELEASE);
+
+    int err = 0;
+    lfs_size_t submitted = 0;
+    lfs_size_t completed = 0;
+    while (completed < n) {
+        int res = (int)syscall(__NR_io_uring_enter, bd->ring,
+                n-submitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        submitted += res;
+
+        unsigned head = *bd->cq_head;
+        unsigned ctail = __atomic_load_n(bd->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != ctail) {
+            const struct io_uring_cqe *cqe = &cqes[head & *bd->cq_mask];
+            const struct lfs_uringbd_prog *q = &bd->queue[cqe->user_data];
+            if (cqe->res < 0) {
+                err = (err) ? err : cqe->res;
+            } else if ((lfs_size_t)cqe->res < q->size) {
+                // finish short writes ourselves
+                int err_ = lfs_uringbd_pwrite(bd,
+                        &bd->buffer[q->pos + cqe->res],
+                        q->size - cqe->res,
+                        q->off + cqe->res);
+                err = (err) ? err : err_;
+            }
+
+            head += 1;
+            completed += 1;
+        }
+        __atomic_store_n(bd->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return err;
+}
+#endif
+
+// write out any queued progs
+static int lfs_uringbd_flush(lfs_uringbd_t *bd) {
+    int err = 0;
+    #ifdef LFS_URINGBD_URING
+    if (bd->ring >= 0) {
+        for (lfs_size_t i = 0; i < bd->queue_count; i += bd->ring_entries) {
+            int err_ = lfs_uringbd_ring_write(bd, i,
+                    lfs_min(bd->queue_count-i, bd->ring_entries));
+            err = (err) ? err : err_;
+        }
+    } else
+    #endif
+    {
+        for (lfs_size_t i = 0; i < bd->queue_count; i++) {
+            const struct lfs_uringbd_prog *q = &bd->queue[i];
+            int err_ = lfs_uringbd_pwrite(bd,
+                    &bd->buffer[q->pos], q->size, q->off);
+            err = (err) ? err : err_;
+        }
+    }
+
+    bd->queue_count = 0;
+    bd->queue_used = 0;
+    return err;
+}
+
+// does a range overlap any queued progs?
+static bool lfs_uringbd_queued(const lfs_uringbd_t *bd,
+        uint64_t off, lfs_size_t size) {
+    for (lfs_size_t i = 0; i < bd->queue_count; i++) {
+        const struct lfs_uringbd_prog *q = &bd->queue[i];
+        if (off < q->off + q->size && q->off < off + size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void lfs_uringbd_free(lfs_uringbd_t *bd) {
+    #ifdef LFS_URINGBD_URING
+    lfs_uringbd_ring_destroy(bd);
+    #endif
+    free(bd->queue);
+    free(bd->buffer);
+    free(bd->bounce);
+    bd->queue = NULL;
+    bd->buffer = NULL;
+    bd->bounce = NULL;
+}
+
+int lfs_uringbd_create(const struct lfs_config *cfg, const char *path,
+        const struct lfs_uringbd_config *bdcfg) {
+    LFS_URINGBD_TRACE("lfs_uringbd_create(%p {.context=%p, "
+                ".read=%p, .prog=%p, .erase=%p, .sync=%p}, "
+                "\"%s\", "
+                "%p {.read_size=%"PRIu32", .prog_size=%"PRIu32", "
+                ".erase_size=%"PRIu32", .erase_count=%"PRIu32", "
+                ".queue_size=%"PRIu32", .direct=%d})",
+            (void*)cfg, cfg->context,
+            (void*)(uintptr_t)cfg->read, (void*)(uintptr_t)cfg->prog,
+            (void*)(uintptr_t)cfg->erase, (void*)(uintptr_t)cfg->sync,
+            path,
+            (void*)bdcfg,
+            bdcfg->read_size, bdcfg->prog_size, bdcfg->erase_size,
+            bdcfg->erase_count, bdcfg->queue_size, bdcfg->direct);
+    lfs_uringbd_t *bd = cfg->context;
+    memset(bd, 0, sizeof(*bd));
+    bd->cfg = bdcfg;
+    bd->ring = -1;
+
+    // open file
+    int flags = O_RDWR | O_CREAT;
+    if (bdcfg->direct) {
+        #ifdef O_DIRECT
+        flags |= O_DIRECT;
+        #else
+        LFS_URINGBD_TRACE("lfs_uringbd_create -> %d", LFS_ERR_INVAL);
+        return LFS_ERR_INVAL;
+        #endif
+    }
+
+    bd->fd = open(path, flags, 0666);
+    if (bd->fd < 0) {
+        int err = -errno;
+        LFS_URINGBD_TRACE("lfs_uringbd_create -> %d", err);
+        return err;
+    }
+
+    int err;
+    if (bdcfg->direct) {
+        void *bounce;
+        err = -posix_memalign(&bounce, LFS_URINGBD_ALIGN,
+                bdcfg->erase_size);
+        if (err) {
+            goto cleanup;
+        }
+        bd->bounce = bounce;
+    }
+
+    if (bdcfg->queue_size) {
+        lfs_size_t entries = lfs_max(1, lfs_min(
+                bdcfg->queue_size / bdcfg->prog_size,
+                LFS_URINGBD_ENTRIES));
+        bd->queue = malloc(entries*sizeof(struct lfs_uringbd_prog));
+        if (!bd->queue) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+        bd->ring_entries = entries;
+
+        void *buffer;
+        err = -posix_memalign(&buffer, LFS_URINGBD_ALIGN,
+                bdcfg->queue_size);
+        if (err) {
+            goto cleanup;
+        }
+        bd->buffer = buffer;
+
+        #ifdef LFS_URINGBD_URING
+        // no io_uring? fall back to writing queued progs one at a time
+        (void)lfs_uringbd_ring_create(bd, entries);
+        #endif
+    }
+
+    LFS_URINGBD_TRACE("lfs_uringbd_create -> %d", 0);
+    return 0;
+
+cleanup:;
+    lfs_uringbd_free(bd);
+    close(bd->fd);
+    LFS_URINGBD_TRACE("lfs_uringbd_create -> %d", err);
+    return err;
+}
+
+int lfs_uringbd_destroy(const struct lfs_config *cfg) {
+    LFS_URINGBD_TRACE("lfs_uringbd_destroy(%p)", (void*)cfg);
+    lfs_uringbd_t *bd = cfg->context;
+
+    // don't lose any queued progs
+    int err = lfs_uringbd_flush(bd);
+    lfs_uringbd_free(bd);
+
+    if (close(bd->fd) < 0 && !err) {
+        err = -errno;
+    }
+    LFS_URINGBD_TRACE("lfs_uringbd_destroy -> %d", err);
+    return err;
+}
+
+int lfs_uringbd_read(const struct lfs_config *cfg, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    LFS_URINGBD_TRACE("lfs_uringbd_read(%p, "
+                "0x%"PRIx32", %"PRIu32", %p, %"PRIu32")",
+            (void*)cfg, block, off, buffer, size);
+    lfs_uringbd_t *bd = cfg->context;
+
+    // check if read is valid
+    LFS_ASSERT(block < bd->cfg->erase_count);
+    LFS_ASSERT(off  % bd->cfg->read_size == 0);
+    LFS_ASSERT(size % bd->cfg->read_size == 0);
+    LFS_ASSERT(off+size <= bd->cfg->erase_size);
+
+    uint64_t off_ = (uint64_t)block*bd->cfg->erase_size + off;
+
+    // read
+    int err = lfs_uringbd_pread(bd, buffer, size, off_);
+    if (err) {
+        LFS_URINGBD_TRACE("lfs_uringbd_read -> %d", err);
+        return err;
+    }
+
+    // patch in any queued progs, these never overlap so order doesn't
+    // matter, and this keeps littlefs's read-back validation from
+    // flushing the queue on every prog
+    for (lfs_size_t i = 0; i < bd->queue_count; i++) {
+        const struct lfs_uringbd_prog *q = &bd->queue[i];
+        if (off_ < q->off + q->size && q->off < off_ + size) {
+            uint64_t start = (off_ > q->off) ? off_ : q->off;
+            uint64_t end = (off_+size < q->off+q->size)
+                    ? off_+size
+                    : q->off+q->size;
+            memcpy(&((uint8_t*)buffer)[start - off_],
+                    &bd->buffer[q->pos + (start - q->off)],
+                    end - start);
+        }
+    }
+
+    LFS_URINGBD_TRACE("lfs_uringbd_read -> %d", 0);
+    return 0;
+}
+
+int lfs_uringbd_prog(const struct lfs_config *cfg, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    LFS_URINGBD_TRACE("lfs_uringbd_prog(%p, "
+                "0x%"PRIx32", %"PRIu32", %p, %"PRIu32")",
+            (void*)cfg, block, off, buffer, size);
+    lfs_uringbd_t *bd = cfg->context;
+
+    // check if write is valid
+    LFS_ASSERT(block < bd->cfg->erase_count);
+    LFS_ASSERT(off  % bd->cfg->prog_size == 0);
+    LFS_ASSERT(size % bd->cfg->prog_size == 0);
+    LFS_ASSERT(off+size <= bd->cfg->erase_size);
+
+    uint64_t off_ = (uint64_t)block*bd->cfg->erase_size + off;
+
+    // queued writes are unordered, so we need to write out the queue if
+    // we're reprogramming part of it
+    bool overlap = lfs_uringbd_queued(bd, off_, size);
+
+    // continuing the last queued prog? just extend it
+    if (bd->queue_count > 0 && !overlap) {
+        struct lfs_uringbd_prog *q = &bd->queue[bd->queue_count-1];
+        if (q->off + q->size == off_
+                && q->pos + q->size == bd->queue_used
+                && bd->queue_used + size <= bd->cfg->queue_size) {
+            memcpy(&bd->buffer[bd->queue_used], buffer, size);
+            q->size += size;
+            bd->queue_used += size;
+            LFS_URINGBD_TRACE("lfs_uringbd_prog -> %d", 0);
+            return 0;
+        }
+    }
+
+    // write out the queue if it's full or we overlap it
+    if (bd->queue_count > 0 && (
+            bd->queue_count == bd->ring_entries
+            || bd->queue_used + size > bd->cfg->queue_size
+            || overlap)) {
+        int err = lfs_uringbd_flush(bd);
+        if (err) {
+            LFS_URINGBD_TRACE("lfs_uringbd_prog -> %d", err);
+            return err;
+        }
+    }
+
+    // too big to queue? write immediately
+    if (size > bd->cfg->queue_size) {
+        int err = lfs_uringbd_pwrite(bd, buffer, size, off_);
+        LFS_URINGBD_TRACE("lfs_uringbd_prog -> %d", err);
+        return err;
+    }
+
+    // queue prog
+    struct lfs_uringbd_prog *q = &bd->queue[bd->queue_count];
+    q->pos = bd->queue_used;
+    q->size = size;
+    q->off = off_;
+    memcpy(&bd->buffer[q->pos], buffer, size);
+    bd->queue_count += 1;
+    bd->queue_used += size;
+
+    LFS_URINGBD_TRACE("lfs_uringbd_prog -> %d", 0);
+    return 0;
+}
+
+int lfs_uringbd_erase(const struct lfs_config *cfg, lfs_block_t block) {
+    LFS_URINGBD_TRACE("lfs_uringbd_erase(%p, 0x%"PRIx32" (%"PRIu32"))",
+            (void*)cfg, block,
+            ((lfs_uringbd_t*)cfg->context)->cfg->erase_size);
+    lfs_uringbd_t *bd = cfg->context;
+
+    // check if erase is valid
+    LFS_ASSERT(block < bd->cfg->erase_count);
+
+    // erase is a noop
+    (void)block;
+
+    LFS_URINGBD_TRACE("lfs_uringbd_erase -> %d", 0);
+    return 0;
+}
+
+int lfs_uringbd_sync(const struct lfs_config *cfg) {
+    LFS_URINGBD_TRACE("lfs_uringbd_sync(%p)", (void*)cfg);
+    lfs_uringbd_t *bd = cfg->context;
+
+    // write out queued progs
+    int err = lfs_uringbd_flush(bd);
+    if (err) {
+        LFS_URINGBD_TRACE("lfs_uringbd_sync -> %d", err);
+        return err;
+    }
+
+    // file sync
+    if (fsync(bd->fd) < 0) {
+        err = -errno;
+        LFS_URINGBD_TRACE("lfs_uringbd_sync -> %d", err);
+        return err;
+    }
+
+    LFS_URINGBD_TRACE("lfs_uringbd_sync -> %d", 0);
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Block device in a file, using positioned I/O and io_uring batching for
+ * high throughput on hosts
+ *
+ * Copyright (c) 2022, The littlefs authors.
+ * Copyright (c) 2017, Arm Limited. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef LFS_URINGBD_H
+#define LFS_URINGBD_H
+
+#include "lfs.h"
+#include "lfs_util.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+// Block device specific tracing
+#ifndef LFS_URINGBD_TRACE
+#ifdef LFS_URINGBD_YES_TRACE
+#define LFS_URINGBD_TRACE(...) LFS_TRACE(__VA_ARGS__)
+#else
+#define LFS_URINGBD_TRACE(...)
+#endif
+#endif
+
+// uringbd config
+struct lfs_uringbd_config {
+    // Minimum size of a read operation in bytes.
+    lfs_size_t read_size;
+
+    // Minimum size of a program operation in bytes.
+    lfs_size_t prog_size;
+
+    // Size of an erase operation in bytes.
+    lfs_size_t erase_size;
+
+    // Number of erase blocks on the device.
+    lfs_size_t erase_count;
+
+    // Size of the prog queue in bytes. Progs are copied into the queue and
+    // written together, with io_uring where available, when the queue
+    // fills or on sync. Reads are served from the queue in the meantime.
+    // Zero writes each prog immediately.
+    lfs_size_t queue_size;
+
+    // Optionally open the file with O_DIRECT, bypassing the host's page
+    // cache. read_size and prog_size must be multiples of the file's
+    // direct I/O alignment.
+    bool direct;
+};
+
+// uringbd state
+typedef struct lfs_uringbd {
+    int fd;
+    const struct lfs_uringbd_config *cfg;
+
+    // queued progs, copied into buffer back to back
+    struct lfs_uringbd_prog {
+        lfs_off_t pos;
+        lfs_size_t size;
+        uint64_t off;
+    } *queue;
+    lfs_size_t queue_count;
+    lfs_size_t queue_used;
+    uint8_t *buffer;
+
+    // aligned buffer for direct I/O with unaligned buffers
+    uint8_t *bounce;
+
+    // io_uring rings, ring < 0 if io_uring isn't available
+    int ring;
+    uint32_t ring_entries;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    void *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    void *cqes;
+} lfs_uringbd_t;
+
+
+// Create a uring block device
+int lfs_uringbd_create(const struct lfs_config *cfg, const char *path,
+        const struct lfs_uringbd_config *bdcfg);
+
+// Clean up memory associated with block device, writing any queued progs
+int lfs_uringbd_destroy(const struct lfs_config *cfg);
+
+// Read a block
+int lfs_uringbd_read(const struct lfs_config *cfg, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size);
+
+// Program a block
+//
+// The block must have previously been erased.
+int lfs_uringbd_prog(const struct lfs_config *cfg, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size);
+
+// Erase a block
+//
+// A block must be erased before being programmed. The
+// state of an erased block is undefined.
+int lfs_uringbd_erase(const struct lfs_config *cfg, lfs_block_t block);
+
+// Sync the block device, writing any queued progs
+int lfs_uringbd_sync(const struct lfs_config *cfg);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * CRC benchmark - throughput of lfs_crc against the original nibble-table
+ * implementation across buffer sizes
+ *
+ * Run with build/gtest/lfs_benches --gtest_filter='CrcBench.*', configure
+ * with -DLFS_FAST_CRC=ON to measure the slice-by-8/hardware CRC.
+ */
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+extern "C" {
+#include "lfs_util.h"
+}
+
+// Original nibble-table implementation, kept here for comparison
+static uint32_t CrcNibble(uint32_t crc, const uint8_t *data, size_t size) {
+    static const uint32_t rtable[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 0)) & 0xf];
+        crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 4)) & 0xf];
+    }
+    return crc;
+}
+
+TEST(CrcBench, Throughput) {
+    const size_t TOTAL = 4*1024*1024;
+    printf("\n  %8s %14s %14s %8s\n",
+            "size", "nibble MB/s", "lfs_crc MB/s", "speedup");
+    for (size_t size : {16, 64, 256, 1024, 4096, 32768}) {
+        std::vector<uint8_t> buffer(size);
+        uint32_t seed = 3;
+        for (size_t i = 0; i < size; i++) {
+            seed = seed*1103515245 + 12345;
+            buffer[i] = (uint8_t)(seed >> 16);
+        }
+        size_t iters = TOTAL / size;
+
+        uint32_t crc1 = 0xffffffff;
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iters; i++) {
+            crc1 = CrcNibble(crc1, buffer.data(), size);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+
+        uint32_t crc2 = 0xffffffff;
+        for (size_t i = 0; i < iters; i++) {
+            crc2 = lfs_crc(crc2, buffer.data(), size);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        ASSERT_EQ(crc1, crc2);
+
+        double nibble = std::chrono::duration<double>(t1 - t0).count();
+        double fast = std::chrono::duration<double>(t2 - t1).count();
+        printf("  %8zu %14.1f %14.1f %7.1fx\n", size,
+                TOTAL / nibble / 1e6,
+                TOTAL / fast / 1e6,
+                nibble / fast);
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * Lookahead benchmark - time per block of lfs_alloc against the original
+ * bit-at-a-time search, over dense and sparse bitmaps
+ *
+ * Run with build/gtest/lfs_benches --gtest_filter='LookaheadBench.*'.
+ */
+
+#include "lfs_test_lookahead.h"
+#include <chrono>
+#include <cstdio>
+
+class LookaheadBench : public LfsLookaheadFixture {
+protected:
+    // the original bit-at-a-time lfs_alloc, minus scanning the filesystem,
+    // kept out-of-line so it pays the same call overhead as lfs_alloc
+    __attribute__((noinline))
+    static bool AllocBitwise(lfs_t *lfs, lfs_block_t *block) {
+        while (lfs->lookahead.next < lfs->lookahead.size) {
+            if (!(lfs->lookahead.buffer[lfs->lookahead.next / 8]
+                    & (1U << (lfs->lookahead.next % 8)))) {
+                *block = (lfs->lookahead.start + lfs->lookahead.next)
+                        % lfs->block_count;
+
+                while (true) {
+                    lfs->lookahead.next += 1;
+                    lfs->lookahead.ckpoint -= 1;
+
+                    if (lfs->lookahead.next >= lfs->lookahead.size
+                            || !(lfs->lookahead.buffer[lfs->lookahead.next / 8]
+                                & (1U << (lfs->lookahead.next % 8)))) {
+                        return true;
+                    }
+                }
+            }
+
+            lfs->lookahead.next += 1;
+            lfs->lookahead.ckpoint -= 1;
+        }
+
+        return false;
+    }
+};
+
+TEST_F(LookaheadBench, Alloc) {
+    const lfs_size_t LOOKAHEAD_SIZE = 8192;
+    const int ITERS = 16;
+    printf("\n  %8s %14s %14s %8s\n",
+            "density", "bitwise ns/b", "lfs_alloc ns/b", "speedup");
+    for (uint32_t density : {10, 50, 90, 99}) {
+        lfs_t lfs;
+        Init(&lfs, LOOKAHEAD_SIZE);
+        std::vector<uint8_t> bitmap = PrngBitmap(
+                LOOKAHEAD_SIZE, density, density);
+
+        lfs_size_t count1 = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < ITERS; i++) {
+            Window(&lfs, bitmap, 8*LOOKAHEAD_SIZE);
+            lfs_block_t block;
+            while (AllocBitwise(&lfs, &block)) {
+                count1 += 1;
+            }
+        }
+        auto t1 = std::chrono::steady_clock::now();
+
+        // keep gtest's asserts out of the timed loop, the bitwise loop
+        // doesn't pay for them either
+        lfs_size_t count2 = 0;
+        int err = 0;
+        for (int i = 0; i < ITERS && !err; i++) {
+            Window(&lfs, bitmap, 8*LOOKAHEAD_SIZE);
+            while (lfs.lookahead.next < lfs.lookahead.size) {
+                lfs_block_t block;
+                err = lfs_test_alloc(&lfs, &block);
+                if (err) {
+                    break;
+                }
+                count2 += 1;
+            }
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        ASSERT_EQ(err, 0);
+        ASSERT_EQ(count1, count2);
+
+        double blocks = (double)ITERS * 8*LOOKAHEAD_SIZE;
+        double bitwise = std::chrono::duration<double>(t1 - t0).count();
+        double fast = std::chrono::duration<double>(t2 - t1).count();
+        printf("  %7u%% %14.2f %14.2f %7.1fx\n", density,
+                bitwise / blocks * 1e9,
+                fast / blocks * 1e9,
+                bitwise / fast);
+
+        ASSERT_EQ(lfs_test_deinit(&lfs), 0);
+    }
+}
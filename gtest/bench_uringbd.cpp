@@ -0,0 +1,174 @@
+/*
+ * uringbd benchmark - wall-clock time to build and read back an image
+ * with lfs_filebd and lfs_uringbd on the host's filesystem
+ *
+ * Run with build/gtest/lfs_benches --gtest_filter='UringbdBench.*', set
+ * LFS_BENCH_DIR to put the images somewhere other than the temp dir.
+ */
+#include "lfs_test_fixture.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "bd/lfs_filebd.h"
+#include "bd/lfs_uringbd.h"
+}
+
+class UringbdBench : public ::testing::Test {
+protected:
+    // a 16 MiB image of 400 files, with an fsync on every sync
+    static const lfs_size_t BLOCK_SIZE = 4096;
+    static const lfs_size_t BLOCK_COUNT = 4096;
+    static const lfs_size_t FILES = 400;
+    static const int RUNS = 7;
+
+    static lfs_size_t Size(lfs_size_t i) {
+        const lfs_size_t SIZES[] = {100, 3000, 9000, 20000, 60000};
+        return SIZES[i % 5];
+    }
+
+    static std::string Path() {
+        const char *dir = getenv("LFS_BENCH_DIR");
+        std::string path = (dir) ? std::string(dir) + "/"
+                : ::testing::TempDir();
+        return path + "lfs_bench_uringbd.img";
+    }
+
+    static struct lfs_config Config() {
+        struct lfs_config cfg;
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.read_size = 16;
+        cfg.prog_size = 16;
+        cfg.block_size = BLOCK_SIZE;
+        cfg.block_count = BLOCK_COUNT;
+        cfg.block_cycles = -1;
+        cfg.cache_size = 256;
+        cfg.lookahead_size = BLOCK_COUNT/8;
+        return cfg;
+    }
+
+    // format, write every file, then mount again and read them back
+    static void Workload(const struct lfs_config *cfg) {
+        lfs_t lfs;
+        ASSERT_EQ(lfs_format(&lfs, cfg), 0);
+        ASSERT_EQ(lfs_mount(&lfs, cfg), 0);
+        std::vector<uint8_t> data;
+        for (lfs_size_t i = 0; i < FILES; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "file%04u", (unsigned)i);
+            data.resize(Size(i));
+            for (lfs_size_t j = 0; j < data.size(); j++) {
+                data[j] = LfsPattern(i, j);
+            }
+
+            lfs_file_t file;
+            ASSERT_EQ(lfs_file_open(&lfs, &file, path,
+                    LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL), 0);
+            ASSERT_EQ(lfs_file_write(&lfs, &file, data.data(), data.size()),
+                    (lfs_ssize_t)data.size());
+            ASSERT_EQ(lfs_file_close(&lfs, &file), 0);
+        }
+        ASSERT_EQ(lfs_unmount(&lfs), 0);
+
+        ASSERT_EQ(lfs_mount(&lfs, cfg), 0);
+        for (lfs_size_t i = 0; i < FILES; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "file%04u", (unsigned)i);
+            data.resize(Size(i));
+
+            lfs_file_t file;
+            ASSERT_EQ(lfs_file_open(&lfs, &file, path, LFS_O_RDONLY), 0);
+            ASSERT_EQ(lfs_file_read(&lfs, &file, data.data(), data.size()),
+                    (lfs_ssize_t)data.size());
+            ASSERT_EQ(lfs_file_close(&lfs, &file), 0);
+            ASSERT_EQ(data[data.size()-1], LfsPattern(i, data.size()-1));
+        }
+        ASSERT_EQ(lfs_unmount(&lfs), 0);
+    }
+
+    static double Filebd() {
+        std::string path = Path();
+        remove(path.c_str());
+        struct lfs_filebd_config bdcfg;
+        memset(&bdcfg, 0, sizeof(bdcfg));
+        bdcfg.read_size = 16;
+        bdcfg.prog_size = 16;
+        bdcfg.erase_size = BLOCK_SIZE;
+        bdcfg.erase_count = BLOCK_COUNT;
+
+        lfs_filebd_t bd;
+        struct lfs_config cfg = Config();
+        cfg.context = &bd;
+        cfg.read = lfs_filebd_read;
+        cfg.prog = lfs_filebd_prog;
+        cfg.erase = lfs_filebd_erase;
+        cfg.sync = lfs_filebd_sync;
+
+        auto t0 = std::chrono::steady_clock::now();
+        EXPECT_EQ(lfs_filebd_create(&cfg, path.c_str(), &bdcfg), 0);
+        Workload(&cfg);
+        EXPECT_EQ(lfs_filebd_destroy(&cfg), 0);
+        auto t1 = std::chrono::steady_clock::now();
+        remove(path.c_str());
+        return std::chrono::duration<double>(t1 - t0).count();
+    }
+
+    static double Uringbd(lfs_size_t queue_size) {
+        std::string path = Path();
+        remove(path.c_str());
+        struct lfs_uringbd_config bdcfg;
+        memset(&bdcfg, 0, sizeof(bdcfg));
+        bdcfg.read_size = 16;
+        bdcfg.prog_size = 16;
+        bdcfg.erase_size = BLOCK_SIZE;
+        bdcfg.erase_count = BLOCK_COUNT;
+        bdcfg.queue_size = queue_size;
+
+        lfs_uringbd_t bd;
+        struct lfs_config cfg = Config();
+        cfg.context = &bd;
+        cfg.read = lfs_uringbd_read;
+        cfg.prog = lfs_uringbd_prog;
+        cfg.erase = lfs_uringbd_erase;
+        cfg.sync = lfs_uringbd_sync;
+
+        auto t0 = std::chrono::steady_clock::now();
+        EXPECT_EQ(lfs_uringbd_create(&cfg, path.c_str(), &bdcfg), 0);
+        Workload(&cfg);
+        EXPECT_EQ(lfs_uringbd_destroy(&cfg), 0);
+        auto t1 = std::chrono::steady_clock::now();
+        remove(path.c_str());
+        return std::chrono::duration<double>(t1 - t0).count();
+    }
+};
+
+// Runs are interleaved so drift on the host affects every block device
+// the same, the speedup is of the medians
+TEST_F(UringbdBench, Image) {
+    const char *NAMES[] = {
+            "filebd", "uringbd, no queue", "uringbd, 1 MiB queue"};
+    std::vector<double> times[3];
+    for (int run = 0; run < RUNS; run++) {
+        times[0].push_back(Filebd());
+        times[1].push_back(Uringbd(0));
+        times[2].push_back(Uringbd(1024*1024));
+    }
+
+    printf("\n  %-22s %8s %8s %8s %8s\n",
+            "bd", "min s", "median s", "max s", "speedup");
+    double base = 0;
+    for (int i = 0; i < 3; i++) {
+        std::sort(times[i].begin(), times[i].end());
+        double median = times[i][RUNS/2];
+        if (i == 0) {
+            base = median;
+        }
+        printf("  %-22s %8.3f %8.3f %8.3f %7.2fx\n", NAMES[i],
+                times[i].front(), median, times[i].back(), base / median);
+    }
+}
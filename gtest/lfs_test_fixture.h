@@ -2,6 +2,7 @@
 #define LFS_TEST_FIXTURE_H
 
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <vector>
 #include <string>
 
@@ -33,6 +34,12 @@ inline std::vector<LfsGeometry> AllGeometries() {
     };
 }
 
+// Deterministic file contents, byte j of file i. Neighbouring files and
+// offsets differ, so a read from the wrong place shows up as a mismatch
+inline uint8_t LfsPattern(lfs_size_t i, lfs_size_t j) {
+    return (uint8_t)(i*31 + j*7 + (j >> 8));
+}
+
 // Base fixture providing lfs_config and block device
 class LfsTestFixture : public ::testing::Test {
 protected:
@@ -42,6 +49,16 @@ protected:
     // Configure geometry before SetUp
     void SetGeometry(const LfsGeometry& geom);
 
+    // Number of files/dirs a workload creates, up to n but no more than
+    // one per count_blocks_ blocks so small geometries don't run out
+    lfs_size_t Count(lfs_size_t n) const {
+        return std::min<lfs_size_t>(n, cfg_.block_count/count_blocks_);
+    }
+
+    lfs_size_t Count() const {
+        return Count(count_);
+    }
+
     // Core test objects
     lfs_t lfs_;
     lfs_config cfg_;
@@ -55,6 +72,8 @@ protected:
     int32_t erase_value_ = -1;  // -1 = don't simulate erase
     uint32_t erase_cycles_ = 0;
     lfs_emubd_badblock_behavior_t badblock_behavior_ = LFS_EMUBD_BADBLOCK_PROGERROR;
+    lfs_size_t count_ = 16;
+    lfs_size_t count_blocks_ = 8;
 
 private:
     LfsGeometry geometry_ = {"default", 16, 16, 512, 2048};
@@ -49,6 +49,19 @@ int lfs_test_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
     return lfs_dir_commit(lfs, dir, mattrs, attrcount);
 }
 
+int lfs_test_alloc(lfs_t *lfs, lfs_block_t *block) {
+    return lfs_alloc(lfs, block);
+}
+
+int lfs_test_ioq_submit(lfs_t *lfs, uint8_t type,
+        lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
+    return lfs_ioq_submit(lfs, type, block, off, buffer, size);
+}
+
+int lfs_test_ioq_wait(lfs_t *lfs, lfs_block_t block) {
+    return lfs_ioq_wait(lfs, block);
+}
+
 void lfs_test_fs_prepmove(lfs_t *lfs, uint16_t id, const lfs_block_t pair[2]) {
     lfs_fs_prepmove(lfs, id, pair);
 }
@@ -56,6 +56,9 @@ struct lfs_attr_internal {
 #define LFS_TYPE_GLOBALS        0x7ff
 #define LFS_FROM_NOOP           0x000
 
+// Block address that is never valid (matches lfs.c)
+#define LFS_BLOCK_NULL ((lfs_block_t)-1)
+
 // Internal functions wrapped for testing
 int lfs_test_init(lfs_t *lfs, const struct lfs_config *cfg);
 int lfs_test_deinit(lfs_t *lfs);
@@ -66,6 +69,12 @@ lfs_stag_t lfs_test_dir_get(lfs_t *lfs, const lfs_mdir_t *dir,
 int lfs_test_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         const struct lfs_attr_internal *attrs, int attrcount);
 
+int lfs_test_alloc(lfs_t *lfs, lfs_block_t *block);
+
+int lfs_test_ioq_submit(lfs_t *lfs, uint8_t type,
+        lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size);
+int lfs_test_ioq_wait(lfs_t *lfs, lfs_block_t block);
+
 void lfs_test_fs_prepmove(lfs_t *lfs, uint16_t id, const lfs_block_t pair[2]);
 
 void lfs_test_superblock_tole32(lfs_superblock_t *superblock);
@@ -0,0 +1,63 @@
+/*
+ * Lookahead fixture - an lfs_t whose lookahead buffer can be pointed at
+ * arbitrary bitmaps, shared by the lookahead tests and benchmarks
+ *
+ * This requires access to littlefs internals via the test wrapper.
+ */
+#ifndef LFS_TEST_LOOKAHEAD_H
+#define LFS_TEST_LOOKAHEAD_H
+
+#include <gtest/gtest.h>
+#include "bd/lfs_emubd.h"
+#include "lfs_test_internal.h"
+#include <cstring>
+#include <vector>
+
+class LfsLookaheadFixture : public ::testing::Test {
+protected:
+    // fill a bitmap with roughly density% in-use blocks
+    static std::vector<uint8_t> PrngBitmap(lfs_size_t size,
+            uint32_t density, uint32_t seed) {
+        std::vector<uint8_t> bitmap(size, 0);
+        uint32_t x = seed;
+        for (lfs_size_t i = 0; i < 8*size; i++) {
+            x = x*1103515245 + 12345;
+            if ((x >> 16) % 100 < density) {
+                bitmap[i / 8] |= 1U << (i % 8);
+            }
+        }
+        return bitmap;
+    }
+
+    void Init(lfs_t *lfs, lfs_size_t lookahead_size) {
+        // the block device is never touched, we only search the
+        // lookahead buffer
+        memset(&cfg_, 0, sizeof(cfg_));
+        cfg_.read = lfs_emubd_read;
+        cfg_.prog = lfs_emubd_prog;
+        cfg_.erase = lfs_emubd_erase;
+        cfg_.sync = lfs_emubd_sync;
+        cfg_.read_size = 16;
+        cfg_.prog_size = 16;
+        cfg_.block_size = 512;
+        cfg_.block_count = 8*lookahead_size;
+        cfg_.block_cycles = -1;
+        cfg_.cache_size = 64;
+        cfg_.lookahead_size = lookahead_size;
+        ASSERT_EQ(lfs_test_init(lfs, &cfg_), 0);
+    }
+
+    // point the allocator at a window of our bitmap
+    static void Window(lfs_t *lfs, std::vector<uint8_t> &bitmap,
+            lfs_block_t size) {
+        memcpy(lfs->lookahead.buffer, bitmap.data(), bitmap.size());
+        lfs->lookahead.start = 0;
+        lfs->lookahead.size = size;
+        lfs->lookahead.next = 0;
+        lfs->lookahead.ckpoint = lfs->block_count;
+    }
+
+    lfs_config cfg_;
+};
+
+#endif // LFS_TEST_LOOKAHEAD_H
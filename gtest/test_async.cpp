@@ -0,0 +1,436 @@
+/*
+ * Asynchronous block device tests - operations emulated with submit/wait,
+ * and erases and metadata progs left in flight
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <vector>
+
+class AsyncTest : public LfsParametricTest {
+protected:
+    // submit/wait wrappers that only report bad blocks on wait, like a
+    // real asynchronous device would
+    static std::map<const struct lfs_bd_io*, int> errors_;
+
+    static int Submit(const struct lfs_config *c, struct lfs_bd_io *io) {
+        int err = lfs_emubd_submit(c, io);
+        if (err == LFS_ERR_CORRUPT) {
+            errors_[io] = err;
+            return 0;
+        }
+        return err;
+    }
+
+    static int Wait(const struct lfs_config *c, struct lfs_bd_io *io) {
+        int err = lfs_emubd_wait(c, io);
+        if (err) {
+            return err;
+        }
+
+        auto it = errors_.find(io);
+        if (it != errors_.end()) {
+            err = it->second;
+            errors_.erase(it);
+        }
+        return err;
+    }
+
+    // a device that really leaves operations in flight, doing nothing
+    // until they're waited on, and then finishing them in order, so
+    // anything that uses a block or buffer too early sees stale data
+    static std::deque<struct lfs_bd_io*> pending_;
+    static std::map<const struct lfs_bd_io*, int> done_;
+    static lfs_size_t inflight_;
+    static lfs_size_t reads_;
+    static bool failreads_;
+
+    // is a read still in flight into any of these bytes?
+    static bool Pending(const void *buffer, lfs_size_t size) {
+        for (const struct lfs_bd_io *io : pending_) {
+            if (io->type == LFS_BD_IO_READ
+                    && (const uint8_t*)io->buffer
+                        < (const uint8_t*)buffer + size
+                    && (const uint8_t*)buffer
+                        < (const uint8_t*)io->buffer + io->size) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // buffers must not be reused while a read is still filling them
+    static int DeferRead(const struct lfs_config *c, lfs_block_t block,
+            lfs_off_t off, void *buffer, lfs_size_t size) {
+        if (Pending(buffer, size)) {
+            ADD_FAILURE() << "read into a buffer with a read in flight";
+        }
+        return lfs_emubd_read(c, block, off, buffer, size);
+    }
+
+    static int DeferSubmit(const struct lfs_config *c, struct lfs_bd_io *io) {
+        (void)c;
+        if (io->type == LFS_BD_IO_READ && Pending(io->buffer, io->size)) {
+            ADD_FAILURE() << "read into a buffer with a read in flight";
+        }
+
+        // a real device may scribble over a read's buffer until it's done
+        if (io->type == LFS_BD_IO_READ) {
+            memset(io->buffer, 0xcc, io->size);
+        }
+        pending_.push_back(io);
+        inflight_ = std::max<lfs_size_t>(inflight_, pending_.size());
+        return 0;
+    }
+
+    static int DeferWait(const struct lfs_config *c, struct lfs_bd_io *io) {
+        if (std::find(pending_.begin(), pending_.end(), io) == pending_.end()
+                && done_.find(io) == done_.end()) {
+            ADD_FAILURE() << "waited on an operation never submitted";
+            return LFS_ERR_IO;
+        }
+
+        while (done_.find(io) == done_.end()) {
+            struct lfs_bd_io *p = pending_.front();
+            pending_.pop_front();
+            int err;
+            if (p->type == LFS_BD_IO_READ) {
+                // every other read fails if asked, reads through the
+                // queue are only ever speculative
+                reads_ += 1;
+                err = (failreads_ && reads_ % 2 == 0)
+                        ? LFS_ERR_IO
+                        : lfs_emubd_read(c, p->block, p->off,
+                            p->buffer, p->size);
+            } else if (p->type == LFS_BD_IO_PROG) {
+                err = lfs_emubd_prog(c, p->block, p->off, p->buffer, p->size);
+            } else {
+                err = lfs_emubd_erase(c, p->block);
+            }
+            done_[p] = err;
+        }
+
+        int err = done_[io];
+        done_.erase(io);
+        return err;
+    }
+
+    void SetUp() override {
+        LfsParametricTest::SetUp();
+        errors_.clear();
+        pending_.clear();
+        done_.clear();
+        inflight_ = 0;
+        reads_ = 0;
+        failreads_ = false;
+
+        // recreate our block device with simulated latency, roughly NOR
+        // timings
+        lfs_emubd_destroy(&cfg_);
+        bdcfg_.read_latency = 10*1000;
+        bdcfg_.prog_latency = 100*1000;
+        bdcfg_.erase_latency = 5*1000*1000;
+        memset(&bd_, 0, sizeof(bd_));
+        LFS_ASSERT_OK(lfs_emubd_create(&cfg_, &bdcfg_));
+    }
+
+    lfs_size_t Size(lfs_size_t i) {
+        const lfs_size_t SIZES[] = {
+                3, 60, cfg_.block_size/2, cfg_.block_size+5,
+                2*cfg_.block_size+1};
+        return SIZES[i % 5];
+    }
+
+    // create, rewrite, and remove a handful of files
+    void Churn(lfs_t *lfs, lfs_size_t n) {
+        int err = lfs_mkdir(lfs, "dir");
+        ASSERT_TRUE(err == 0 || err == LFS_ERR_EXIST);
+        for (lfs_size_t i = 0; i < n; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "dir/file%03u", (unsigned)i);
+            std::vector<uint8_t> data(Size(i));
+            for (lfs_size_t j = 0; j < data.size(); j++) {
+                data[j] = LfsPattern(i, j);
+            }
+
+            lfs_file_t file;
+            LFS_ASSERT_OK(lfs_file_open(lfs, &file, path,
+                    LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC));
+            ASSERT_EQ(lfs_file_write(lfs, &file, data.data(), data.size()),
+                    (lfs_ssize_t)data.size());
+            LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+
+            // rewrite the start of every other file
+            if (i % 2 == 1) {
+                LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_WRONLY));
+                ASSERT_EQ(lfs_file_write(lfs, &file, data.data(), 1), 1);
+                LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+            }
+        }
+
+        // and remove every third file
+        for (lfs_size_t i = 0; i < n; i += 3) {
+            char path[64];
+            snprintf(path, sizeof(path), "dir/file%03u", (unsigned)i);
+            LFS_ASSERT_OK(lfs_remove(lfs, path));
+        }
+    }
+
+    void Check(lfs_t *lfs, lfs_size_t n, lfs_size_t readahead_size = 0) {
+        struct lfs_file_config filecfg;
+        memset(&filecfg, 0, sizeof(filecfg));
+        std::vector<uint8_t> ahead(readahead_size);
+        filecfg.readahead_size = readahead_size;
+        filecfg.readahead_buffer = (readahead_size) ? ahead.data() : NULL;
+
+        for (lfs_size_t i = 0; i < n; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "dir/file%03u", (unsigned)i);
+            struct lfs_info info;
+            if (i % 3 == 0) {
+                ASSERT_EQ(lfs_stat(lfs, path, &info), LFS_ERR_NOENT);
+                continue;
+            }
+
+            LFS_ASSERT_OK(lfs_stat(lfs, path, &info));
+            ASSERT_EQ(info.size, Size(i));
+
+            lfs_file_t file;
+            LFS_ASSERT_OK(lfs_file_opencfg(lfs, &file, path, LFS_O_RDONLY,
+                    &filecfg));
+            // in small pieces, so read-ahead runs ahead of us, and
+            // stopping halfway leaves it in flight for close to wait on
+            lfs_size_t half = (i % 2) ? Size(i)/2 : Size(i);
+            for (lfs_size_t off = 0; off < half; off += 7) {
+                uint8_t data[7];
+                lfs_size_t size = std::min<lfs_size_t>(7, half - off);
+                ASSERT_EQ(lfs_file_read(lfs, &file, data, size),
+                        (lfs_ssize_t)size);
+                for (lfs_size_t j = 0; j < size; j++) {
+                    ASSERT_EQ(data[j], LfsPattern(i, off+j))
+                            << path << " off " << off+j;
+                }
+            }
+            LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+            ASSERT_FALSE(Pending(ahead.data(), ahead.size())) << path;
+        }
+    }
+};
+
+std::map<const struct lfs_bd_io*, int> AsyncTest::errors_;
+std::deque<struct lfs_bd_io*> AsyncTest::pending_;
+std::map<const struct lfs_bd_io*, int> AsyncTest::done_;
+lfs_size_t AsyncTest::inflight_;
+lfs_size_t AsyncTest::reads_;
+bool AsyncTest::failreads_;
+
+// A block device with only submit/wait should work the same as one with
+// read/prog/erase
+TEST_P(AsyncTest, Emulated) {
+    cfg_.read = NULL;
+    cfg_.prog = NULL;
+    cfg_.erase = NULL;
+    cfg_.submit = lfs_emubd_submit;
+    cfg_.wait = lfs_emubd_wait;
+
+    for (lfs_size_t depth : {(lfs_size_t)0, (lfs_size_t)3}) {
+        cfg_.io_depth = depth;
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Churn(&lfs, Count(20));
+        Check(&lfs, Count(20));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Check(&lfs, Count(20));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Operations that really stay in flight until waited on must be waited on
+// before their block is read or their buffer reused, at every queue depth,
+// including a queue of one that's always full
+TEST_P(AsyncTest, Deferred) {
+    cfg_.read = DeferRead;
+    cfg_.submit = DeferSubmit;
+    cfg_.wait = DeferWait;
+
+    // one read cache line is always evicted with a prefetch in flight
+    for (lfs_size_t depth : {(lfs_size_t)1, (lfs_size_t)2, (lfs_size_t)3,
+            (lfs_size_t)8}) {
+        cfg_.io_depth = depth;
+        cfg_.read_cache_lines = (depth % 2) ? 1 : 4;
+        inflight_ = 0;
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Churn(&lfs, Count(20));
+        Check(&lfs, Count(20), 2*cfg_.read_size);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+        ASSERT_TRUE(pending_.empty());
+
+        // in flight on top of the queue, only our own waited-on
+        // operations, one at a time
+        ASSERT_GT(inflight_, 0u);
+        ASSERT_LE(inflight_, depth+1);
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Check(&lfs, Count(20), 4*cfg_.read_size);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+        ASSERT_TRUE(pending_.empty());
+    }
+}
+
+// Failed read-ahead and prefetch are only hints, whatever they were filling
+// must be read again rather than trusted
+TEST_P(AsyncTest, FailedReads) {
+    cfg_.read = DeferRead;
+    cfg_.submit = DeferSubmit;
+    cfg_.wait = DeferWait;
+    cfg_.read_cache_lines = 4;
+    cfg_.io_depth = 4;
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Churn(&lfs, Count(20));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    failreads_ = true;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Check(&lfs, Count(20), 2*cfg_.read_size);
+    Check(&lfs, Count(20), 4*cfg_.read_size);
+    lfs_size_t blocks = 0;
+    LFS_ASSERT_OK(lfs_fs_traverse(&lfs, [](void *data, lfs_block_t) {
+        *(lfs_size_t*)data += 1;
+        return 0;
+    }, &blocks));
+    ASSERT_GT(blocks, 0u);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    // some reads must actually have been left to fail
+    ASSERT_GT(reads_, 1u);
+}
+
+// Leaving operations in flight should give the same filesystem, and
+// overlapping erases with other work should take less simulated time
+TEST_P(AsyncTest, Pipelined) {
+    cfg_.submit = lfs_emubd_submit;
+    cfg_.wait = lfs_emubd_wait;
+
+    lfs_emubd_ssleep_t times[2];
+    for (int pipelined = 0; pipelined < 2; pipelined++) {
+        cfg_.io_depth = (pipelined) ? 4 : 0;
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        lfs_emubd_ssleep_t time = lfs_emubd_time(&cfg_);
+        Churn(&lfs, Count(40));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+        times[pipelined] = lfs_emubd_time(&cfg_) - time;
+
+        // also check with everything waited on
+        cfg_.io_depth = 0;
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Check(&lfs, Count(40));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+
+    EXPECT_LT(times[1], times[0]);
+}
+
+// A statically allocated io queue works the same
+TEST_P(AsyncTest, StaticBuffer) {
+    cfg_.read = NULL;
+    cfg_.prog = NULL;
+    cfg_.erase = NULL;
+    cfg_.submit = lfs_emubd_submit;
+    cfg_.wait = lfs_emubd_wait;
+    cfg_.io_depth = 2;
+    std::vector<struct lfs_bd_io> buffer(2
+            + (2*(sizeof(lfs_block_t) + cfg_.cache_size)
+                + sizeof(struct lfs_bd_io)-1)
+                / sizeof(struct lfs_bd_io));
+    cfg_.io_buffer = buffer.data();
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Churn(&lfs, Count(10));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Check(&lfs, Count(10));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Bad blocks found by in-flight operations must still be relocated around
+TEST_P(AsyncTest, Badblocks) {
+    const lfs_emubd_badblock_behavior_t BEHAVIORS[] = {
+            LFS_EMUBD_BADBLOCK_PROGERROR,
+            LFS_EMUBD_BADBLOCK_ERASEERROR};
+    for (lfs_emubd_badblock_behavior_t behavior : BEHAVIORS) {
+        lfs_emubd_destroy(&cfg_);
+        bdcfg_.erase_cycles = 0xffffffff;
+        bdcfg_.badblock_behavior = behavior;
+        memset(&bd_, 0, sizeof(bd_));
+        LFS_ASSERT_OK(lfs_emubd_create(&cfg_, &bdcfg_));
+        cfg_.submit = Submit;
+        cfg_.wait = Wait;
+        cfg_.io_depth = 4;
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+
+        // mark every 3rd block after the superblocks as bad
+        for (lfs_block_t b = 2; b < cfg_.block_count; b += 3) {
+            LFS_ASSERT_OK(lfs_emubd_setwear(&cfg_, b, 0xffffffff));
+        }
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Churn(&lfs, Count(20));
+        Check(&lfs, Count(20));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Check(&lfs, Count(20));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Operations still in flight at unmount report their errors from unmount
+TEST_P(AsyncTest, Unmount) {
+    cfg_.submit = lfs_emubd_submit;
+    cfg_.wait = Wait;
+    cfg_.io_depth = 4;
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+            LFS_O_WRONLY | LFS_O_CREAT));
+    std::vector<uint8_t> data(2*cfg_.block_size + 1);
+    ASSERT_EQ(lfs_file_write(&lfs, &file, data.data(), data.size()),
+            (lfs_ssize_t)data.size());
+
+    // fail whatever's still in flight
+    ASSERT_GT(lfs.ioq.count, 0u);
+    for (lfs_size_t i = 0; i < lfs.ioq.count; i++) {
+        errors_[&lfs.ioq.ios[(lfs.ioq.head + i) % cfg_.io_depth]]
+                = LFS_ERR_IO;
+    }
+    ASSERT_EQ(lfs_unmount(&lfs), LFS_ERR_IO);
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, AsyncTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
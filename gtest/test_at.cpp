@@ -0,0 +1,387 @@
+/*
+ * Directory-relative operation tests - paths looked up from an open
+ * directory handle instead of the root
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+class AtTest : public LfsParametricTest {
+protected:
+    static std::string Dir(lfs_size_t depth) {
+        std::string path;
+        for (lfs_size_t i = 0; i < depth; i++) {
+            path += (i ? "/d" : "d") + std::to_string(i);
+        }
+        return path;
+    }
+
+    lfs_size_t Depth() {
+        return 6;
+    }
+
+    void MkTree(lfs_t *lfs) {
+        for (lfs_size_t d = 1; d <= Depth(); d++) {
+            LFS_ASSERT_OK(lfs_mkdir(lfs, Dir(d).c_str()));
+        }
+    }
+
+    // walk a tree with only directory-relative lookups
+    void Walk(lfs_t *lfs, lfs_dir_t *at, const std::string &prefix,
+            std::set<std::string> &found) {
+        struct lfs_info info;
+        while (true) {
+            int res = lfs_dir_read(lfs, at, &info);
+            ASSERT_GE(res, 0);
+            if (res == 0) {
+                break;
+            }
+            if (strcmp(info.name, ".") == 0 || strcmp(info.name, "..") == 0) {
+                continue;
+            }
+
+            struct lfs_info info2;
+            LFS_ASSERT_OK(lfs_statat(lfs, at, info.name, &info2));
+            ASSERT_STREQ(info2.name, info.name);
+            ASSERT_EQ(info2.type, info.type);
+            found.insert(prefix + info.name);
+
+            if (info.type == LFS_TYPE_DIR) {
+                lfs_dir_t dir;
+                LFS_ASSERT_OK(lfs_dir_openat(lfs, at, &dir, info.name));
+                Walk(lfs, &dir, prefix + info.name + "/", found);
+                LFS_ASSERT_OK(lfs_dir_close(lfs, &dir));
+            } else {
+                lfs_file_t file;
+                LFS_ASSERT_OK(lfs_file_openat(lfs, at, &file, info.name,
+                        LFS_O_RDONLY));
+                ASSERT_EQ(lfs_file_size(lfs, &file), (lfs_soff_t)info.size);
+                LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+            }
+        }
+    }
+};
+
+// Each operation should find the same things as its root-relative twin
+TEST_P(AtTest, Ops) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    MkTree(&lfs);
+
+    lfs_dir_t at;
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &at, Dir(2).c_str()));
+    LFS_ASSERT_OK(lfs_mkdirat(&lfs, &at, "new"));
+    ASSERT_EQ(lfs_mkdirat(&lfs, &at, "new"), LFS_ERR_EXIST);
+
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_openat(&lfs, &at, &file, "new/file",
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+    ASSERT_EQ(lfs_file_write(&lfs, &file, "hello", 5), 5);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    LFS_ASSERT_OK(lfs_setattr(&lfs, (Dir(2) + "/new/file").c_str(), 'a',
+            "world", 5));
+
+    struct lfs_info info;
+    LFS_ASSERT_OK(lfs_stat(&lfs, (Dir(2) + "/new/file").c_str(), &info));
+    ASSERT_EQ(info.size, 5u);
+    LFS_ASSERT_OK(lfs_statat(&lfs, &at, "new/file", &info));
+    ASSERT_STREQ(info.name, "file");
+    ASSERT_EQ(info.type, LFS_TYPE_REG);
+    ASSERT_EQ(info.size, 5u);
+    LFS_ASSERT_OK(lfs_statat(&lfs, &at, "./d2/../new//file", &info));
+    ASSERT_STREQ(info.name, "file");
+    LFS_ASSERT_OK(lfs_statat(&lfs, &at, "d2/d3", &info));
+    ASSERT_EQ(info.type, LFS_TYPE_DIR);
+    ASSERT_EQ(lfs_statat(&lfs, &at, "d3", &info), LFS_ERR_NOENT);
+    ASSERT_EQ(lfs_statat(&lfs, &at, "new/file/x", &info), LFS_ERR_NOTDIR);
+
+    char buffer[8];
+    ASSERT_EQ(lfs_getattrat(&lfs, &at, "new/file", 'a', buffer, 8), 5);
+    ASSERT_EQ(memcmp(buffer, "world", 5), 0);
+    ASSERT_EQ(lfs_getattrat(&lfs, &at, "new/file", 'b', buffer, 8),
+            LFS_ERR_NOATTR);
+
+    struct lfs_file_config filecfg = {};
+    struct lfs_attr attrs[] = {{'a', buffer, 8}};
+    filecfg.attrs = attrs;
+    filecfg.attr_count = 1;
+    memset(buffer, 0, sizeof(buffer));
+    LFS_ASSERT_OK(lfs_file_opencfgat(&lfs, &at, &file, "new/file",
+            LFS_O_RDONLY, &filecfg));
+    ASSERT_EQ(memcmp(buffer, "world", 5), 0);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+
+    // absolute paths and a NULL dir are still relative to the root
+    LFS_ASSERT_OK(lfs_statat(&lfs, &at, ("/" + Dir(1)).c_str(), &info));
+    ASSERT_STREQ(info.name, "d0");
+    LFS_ASSERT_OK(lfs_statat(&lfs, NULL, Dir(1).c_str(), &info));
+    ASSERT_STREQ(info.name, "d0");
+    LFS_ASSERT_OK(lfs_statat(&lfs, &at, "/", &info));
+    ASSERT_STREQ(info.name, "/");
+
+    // paths can't leave or refer to the dir itself
+    ASSERT_EQ(lfs_statat(&lfs, &at, ".", &info), LFS_ERR_INVAL);
+    ASSERT_EQ(lfs_statat(&lfs, &at, "..", &info), LFS_ERR_INVAL);
+    ASSERT_EQ(lfs_statat(&lfs, &at, "new/../..", &info), LFS_ERR_INVAL);
+    ASSERT_EQ(lfs_statat(&lfs, &at, "new/..", &info), LFS_ERR_INVAL);
+    ASSERT_EQ(lfs_removeat(&lfs, &at, "."), LFS_ERR_INVAL);
+    ASSERT_EQ(lfs_mkdirat(&lfs, &at, "."), LFS_ERR_INVAL);
+
+    // rename between two dirs and the root
+    lfs_dir_t at2;
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &at2, Dir(Depth()).c_str()));
+    LFS_ASSERT_OK(lfs_renameat(&lfs, &at, "new/file", &at2, "moved"));
+    ASSERT_EQ(lfs_statat(&lfs, &at, "new/file", &info), LFS_ERR_NOENT);
+    LFS_ASSERT_OK(lfs_stat(&lfs, (Dir(Depth()) + "/moved").c_str(), &info));
+    ASSERT_EQ(info.size, 5u);
+    LFS_ASSERT_OK(lfs_renameat(&lfs, &at2, "moved", NULL, "top"));
+    LFS_ASSERT_OK(lfs_stat(&lfs, "top", &info));
+    ASSERT_EQ(lfs_getattr(&lfs, "top", 'a', buffer, 8), 5);
+
+    ASSERT_EQ(lfs_removeat(&lfs, &at, "d2"), LFS_ERR_NOTEMPTY);
+    LFS_ASSERT_OK(lfs_removeat(&lfs, &at, "new"));
+    ASSERT_EQ(lfs_stat(&lfs, (Dir(2) + "/new").c_str(), &info),
+            LFS_ERR_NOENT);
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &at2));
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &at));
+
+    // the root can be used like any other dir
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &at, "/"));
+    LFS_ASSERT_OK(lfs_statat(&lfs, &at, ".", &info));
+    ASSERT_STREQ(info.name, "/");
+    LFS_ASSERT_OK(lfs_removeat(&lfs, &at, "top"));
+    ASSERT_EQ(lfs_stat(&lfs, "top", &info), LFS_ERR_NOENT);
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &at));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Walking a tree with relative lookups should see everything, and
+// removing entries while reading shouldn't lose our place
+TEST_P(AtTest, Walk) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    MkTree(&lfs);
+
+    std::set<std::string> expected;
+    for (lfs_size_t d = 1; d <= Depth(); d++) {
+        expected.insert(Dir(d));
+    }
+    lfs_dir_t at;
+    for (lfs_size_t d = 0; d <= Depth(); d += 2) {
+        LFS_ASSERT_OK(lfs_dir_open(&lfs, &at, d ? Dir(d).c_str() : "/"));
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            std::string name = "f" + std::to_string((i*7) % Count());
+            lfs_file_t file;
+            LFS_ASSERT_OK(lfs_file_openat(&lfs, &at, &file, name.c_str(),
+                    LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+            ASSERT_EQ(lfs_file_write(&lfs, &file, &i, sizeof(i)),
+                    (lfs_ssize_t)sizeof(i));
+            LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+            expected.insert((d ? Dir(d) + "/" : "") + name);
+        }
+        LFS_ASSERT_OK(lfs_dir_close(&lfs, &at));
+    }
+
+    std::set<std::string> found;
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &at, "/"));
+    Walk(&lfs, &at, "", found);
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &at));
+    ASSERT_EQ(found, expected);
+
+    // remove every file in the deepest dir while reading it
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &at, Dir(Depth()).c_str()));
+    lfs_size_t removed = 0;
+    struct lfs_info info;
+    while (true) {
+        int res = lfs_dir_read(&lfs, &at, &info);
+        ASSERT_GE(res, 0);
+        if (res == 0) {
+            break;
+        }
+        if (info.type == LFS_TYPE_REG) {
+            LFS_ASSERT_OK(lfs_removeat(&lfs, &at, info.name));
+            removed += 1;
+        }
+    }
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &at));
+    ASSERT_EQ(removed, Count());
+    LFS_ASSERT_OK(lfs_remove(&lfs, Dir(Depth()).c_str()));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    found.clear();
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &at, "/"));
+    Walk(&lfs, &at, "", found);
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &at));
+    for (auto it = expected.begin(); it != expected.end();) {
+        if (it->compare(0, Dir(Depth()).size(), Dir(Depth())) == 0) {
+            it = expected.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    ASSERT_EQ(found, expected);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// A dir removed while open shouldn't resolve anything, even once its
+// blocks have been reused by another dir
+TEST_P(AtTest, Removed) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "d"));
+
+    lfs_dir_t at;
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &at, "d"));
+    lfs_block_t head[2] = {at.head[0], at.head[1]};
+    LFS_ASSERT_OK(lfs_remove(&lfs, "d"));
+
+    // keep making dirs until one lands on the removed pair
+    lfs_size_t reused = 0;
+    for (lfs_size_t i = 0; !reused && i < cfg_.block_count; i++) {
+        std::string name = "e" + std::to_string(i);
+        int err = lfs_mkdir(&lfs, name.c_str());
+        if (err == LFS_ERR_NOSPC) {
+            break;
+        }
+        LFS_ASSERT_OK(err);
+
+        lfs_dir_t dir;
+        LFS_ASSERT_OK(lfs_dir_open(&lfs, &dir, name.c_str()));
+        if (dir.head[0] == head[0] || dir.head[0] == head[1]
+                || dir.head[1] == head[0] || dir.head[1] == head[1]) {
+            reused = i+1;
+        }
+        LFS_ASSERT_OK(lfs_dir_close(&lfs, &dir));
+    }
+
+    struct lfs_info info;
+    lfs_file_t file;
+    lfs_dir_t dir;
+    char buffer[8];
+    ASSERT_EQ(lfs_mkdirat(&lfs, &at, "x"), LFS_ERR_NOENT);
+    ASSERT_EQ(lfs_statat(&lfs, &at, "x", &info), LFS_ERR_NOENT);
+    ASSERT_EQ(lfs_file_openat(&lfs, &at, &file, "x",
+            LFS_O_WRONLY | LFS_O_CREAT), LFS_ERR_NOENT);
+    ASSERT_EQ(lfs_dir_openat(&lfs, &at, &dir, "x"), LFS_ERR_NOENT);
+    ASSERT_EQ(lfs_removeat(&lfs, &at, "x"), LFS_ERR_NOENT);
+    ASSERT_EQ(lfs_renameat(&lfs, NULL, "e0", &at, "x"), LFS_ERR_NOENT);
+    ASSERT_EQ(lfs_getattrat(&lfs, &at, "x", 'a', buffer, 8),
+            LFS_ERR_NOENT);
+    ASSERT_EQ(lfs_dir_rewind(&lfs, &at), LFS_ERR_NOENT);
+
+    // nothing should have landed in the dir that took our blocks
+    if (reused) {
+        std::string name = "e" + std::to_string(reused-1);
+        ASSERT_EQ(lfs_stat(&lfs, (name + "/x").c_str(), &info),
+                LFS_ERR_NOENT);
+    }
+
+    // absolute paths still work
+    LFS_ASSERT_OK(lfs_statat(&lfs, &at, "/e0", &info));
+    LFS_ASSERT_OK(lfs_removeat(&lfs, &at, "/e0"));
+    LFS_ASSERT_OK(lfs_mkdirat(&lfs, &at, "/x"));
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &at));
+    LFS_ASSERT_OK(lfs_stat(&lfs, "x", &info));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Looking up entries in a deep dir shouldn't need to fetch every dir on
+// the way there
+TEST_P(AtTest, Readed) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    MkTree(&lfs);
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file,
+                (Dir(Depth()) + "/f" + std::to_string(i)).c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    }
+
+    struct lfs_info info;
+    lfs_emubd_sio_t walked = lfs_emubd_readed(&cfg_);
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        LFS_ASSERT_OK(lfs_stat(&lfs,
+                (Dir(Depth()) + "/f" + std::to_string(i)).c_str(), &info));
+    }
+    walked = lfs_emubd_readed(&cfg_) - walked;
+
+    lfs_dir_t at;
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &at, Dir(Depth()).c_str()));
+    lfs_emubd_sio_t relative = lfs_emubd_readed(&cfg_);
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        LFS_ASSERT_OK(lfs_statat(&lfs, &at,
+                ("f" + std::to_string(i)).c_str(), &info));
+    }
+    relative = lfs_emubd_readed(&cfg_) - relative;
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &at));
+    // a dentry cache already saves the walk through the parent directories,
+    // see AtTest.Dcache
+    if (!cfg_.dentry_cache_size) {
+        EXPECT_LT(relative, walked);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Relative lookups fill and hit the dentry cache like absolute ones, keyed
+// by the directory's metadata pair. The cached entry still has to be
+// fetched, so this only saves reads along with the mdir cache
+TEST_P(AtTest, Dcache) {
+    cfg_.dentry_cache_size = Count();
+    cfg_.mdir_cache_size = Depth() + 2;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    MkTree(&lfs);
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file,
+                (Dir(Depth()) + "/f" + std::to_string(i)).c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    lfs_dir_t at;
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &at, Dir(Depth()).c_str()));
+    struct lfs_info info;
+    lfs_emubd_sio_t readed[2];
+    for (int pass = 0; pass < 2; pass++) {
+        readed[pass] = lfs_emubd_readed(&cfg_);
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            std::string name = "f" + std::to_string(i);
+            LFS_ASSERT_OK(lfs_statat(&lfs, &at, name.c_str(), &info));
+            ASSERT_STREQ(info.name, name.c_str());
+            ASSERT_EQ(info.type, LFS_TYPE_REG);
+        }
+        readed[pass] = lfs_emubd_readed(&cfg_) - readed[pass];
+    }
+
+    // entries remembered by relative lookups are good for absolute ones
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        std::string name = "f" + std::to_string(i);
+        LFS_ASSERT_OK(lfs_stat(&lfs, (Dir(Depth()) + "/" + name).c_str(),
+                &info));
+        ASSERT_STREQ(info.name, name.c_str());
+    }
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &at));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    EXPECT_LT(readed[1], readed[0]);
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, AtTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,149 @@
+/*
+ * Prog bypass tests - large aligned writes programmed straight from the
+ * caller's buffer
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+class BypassTest : public LfsParametricTest {
+protected:
+    // a prog wrapper that notices progs from the caller's buffer
+    static const uint8_t *user_;
+    static lfs_size_t user_size_;
+    static lfs_size_t bypassed_;
+
+    static int corrupt_;
+
+    static int Prog(const struct lfs_config *c, lfs_block_t block,
+            lfs_off_t off, const void *buffer, lfs_size_t size) {
+        const uint8_t *data = static_cast<const uint8_t*>(buffer);
+        if (user_ && data >= user_ && data + size <= user_ + user_size_) {
+            bypassed_ += size;
+
+            // silently prog the wrong data? only validation can catch this
+            if (corrupt_ > 0) {
+                corrupt_ -= 1;
+                std::vector<uint8_t> bad(data, data+size);
+                bad[size/2] ^= 0x55;
+                return lfs_emubd_prog(c, block, off, bad.data(), size);
+            }
+        }
+        return lfs_emubd_prog(c, block, off, buffer, size);
+    }
+
+    void SetUp() override {
+        LfsParametricTest::SetUp();
+        cfg_.prog = Prog;
+        user_ = NULL;
+        user_size_ = 0;
+        bypassed_ = 0;
+        corrupt_ = 0;
+    }
+
+    void CheckFile(lfs_t *lfs, const char *path,
+            const std::vector<uint8_t> &model) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_RDONLY));
+        ASSERT_EQ(lfs_file_size(lfs, &file), (lfs_soff_t)model.size());
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < model.size(); j += sizeof(buffer)) {
+            lfs_size_t n = std::min<lfs_size_t>(sizeof(buffer),
+                    model.size()-j);
+            ASSERT_EQ(lfs_file_read(lfs, &file, buffer, n), (lfs_ssize_t)n);
+            for (lfs_size_t k = 0; k < n; k++) {
+                ASSERT_EQ(buffer[k], model[j+k]) << "off " << j+k;
+            }
+        }
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+};
+
+const uint8_t *BypassTest::user_;
+lfs_size_t BypassTest::user_size_;
+lfs_size_t BypassTest::bypassed_;
+int BypassTest::corrupt_;
+
+// Large writes at any alignment should land correctly, and most of a bulk
+// write should skip the caches
+TEST_P(BypassTest, Write) {
+    const lfs_size_t SIZE = 4*cfg_.block_size;
+    std::vector<uint8_t> model(SIZE);
+    for (lfs_size_t j = 0; j < SIZE; j++) {
+        model[j] = LfsPattern(1, j);
+    }
+
+    for (lfs_size_t head : {(lfs_size_t)0, (lfs_size_t)1,
+            cfg_.cache_size-1, cfg_.cache_size+3}) {
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+                LFS_O_WRONLY | LFS_O_CREAT));
+        ASSERT_EQ(lfs_file_write(&lfs, &file, model.data(), head),
+                (lfs_ssize_t)head);
+        user_ = model.data();
+        user_size_ = SIZE;
+        bypassed_ = 0;
+        ASSERT_EQ(lfs_file_write(&lfs, &file, &model[head], SIZE-head),
+                (lfs_ssize_t)(SIZE-head));
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        user_ = NULL;
+
+        // everything but the skip-pointers and the unaligned edges of
+        // each block should bypass the cache
+        if (cfg_.cache_size < cfg_.block_size) {
+            EXPECT_GE(bypassed_, SIZE/2) << "head " << head;
+        }
+
+        CheckFile(&lfs, "file", model);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        CheckFile(&lfs, "file", model);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Bypassed progs must still be validated, bad progs should send us to a
+// new block
+TEST_P(BypassTest, Corrupt) {
+    const lfs_size_t SIZE = 4*cfg_.block_size;
+    std::vector<uint8_t> model(SIZE);
+    for (lfs_size_t j = 0; j < SIZE; j++) {
+        model[j] = LfsPattern(1, j);
+    }
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+            LFS_O_WRONLY | LFS_O_CREAT));
+    user_ = model.data();
+    user_size_ = SIZE;
+    corrupt_ = 3;
+    ASSERT_EQ(lfs_file_write(&lfs, &file, model.data(), SIZE),
+            (lfs_ssize_t)SIZE);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    user_ = NULL;
+    if (cfg_.cache_size < cfg_.block_size) {
+        EXPECT_EQ(corrupt_, 0);
+    }
+
+    CheckFile(&lfs, "file", model);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    CheckFile(&lfs, "file", model);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, BypassTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,138 @@
+/*
+ * Read cache tests - additional read cache lines
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+class CacheTest : public LfsParametricTest {
+protected:
+    // create a handful of small files in a couple directories, then
+    // read them back in an interleaved order, returns bytes read
+    lfs_emubd_sio_t WriteAndReadBack(void) {
+        const int N = 20;
+        lfs_t lfs;
+        EXPECT_EQ(lfs_format(&lfs, &cfg_), 0);
+        EXPECT_EQ(lfs_mount(&lfs, &cfg_), 0);
+        EXPECT_EQ(lfs_mkdir(&lfs, "a"), 0);
+        EXPECT_EQ(lfs_mkdir(&lfs, "b"), 0);
+        for (int i = 0; i < N; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "%s/file%03d", (i % 2) ? "a" : "b", i);
+            lfs_file_t file;
+            EXPECT_EQ(lfs_file_open(&lfs, &file, path,
+                    LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL), 0);
+            for (int j = 0; j < 4*i; j++) {
+                uint8_t c = (uint8_t)(i + j);
+                EXPECT_EQ(lfs_file_write(&lfs, &file, &c, 1), 1);
+            }
+            EXPECT_EQ(lfs_file_close(&lfs, &file), 0);
+        }
+        EXPECT_EQ(lfs_unmount(&lfs), 0);
+
+        EXPECT_EQ(lfs_mount(&lfs, &cfg_), 0);
+        lfs_emubd_setreaded(&cfg_, 0);
+        for (int k = 0; k < 3; k++) {
+            for (int i = 0; i < N; i++) {
+                int i_ = (i * 7) % N;
+                char path[64];
+                snprintf(path, sizeof(path), "%s/file%03d", (i_ % 2) ? "a" : "b", i_);
+                lfs_file_t file;
+                EXPECT_EQ(lfs_file_open(&lfs, &file, path, LFS_O_RDONLY), 0);
+                for (int j = 0; j < 4*i_; j++) {
+                    uint8_t c;
+                    EXPECT_EQ(lfs_file_read(&lfs, &file, &c, 1), 1);
+                    EXPECT_EQ(c, (uint8_t)(i_ + j));
+                }
+                EXPECT_EQ(lfs_file_close(&lfs, &file), 0);
+            }
+        }
+        lfs_emubd_sio_t readed = lfs_emubd_readed(&cfg_);
+        EXPECT_EQ(lfs_unmount(&lfs), 0);
+        return readed;
+    }
+};
+
+// Additional lines should never read more than the single read cache
+TEST_P(CacheTest, Lines) {
+    lfs_emubd_sio_t readed = WriteAndReadBack();
+
+    cfg_.read_cache_lines = 8;
+    lfs_emubd_sio_t readed_lines = WriteAndReadBack();
+    EXPECT_LE(readed_lines, readed);
+}
+
+// Set-associative lines with each replacement policy
+TEST_P(CacheTest, Policies) {
+    for (lfs_size_t ways : {1, 2, 4}) {
+        for (enum lfs_read_cache_policy policy
+                : {LFS_READ_CACHE_LRU, LFS_READ_CACHE_FIFO}) {
+            cfg_.read_cache_lines = 8;
+            cfg_.read_cache_ways = ways;
+            cfg_.read_cache_policy = policy;
+            WriteAndReadBack();
+            if (HasFailure()) {
+                return;
+            }
+        }
+    }
+}
+
+// Lines may live in a caller-provided buffer pool
+TEST_P(CacheTest, StaticBuffer) {
+    const lfs_size_t LINES = 4;
+    std::vector<uint64_t> pool(
+            (LINES*(sizeof(lfs_cache_t) + cfg_.cache_size) + 7) / 8);
+    cfg_.read_cache_lines = LINES;
+    cfg_.read_cache_ways = 2;
+    cfg_.read_cache_buffer = pool.data();
+    WriteAndReadBack();
+}
+
+// Lines must stay coherent across writes, removes, and relocations
+TEST_P(CacheTest, Coherence) {
+    cfg_.read_cache_lines = 4;
+    cfg_.block_cycles = 2;
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (int k = 0; k < 10; k++) {
+        for (int i = 0; i < 5; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "file%d", i);
+            lfs_file_t file;
+            LFS_ASSERT_OK(lfs_file_open(&lfs, &file, path,
+                    LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC));
+            for (int j = 0; j < 3*i*k; j++) {
+                uint8_t c = (uint8_t)(i + j + k);
+                ASSERT_EQ(lfs_file_write(&lfs, &file, &c, 1), 1);
+            }
+            LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        }
+
+        for (int i = 0; i < 5; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "file%d", i);
+            lfs_file_t file;
+            LFS_ASSERT_OK(lfs_file_open(&lfs, &file, path, LFS_O_RDONLY));
+            for (int j = 0; j < 3*i*k; j++) {
+                uint8_t c;
+                ASSERT_EQ(lfs_file_read(&lfs, &file, &c, 1), 1);
+                ASSERT_EQ(c, (uint8_t)(i + j + k));
+            }
+            LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        }
+
+        if (k % 3 == 2) {
+            LFS_ASSERT_OK(lfs_remove(&lfs, "file0"));
+        }
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, CacheTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -119,6 +119,9 @@ TEST_F(CompatTest, ForwardMount) {
     lfsp_t lfsp;
     ASSERT_EQ(lfsp_format(&lfsp, &cfgp), 0);
     ASSERT_EQ(lfsp_mount(&lfsp, &cfgp), 0);
+    struct lfsp_fsinfo fsinfop;
+    ASSERT_EQ(lfsp_fs_stat(&lfsp, &fsinfop), 0);
+    ASSERT_LE(fsinfop.disk_version, (uint32_t)LFSP_DISK_VERSION);
     ASSERT_EQ(lfsp_unmount(&lfsp), 0);
 
     // Mount with new version
@@ -128,7 +131,7 @@ TEST_F(CompatTest, ForwardMount) {
     // Check version
     struct lfs_fsinfo fsinfo;
     ASSERT_EQ(lfs_fs_stat(&lfs, &fsinfo), 0);
-    ASSERT_EQ(fsinfo.disk_version, LFSP_DISK_VERSION);
+    ASSERT_EQ(fsinfo.disk_version, fsinfop.disk_version);
 
     ASSERT_EQ(lfs_unmount(&lfs), 0);
 }
@@ -561,7 +564,9 @@ TEST_F(CompatTest, MinorBump) {
 
     ASSERT_EQ(lfs_unmount(&lfs), 0);
 
-    // Now write - should bump minor version
+    // Now write with name hashes, which need the newer minor version -
+    // should bump minor version
+    cfg_.name_hash_size = 8;
     ASSERT_EQ(lfs_mount(&lfs, &cfg_), 0);
 
     ASSERT_EQ(lfs_fs_stat(&lfs, &fsinfo), 0);
@@ -593,3 +598,44 @@ TEST_F(CompatTest, MinorBump) {
 
     ASSERT_EQ(lfs_unmount(&lfs), 0);
 }
+
+// Test that minor version is left alone by writes that don't need it
+TEST_F(CompatTest, MinorKeep) {
+    // Disks only need lfs2.2 for free maps and name hashes
+    lfs_t lfs;
+    ASSERT_EQ(lfs_format(&lfs, &cfg_), 0);
+    ASSERT_EQ(lfs_mount(&lfs, &cfg_), 0);
+    struct lfs_fsinfo fsinfo;
+    ASSERT_EQ(lfs_fs_stat(&lfs, &fsinfo), 0);
+    ASSERT_EQ(fsinfo.disk_version, 0x00020001u);
+
+    lfs_file_t file;
+    ASSERT_EQ(lfs_file_open(&lfs, &file, "test",
+            LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL), 0);
+    ASSERT_EQ(lfs_file_write(&lfs, &file, "testtest", 8), 8);
+    ASSERT_EQ(lfs_file_close(&lfs, &file), 0);
+    ASSERT_EQ(lfs_unmount(&lfs), 0);
+
+    ASSERT_EQ(lfs_mount(&lfs, &cfg_), 0);
+    ASSERT_EQ(lfs_fs_stat(&lfs, &fsinfo), 0);
+    ASSERT_EQ(fsinfo.disk_version, 0x00020001u);
+
+    // Writing a free map bumps the minor version
+    ASSERT_EQ(lfs_fs_mkfreemap(&lfs), 0);
+    ASSERT_EQ(lfs_fs_stat(&lfs, &fsinfo), 0);
+    ASSERT_EQ(fsinfo.disk_version, 0x00020002u);
+    ASSERT_EQ(lfs_unmount(&lfs), 0);
+
+    ASSERT_EQ(lfs_mount(&lfs, &cfg_), 0);
+    ASSERT_EQ(lfs_fs_stat(&lfs, &fsinfo), 0);
+    ASSERT_EQ(fsinfo.disk_version, 0x00020002u);
+    ASSERT_EQ(lfs_unmount(&lfs), 0);
+
+    // Formatting with name hashes starts out on lfs2.2
+    cfg_.name_hash_size = 8;
+    ASSERT_EQ(lfs_format(&lfs, &cfg_), 0);
+    ASSERT_EQ(lfs_mount(&lfs, &cfg_), 0);
+    ASSERT_EQ(lfs_fs_stat(&lfs, &fsinfo), 0);
+    ASSERT_EQ(fsinfo.disk_version, 0x00020002u);
+    ASSERT_EQ(lfs_unmount(&lfs), 0);
+}
@@ -0,0 +1,221 @@
+/*
+ * Block copy tests - moving data between blocks in chunks, optionally
+ * through the device's copy hook
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+class CopyTest : public LfsParametricTest {
+protected:
+    // a copy hook built on top of emubd's read/prog
+    static lfs_size_t copied_;
+    static int corrupt_;
+
+    static int Copy(const struct lfs_config *c, lfs_block_t block,
+            lfs_off_t off, lfs_block_t src_block, lfs_off_t src_off,
+            lfs_size_t size) {
+        EXPECT_EQ(off % c->cache_size, 0u);
+        EXPECT_EQ(size % c->cache_size, 0u);
+        EXPECT_EQ(src_off % c->read_size, 0u);
+        if (corrupt_ > 0) {
+            corrupt_ -= 1;
+            return LFS_ERR_CORRUPT;
+        }
+
+        std::vector<uint8_t> buffer(size);
+        int err = lfs_emubd_read(c, src_block, src_off, buffer.data(), size);
+        if (err) {
+            return err;
+        }
+        err = lfs_emubd_prog(c, block, off, buffer.data(), size);
+        if (err) {
+            return err;
+        }
+        copied_ += size;
+        return 0;
+    }
+
+    void SetUp() override {
+        LfsParametricTest::SetUp();
+        copied_ = 0;
+        corrupt_ = 0;
+    }
+
+    // append to a file with one open per write, each open has to copy
+    // out the partial last block
+    int Append(lfs_t *lfs, const char *path, lfs_size_t off,
+            lfs_size_t size, lfs_size_t chunk) {
+        uint8_t buffer[256];
+        for (lfs_size_t j = off; j < size; j += chunk) {
+            lfs_file_t file;
+            int err = lfs_file_open(lfs, &file, path,
+                    LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
+            if (err) {
+                return err;
+            }
+
+            lfs_size_t n = std::min<lfs_size_t>(chunk, size-j);
+            for (lfs_size_t k = 0; k < n; k++) {
+                buffer[k] = LfsPattern(1, j+k);
+            }
+            lfs_ssize_t res = lfs_file_write(lfs, &file, buffer, n);
+            if (res < 0) {
+                lfs_file_close(lfs, &file);
+                return (int)res;
+            }
+
+            err = lfs_file_close(lfs, &file);
+            if (err) {
+                return err;
+            }
+        }
+        return 0;
+    }
+
+    void CheckFile(lfs_t *lfs, const char *path, lfs_size_t size) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_RDONLY));
+        ASSERT_EQ(lfs_file_size(lfs, &file), (lfs_soff_t)size);
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < size; j += sizeof(buffer)) {
+            lfs_size_t n = std::min<lfs_size_t>(sizeof(buffer), size-j);
+            ASSERT_EQ(lfs_file_read(lfs, &file, buffer, n), (lfs_ssize_t)n);
+            for (lfs_size_t k = 0; k < n; k++) {
+                ASSERT_EQ(buffer[k], LfsPattern(1, j+k)) << "off " << j+k;
+            }
+        }
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    void CheckFile(lfs_t *lfs, const char *path,
+            const std::vector<uint8_t> &model) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_RDONLY));
+        ASSERT_EQ(lfs_file_size(lfs, &file), (lfs_soff_t)model.size());
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < model.size(); j += sizeof(buffer)) {
+            lfs_size_t n = std::min<lfs_size_t>(sizeof(buffer),
+                    model.size()-j);
+            ASSERT_EQ(lfs_file_read(lfs, &file, buffer, n), (lfs_ssize_t)n);
+            for (lfs_size_t k = 0; k < n; k++) {
+                ASSERT_EQ(buffer[k], model[j+k]) << "off " << j+k;
+            }
+        }
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+};
+
+lfs_size_t CopyTest::copied_;
+int CopyTest::corrupt_;
+
+// Appending across many opens copies the last block each time, with and
+// without a copy hook
+TEST_P(CopyTest, Append) {
+    const lfs_size_t SIZE = 3*cfg_.block_size + 7;
+    const lfs_size_t CHUNK = std::min<lfs_size_t>(cfg_.block_size/5 + 3, 256);
+    for (int hook = 0; hook < 2; hook++) {
+        cfg_.copy = (hook) ? Copy : NULL;
+        copied_ = 0;
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        LFS_ASSERT_OK(Append(&lfs, "file", 0, SIZE, CHUNK));
+        CheckFile(&lfs, "file", SIZE);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        CheckFile(&lfs, "file", SIZE);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        // note we only hand whole caches to the hook, and a partial
+        // block never fills one if our cache is a whole block
+        if (hook && cfg_.cache_size < cfg_.block_size) {
+            EXPECT_GT(copied_, 0u);
+        } else if (!hook) {
+            EXPECT_EQ(copied_, 0u);
+        }
+    }
+}
+
+// A hook that reports a bad block should send us to a new block, both when
+// extending a file and when relocating one
+TEST_P(CopyTest, Corrupt) {
+    const lfs_size_t SIZE = 2*cfg_.block_size + 7;
+    cfg_.copy = Copy;
+
+    for (int n : {1, 3}) {
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        LFS_ASSERT_OK(Append(&lfs, "file", 0, SIZE/2, 256));
+        corrupt_ = n;
+        LFS_ASSERT_OK(Append(&lfs, "file", SIZE/2, SIZE, 256));
+        corrupt_ = 0;
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        CheckFile(&lfs, "file", SIZE);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Growing an inline file out of its metadata relocates it into a block
+TEST_P(CopyTest, Outline) {
+    const lfs_size_t SIZE = cfg_.block_size + 7;
+    cfg_.copy = Copy;
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(Append(&lfs, "file", 0, 8, 8));
+    LFS_ASSERT_OK(Append(&lfs, "file", 8, SIZE, 256));
+    CheckFile(&lfs, "file", SIZE);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Overwriting a byte copies the rest of the file into new blocks when
+// the file is flushed
+TEST_P(CopyTest, Overwrite) {
+    const lfs_size_t SIZE = 3*cfg_.block_size + 7;
+    const lfs_off_t OFFS[] = {0, 1, cfg_.block_size-1, cfg_.block_size,
+            SIZE/2, SIZE-1};
+    for (int hook = 0; hook < 3; hook++) {
+        cfg_.copy = (hook) ? Copy : NULL;
+        std::vector<uint8_t> model(SIZE);
+        for (lfs_size_t j = 0; j < SIZE; j++) {
+            model[j] = LfsPattern(1, j);
+        }
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        LFS_ASSERT_OK(Append(&lfs, "file", 0, SIZE, 256));
+
+        for (lfs_off_t off : OFFS) {
+            // with hook == 2 the hook also reports some bad blocks
+            corrupt_ = (hook == 2) ? 1 : 0;
+            lfs_file_t file;
+            LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file", LFS_O_RDWR));
+            ASSERT_EQ(lfs_file_seek(&lfs, &file, off, LFS_SEEK_SET),
+                    (lfs_soff_t)off);
+            uint8_t data = (uint8_t)~model[off];
+            ASSERT_EQ(lfs_file_write(&lfs, &file, &data, 1), 1);
+            LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+            model[off] = data;
+            CheckFile(&lfs, "file", model);
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        CheckFile(&lfs, "file", model);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, CopyTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
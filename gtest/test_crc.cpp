@@ -0,0 +1,53 @@
+/*
+ * CRC tests - checks lfs_crc against a bitwise reference
+ */
+#include "lfs_test_fixture.h"
+#include <vector>
+
+extern "C" {
+#include "lfs_util.h"
+}
+
+// Bit-at-a-time reference CRC-32, reflected polynomial 0xedb88320
+static uint32_t CrcBitwise(uint32_t crc, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+        }
+    }
+    return crc;
+}
+
+static std::vector<uint8_t> PrngBuffer(size_t size, uint32_t seed) {
+    std::vector<uint8_t> buffer(size);
+    for (size_t i = 0; i < size; i++) {
+        seed = seed*1103515245 + 12345;
+        buffer[i] = (uint8_t)(seed >> 16);
+    }
+    return buffer;
+}
+
+// Every size and alignment must be bit-exact with the reference
+TEST(CrcTest, BitExact) {
+    std::vector<uint8_t> buffer = PrngBuffer(4096+16, 1);
+    for (size_t off = 0; off < 16; off++) {
+        for (size_t size = 0; size <= 4096; size += (size < 300) ? 1 : 61) {
+            uint32_t crc = 0xffffffff ^ (uint32_t)(off*size);
+            ASSERT_EQ(lfs_crc(crc, &buffer[off], size),
+                    CrcBitwise(crc, &buffer[off], size))
+                    << "off=" << off << " size=" << size;
+        }
+    }
+}
+
+// Splitting a buffer must not change the result
+TEST(CrcTest, Incremental) {
+    std::vector<uint8_t> buffer = PrngBuffer(1024, 2);
+    uint32_t expected = CrcBitwise(0xffffffff, buffer.data(), buffer.size());
+    for (size_t split = 0; split <= buffer.size(); split += 7) {
+        uint32_t crc = lfs_crc(0xffffffff, buffer.data(), split);
+        crc = lfs_crc(crc, &buffer[split], buffer.size()-split);
+        ASSERT_EQ(crc, expected) << "split=" << split;
+    }
+}
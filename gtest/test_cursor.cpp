@@ -0,0 +1,233 @@
+/*
+ * Cursor tests - metadata decoded straight from cache lines, with tags,
+ * names, and crcs straddling line boundaries
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+class CursorTest : public LfsParametricTest {
+protected:
+    CursorTest() {
+        count_ = 40;
+        count_blocks_ = 2;
+    }
+
+    // names of every length, so tags and names land on every offset of
+    // our cache lines
+    static std::string Name(lfs_size_t i) {
+        char name[64];
+        snprintf(name, sizeof(name), "f%0*u", (int)(1 + (i*7) % 23),
+                (unsigned)i);
+        return name;
+    }
+
+    // attrs from empty to a couple of lines long, capped so a handful
+    // still fit in a metadata block
+    lfs_size_t AttrSize(lfs_size_t i) {
+        return i % std::min(2*cfg_.cache_size + 3, cfg_.block_size/8);
+    }
+
+    void SetAttr(lfs_t *lfs, const std::string &name, lfs_size_t i,
+            lfs_size_t size) {
+        std::vector<uint8_t> attr(size);
+        for (lfs_size_t j = 0; j < size; j++) {
+            attr[j] = LfsPattern(i, j);
+        }
+        LFS_ASSERT_OK(lfs_setattr(lfs, name.c_str(), 'a',
+                attr.data(), size));
+    }
+
+    void CheckAttr(lfs_t *lfs, const std::string &name, lfs_size_t i,
+            lfs_size_t size) {
+        std::vector<uint8_t> attr(size+1);
+        ASSERT_EQ(lfs_getattr(lfs, name.c_str(), 'a',
+                attr.data(), attr.size()), (lfs_ssize_t)size) << name;
+        for (lfs_size_t j = 0; j < size; j++) {
+            ASSERT_EQ(attr[j], LfsPattern(i, j)) << name << " @" << j;
+        }
+    }
+
+    void Create(lfs_t *lfs, const std::string &name, lfs_size_t i) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, name.c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        ASSERT_EQ(lfs_file_write(lfs, &file, &i, sizeof(i)),
+                (lfs_ssize_t)sizeof(i));
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    void Check(lfs_t *lfs, const std::string &name, lfs_size_t i) {
+        struct lfs_info info;
+        ASSERT_EQ(lfs_stat(lfs, name.c_str(), &info), 0) << name;
+        ASSERT_EQ(std::string(info.name), name);
+        ASSERT_EQ(info.size, sizeof(i));
+
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, name.c_str(), LFS_O_RDONLY));
+        lfs_size_t j;
+        ASSERT_EQ(lfs_file_read(lfs, &file, &j, sizeof(j)),
+                (lfs_ssize_t)sizeof(j));
+        ASSERT_EQ(j, i) << name;
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    // the listing must hold exactly our names
+    void List(lfs_t *lfs, const std::set<std::string> &names) {
+        lfs_dir_t dir;
+        LFS_ASSERT_OK(lfs_dir_open(lfs, &dir, "/"));
+        struct lfs_info info;
+        std::set<std::string> listed;
+        while (lfs_dir_read(lfs, &dir, &info) > 0) {
+            if (strcmp(info.name, ".") != 0 && strcmp(info.name, "..") != 0) {
+                ASSERT_TRUE(listed.insert(info.name).second) << info.name;
+            }
+        }
+        LFS_ASSERT_OK(lfs_dir_close(lfs, &dir));
+        ASSERT_EQ(listed, names);
+    }
+
+    // the smallest lines, a few lines, and whole blocks, each with no
+    // extra lines, one, and a few ways to pin from
+    std::vector<std::pair<lfs_size_t, lfs_size_t>> Caches() {
+        lfs_size_t line = std::max(cfg_.read_size, cfg_.prog_size);
+        std::vector<std::pair<lfs_size_t, lfs_size_t>> caches;
+        for (lfs_size_t size : {line, 4*line, cfg_.block_size}) {
+            if (size > cfg_.block_size
+                    || (!caches.empty() && size == caches.back().first)) {
+                continue;
+            }
+            for (lfs_size_t lines : {(lfs_size_t)0, (lfs_size_t)1,
+                    (lfs_size_t)4}) {
+                caches.push_back({size, lines});
+            }
+        }
+        return caches;
+    }
+};
+
+// Names and attrs of every length, over every cache shape, must decode the
+// same as they were written, wherever they cross a line
+TEST_P(CursorTest, Straddle) {
+    for (auto cache : Caches()) {
+        cfg_.cache_size = cache.first;
+        cfg_.read_cache_lines = cache.second;
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        std::set<std::string> names;
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            Create(&lfs, Name(i), i);
+            SetAttr(&lfs, Name(i), i, AttrSize(i));
+            names.insert(Name(i));
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            Check(&lfs, Name(i), i);
+            CheckAttr(&lfs, Name(i), i, AttrSize(i));
+
+            // names that only differ in their last byte, or are one byte
+            // longer or shorter, are compared up to a line boundary
+            std::string name = Name(i);
+            struct lfs_info info;
+            for (const std::string &probe : {name + "0",
+                    name.substr(0, name.size()-1) + "~"}) {
+                if (!names.count(probe)) {
+                    ASSERT_EQ(lfs_stat(&lfs, probe.c_str(), &info),
+                            LFS_ERR_NOENT) << probe;
+                }
+            }
+        }
+        List(&lfs, names);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Compacting copies each tag's data through the caches while the log
+// itself is decoded through a cursor, attrs longer than a line make the
+// two fight over lines
+TEST_P(CursorTest, Compact) {
+    for (auto cache : Caches()) {
+        cfg_.cache_size = cache.first;
+        cfg_.read_cache_lines = cache.second;
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        const lfs_size_t N = 4;
+        std::vector<lfs_size_t> model(N);
+        for (lfs_size_t i = 0; i < N; i++) {
+            Create(&lfs, Name(i), i);
+            model[i] = i;
+            SetAttr(&lfs, Name(i), model[i], AttrSize(model[i]));
+        }
+
+        // rewrite until the log has been compacted a good few times
+        for (lfs_size_t k = N; k < 8*Count(); k++) {
+            model[k % N] = k;
+            SetAttr(&lfs, Name(k % N), k, AttrSize(k));
+            for (lfs_size_t i = 0; i < N; i++) {
+                CheckAttr(&lfs, Name(i), model[i], AttrSize(model[i]));
+            }
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (lfs_size_t i = 0; i < N; i++) {
+            Check(&lfs, Name(i), i);
+            CheckAttr(&lfs, Name(i), model[i], AttrSize(model[i]));
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Deletes and moves leave tags that hide earlier ones, which must still be
+// found wherever they land
+TEST_P(CursorTest, Logs) {
+    for (auto cache : Caches()) {
+        cfg_.cache_size = cache.first;
+        cfg_.read_cache_lines = cache.second;
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        std::set<std::string> names;
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            Create(&lfs, Name(i), i);
+            names.insert(Name(i));
+        }
+        for (lfs_size_t i = 0; i < Count(); i += 3) {
+            LFS_ASSERT_OK(lfs_remove(&lfs, Name(i).c_str()));
+            names.erase(Name(i));
+        }
+        for (lfs_size_t i = 1; i < Count(); i += 3) {
+            LFS_ASSERT_OK(lfs_rename(&lfs, Name(i).c_str(),
+                    ("r" + Name(i)).c_str()));
+            names.erase(Name(i));
+            names.insert("r" + Name(i));
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            struct lfs_info info;
+            if (i % 3 == 0) {
+                ASSERT_EQ(lfs_stat(&lfs, Name(i).c_str(), &info),
+                        LFS_ERR_NOENT);
+            } else {
+                Check(&lfs, (i % 3 == 1) ? "r" + Name(i) : Name(i), i);
+            }
+        }
+        List(&lfs, names);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, CursorTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,410 @@
+/*
+ * Dentry cache tests - path lookups through remembered path components,
+ * which must follow entries as commits shift, move, and relocate them
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+class DcacheTest : public LfsParametricTest {
+protected:
+    DcacheTest() {
+        count_ = 8;
+        count_blocks_ = 16;
+    }
+
+    void Write(lfs_t *lfs, const std::string &path, lfs_size_t v) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path.c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC));
+        ASSERT_EQ(lfs_file_write(lfs, &file, &v, sizeof(v)),
+                (lfs_ssize_t)sizeof(v));
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    // stat first, which is all lookup, then read what the lookup found
+    void Check(lfs_t *lfs, const std::string &path, lfs_size_t v) {
+        struct lfs_info info;
+        ASSERT_EQ(lfs_stat(lfs, path.c_str(), &info), 0) << path;
+        ASSERT_EQ(info.type, LFS_TYPE_REG) << path;
+        ASSERT_EQ(info.size, sizeof(v)) << path;
+
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path.c_str(), LFS_O_RDONLY));
+        lfs_size_t w;
+        ASSERT_EQ(lfs_file_read(lfs, &file, &w, sizeof(w)),
+                (lfs_ssize_t)sizeof(w));
+        ASSERT_EQ(w, v) << path;
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    void Missing(lfs_t *lfs, const std::string &path) {
+        struct lfs_info info;
+        ASSERT_EQ(lfs_stat(lfs, path.c_str(), &info), LFS_ERR_NOENT)
+                << path;
+    }
+
+    // remembered entry for a name in any directory, if any
+    const lfs_t::lfs_dcache::lfs_dcache_entry *Remembered(lfs_t *lfs,
+            const std::string &name) {
+        for (lfs_size_t i = 0; i < lfs->dcache.count; i++) {
+            const lfs_t::lfs_dcache::lfs_dcache_entry *entry
+                    = &lfs->dcache.entries[i];
+            if ((entry->tag & 0x3ff) == name.size()
+                    && memcmp(entry->name, name.data(), name.size()) == 0) {
+                return entry;
+            }
+        }
+        return NULL;
+    }
+
+    // every remembered entry for a name must be under the parent's
+    // current pair, not one it relocated from
+    void Parent(lfs_t *lfs, const std::string &name,
+            std::pair<lfs_block_t, lfs_block_t> parent) {
+        for (lfs_size_t i = 0; i < lfs->dcache.count; i++) {
+            const lfs_t::lfs_dcache::lfs_dcache_entry *entry
+                    = &lfs->dcache.entries[i];
+            if ((entry->tag & 0x3ff) == name.size()
+                    && memcmp(entry->name, name.data(), name.size()) == 0) {
+                ASSERT_EQ(std::min(entry->parent[0], entry->parent[1]),
+                        parent.first) << name;
+                ASSERT_EQ(std::max(entry->parent[0], entry->parent[1]),
+                        parent.second) << name;
+            }
+        }
+    }
+
+    bool Split(lfs_t *lfs, const char *path) {
+        lfs_dir_t dir;
+        EXPECT_EQ(lfs_dir_open(lfs, &dir, path), 0);
+        bool split = dir.m.split;
+        EXPECT_EQ(lfs_dir_close(lfs, &dir), 0);
+        return split;
+    }
+
+    // a directory's first metadata pair, in either order
+    std::pair<lfs_block_t, lfs_block_t> Pair(lfs_t *lfs, const char *path) {
+        lfs_dir_t dir;
+        EXPECT_EQ(lfs_dir_open(lfs, &dir, path), 0);
+        std::pair<lfs_block_t, lfs_block_t> pair = std::minmax(
+                dir.m.pair[0], dir.m.pair[1]);
+        EXPECT_EQ(lfs_dir_close(lfs, &dir), 0);
+        return pair;
+    }
+
+    // read bytes for looking up every path twice, the second time
+    // through whatever the first remembered
+    lfs_emubd_sio_t Lookup(lfs_size_t dentry_cache_size,
+            const std::vector<std::string> &paths) {
+        cfg_.dentry_cache_size = dentry_cache_size;
+        lfs_t lfs;
+        EXPECT_EQ(lfs_mount(&lfs, &cfg_), 0);
+        struct lfs_info info;
+        for (const std::string &path : paths) {
+            EXPECT_EQ(lfs_stat(&lfs, path.c_str(), &info), 0);
+        }
+
+        lfs_emubd_sio_t readed = lfs_emubd_readed(&cfg_);
+        for (const std::string &path : paths) {
+            EXPECT_EQ(lfs_stat(&lfs, path.c_str(), &info), 0);
+        }
+        readed = lfs_emubd_readed(&cfg_) - readed;
+        EXPECT_EQ(lfs_unmount(&lfs), 0);
+        return readed;
+    }
+};
+
+// Creating and removing names before a remembered entry shifts its id,
+// which must be fixed up in place rather than pointing at a neighbour
+TEST_P(DcacheTest, Shifts) {
+    cfg_.dentry_cache_size = 64;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    const lfs_size_t N = 4;
+    for (lfs_size_t i = 0; i < N; i++) {
+        Write(&lfs, "dir/m" + std::to_string(i), i);
+        Check(&lfs, "dir/m" + std::to_string(i), i);
+    }
+
+    // each neighbour holds a different value, so a stale id shows up
+    for (lfs_size_t i = 0; i < N; i++) {
+        Write(&lfs, "dir/a" + std::to_string(i), 100+i);
+        for (lfs_size_t j = 0; j < N; j++) {
+            Check(&lfs, "dir/m" + std::to_string(j), j);
+        }
+        Check(&lfs, "dir/a" + std::to_string(i), 100+i);
+    }
+
+    for (lfs_size_t i = 0; i < N; i++) {
+        LFS_ASSERT_OK(lfs_remove(&lfs, ("dir/a" + std::to_string(i)).c_str()));
+        Missing(&lfs, "dir/a" + std::to_string(i));
+        for (lfs_size_t j = 0; j < N; j++) {
+            Check(&lfs, "dir/m" + std::to_string(j), j);
+        }
+    }
+
+    // and with the directory still in one pair, shifted entries should
+    // have been kept, not just forgotten
+    if (!Split(&lfs, "dir")) {
+        for (lfs_size_t j = 0; j < N; j++) {
+            ASSERT_TRUE(Remembered(&lfs, "m" + std::to_string(j)));
+        }
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Removed names must be forgotten, a new file or directory with the same
+// name is something else entirely
+TEST_P(DcacheTest, Replace) {
+    cfg_.dentry_cache_size = 64;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        // a file replaced by a file
+        Write(&lfs, "f", i);
+        Check(&lfs, "f", i);
+        LFS_ASSERT_OK(lfs_remove(&lfs, "f"));
+        Missing(&lfs, "f");
+
+        // a directory replaced by a directory, which points somewhere new
+        Write(&lfs, "dir/x" + std::to_string(i), i);
+        Check(&lfs, "dir/x" + std::to_string(i), i);
+        LFS_ASSERT_OK(lfs_remove(&lfs, ("dir/x" + std::to_string(i)).c_str()));
+        LFS_ASSERT_OK(lfs_remove(&lfs, "dir"));
+        Missing(&lfs, "dir/x" + std::to_string(i));
+        LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+        Missing(&lfs, "dir/x" + std::to_string(i));
+
+        // a file renamed over another file
+        Write(&lfs, "g", 100+i);
+        Write(&lfs, "h", 200+i);
+        Check(&lfs, "g", 100+i);
+        Check(&lfs, "h", 200+i);
+        LFS_ASSERT_OK(lfs_rename(&lfs, "g", "h"));
+        Missing(&lfs, "g");
+        Check(&lfs, "h", 100+i);
+        LFS_ASSERT_OK(lfs_remove(&lfs, "h"));
+    }
+
+    // a directory where a file was, and a file where a directory was
+    Write(&lfs, "e", 1);
+    Check(&lfs, "e", 1);
+    LFS_ASSERT_OK(lfs_remove(&lfs, "e"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "e"));
+    Write(&lfs, "e/f", 2);
+    Check(&lfs, "e/f", 2);
+    LFS_ASSERT_OK(lfs_remove(&lfs, "e/f"));
+    LFS_ASSERT_OK(lfs_remove(&lfs, "e"));
+    Write(&lfs, "e", 3);
+    Check(&lfs, "e", 3);
+    struct lfs_info info;
+    ASSERT_EQ(lfs_stat(&lfs, "e/f", &info), LFS_ERR_NOTDIR);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Renames move remembered entries between directories, the old paths
+// must go and everything under a moved directory must follow it
+TEST_P(DcacheTest, Moves) {
+    cfg_.dentry_cache_size = 64;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "a"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "b"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "a/d"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "a/d/e"));
+    Write(&lfs, "a/d/e/f", 1);
+    Write(&lfs, "a/g", 2);
+    Check(&lfs, "a/d/e/f", 1);
+    Check(&lfs, "a/g", 2);
+
+    // back and forth, with every path looked up before each move
+    std::string d = "a/d";
+    std::string g = "a/g";
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        std::string nd = (i % 2 ? "a/d" : "b/d") + std::to_string(i);
+        std::string ng = (i % 2 ? "a/g" : "b/g") + std::to_string(i);
+        LFS_ASSERT_OK(lfs_rename(&lfs, d.c_str(), nd.c_str()));
+        LFS_ASSERT_OK(lfs_rename(&lfs, g.c_str(), ng.c_str()));
+        Missing(&lfs, d + "/e/f");
+        Missing(&lfs, d);
+        Missing(&lfs, g);
+        Check(&lfs, nd + "/e/f", 1);
+        Check(&lfs, ng, 2);
+
+        // and a new directory where the old one was
+        LFS_ASSERT_OK(lfs_mkdir(&lfs, d.c_str()));
+        Missing(&lfs, d + "/e");
+        LFS_ASSERT_OK(lfs_remove(&lfs, d.c_str()));
+        d = nd;
+        g = ng;
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    cfg_.dentry_cache_size = 0;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Check(&lfs, d + "/e/f", 1);
+    Check(&lfs, g, 2);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Splitting a directory moves names to a new pair, remembered entries for
+// them must not keep pointing at the pair they came from
+TEST_P(DcacheTest, Split) {
+    if (cfg_.block_size > 4096) {
+        GTEST_SKIP() << "Directory won't split";
+    }
+
+    cfg_.dentry_cache_size = 64;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    // each file takes a good 40 bytes of metadata
+    const lfs_size_t N = cfg_.block_size/16;
+    for (lfs_size_t i = 0; i < N; i++) {
+        // in reverse, so each split moves names we've looked up
+        char name[64];
+        snprintf(name, sizeof(name), "dir/%024u", (unsigned)(N-1-i));
+        Write(&lfs, name, N-1-i);
+        for (lfs_size_t j = N-1-i; j < N; j++) {
+            snprintf(name, sizeof(name), "dir/%024u", (unsigned)j);
+            Check(&lfs, name, j);
+        }
+    }
+    ASSERT_TRUE(Split(&lfs, "dir"));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Relocating the pair a remembered entry lives in, or the directory it
+// points to, must not leave us looking in the old blocks
+TEST_P(DcacheTest, Relocate) {
+    cfg_.dentry_cache_size = 64;
+    cfg_.block_cycles = 1;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "a"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "a/b"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "a/b/c"));
+    Write(&lfs, "a/f", 0);
+    Write(&lfs, "a/b/c/f", 0);
+
+    std::pair<lfs_block_t, lfs_block_t> pairs[2] = {
+        Pair(&lfs, "a"), Pair(&lfs, "a/b")};
+    lfs_size_t relocations = 0;
+    for (lfs_size_t i = 1; relocations < 6; i++) {
+        ASSERT_LT(i, 4096u) << "dirs never relocated";
+        // "a" holds the entry for "a/b", "a/b" is what it points to
+        Write(&lfs, "a/f", i);
+        LFS_ASSERT_OK(lfs_setattr(&lfs, "a/b/c", 'v', &i, sizeof(i)));
+        Check(&lfs, "a/f", i);
+        Check(&lfs, "a/b/c/f", 0);
+        lfs_size_t v;
+        ASSERT_EQ(lfs_getattr(&lfs, "a/b/c", 'v', &v, sizeof(v)),
+                (lfs_ssize_t)sizeof(v));
+        ASSERT_EQ(v, i);
+
+        for (lfs_size_t j = 0; j < 2; j++) {
+            std::pair<lfs_block_t, lfs_block_t> npair = Pair(&lfs,
+                    j ? "a/b" : "a");
+            if (npair != pairs[j]) {
+                relocations += 1;
+                pairs[j] = npair;
+            }
+        }
+        Parent(&lfs, "b", pairs[0]);
+        Parent(&lfs, "c", pairs[1]);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    cfg_.dentry_cache_size = 0;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Check(&lfs, "a/b/c/f", 0);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// With more paths than we can remember, the least recently used are
+// forgotten, and names too long to remember are looked up the long way
+TEST_P(DcacheTest, Evict) {
+    cfg_.dentry_cache_size = 2;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    std::string longname(LFS_DENTRY_NAME_MAX+1, 'l');
+    std::vector<std::string> paths;
+    for (lfs_size_t i = 0; i < 5; i++) {
+        std::string dir = "d" + std::to_string(i);
+        LFS_ASSERT_OK(lfs_mkdir(&lfs, dir.c_str()));
+        paths.push_back(dir + "/" + ((i % 2) ? longname : "f"));
+        Write(&lfs, paths.back(), i);
+    }
+
+    lfs_size_t model[5] = {0, 1, 2, 3, 4};
+    for (lfs_size_t i = 0; i < 4*Count(); i++) {
+        model[i % 5] = 100+i;
+        Write(&lfs, paths[i % 5], 100+i);
+        for (lfs_size_t j = 0; j < 5; j++) {
+            Check(&lfs, paths[(i+j) % 5], model[(i+j) % 5]);
+            ASSERT_LE(lfs.dcache.count, cfg_.dentry_cache_size);
+        }
+        ASSERT_FALSE(Remembered(&lfs, longname));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Looking up deep paths shouldn't need to fetch every directory on the way
+TEST_P(DcacheTest, Readed) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    std::string dir;
+    std::vector<std::string> paths;
+    for (lfs_size_t d = 0; d < 6; d++) {
+        dir += (d ? "/d" : "d") + std::to_string(d);
+        LFS_ASSERT_OK(lfs_mkdir(&lfs, dir.c_str()));
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            paths.push_back(dir + "/f" + std::to_string(i));
+            Write(&lfs, paths.back(), i);
+        }
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    lfs_emubd_sio_t walked = Lookup(0, paths);
+    lfs_emubd_sio_t cached = Lookup(64, paths);
+    EXPECT_LT(cached, walked);
+}
+
+// A statically allocated cache works the same
+TEST_P(DcacheTest, StaticBuffer) {
+    std::vector<lfs_t::lfs_dcache::lfs_dcache_entry> buffer(4);
+    cfg_.dentry_cache_size = buffer.size();
+    cfg_.dentry_cache_buffer = buffer.data();
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "a"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "a/b"));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Write(&lfs, "a/b/f" + std::to_string(i), i);
+        for (lfs_size_t j = 0; j <= i; j++) {
+            Check(&lfs, "a/b/f" + std::to_string(j), j);
+        }
+        ASSERT_TRUE(Remembered(&lfs, "b"));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, DcacheTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,166 @@
+/*
+ * Allocator extent tests - lookahead windows populated from one traversal
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+
+class ExtentsTest : public LfsParametricTest {
+protected:
+    // write a file with a recognizable pattern
+    int WriteFile(lfs_t *lfs, int i, lfs_size_t size) {
+        char path[64];
+        snprintf(path, sizeof(path), "file%03d", i);
+        lfs_file_t file;
+        int err = lfs_file_open(lfs, &file, path,
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+        if (err) {
+            return err;
+        }
+
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < size; j += sizeof(buffer)) {
+            lfs_size_t chunk = std::min<lfs_size_t>(sizeof(buffer), size-j);
+            for (lfs_size_t k = 0; k < chunk; k++) {
+                buffer[k] = LfsPattern(i, j+k);
+            }
+            lfs_ssize_t res = lfs_file_write(lfs, &file, buffer, chunk);
+            if (res < 0) {
+                lfs_file_close(lfs, &file);
+                return (int)res;
+            }
+        }
+        return lfs_file_close(lfs, &file);
+    }
+
+    void CheckFile(lfs_t *lfs, int i, lfs_size_t size) {
+        char path[64];
+        snprintf(path, sizeof(path), "file%03d", i);
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_RDONLY));
+        ASSERT_EQ(lfs_file_size(lfs, &file), (lfs_soff_t)size);
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < size; j += sizeof(buffer)) {
+            lfs_size_t chunk = std::min<lfs_size_t>(sizeof(buffer), size-j);
+            ASSERT_EQ(lfs_file_read(lfs, &file, buffer, chunk),
+                    (lfs_ssize_t)chunk);
+            for (lfs_size_t k = 0; k < chunk; k++) {
+                ASSERT_EQ(buffer[k], LfsPattern(i, j+k))
+                        << "file " << i << " off " << j+k;
+            }
+        }
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+};
+
+// Allocating through many small lookahead windows should only need a
+// fraction of the traversals
+TEST_P(ExtentsTest, Traversals) {
+    const lfs_size_t SIZE = 2*cfg_.block_size;
+    const int N = (int)(cfg_.block_count / 2 / 4);
+    cfg_.lookahead_size = 1;
+
+    lfs_emubd_sio_t readed[2];
+    for (int extents = 0; extents < 2; extents++) {
+        cfg_.lookahead_extents = (extents) ? 64 : 0;
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (int i = 0; i < N; i++) {
+            LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        lfs_emubd_setreaded(&cfg_, 0);
+        for (int i = N; i < 2*N; i++) {
+            LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+        }
+        readed[extents] = lfs_emubd_readed(&cfg_);
+
+        for (int i = 0; i < 2*N; i++) {
+            CheckFile(&lfs, i, SIZE);
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+
+    EXPECT_LT(readed[1], readed[0]);
+}
+
+// Filling and refilling a fragmented filesystem must never clobber existing
+// data, even when we run out of extents
+TEST_P(ExtentsTest, Fill) {
+    const lfs_size_t SIZE = 2*cfg_.block_size;
+    cfg_.lookahead_size = 1;
+
+    const lfs_size_t EXTENTS[] = {1, 2, 8};
+    for (lfs_size_t extents : EXTENTS) {
+        cfg_.lookahead_extents = extents;
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        int n = (int)(cfg_.block_count / 2 / 2);
+        for (int i = 0; i < n; i++) {
+            LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+        }
+        // leave some holes
+        for (int i = 0; i < n; i += 3) {
+            char path[64];
+            snprintf(path, sizeof(path), "file%03d", i);
+            LFS_ASSERT_OK(lfs_remove(&lfs, path));
+        }
+
+        int m = n;
+        while (true) {
+            int err = WriteFile(&lfs, m, SIZE);
+            if (err == LFS_ERR_NOSPC) {
+                break;
+            }
+            LFS_ASSERT_OK(err);
+            m += 1;
+        }
+        for (int i = 0; i < n; i++) {
+            if (i % 3 != 0) {
+                CheckFile(&lfs, i, SIZE);
+            }
+        }
+        for (int i = n; i < m; i++) {
+            CheckFile(&lfs, i, SIZE);
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Rewriting files wraps the allocator around the disk many times, each
+// wrap must repopulate the extents
+TEST_P(ExtentsTest, Wraparound) {
+    const lfs_size_t SIZE = cfg_.block_size + 7;
+    cfg_.lookahead_extents = 4;
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (int i = 0; i < 4; i++) {
+        LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+    }
+    for (lfs_size_t k = 0; k < 2*cfg_.block_count; k++) {
+        LFS_ASSERT_OK(WriteFile(&lfs, k % 4, SIZE));
+    }
+    for (int i = 0; i < 4; i++) {
+        CheckFile(&lfs, i, SIZE);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (int i = 0; i < 4; i++) {
+        CheckFile(&lfs, i, SIZE);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, ExtentsTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
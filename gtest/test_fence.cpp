@@ -0,0 +1,226 @@
+/*
+ * Fence tests - lookups that skip remembered metadata pairs in split
+ * directories whose last name sorts before the name we're looking for
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+class FenceTest : public LfsParametricTest {
+protected:
+    FenceTest() {
+        count_ = 64;
+        count_blocks_ = 2;
+    }
+
+    // names of varying length with long common prefixes, so fences only
+    // hold a prefix and ties fall back to name lengths
+    static std::string Name(lfs_size_t i) {
+        return std::string(1 + (i*5) % (LFS_FENCE_MAX+4), 'f')
+                + std::to_string(i);
+    }
+
+    void Create(lfs_t *lfs, const std::string &name) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, name.c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    // create out of order, so new names land all over directories that
+    // have already split
+    void Populate(lfs_t *lfs, std::set<std::string> &names) {
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            std::string name = Name((i*7) % Count());
+            Create(lfs, name);
+            names.insert(name);
+        }
+    }
+
+    // every name is some mdir's fence or next to one, so look up each
+    // name and the names that sort just before, just after, and share
+    // its first LFS_FENCE_MAX bytes
+    void Probe(lfs_t *lfs, const std::set<std::string> &names) {
+        for (const std::string &name : names) {
+            // '/' would make this a path, '.' still sorts before '0'
+            std::string before = name;
+            before.back() = (before.back() == '0') ? '.' : before.back()-1;
+            std::string prefix = name.substr(0, name.size()-1);
+            std::string padded = name.substr(0,
+                    std::min<size_t>(name.size(), LFS_FENCE_MAX));
+            padded += std::string(LFS_FENCE_MAX+2, 'g');
+            for (const std::string &probe : {name, before, prefix,
+                    name + "0", name + "~", padded}) {
+                if (probe.empty()) {
+                    continue;
+                }
+
+                struct lfs_info info;
+                int err = lfs_stat(lfs, probe.c_str(), &info);
+                if (names.count(probe)) {
+                    ASSERT_EQ(err, 0) << probe;
+                    ASSERT_EQ(std::string(info.name), probe);
+                } else {
+                    ASSERT_EQ(err, LFS_ERR_NOENT) << probe;
+                }
+            }
+        }
+    }
+
+    // remembered mdirs whose fence we've learned
+    lfs_size_t Fenced(lfs_t *lfs) {
+        lfs_size_t fenced = 0;
+        for (lfs_size_t i = 0; i < lfs->mcache.count; i++) {
+            if (lfs->mcache.entries[i].fsize) {
+                fenced += 1;
+            }
+        }
+        return fenced;
+    }
+
+    std::vector<std::string> List(lfs_t *lfs) {
+        lfs_dir_t dir;
+        EXPECT_EQ(lfs_dir_open(lfs, &dir, "/"), 0);
+        struct lfs_info info;
+        std::vector<std::string> names;
+        while (lfs_dir_read(lfs, &dir, &info) > 0) {
+            names.push_back(info.name);
+        }
+        EXPECT_EQ(lfs_dir_close(lfs, &dir), 0);
+        return names;
+    }
+
+    // read bytes for looking up a name
+    lfs_emubd_sio_t Lookup(lfs_t *lfs, const std::string &name) {
+        lfs_emubd_sio_t readed = lfs_emubd_readed(&cfg_);
+        struct lfs_info info;
+        EXPECT_EQ(lfs_stat(lfs, name.c_str(), &info), 0);
+        return lfs_emubd_readed(&cfg_) - readed;
+    }
+};
+
+// Names on either side of a fence, equal to it, or that only differ from
+// it past the bytes a fence holds, must be found or not found exactly
+TEST_P(FenceTest, Boundaries) {
+    cfg_.mdir_cache_size = 64;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    std::set<std::string> names;
+    Populate(&lfs, names);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    // twice, the first pass learns the fences the second uses
+    Probe(&lfs, names);
+    Probe(&lfs, names);
+    if (32*Count() > cfg_.block_size) {
+        ASSERT_GT(Fenced(&lfs), 0u);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Removing an mdir's last name or adding one after it moves its fence,
+// lookups between the old and new fence must follow, and new names must
+// land where they would without fences
+TEST_P(FenceTest, Moves) {
+    std::vector<std::string> expected;
+    for (lfs_size_t size : {(lfs_size_t)0, (lfs_size_t)64}) {
+        cfg_.mdir_cache_size = size;
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        std::set<std::string> names;
+        Populate(&lfs, names);
+        Probe(&lfs, names);
+
+        std::vector<std::string> sorted(names.begin(), names.end());
+        for (lfs_size_t i = 0; i < sorted.size(); i += 3) {
+            // a name right after this one, between it and the next
+            std::string after = sorted[i] + "0";
+            Create(&lfs, after);
+            names.insert(after);
+            Probe(&lfs, names);
+
+            // and drop the name that used to be here
+            LFS_ASSERT_OK(lfs_remove(&lfs, sorted[i].c_str()));
+            names.erase(sorted[i]);
+            Probe(&lfs, names);
+
+            // renames move a name between mdirs in one commit
+            if (i+1 < sorted.size()) {
+                std::string renamed = sorted[i+1] + "~";
+                LFS_ASSERT_OK(lfs_rename(&lfs, sorted[i+1].c_str(),
+                        renamed.c_str()));
+                names.erase(sorted[i+1]);
+                names.insert(renamed);
+                Probe(&lfs, names);
+            }
+        }
+
+        std::vector<std::string> listed = List(&lfs);
+        ASSERT_EQ(listed.size(), 2 + names.size());
+        if (size == 0) {
+            expected = listed;
+        }
+        ASSERT_EQ(listed, expected);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        cfg_.mdir_cache_size = 0;
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Probe(&lfs, names);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Fences should also work with name hashes, which are checked after them
+TEST_P(FenceTest, Namehash) {
+    cfg_.mdir_cache_size = 64;
+    cfg_.name_hash_size = 16;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    std::set<std::string> names;
+    Populate(&lfs, names);
+    LFS_ASSERT_OK(lfs_fs_gc(&lfs));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Probe(&lfs, names);
+    Probe(&lfs, names);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Once fences are known, looking up a name at the end of a large directory
+// shouldn't cost much more than looking up a name at the start
+TEST_P(FenceTest, Readed) {
+    cfg_.mdir_cache_size = 64;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "file%03u", (unsigned)i);
+        Create(&lfs, name);
+    }
+
+    char last[64];
+    snprintf(last, sizeof(last), "file%03u", (unsigned)Count()-1);
+    Lookup(&lfs, "file000");
+    Lookup(&lfs, last);
+
+    // without fences we'd need to scan every mdir in the directory
+    lfs_emubd_sio_t first = Lookup(&lfs, "file000");
+    lfs_emubd_sio_t fenced = Lookup(&lfs, last);
+    EXPECT_LE(fenced, 2*first);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, FenceTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,140 @@
+/*
+ * Zero-fill tests - growing files by truncate and by writing past the end
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+class FillTest : public LfsParametricTest {
+protected:
+    // a fill hook built on top of emubd's prog
+    static lfs_size_t filled_;
+    static int corrupt_;
+
+    static int Fill(const struct lfs_config *c, lfs_block_t block,
+            lfs_off_t off, lfs_size_t size) {
+        EXPECT_EQ(off % c->cache_size, 0u);
+        EXPECT_EQ(size % c->cache_size, 0u);
+        if (corrupt_ > 0) {
+            corrupt_ -= 1;
+            return LFS_ERR_CORRUPT;
+        }
+
+        std::vector<uint8_t> buffer(size, 0);
+        int err = lfs_emubd_prog(c, block, off, buffer.data(), size);
+        if (err) {
+            return err;
+        }
+        filled_ += size;
+        return 0;
+    }
+
+    void SetUp() override {
+        LfsParametricTest::SetUp();
+        filled_ = 0;
+        corrupt_ = 0;
+    }
+
+    void CheckFile(lfs_t *lfs, const char *path,
+            const std::vector<uint8_t> &model) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_RDONLY));
+        ASSERT_EQ(lfs_file_size(lfs, &file), (lfs_soff_t)model.size());
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < model.size(); j += sizeof(buffer)) {
+            lfs_size_t n = std::min<lfs_size_t>(sizeof(buffer),
+                    model.size()-j);
+            ASSERT_EQ(lfs_file_read(lfs, &file, buffer, n), (lfs_ssize_t)n);
+            for (lfs_size_t k = 0; k < n; k++) {
+                ASSERT_EQ(buffer[k], model[j+k]) << "off " << j+k;
+            }
+        }
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+};
+
+lfs_size_t FillTest::filled_;
+int FillTest::corrupt_;
+
+// Growing a file with truncate fills the gap with zeros, with and without
+// a fill hook, and with a hook that reports bad blocks
+TEST_P(FillTest, Truncate) {
+    const lfs_size_t SIZES[] = {
+            7, 100, cfg_.block_size-1, cfg_.block_size+3, 4*cfg_.block_size};
+    for (int hook = 0; hook < 3; hook++) {
+        cfg_.fill = (hook) ? Fill : NULL;
+        filled_ = 0;
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+
+        std::vector<uint8_t> model;
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+                LFS_O_RDWR | LFS_O_CREAT));
+        for (lfs_size_t size : SIZES) {
+            corrupt_ = (hook == 2) ? 1 : 0;
+            // grow, then leave a marker at the end so later fills have
+            // something to preserve
+            LFS_ASSERT_OK(lfs_file_truncate(&lfs, &file, size));
+            model.resize(size, 0);
+            ASSERT_EQ(lfs_file_seek(&lfs, &file, -1, LFS_SEEK_END),
+                    (lfs_soff_t)size-1);
+            uint8_t data = (uint8_t)size;
+            ASSERT_EQ(lfs_file_write(&lfs, &file, &data, 1), 1);
+            model[size-1] = data;
+        }
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        CheckFile(&lfs, "file", model);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        CheckFile(&lfs, "file", model);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        if (hook && cfg_.cache_size < cfg_.block_size) {
+            EXPECT_GT(filled_, 0u);
+        } else if (!hook) {
+            EXPECT_EQ(filled_, 0u);
+        }
+    }
+}
+
+// Writing past the end of a file fills the gap with zeros
+TEST_P(FillTest, SeekWrite) {
+    const lfs_size_t OFFS[] = {
+            3, 90, cfg_.block_size+5, 2*cfg_.block_size, 4*cfg_.block_size-1};
+    for (int hook = 0; hook < 3; hook++) {
+        cfg_.fill = (hook) ? Fill : NULL;
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+
+        std::vector<uint8_t> model;
+        for (lfs_off_t off : OFFS) {
+            corrupt_ = (hook == 2) ? 1 : 0;
+            lfs_file_t file;
+            LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+                    LFS_O_WRONLY | LFS_O_CREAT));
+            ASSERT_EQ(lfs_file_seek(&lfs, &file, off, LFS_SEEK_SET),
+                    (lfs_soff_t)off);
+            uint8_t data[3] = {(uint8_t)off, 'x', (uint8_t)(off >> 8)};
+            ASSERT_EQ(lfs_file_write(&lfs, &file, data, sizeof(data)),
+                    (lfs_ssize_t)sizeof(data));
+            LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+
+            model.resize(std::max<lfs_size_t>(model.size(), off+3), 0);
+            memcpy(&model[off], data, sizeof(data));
+            CheckFile(&lfs, "file", model);
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, FillTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,282 @@
+/*
+ * Free map tests - persistent free map used by the block allocator
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <set>
+#include <vector>
+
+class FreemapTest : public LfsParametricTest {
+protected:
+    // write a file with a recognizable pattern
+    int WriteFile(lfs_t *lfs, int i, lfs_size_t size) {
+        char path[64];
+        snprintf(path, sizeof(path), "file%03d", i);
+        lfs_file_t file;
+        int err = lfs_file_open(lfs, &file, path,
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+        if (err) {
+            return err;
+        }
+
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < size; j += sizeof(buffer)) {
+            lfs_size_t chunk = std::min<lfs_size_t>(sizeof(buffer), size-j);
+            for (lfs_size_t k = 0; k < chunk; k++) {
+                buffer[k] = LfsPattern(i, j+k);
+            }
+            lfs_ssize_t res = lfs_file_write(lfs, &file, buffer, chunk);
+            if (res < 0) {
+                lfs_file_close(lfs, &file);
+                return (int)res;
+            }
+        }
+        return lfs_file_close(lfs, &file);
+    }
+
+    void CheckFile(lfs_t *lfs, int i, lfs_size_t size) {
+        char path[64];
+        snprintf(path, sizeof(path), "file%03d", i);
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_RDONLY));
+        ASSERT_EQ(lfs_file_size(lfs, &file), (lfs_soff_t)size);
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < size; j += sizeof(buffer)) {
+            lfs_size_t chunk = std::min<lfs_size_t>(sizeof(buffer), size-j);
+            ASSERT_EQ(lfs_file_read(lfs, &file, buffer, chunk),
+                    (lfs_ssize_t)chunk);
+            for (lfs_size_t k = 0; k < chunk; k++) {
+                ASSERT_EQ(buffer[k], LfsPattern(i, j+k))
+                        << "file " << i << " off " << j+k;
+            }
+        }
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    static int Collect(void *data, lfs_block_t block) {
+        static_cast<std::set<lfs_block_t>*>(data)->insert(block);
+        return 0;
+    }
+};
+
+// Allocating from a free map should be correct and avoid traversals
+TEST_P(FreemapTest, Mount) {
+    const lfs_size_t SIZE = 3*cfg_.block_size;
+    const int N = (int)(cfg_.block_count / 3 / 4);
+
+    lfs_emubd_sio_t readed[2];
+    for (int freemap = 0; freemap < 2; freemap++) {
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (int i = 0; i < N; i++) {
+            LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+        }
+        if (freemap) {
+            LFS_ASSERT_OK(lfs_fs_mkfreemap(&lfs));
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        lfs_emubd_setreaded(&cfg_, 0);
+        LFS_ASSERT_OK(WriteFile(&lfs, N, SIZE));
+        readed[freemap] = lfs_emubd_readed(&cfg_);
+
+        for (int i = 0; i <= N; i++) {
+            CheckFile(&lfs, i, SIZE);
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+
+    EXPECT_LT(readed[1], readed[0]);
+}
+
+// Filling the filesystem from a free map must never clobber existing data
+TEST_P(FreemapTest, Fill) {
+    const lfs_size_t SIZE = 2*cfg_.block_size;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    int n = (int)(cfg_.block_count / 2 / 2);
+    for (int i = 0; i < n; i++) {
+        LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+    }
+    // leave some holes
+    for (int i = 0; i < n; i += 3) {
+        char path[64];
+        snprintf(path, sizeof(path), "file%03d", i);
+        LFS_ASSERT_OK(lfs_remove(&lfs, path));
+    }
+    LFS_ASSERT_OK(lfs_fs_mkfreemap(&lfs));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    int m = n;
+    while (true) {
+        int err = WriteFile(&lfs, m, SIZE);
+        if (err == LFS_ERR_NOSPC) {
+            break;
+        }
+        LFS_ASSERT_OK(err);
+        m += 1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (i % 3 != 0) {
+            CheckFile(&lfs, i, SIZE);
+        }
+    }
+    for (int i = n; i < m; i++) {
+        CheckFile(&lfs, i, SIZE);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Changes after the free map is written must make it stale
+TEST_P(FreemapTest, Stale) {
+    const lfs_size_t SIZE = cfg_.block_size;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    for (int i = 0; i < 4; i++) {
+        LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+    }
+    LFS_ASSERT_OK(lfs_fs_mkfreemap(&lfs));
+    // the free map doesn't know about these
+    for (int i = 4; i < 8; i++) {
+        LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    // remount a couple times, allocating as much as we can
+    for (int k = 0; k < 3; k++) {
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (int i = 0; i < 8; i++) {
+            CheckFile(&lfs, i, SIZE);
+        }
+        for (int i = 8; i < 12; i++) {
+            LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+        }
+        for (int i = 8; i < 12; i++) {
+            CheckFile(&lfs, i, SIZE);
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// A free map whose blocks have been reused must be ignored
+TEST_P(FreemapTest, Corrupted) {
+    const lfs_size_t SIZE = cfg_.block_size;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (int i = 0; i < 4; i++) {
+        LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+    }
+    std::set<lfs_block_t> before;
+    LFS_ASSERT_OK(lfs_fs_traverse(&lfs, Collect, &before));
+    LFS_ASSERT_OK(lfs_fs_mkfreemap(&lfs));
+    std::set<lfs_block_t> after;
+    LFS_ASSERT_OK(lfs_fs_traverse(&lfs, Collect, &after));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    // the free map's blocks are only in use while we allocate from it
+    std::vector<lfs_block_t> freemap;
+    for (lfs_block_t block : after) {
+        if (!before.count(block)) {
+            freemap.push_back(block);
+        }
+    }
+    ASSERT_FALSE(freemap.empty());
+
+    // mark everything as free, if we trusted this we would clobber files
+    std::vector<uint8_t> zeros(cfg_.block_size, 0x00);
+    for (lfs_block_t block : freemap) {
+        LFS_ASSERT_OK(cfg_.erase(&cfg_, block));
+        LFS_ASSERT_OK(cfg_.prog(&cfg_, block, 0, zeros.data(), zeros.size()));
+    }
+
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (int i = 4; i < 12; i++) {
+        LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+    }
+    for (int i = 0; i < 12; i++) {
+        CheckFile(&lfs, i, SIZE);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// The free map should survive compacting the superblock, which we force
+// here with attrs on the root that don't change which blocks are in use
+TEST_P(FreemapTest, Compacted) {
+    const lfs_size_t SIZE = 3*cfg_.block_size;
+    const int N = (int)(cfg_.block_count / 3 / 4);
+
+    lfs_emubd_sio_t readed[2];
+    for (int freemap = 0; freemap < 2; freemap++) {
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (int i = 0; i < N; i++) {
+            LFS_ASSERT_OK(WriteFile(&lfs, i, SIZE));
+        }
+        if (freemap) {
+            LFS_ASSERT_OK(lfs_fs_mkfreemap(&lfs));
+        }
+
+        uint8_t buffer[16];
+        for (lfs_size_t j = 0; j < 4*cfg_.block_size/sizeof(buffer); j++) {
+            memset(buffer, (int)j, sizeof(buffer));
+            LFS_ASSERT_OK(lfs_setattr(&lfs, "/", 'a',
+                    buffer, sizeof(buffer)));
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        lfs_emubd_setreaded(&cfg_, 0);
+        LFS_ASSERT_OK(WriteFile(&lfs, N, SIZE));
+        readed[freemap] = lfs_emubd_readed(&cfg_);
+
+        for (int i = 0; i <= N; i++) {
+            CheckFile(&lfs, i, SIZE);
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+
+    EXPECT_LT(readed[1], readed[0]);
+}
+
+// Rebuilding the free map repeatedly, with metadata relocations mixed in
+TEST_P(FreemapTest, Rebuild) {
+    cfg_.block_cycles = 2;
+    const lfs_size_t SIZE = cfg_.block_size + 7;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    for (int k = 0; k < 8; k++) {
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (int i = 0; i < 4; i++) {
+            LFS_ASSERT_OK(WriteFile(&lfs, (k+i) % 6, SIZE));
+        }
+        LFS_ASSERT_OK(lfs_fs_mkfreemap(&lfs));
+        LFS_ASSERT_OK(lfs_fs_mkfreemap(&lfs));
+
+        lfs_ssize_t size = lfs_fs_size(&lfs);
+        ASSERT_GT(size, 0);
+        ASSERT_LE((lfs_size_t)size, cfg_.block_count);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (int i = 0; i < 4; i++) {
+            CheckFile(&lfs, (k+i) % 6, SIZE);
+        }
+        LFS_ASSERT_OK(WriteFile(&lfs, 6, SIZE*(k%3 + 1)));
+        CheckFile(&lfs, 6, SIZE*(k%3 + 1));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, FreemapTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
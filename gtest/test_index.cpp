@@ -0,0 +1,177 @@
+/*
+ * File index tests - remembering blocks of a file's skip-list
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+class IndexTest : public LfsParametricTest {
+protected:
+    int WriteFile(lfs_t *lfs, const char *path, lfs_size_t size) {
+        lfs_file_t file;
+        int err = lfs_file_open(lfs, &file, path,
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+        if (err) {
+            return err;
+        }
+
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < size; j += sizeof(buffer)) {
+            lfs_size_t chunk = std::min<lfs_size_t>(sizeof(buffer), size-j);
+            for (lfs_size_t k = 0; k < chunk; k++) {
+                buffer[k] = LfsPattern(1, j+k);
+            }
+            lfs_ssize_t res = lfs_file_write(lfs, &file, buffer, chunk);
+            if (res < 0) {
+                lfs_file_close(lfs, &file);
+                return (int)res;
+            }
+        }
+        return lfs_file_close(lfs, &file);
+    }
+
+    void CheckRead(lfs_t *lfs, lfs_file_t *file,
+            const std::vector<uint8_t> &model, lfs_size_t off,
+            lfs_size_t size) {
+        uint8_t buffer[64];
+        size = std::min<lfs_size_t>(size, sizeof(buffer));
+        ASSERT_EQ(lfs_file_seek(lfs, file, off, LFS_SEEK_SET),
+                (lfs_soff_t)off);
+        lfs_size_t expected = (off < model.size())
+                ? std::min<lfs_size_t>(size, model.size()-off)
+                : 0;
+        ASSERT_EQ(lfs_file_read(lfs, file, buffer, size),
+                (lfs_ssize_t)expected);
+        for (lfs_size_t k = 0; k < expected; k++) {
+            ASSERT_EQ(buffer[k], model[off+k]) << "off " << off+k;
+        }
+    }
+};
+
+// Random reads should read fewer bytes with an index
+TEST_P(IndexTest, RandomReads) {
+    const lfs_size_t SIZE = (cfg_.block_count/2) * (cfg_.block_size-16);
+    const int N = 256;
+    std::vector<uint8_t> model(SIZE);
+    for (lfs_size_t j = 0; j < SIZE; j++) {
+        model[j] = LfsPattern(1, j);
+    }
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(WriteFile(&lfs, "big", SIZE));
+
+    lfs_emubd_sio_t readed[2];
+    for (int indexed = 0; indexed < 2; indexed++) {
+        struct lfs_file_config filecfg;
+        memset(&filecfg, 0, sizeof(filecfg));
+        filecfg.index_size = (indexed) ? 32 : 0;
+
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_opencfg(&lfs, &file, "big",
+                LFS_O_RDONLY, &filecfg));
+        lfs_emubd_setreaded(&cfg_, 0);
+        uint32_t prng = 42;
+        for (int i = 0; i < N; i++) {
+            prng = prng*1103515245 + 12345;
+            CheckRead(&lfs, &file, model, (prng >> 8) % SIZE, 16);
+        }
+        readed[indexed] = lfs_emubd_readed(&cfg_);
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    EXPECT_LT(readed[1], readed[0]);
+}
+
+// Writes, truncates and appends must not leave stale blocks in the index
+TEST_P(IndexTest, Rewrite) {
+    const lfs_size_t SIZE = 8*cfg_.block_size;
+    for (lfs_size_t index_size : {1, 4, 16}) {
+        std::vector<uint8_t> model(SIZE);
+        for (lfs_size_t j = 0; j < SIZE; j++) {
+            model[j] = LfsPattern(1, j);
+        }
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        LFS_ASSERT_OK(WriteFile(&lfs, "file", SIZE));
+
+        // use a static buffer for our index
+        std::vector<uint8_t> index_buffer(8*index_size);
+        struct lfs_file_config filecfg;
+        memset(&filecfg, 0, sizeof(filecfg));
+        filecfg.index_size = index_size;
+        filecfg.index_buffer = index_buffer.data();
+
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_opencfg(&lfs, &file, "file",
+                LFS_O_RDWR, &filecfg));
+
+        uint32_t prng = (uint32_t)index_size;
+        for (int i = 0; i < 64; i++) {
+            prng = prng*1103515245 + 12345;
+            lfs_size_t off = (prng >> 8) % (model.size()+1);
+            switch ((prng >> 4) % 4) {
+                // random read
+                case 0:
+                case 1: {
+                    CheckRead(&lfs, &file, model, off, 16);
+                    break;
+                }
+
+                // random write, possibly extending the file
+                case 2: {
+                    uint8_t buffer[24];
+                    for (lfs_size_t k = 0; k < sizeof(buffer); k++) {
+                        buffer[k] = (uint8_t)(prng + k);
+                    }
+                    ASSERT_EQ(lfs_file_seek(&lfs, &file, off, LFS_SEEK_SET),
+                            (lfs_soff_t)off);
+                    ASSERT_EQ(lfs_file_write(&lfs, &file,
+                                buffer, sizeof(buffer)),
+                            (lfs_ssize_t)sizeof(buffer));
+                    if (off + sizeof(buffer) > model.size()) {
+                        model.resize(off + sizeof(buffer));
+                    }
+                    memcpy(&model[off], buffer, sizeof(buffer));
+                    break;
+                }
+
+                // truncate, shrinking or growing
+                case 3: {
+                    lfs_size_t size = (i % 2 == 0)
+                            ? off
+                            : std::min<lfs_size_t>(
+                                model.size() + cfg_.block_size,
+                                SIZE);
+                    LFS_ASSERT_OK(lfs_file_truncate(&lfs, &file, size));
+                    model.resize(size, 0);
+                    break;
+                }
+            }
+        }
+
+        // check everything, both through our index and after reopening
+        for (lfs_size_t off = 0; off < model.size(); off += 61) {
+            CheckRead(&lfs, &file, model, off, 61);
+        }
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file", LFS_O_RDONLY));
+        ASSERT_EQ(lfs_file_size(&lfs, &file), (lfs_soff_t)model.size());
+        for (lfs_size_t off = 0; off < model.size(); off += 61) {
+            CheckRead(&lfs, &file, model, off, 61);
+        }
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, IndexTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,98 @@
+/*
+ * IO queue tests - bad blocks found by in-flight operations that complete
+ * while we're waiting on something else
+ *
+ * These tests require access to littlefs internals via the test wrapper.
+ */
+
+#include <gtest/gtest.h>
+#include "bd/lfs_emubd.h"
+#include "lfs_test_internal.h"
+#include <cstring>
+#include <set>
+
+class IoqTest : public ::testing::Test {
+protected:
+    // operations never touch storage, they only fail on the blocks we
+    // say are bad
+    static std::set<lfs_block_t> bad_;
+
+    static int Submit(const struct lfs_config *c, struct lfs_bd_io *io) {
+        (void)c;
+        (void)io;
+        return 0;
+    }
+
+    static int Wait(const struct lfs_config *c, struct lfs_bd_io *io) {
+        (void)c;
+        return (bad_.count(io->block)) ? LFS_ERR_CORRUPT : 0;
+    }
+
+    void Init(lfs_t *lfs, lfs_size_t io_depth) {
+        bad_.clear();
+        memset(&cfg_, 0, sizeof(cfg_));
+        cfg_.read = lfs_emubd_read;
+        cfg_.prog = lfs_emubd_prog;
+        cfg_.erase = lfs_emubd_erase;
+        cfg_.sync = lfs_emubd_sync;
+        cfg_.submit = Submit;
+        cfg_.wait = Wait;
+        cfg_.read_size = 16;
+        cfg_.prog_size = 16;
+        cfg_.block_size = 512;
+        cfg_.block_count = 64;
+        cfg_.block_cycles = -1;
+        cfg_.cache_size = 64;
+        cfg_.lookahead_size = 8;
+        cfg_.io_depth = io_depth;
+        ASSERT_EQ(lfs_test_init(lfs, &cfg_), 0);
+    }
+
+    lfs_config cfg_;
+};
+
+std::set<lfs_block_t> IoqTest::bad_;
+
+// Every bad block should be reported the next time it's used, no matter
+// how many fail before then
+TEST_F(IoqTest, Badblocks) {
+    lfs_t lfs;
+    Init(&lfs, 4);
+    bad_ = {3, 5, 7};
+    for (lfs_block_t b : {2, 3, 5, 7}) {
+        ASSERT_EQ(lfs_test_ioq_submit(&lfs, LFS_BD_IO_ERASE, b, 0, NULL, 0),
+                0);
+    }
+
+    // waiting on everything finds no fault with us
+    ASSERT_EQ(lfs_test_ioq_wait(&lfs, LFS_BLOCK_NULL), 0);
+
+    // but each bad block is reported once, on its next use
+    EXPECT_EQ(lfs_test_ioq_wait(&lfs, 2), 0);
+    EXPECT_EQ(lfs_test_ioq_wait(&lfs, 5), LFS_ERR_CORRUPT);
+    EXPECT_EQ(lfs_test_ioq_submit(&lfs, LFS_BD_IO_ERASE, 3, 0, NULL, 0),
+            LFS_ERR_CORRUPT);
+    EXPECT_EQ(lfs_test_ioq_wait(&lfs, 7), LFS_ERR_CORRUPT);
+    EXPECT_EQ(lfs_test_ioq_wait(&lfs, 5), 0);
+    EXPECT_EQ(lfs_test_ioq_wait(&lfs, 3), 0);
+    EXPECT_EQ(lfs_test_deinit(&lfs), 0);
+}
+
+// If we can't remember any more bad blocks, we can't report them later,
+// so the wait that finds them must fail
+TEST_F(IoqTest, Full) {
+    lfs_t lfs;
+    Init(&lfs, 2);
+    bad_ = {3, 5, 7};
+    ASSERT_EQ(lfs_test_ioq_submit(&lfs, LFS_BD_IO_ERASE, 3, 0, NULL, 0), 0);
+    ASSERT_EQ(lfs_test_ioq_submit(&lfs, LFS_BD_IO_ERASE, 5, 0, NULL, 0), 0);
+    ASSERT_EQ(lfs_test_ioq_wait(&lfs, LFS_BLOCK_NULL), 0);
+
+    ASSERT_EQ(lfs_test_ioq_submit(&lfs, LFS_BD_IO_ERASE, 7, 0, NULL, 0), 0);
+    EXPECT_EQ(lfs_test_ioq_wait(&lfs, LFS_BLOCK_NULL), LFS_ERR_IO);
+
+    // the ones we remembered are still reported
+    EXPECT_EQ(lfs_test_ioq_wait(&lfs, 3), LFS_ERR_CORRUPT);
+    EXPECT_EQ(lfs_test_ioq_wait(&lfs, 5), LFS_ERR_CORRUPT);
+    EXPECT_EQ(lfs_test_deinit(&lfs), 0);
+}
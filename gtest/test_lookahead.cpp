@@ -0,0 +1,54 @@
+/*
+ * Lookahead tests - searching the lookahead buffer for free blocks
+ *
+ * These tests require access to littlefs internals via the test wrapper.
+ */
+
+#include "lfs_test_lookahead.h"
+
+class LookaheadTest : public LfsLookaheadFixture {
+protected:
+    // the original bit-at-a-time search, for comparison
+    static lfs_block_t FindFreeBitwise(const lfs_t *lfs, lfs_block_t off) {
+        while (off < lfs->lookahead.size
+                && (lfs->lookahead.buffer[off / 8] & (1U << (off % 8)))) {
+            off += 1;
+        }
+        return off;
+    }
+};
+
+// Every free block in the window should be found in order, and the
+// checkpoint should account for every block we look at
+TEST_F(LookaheadTest, FindFree) {
+    for (lfs_size_t lookahead_size : {1, 3, 4, 7, 16, 33}) {
+        for (uint32_t density : {0, 10, 50, 90, 99, 100}) {
+            lfs_t lfs;
+            Init(&lfs, lookahead_size);
+            std::vector<uint8_t> bitmap = PrngBitmap(
+                    lookahead_size, density, lookahead_size+density);
+
+            for (lfs_block_t size = 1; size <= 8*lookahead_size; size++) {
+                Window(&lfs, bitmap, size);
+
+                // note we stop before lfs_alloc runs out of blocks, as it
+                // would then try to traverse the filesystem
+                lfs_block_t expected = FindFreeBitwise(&lfs, 0);
+                while (expected < lfs.lookahead.size) {
+                    lfs_block_t block;
+                    ASSERT_EQ(lfs_test_alloc(&lfs, &block), 0);
+                    ASSERT_EQ(block, expected)
+                            << "lookahead_size=" << lookahead_size
+                            << " density=" << density
+                            << " size=" << size;
+                    expected = FindFreeBitwise(&lfs, block+1);
+                    ASSERT_EQ(lfs.lookahead.next, expected);
+                    ASSERT_EQ(lfs.lookahead.ckpoint,
+                            lfs.block_count - lfs.lookahead.next);
+                }
+            }
+
+            ASSERT_EQ(lfs_test_deinit(&lfs), 0);
+        }
+    }
+}
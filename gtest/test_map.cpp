@@ -0,0 +1,303 @@
+/*
+ * Memory-mapped block device tests - reads and metadata scans from mapped
+ * memory, and borrowing file data without copying
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "bd/lfs_rambd.h"
+#include "bd/lfs_filebd.h"
+}
+
+class MapTest : public LfsParametricTest {
+protected:
+    // a map wrapper that counts maps
+    static lfs_size_t mapped_;
+
+    static int Map(const struct lfs_config *c, lfs_block_t block,
+            const void **buffer) {
+        mapped_ += 1;
+        return lfs_rambd_map(c, block, buffer);
+    }
+
+    lfs_rambd_t ram_;
+    struct lfs_rambd_config ramcfg_;
+    struct lfs_config rcfg_;
+
+    void SetUp() override {
+        LfsParametricTest::SetUp();
+        mapped_ = 0;
+
+        // same geometry as emubd, but backed by RAM we can map
+        memset(&ramcfg_, 0, sizeof(ramcfg_));
+        ramcfg_.read_size = cfg_.read_size;
+        ramcfg_.prog_size = cfg_.prog_size;
+        ramcfg_.erase_size = cfg_.block_size;
+        ramcfg_.erase_count = cfg_.block_count;
+
+        rcfg_ = cfg_;
+        rcfg_.context = &ram_;
+        rcfg_.read = lfs_rambd_read;
+        rcfg_.prog = lfs_rambd_prog;
+        rcfg_.erase = lfs_rambd_erase;
+        rcfg_.sync = lfs_rambd_sync;
+        rcfg_.map = Map;
+        LFS_ASSERT_OK(lfs_rambd_create(&rcfg_, &ramcfg_));
+    }
+
+    void TearDown() override {
+        lfs_rambd_destroy(&rcfg_);
+        LfsParametricTest::TearDown();
+    }
+
+    void CheckFile(lfs_t *lfs, const char *path,
+            const std::vector<uint8_t> &model) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_RDONLY));
+        ASSERT_EQ(lfs_file_size(lfs, &file), (lfs_soff_t)model.size());
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < model.size(); j += sizeof(buffer)) {
+            lfs_size_t n = std::min<lfs_size_t>(sizeof(buffer),
+                    model.size()-j);
+            ASSERT_EQ(lfs_file_read(lfs, &file, buffer, n), (lfs_ssize_t)n);
+            for (lfs_size_t k = 0; k < n; k++) {
+                ASSERT_EQ(buffer[k], model[j+k]) << "off " << j+k;
+            }
+        }
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    // borrow the whole file in chunks of at most size bytes
+    void CheckBorrow(lfs_t *lfs, const char *path,
+            const std::vector<uint8_t> &model, lfs_size_t size) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_RDONLY));
+        lfs_size_t j = 0;
+        while (true) {
+            const void *buffer;
+            lfs_ssize_t res = lfs_file_borrow(lfs, &file, &buffer, size);
+            ASSERT_GE(res, 0);
+            if (res == 0) {
+                break;
+            }
+            ASSERT_LE((lfs_size_t)res, size);
+            ASSERT_LE(j+res, model.size());
+            const uint8_t *data = static_cast<const uint8_t*>(buffer);
+            for (lfs_ssize_t k = 0; k < res; k++) {
+                ASSERT_EQ(data[k], model[j+k]) << "off " << j+k;
+            }
+            j += res;
+        }
+        ASSERT_EQ(j, model.size());
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    std::vector<uint8_t> Model(lfs_size_t size) {
+        std::vector<uint8_t> model(size);
+        for (lfs_size_t j = 0; j < size; j++) {
+            model[j] = LfsPattern(1, j);
+        }
+        return model;
+    }
+};
+
+lfs_size_t MapTest::mapped_;
+
+// A filesystem on a mapped device should behave as though it were read,
+// across many files, directories, and remounts
+TEST_P(MapTest, Files) {
+    const lfs_size_t SIZES[] = {
+            0, 5, cfg_.cache_size+1, cfg_.block_size+7, 3*cfg_.block_size};
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &rcfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &rcfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    for (int i = 0; i < 20; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "dir/file%d", i);
+        std::vector<uint8_t> model = Model(SIZES[i % 5]);
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file, path,
+                LFS_O_WRONLY | LFS_O_CREAT));
+        ASSERT_EQ(lfs_file_write(&lfs, &file, model.data(), model.size()),
+                (lfs_ssize_t)model.size());
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    mapped_ = 0;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &rcfg_));
+    for (int i = 0; i < 20; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "dir/file%d", i);
+        struct lfs_info info;
+        LFS_ASSERT_OK(lfs_stat(&lfs, path, &info));
+        ASSERT_EQ(info.size, SIZES[i % 5]);
+        CheckFile(&lfs, path, Model(SIZES[i % 5]));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+    EXPECT_GT(mapped_, 0u);
+
+    // and the same filesystem should read the same without mapping
+    rcfg_.map = NULL;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &rcfg_));
+    for (int i = 0; i < 20; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "dir/file%d", i);
+        CheckFile(&lfs, path, Model(SIZES[i % 5]));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Borrowing should return the file's data in place, never crossing a
+// block, including inline files and unflushed writes
+TEST_P(MapTest, Borrow) {
+    const lfs_size_t SIZES[] = {
+            1, cfg_.cache_size-1, cfg_.block_size, 3*cfg_.block_size+5};
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &rcfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &rcfg_));
+    for (lfs_size_t size : SIZES) {
+        std::vector<uint8_t> model = Model(size);
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+                LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC));
+        ASSERT_EQ(lfs_file_write(&lfs, &file, model.data(), size),
+                (lfs_ssize_t)size);
+
+        // borrowing flushes pending writes
+        ASSERT_EQ(lfs_file_seek(&lfs, &file, 0, LFS_SEEK_SET), 0);
+        const void *buffer;
+        lfs_ssize_t res = lfs_file_borrow(&lfs, &file, &buffer, size);
+        ASSERT_GT(res, 0);
+        ASSERT_LE((lfs_size_t)res, cfg_.block_size);
+        ASSERT_EQ(memcmp(buffer, model.data(), res), 0);
+        ASSERT_EQ(lfs_file_tell(&lfs, &file), res);
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+
+        for (lfs_size_t chunk : {(lfs_size_t)1, (lfs_size_t)13,
+                cfg_.block_size, 4*cfg_.block_size}) {
+            CheckBorrow(&lfs, "file", model, chunk);
+        }
+    }
+
+    // borrow from the middle of a file
+    std::vector<uint8_t> model = Model(3*cfg_.block_size+5);
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file", LFS_O_RDONLY));
+    const lfs_off_t OFF = cfg_.block_size + 3;
+    ASSERT_EQ(lfs_file_seek(&lfs, &file, OFF, LFS_SEEK_SET),
+            (lfs_soff_t)OFF);
+    const void *buffer;
+    ASSERT_EQ(lfs_file_borrow(&lfs, &file, &buffer, 16), 16);
+    ASSERT_EQ(memcmp(buffer, &model[OFF], 16), 0);
+
+    // and reads pick up where borrows leave off
+    uint8_t data[16];
+    ASSERT_EQ(lfs_file_read(&lfs, &file, data, 16), 16);
+    ASSERT_EQ(memcmp(data, &model[OFF+16], 16), 0);
+
+    // nothing to borrow at the end of the file
+    ASSERT_EQ(lfs_file_seek(&lfs, &file, 0, LFS_SEEK_END),
+            (lfs_soff_t)model.size());
+    ASSERT_EQ(lfs_file_borrow(&lfs, &file, &buffer, 16), 0);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Without a map callback only inline files can be borrowed
+TEST_P(MapTest, BorrowUnmapped) {
+    rcfg_.map = NULL;
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &rcfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &rcfg_));
+
+    std::vector<uint8_t> small = Model(5);
+    std::vector<uint8_t> large = Model(2*cfg_.block_size);
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "small",
+            LFS_O_WRONLY | LFS_O_CREAT));
+    ASSERT_EQ(lfs_file_write(&lfs, &file, small.data(), small.size()),
+            (lfs_ssize_t)small.size());
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "large",
+            LFS_O_WRONLY | LFS_O_CREAT));
+    ASSERT_EQ(lfs_file_write(&lfs, &file, large.data(), large.size()),
+            (lfs_ssize_t)large.size());
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+
+    CheckBorrow(&lfs, "small", small, 64);
+
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "large", LFS_O_RDONLY));
+    const void *buffer;
+    ASSERT_EQ(lfs_file_borrow(&lfs, &file, &buffer, 16), LFS_ERR_INVAL);
+    ASSERT_EQ(lfs_file_tell(&lfs, &file), 0);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    CheckFile(&lfs, "large", large);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// filebd's mmap mode should be interchangeable with its normal mode
+TEST_P(MapTest, Filebd) {
+    std::string path = ::testing::TempDir() + "lfs_test_map_"
+            + GetParam().name;
+    remove(path.c_str());
+
+    struct lfs_filebd_config filecfg;
+    memset(&filecfg, 0, sizeof(filecfg));
+    filecfg.read_size = cfg_.read_size;
+    filecfg.prog_size = cfg_.prog_size;
+    filecfg.erase_size = cfg_.block_size;
+    filecfg.erase_count = cfg_.block_count;
+    filecfg.mmap = true;
+
+    lfs_filebd_t filebd;
+    struct lfs_config fcfg = cfg_;
+    fcfg.context = &filebd;
+    fcfg.read = lfs_filebd_read;
+    fcfg.prog = lfs_filebd_prog;
+    fcfg.erase = lfs_filebd_erase;
+    fcfg.sync = lfs_filebd_sync;
+    fcfg.map = lfs_filebd_map;
+    LFS_ASSERT_OK(lfs_filebd_create(&fcfg, path.c_str(), &filecfg));
+
+    std::vector<uint8_t> model = Model(2*cfg_.block_size+9);
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &fcfg));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &fcfg));
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+            LFS_O_WRONLY | LFS_O_CREAT));
+    ASSERT_EQ(lfs_file_write(&lfs, &file, model.data(), model.size()),
+            (lfs_ssize_t)model.size());
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    CheckBorrow(&lfs, "file", model, cfg_.block_size);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+    LFS_ASSERT_OK(lfs_filebd_destroy(&fcfg));
+
+    // read it back without mmap
+    filecfg.mmap = false;
+    fcfg.map = lfs_filebd_map;
+    LFS_ASSERT_OK(lfs_filebd_create(&fcfg, path.c_str(), &filecfg));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &fcfg));
+    CheckFile(&lfs, "file", model);
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file", LFS_O_RDONLY));
+    const void *buffer;
+    ASSERT_EQ(lfs_file_borrow(&lfs, &file, &buffer, 16), LFS_ERR_INVAL);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+    LFS_ASSERT_OK(lfs_filebd_destroy(&fcfg));
+    remove(path.c_str());
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, MapTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,270 @@
+/*
+ * Metadata pair cache tests - repeat fetches of remembered metadata pairs,
+ * which must be forgotten whenever their blocks are written
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+class McacheTest : public LfsParametricTest {
+protected:
+    void Write(lfs_t *lfs, const std::string &path, lfs_size_t v) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path.c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC));
+        ASSERT_EQ(lfs_file_write(lfs, &file, &v, sizeof(v)),
+                (lfs_ssize_t)sizeof(v));
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    void Check(lfs_t *lfs, const std::string &path, lfs_size_t expected) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path.c_str(), LFS_O_RDONLY));
+        lfs_size_t v;
+        ASSERT_EQ(lfs_file_read(lfs, &file, &v, sizeof(v)),
+                (lfs_ssize_t)sizeof(v));
+        ASSERT_EQ(v, expected) << path;
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    // a directory's first metadata pair, in either order
+    std::pair<lfs_block_t, lfs_block_t> Pair(lfs_t *lfs, const char *path) {
+        lfs_dir_t dir;
+        EXPECT_EQ(lfs_dir_open(lfs, &dir, path), 0);
+        std::pair<lfs_block_t, lfs_block_t> pair = std::minmax(
+                dir.m.pair[0], dir.m.pair[1]);
+        EXPECT_EQ(lfs_dir_close(lfs, &dir), 0);
+        return pair;
+    }
+
+    bool Split(lfs_t *lfs, const char *path) {
+        lfs_dir_t dir;
+        EXPECT_EQ(lfs_dir_open(lfs, &dir, path), 0);
+        bool split = dir.m.split;
+        EXPECT_EQ(lfs_dir_close(lfs, &dir), 0);
+        return split;
+    }
+
+    // long names so directories split after a handful of files
+    static std::string Name(const char *dir, lfs_size_t i) {
+        char name[128];
+        snprintf(name, sizeof(name), "%s/%060u", dir, (unsigned)i);
+        return name;
+    }
+
+    static int Counter(void *data, lfs_block_t block) {
+        (void)block;
+        *(lfs_size_t*)data += 1;
+        return 0;
+    }
+};
+
+// Relocating a remembered pair moves it to new blocks and frees the old
+// ones for reuse, lookups must keep finding the newest commits
+TEST_P(McacheTest, Relocate) {
+    cfg_.block_cycles = 1;
+    cfg_.mdir_cache_size = 4;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "other"));
+
+    lfs_size_t model[4] = {0, 0, 0, 0};
+    for (lfs_size_t j = 0; j < 4; j++) {
+        Write(&lfs, Name("dir", j), 0);
+    }
+
+    std::pair<lfs_block_t, lfs_block_t> pair = Pair(&lfs, "dir");
+    lfs_size_t relocations = 0;
+    for (lfs_size_t i = 1; relocations < 3; i++) {
+        ASSERT_LT(i, 4096u) << "dir never relocated";
+        model[i % 4] = i;
+        Write(&lfs, Name("dir", i % 4), i);
+        // writes elsewhere reuse the blocks relocations free
+        Write(&lfs, Name("other", 0), i);
+
+        for (lfs_size_t j = 0; j < 4; j++) {
+            Check(&lfs, Name("dir", j), model[j]);
+        }
+
+        std::pair<lfs_block_t, lfs_block_t> npair = Pair(&lfs, "dir");
+        if (npair != pair) {
+            relocations += 1;
+            pair = npair;
+        }
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    cfg_.mdir_cache_size = 0;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t j = 0; j < 4; j++) {
+        Check(&lfs, Name("dir", j), model[j]);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Splitting a remembered pair rewrites it with a new tail and hands half
+// its names to a new pair, neither may be served from what we remembered
+TEST_P(McacheTest, Split) {
+    if (cfg_.block_size > 4096) {
+        GTEST_SKIP() << "Directory won't split";
+    }
+
+    cfg_.mdir_cache_size = 8;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "other"));
+
+    const lfs_size_t N = 48;
+    for (lfs_size_t i = 0; i < N; i++) {
+        // insert in reverse, so each split moves names we've looked up
+        Write(&lfs, Name("dir", N-1-i), N-1-i);
+        for (lfs_size_t j = N-1-i; j < N; j++) {
+            Check(&lfs, Name("dir", j), j);
+        }
+        struct lfs_info info;
+        ASSERT_EQ(lfs_stat(&lfs, Name("dir", N).c_str(), &info),
+                LFS_ERR_NOENT);
+    }
+    ASSERT_TRUE(Split(&lfs, "dir"));
+
+    // moves commit to both the source and destination pairs
+    for (lfs_size_t i = 0; i < N; i += 2) {
+        LFS_ASSERT_OK(lfs_rename(&lfs, Name("dir", i).c_str(),
+                Name("other", i).c_str()));
+        Check(&lfs, Name("other", i), i);
+        Check(&lfs, Name("dir", i+1), i+1);
+    }
+
+    for (lfs_size_t i = 0; i < N; i++) {
+        Check(&lfs, Name((i % 2) ? "dir" : "other", i), i);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    cfg_.mdir_cache_size = 0;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < N; i++) {
+        Check(&lfs, Name((i % 2) ? "dir" : "other", i), i);
+        struct lfs_info info;
+        ASSERT_EQ(lfs_stat(&lfs, Name((i % 2) ? "other" : "dir", i).c_str(),
+                &info), LFS_ERR_NOENT);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// With more pairs in use than we can remember, the least recently used
+// are forgotten, and writes to a forgotten pair must not resurrect it
+TEST_P(McacheTest, Evict) {
+    cfg_.mdir_cache_size = 2;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    const char *DIRS[] = {"a", "b", "c", "d", "e"};
+    for (const char *d : DIRS) {
+        LFS_ASSERT_OK(lfs_mkdir(&lfs, d));
+        Write(&lfs, Name(d, 0), 0);
+    }
+
+    lfs_size_t model[5] = {0, 0, 0, 0, 0};
+    for (lfs_size_t i = 1; i < 4*Count(); i++) {
+        model[i % 5] = i;
+        Write(&lfs, Name(DIRS[i % 5], 0), i);
+        for (lfs_size_t d = 0; d < 5; d++) {
+            Check(&lfs, Name(DIRS[(i+d) % 5], 0), model[(i+d) % 5]);
+            ASSERT_LE(lfs.mcache.count, cfg_.mdir_cache_size);
+        }
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Appending to a remembered pair must not leave us trusting its old
+// erased state, or later commits would prog over data
+TEST_P(McacheTest, Appends) {
+    cfg_.mdir_cache_size = 4;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    for (lfs_size_t i = 0; i < 8*Count(); i++) {
+        LFS_ASSERT_OK(lfs_setattr(&lfs, "dir", 'v', &i, sizeof(i)));
+        struct lfs_info info;
+        LFS_ASSERT_OK(lfs_stat(&lfs, "dir", &info));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    cfg_.mdir_cache_size = 0;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    lfs_size_t v;
+    ASSERT_EQ(lfs_getattr(&lfs, "dir", 'v', &v, sizeof(v)),
+            (lfs_ssize_t)sizeof(v));
+    ASSERT_EQ(v, 8*Count()-1);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Walking the filesystem a second time shouldn't need to refetch
+// everything, and should find the same blocks
+TEST_P(McacheTest, Readed) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t d = 0; d < 3; d++) {
+        char path[64];
+        snprintf(path, sizeof(path), "d%u", (unsigned)d);
+        LFS_ASSERT_OK(lfs_mkdir(&lfs, path));
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            Write(&lfs, Name(path, i), i);
+        }
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    lfs_emubd_sio_t readed[2];
+    lfs_size_t blocks[2];
+    for (lfs_size_t size : {(lfs_size_t)0, (lfs_size_t)64}) {
+        cfg_.mdir_cache_size = size;
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        lfs_size_t first = 0;
+        LFS_ASSERT_OK(lfs_fs_traverse(&lfs, Counter, &first));
+        lfs_emubd_sio_t before = lfs_emubd_readed(&cfg_);
+        lfs_size_t second = 0;
+        LFS_ASSERT_OK(lfs_fs_traverse(&lfs, Counter, &second));
+        readed[size ? 1 : 0] = lfs_emubd_readed(&cfg_) - before;
+        blocks[size ? 1 : 0] = second;
+        ASSERT_EQ(second, first);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+    EXPECT_EQ(blocks[1], blocks[0]);
+    EXPECT_LT(readed[1], readed[0]);
+}
+
+// A statically allocated cache works the same
+TEST_P(McacheTest, StaticBuffer) {
+    std::vector<lfs_t::lfs_mcache::lfs_mcache_entry> buffer(2);
+    cfg_.mdir_cache_size = buffer.size();
+    cfg_.mdir_cache_buffer = buffer.data();
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    const char *DIRS[] = {"a", "b", "c"};
+    for (const char *d : DIRS) {
+        LFS_ASSERT_OK(lfs_mkdir(&lfs, d));
+    }
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Write(&lfs, Name(DIRS[i % 3], i), i);
+        for (lfs_size_t j = 0; j <= i; j++) {
+            Check(&lfs, Name(DIRS[j % 3], j), j);
+        }
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, McacheTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,267 @@
+/*
+ * Metadata index tests - lookups through the in-RAM tag index, which
+ * follows new commits and falls back to scanning when it overflows
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class MindexTest : public LfsParametricTest {
+protected:
+    MindexTest() {
+        count_ = 24;
+        count_blocks_ = 2;
+    }
+
+    static std::string Name(lfs_size_t i) {
+        char name[64];
+        snprintf(name, sizeof(name), "file%03u", (unsigned)i);
+        return name;
+    }
+
+    // a file holding v, with a v-sized attr, so each file has a name,
+    // struct, and attr tag in the index
+    void Create(lfs_t *lfs, const std::string &path, lfs_size_t v) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path.c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        ASSERT_EQ(lfs_file_write(lfs, &file, &v, sizeof(v)),
+                (lfs_ssize_t)sizeof(v));
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+
+        uint8_t attr[7];
+        memset(attr, (int)v, sizeof(attr));
+        LFS_ASSERT_OK(lfs_setattr(lfs, path.c_str(), 'a',
+                attr, 1 + v % sizeof(attr)));
+    }
+
+    void Check(lfs_t *lfs, const std::string &path, lfs_size_t v) {
+        struct lfs_info info;
+        LFS_ASSERT_OK(lfs_stat(lfs, path.c_str(), &info));
+        ASSERT_EQ(info.type, LFS_TYPE_REG);
+        ASSERT_EQ(info.size, sizeof(v));
+
+        uint8_t attr[7];
+        ASSERT_EQ(lfs_getattr(lfs, path.c_str(), 'a', attr, sizeof(attr)),
+                (lfs_ssize_t)(1 + v % sizeof(attr))) << path;
+        for (lfs_size_t j = 0; j < 1 + v % sizeof(attr); j++) {
+            ASSERT_EQ(attr[j], (uint8_t)v) << path;
+        }
+        ASSERT_EQ(lfs_getattr(lfs, path.c_str(), 'b', attr, sizeof(attr)),
+                LFS_ERR_NOATTR);
+
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path.c_str(), LFS_O_RDONLY));
+        lfs_size_t w;
+        ASSERT_EQ(lfs_file_read(lfs, &file, &w, sizeof(w)),
+                (lfs_ssize_t)sizeof(w));
+        ASSERT_EQ(w, v) << path;
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    // read bytes for listing the root directory
+    lfs_emubd_sio_t List(lfs_size_t metadata_index_size) {
+        cfg_.metadata_index_size = metadata_index_size;
+        lfs_t lfs;
+        EXPECT_EQ(lfs_mount(&lfs, &cfg_), 0);
+        lfs_emubd_sio_t readed = lfs_emubd_readed(&cfg_);
+        lfs_dir_t dir;
+        EXPECT_EQ(lfs_dir_open(&lfs, &dir, "/"), 0);
+        struct lfs_info info;
+        lfs_size_t count = 0;
+        while (lfs_dir_read(&lfs, &dir, &info) > 0) {
+            count += 1;
+        }
+        EXPECT_EQ(lfs_dir_close(&lfs, &dir), 0);
+        EXPECT_EQ(count, 2 + Count());
+        readed = lfs_emubd_readed(&cfg_) - readed;
+        EXPECT_EQ(lfs_unmount(&lfs), 0);
+        return readed;
+    }
+};
+
+// Indexes on either side of the number of tags in the root must find the
+// same thing, the smaller ones falling back to scanning
+TEST_P(MindexTest, Overflow) {
+    const lfs_size_t N = 8;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < N; i++) {
+        Create(&lfs, Name(i), i);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    bool indexed = false;
+    bool overflowed = false;
+    for (lfs_size_t size = 1; size <= 4*N; size++) {
+        cfg_.metadata_index_size = size;
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (lfs_size_t i = 0; i < N; i++) {
+            Check(&lfs, Name(N-1-i), N-1-i);
+        }
+
+        if (lfs.mindex.count <= size) {
+            indexed = true;
+        } else {
+            overflowed = true;
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+
+    ASSERT_TRUE(indexed);
+    ASSERT_TRUE(overflowed);
+}
+
+// Removing and inserting files shifts the ids of every later file,
+// which the index must follow without rescanning
+TEST_P(MindexTest, Splice) {
+    cfg_.metadata_index_size = 256;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Create(&lfs, Name(i), i);
+    }
+    Check(&lfs, Name(Count()-1), Count()-1);
+
+    // remove from the front, every remaining file moves down an id
+    for (lfs_size_t i = 0; i < Count()/2; i++) {
+        LFS_ASSERT_OK(lfs_remove(&lfs, Name(i).c_str()));
+        struct lfs_info info;
+        ASSERT_EQ(lfs_stat(&lfs, Name(i).c_str(), &info), LFS_ERR_NOENT);
+        for (lfs_size_t j = i+1; j < Count(); j++) {
+            Check(&lfs, Name(j), j);
+        }
+    }
+
+    // insert before everything, every file moves up an id
+    for (lfs_size_t i = 0; i < Count()/2; i++) {
+        Create(&lfs, "a" + Name(i), i);
+        for (lfs_size_t j = Count()/2; j < Count(); j++) {
+            Check(&lfs, Name(j), j);
+        }
+    }
+
+    // removed attrs leave delete tags behind
+    for (lfs_size_t i = Count()/2; i < Count(); i += 2) {
+        LFS_ASSERT_OK(lfs_removeattr(&lfs, Name(i).c_str(), 'a'));
+        uint8_t attr[7];
+        ASSERT_EQ(lfs_getattr(&lfs, Name(i).c_str(), 'a',
+                attr, sizeof(attr)), LFS_ERR_NOATTR);
+        if (i+1 < Count()) {
+            Check(&lfs, Name(i+1), i+1);
+        }
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    cfg_.metadata_index_size = 0;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count()/2; i++) {
+        Check(&lfs, "a" + Name(i), i);
+    }
+    for (lfs_size_t i = Count()/2+1; i < Count(); i += 2) {
+        Check(&lfs, Name(i), i);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// The index only follows one mdir, alternating between two must start
+// over each time rather than mixing up their tags
+TEST_P(MindexTest, Switch) {
+    cfg_.metadata_index_size = 256;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "a"));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "b"));
+    lfs_size_t n = Count()/2;
+    for (lfs_size_t i = 0; i < n; i++) {
+        Create(&lfs, "a/" + Name(i), i);
+        Create(&lfs, "b/" + Name(i), 100+i);
+    }
+
+    lfs_block_t last = (lfs_block_t)-1;
+    for (lfs_size_t i = 0; i < 2*n; i++) {
+        Check(&lfs, "a/" + Name(i % n), i % n);
+        ASSERT_NE(lfs.mindex.block, last);
+        last = lfs.mindex.block;
+        Check(&lfs, "b/" + Name(i % n), 100 + i % n);
+        ASSERT_NE(lfs.mindex.block, last);
+        last = lfs.mindex.block;
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Updating the same attr over and over should always find the latest,
+// even as compactions rewrite the log under the index
+TEST_P(MindexTest, Updates) {
+    cfg_.metadata_index_size = 64;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    for (lfs_size_t i = 0; i < 4*Count(); i++) {
+        LFS_ASSERT_OK(lfs_setattr(&lfs, "dir", 'v', &i, sizeof(i)));
+        lfs_size_t j;
+        ASSERT_EQ(lfs_getattr(&lfs, "dir", 'v', &j, sizeof(j)),
+                (lfs_ssize_t)sizeof(j));
+        ASSERT_EQ(j, i);
+
+        // and create something before it now and then, shifting its id
+        if (i % 5 == 0) {
+            char name[64];
+            snprintf(name, sizeof(name), "a%03u", (unsigned)i);
+            LFS_ASSERT_OK(lfs_mkdir(&lfs, name));
+        }
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// With the index, listing a directory shouldn't rescan the log for
+// every entry
+TEST_P(MindexTest, Readed) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file, Name(i).c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    lfs_emubd_sio_t scanned = List(0);
+    lfs_emubd_sio_t indexed = List(256);
+    EXPECT_LE(indexed, scanned);
+
+    // each file needs at least 16 bytes of log, if that doesn't fit in
+    // our cache scanning has to go back to disk
+    if (cfg_.cache_size < 16*Count()) {
+        EXPECT_LT(indexed, scanned);
+    }
+}
+
+// A statically allocated index works the same
+TEST_P(MindexTest, StaticBuffer) {
+    std::vector<uint8_t> buffer(64*8);
+    cfg_.metadata_index_size = 64;
+    cfg_.metadata_index_buffer = buffer.data();
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Create(&lfs, Name(i), i);
+        Check(&lfs, Name(i/2), i/2);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, MindexTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
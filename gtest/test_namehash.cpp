@@ -0,0 +1,289 @@
+/*
+ * Name hash tests - lookups that skip metadata pairs whose name hashes rule
+ * out a name, which must still find the right insertion point for new names
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class NamehashTest : public LfsParametricTest {
+protected:
+    NamehashTest() {
+        count_ = 64;
+        count_blocks_ = 2;
+    }
+
+    // long names, so directories split and compact, writing name hashes,
+    // after a handful of files, but that differ early so fences still
+    // tell them apart
+    static std::string Name(lfs_size_t i) {
+        char name[64];
+        snprintf(name, sizeof(name), "file%03u", (unsigned)i);
+        return name + std::string(40, 'n');
+    }
+
+    // a name that sorts right after Name(i), but isn't one
+    static std::string Between(lfs_size_t i) {
+        char name[64];
+        snprintf(name, sizeof(name), "file%03u", (unsigned)i);
+        return name + std::string(40, 'o');
+    }
+
+    // the two bits a name sets in a name hash, as lfs_namehash_bit picks
+    // them
+    lfs_size_t Bits(const std::string &name) {
+        uint32_t crc = lfs_crc(0xffffffff, name.data(), name.size());
+        lfs_size_t bits = 8*cfg_.name_hash_size;
+        return (1U << (crc % bits))
+                | (1U << (((crc >> 16) | (crc << 16)) % bits));
+    }
+
+    void Create(lfs_t *lfs, const std::string &name, lfs_size_t v) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, name.c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        ASSERT_EQ(lfs_file_write(lfs, &file, &v, sizeof(v)),
+                (lfs_ssize_t)sizeof(v));
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    // stat first, opens may create and so never trust a name hash miss
+    void Check(lfs_t *lfs, const std::string &name, lfs_size_t v) {
+        struct lfs_info info;
+        ASSERT_EQ(lfs_stat(lfs, name.c_str(), &info), 0) << name;
+        ASSERT_EQ(info.size, sizeof(v));
+
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, name.c_str(), LFS_O_RDONLY));
+        lfs_size_t w;
+        ASSERT_EQ(lfs_file_read(lfs, &file, &w, sizeof(w)),
+                (lfs_ssize_t)sizeof(w));
+        ASSERT_EQ(w, v) << name;
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    void Missing(lfs_t *lfs, const std::string &name) {
+        struct lfs_info info;
+        ASSERT_EQ(lfs_stat(lfs, name.c_str(), &info), LFS_ERR_NOENT)
+                << name;
+    }
+
+    std::vector<std::string> List(lfs_t *lfs) {
+        lfs_dir_t dir;
+        EXPECT_EQ(lfs_dir_open(lfs, &dir, "/"), 0);
+        struct lfs_info info;
+        std::vector<std::string> names;
+        while (lfs_dir_read(lfs, &dir, &info) > 0) {
+            names.push_back(info.name);
+        }
+        EXPECT_EQ(lfs_dir_close(lfs, &dir), 0);
+        return names;
+    }
+
+    // remembered mdirs we can currently answer from the name hash
+    lfs_size_t Hashed(lfs_t *lfs) {
+        lfs_size_t hashed = 0;
+        for (lfs_size_t i = 0; i < lfs->mcache.count; i++) {
+            if (lfs->mcache.entries[i].hoff) {
+                hashed += 1;
+            }
+        }
+        return hashed;
+    }
+
+    // fill the root and compact it, so every mdir has a name hash
+    void Populate() {
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            Create(&lfs, Name(i), i);
+        }
+        LFS_ASSERT_OK(lfs_fs_gc(&lfs));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+
+    // read bytes for looking up names that don't exist, once we've seen
+    // every mdir and know their fences
+    lfs_emubd_sio_t MissingReaded(lfs_size_t name_hash_size) {
+        cfg_.name_hash_size = name_hash_size;
+        lfs_t lfs;
+        EXPECT_EQ(lfs_mount(&lfs, &cfg_), 0);
+        struct lfs_info info;
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            EXPECT_EQ(lfs_stat(&lfs, Name(i).c_str(), &info), 0);
+        }
+
+        lfs_emubd_sio_t readed = lfs_emubd_readed(&cfg_);
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            EXPECT_EQ(lfs_stat(&lfs, Between(i).c_str(), &info),
+                    LFS_ERR_NOENT);
+        }
+        readed = lfs_emubd_readed(&cfg_) - readed;
+        EXPECT_EQ(lfs_unmount(&lfs), 0);
+        return readed;
+    }
+};
+
+// A one byte name hash is all collisions, missing names whose bits are
+// set by some other name must still be looked for, and not found
+TEST_P(NamehashTest, Collisions) {
+    cfg_.mdir_cache_size = 64;
+    cfg_.name_hash_size = 1;
+    cfg_.compact_thresh = cfg_.block_size/2;
+    Populate();
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    lfs_size_t set = 0;
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Check(&lfs, Name(i), i);
+        set |= Bits(Name(i));
+    }
+    ASSERT_GT(Hashed(&lfs), 0u);
+
+    lfs_size_t collisions = 0;
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        if ((Bits(Between(i)) & set) == Bits(Between(i))) {
+            collisions += 1;
+        }
+        Missing(&lfs, Between(i));
+    }
+    ASSERT_GT(collisions, 0u);
+
+    // and new names landing on set bits go in the right place
+    for (lfs_size_t i = 0; i < Count(); i += 2) {
+        Create(&lfs, Between(i), 1000+i);
+    }
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Check(&lfs, Name(i), i);
+        if (i % 2 == 0) {
+            Check(&lfs, Between(i), 1000+i);
+        } else {
+            Missing(&lfs, Between(i));
+        }
+    }
+    std::vector<std::string> names = List(&lfs);
+    ASSERT_EQ(names.size(), 2 + Count() + (Count()+1)/2);
+    ASSERT_TRUE(std::is_sorted(names.begin(), names.end()));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Names committed after a compaction aren't in that compaction's name
+// hash, which must be ignored from then on rather than ruling them out
+TEST_P(NamehashTest, Stale) {
+    cfg_.mdir_cache_size = 64;
+    cfg_.name_hash_size = 16;
+    cfg_.compact_thresh = cfg_.block_size/2;
+    Populate();
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Check(&lfs, Name(i), i);
+    }
+    ASSERT_GT(Hashed(&lfs), 0u);
+
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        // a miss the hash may well have answered, then the same name
+        // appended, lookups once the mdir is fetched again can't use the
+        // hash
+        Missing(&lfs, Between(i));
+        Create(&lfs, Between(i), 1000+i);
+        Check(&lfs, Between(i), 1000+i);
+        Check(&lfs, Between(i), 1000+i);
+
+        // same for a rename, which appends the new name and deletes the
+        // old one
+        if (i % 3 == 0) {
+            std::string name = "r" + Name(i);
+            Missing(&lfs, name);
+            LFS_ASSERT_OK(lfs_rename(&lfs, Name(i).c_str(), name.c_str()));
+            Check(&lfs, name, i);
+            Missing(&lfs, Name(i));
+        }
+    }
+
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Check(&lfs, (i % 3 == 0) ? "r" + Name(i) : Name(i), i);
+        Check(&lfs, Between(i), 1000+i);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    cfg_.mdir_cache_size = 0;
+    cfg_.name_hash_size = 0;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Check(&lfs, (i % 3 == 0) ? "r" + Name(i) : Name(i), i);
+        Check(&lfs, Between(i), 1000+i);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Name hashes are written whether or not we use them, and ignored if we
+// don't understand them
+TEST_P(NamehashTest, Compatibility) {
+    cfg_.mdir_cache_size = 64;
+    cfg_.name_hash_size = 64;
+    cfg_.compact_thresh = cfg_.block_size/2;
+    Populate();
+
+    // a different filter size must not be trusted, a name's bits land
+    // somewhere else
+    for (lfs_size_t size : {(lfs_size_t)16, (lfs_size_t)0}) {
+        cfg_.name_hash_size = size;
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            Check(&lfs, Name(i), i);
+            Missing(&lfs, Between(i));
+        }
+        ASSERT_EQ(Hashed(&lfs), 0u);
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Looking up a missing name in a large directory shouldn't need to compare
+// names, even in the one metadata pair its fence leads to
+TEST_P(NamehashTest, Readed) {
+    cfg_.mdir_cache_size = 64;
+    cfg_.name_hash_size = 64;
+    Populate();
+
+    lfs_emubd_sio_t scanned = MissingReaded(0);
+    lfs_emubd_sio_t hashed = MissingReaded(64);
+    EXPECT_LE(hashed, scanned);
+
+    // each file needs at least 32 bytes of metadata, if that spills over
+    // several metadata pairs, which are compacted and so hashed, and we
+    // read much less than a whole block at a time, answering from the hash
+    // should save reads
+    if (32*Count() > cfg_.block_size && 8*cfg_.read_size < cfg_.block_size) {
+        EXPECT_LT(hashed, scanned);
+    }
+}
+
+// A statically allocated filter works the same
+TEST_P(NamehashTest, StaticBuffer) {
+    std::vector<uint8_t> buffer(64);
+    cfg_.mdir_cache_size = 64;
+    cfg_.name_hash_size = buffer.size();
+    cfg_.name_hash_buffer = buffer.data();
+    Populate();
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        Check(&lfs, Name(i), i);
+        Missing(&lfs, Between(i));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, NamehashTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
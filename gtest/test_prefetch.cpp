@@ -0,0 +1,182 @@
+/*
+ * Prefetch tests - walks over the metadata list reading the next metadata
+ * pair into spare read cache lines ahead of time
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+class PrefetchTest : public LfsParametricTest {
+protected:
+    // every directory adds a metadata pair to the metadata list
+    PrefetchTest() {
+        count_ = 128;
+        count_blocks_ = 4;
+    }
+
+    void SetUp() override {
+        LfsParametricTest::SetUp();
+
+        // recreate our block device with a simulated read latency
+        lfs_emubd_destroy(&cfg_);
+        bdcfg_.read_latency = 100*1000;
+        memset(&bd_, 0, sizeof(bd_));
+        LFS_ASSERT_OK(lfs_emubd_create(&cfg_, &bdcfg_));
+
+        cfg_.read_cache_lines = 4;
+        cfg_.submit = lfs_emubd_submit;
+        cfg_.wait = lfs_emubd_wait;
+    }
+
+    void Populate() {
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "dir%03u", (unsigned)i);
+            LFS_ASSERT_OK(lfs_mkdir(&lfs, path));
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+
+    static int Counter(void *data, lfs_block_t block) {
+        (void)block;
+        *(lfs_size_t*)data += 1;
+        return 0;
+    }
+
+    // time a mount and a traversal in simulated nanoseconds
+    void Time(lfs_emubd_ssleep_t *time, lfs_size_t *blocks) {
+        *time = lfs_emubd_time(&cfg_);
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        *blocks = 0;
+        LFS_ASSERT_OK(lfs_fs_traverse(&lfs, Counter, blocks));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+        *time = lfs_emubd_time(&cfg_) - *time;
+    }
+};
+
+// Prefetching shouldn't change what mount, traversal, or removes find
+TEST_P(PrefetchTest, Walk) {
+    Populate();
+
+    lfs_size_t expected = 0;
+    for (lfs_size_t io_depth : {(lfs_size_t)0, (lfs_size_t)1,
+            (lfs_size_t)4}) {
+        cfg_.io_depth = io_depth;
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        lfs_size_t blocks = 0;
+        LFS_ASSERT_OK(lfs_fs_traverse(&lfs, Counter, &blocks));
+        if (io_depth == 0) {
+            expected = blocks;
+        }
+        EXPECT_EQ(blocks, expected);
+        LFS_ASSERT_OK(lfs_fs_gc(&lfs));
+
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "dir%03u", (unsigned)i);
+            struct lfs_info info;
+            LFS_ASSERT_OK(lfs_stat(&lfs, path, &info));
+            EXPECT_EQ(info.type, LFS_TYPE_DIR);
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+
+    // removing directories walks the metadata list looking for
+    // predecessors
+    cfg_.io_depth = 4;
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count(); i += 2) {
+        char path[64];
+        snprintf(path, sizeof(path), "dir%03u", (unsigned)i);
+        LFS_ASSERT_OK(lfs_remove(&lfs, path));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    cfg_.io_depth = 0;
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "dir%03u", (unsigned)i);
+        struct lfs_info info;
+        EXPECT_EQ(lfs_stat(&lfs, path, &info),
+                (i % 2 == 0) ? LFS_ERR_NOENT : 0);
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Reading ahead with submit should let the metadata reads overlap, cutting
+// the time spent on read latency
+TEST_P(PrefetchTest, Latency) {
+    Populate();
+
+    lfs_emubd_ssleep_t sync, prefetched;
+    lfs_size_t expected, blocks;
+    cfg_.io_depth = 0;
+    Time(&sync, &expected);
+
+    cfg_.io_depth = 4;
+    Time(&prefetched, &blocks);
+    EXPECT_EQ(blocks, expected);
+    EXPECT_LT(prefetched, sync);
+}
+
+// A prefetch that fails to read shouldn't leave a line that looks valid,
+// or be mistaken for a bad block when the block is later progged
+TEST_P(PrefetchTest, Readerror) {
+    lfs_emubd_destroy(&cfg_);
+    bdcfg_.erase_cycles = 0xffffffff;
+    bdcfg_.badblock_behavior = LFS_EMUBD_BADBLOCK_READERROR;
+    memset(&bd_, 0, sizeof(bd_));
+    LFS_ASSERT_OK(lfs_emubd_create(&cfg_, &bdcfg_));
+    cfg_.io_depth = 4;
+
+    lfs_size_t count = std::min<lfs_size_t>(16, cfg_.block_count/4);
+    lfs_block_t bads = std::min<lfs_block_t>(cfg_.block_count, 32);
+    for (lfs_block_t bad = 2; bad < bads; bad++) {
+        LFS_ASSERT_OK(lfs_emubd_setwear(&cfg_, bad-1, 0));
+        LFS_ASSERT_OK(lfs_emubd_setwear(&cfg_, bad, 0xffffffff));
+
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (lfs_size_t i = 0; i < count; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "dir%03u", (unsigned)i);
+            LFS_ASSERT_OK(lfs_mkdir(&lfs, path));
+            snprintf(path, sizeof(path), "dir%03u/file", (unsigned)i);
+            lfs_file_t file;
+            LFS_ASSERT_OK(lfs_file_open(&lfs, &file, path,
+                    LFS_O_WRONLY | LFS_O_CREAT));
+            ASSERT_EQ(lfs_file_write(&lfs, &file, path, strlen(path)),
+                    (lfs_ssize_t)strlen(path));
+            LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        for (lfs_size_t i = 0; i < count; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "dir%03u/file", (unsigned)i);
+            lfs_file_t file;
+            LFS_ASSERT_OK(lfs_file_open(&lfs, &file, path, LFS_O_RDONLY));
+            char buffer[64];
+            ASSERT_EQ(lfs_file_read(&lfs, &file, buffer, sizeof(buffer)),
+                    (lfs_ssize_t)strlen(path)) << "bad " << bad;
+            ASSERT_EQ(memcmp(buffer, path, strlen(path)), 0) << "bad " << bad;
+            LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        }
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, PrefetchTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
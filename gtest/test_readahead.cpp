@@ -0,0 +1,254 @@
+/*
+ * Read-ahead tests - sequential file reads through a per-file read-ahead
+ * buffer, optionally read ahead asynchronously with submit/wait
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+class ReadaheadTest : public LfsParametricTest {
+protected:
+    void SetUp() override {
+        LfsParametricTest::SetUp();
+
+        // recreate our block device with a simulated read latency
+        lfs_emubd_destroy(&cfg_);
+        bdcfg_.read_latency = 100*1000;
+        memset(&bd_, 0, sizeof(bd_));
+        LFS_ASSERT_OK(lfs_emubd_create(&cfg_, &bdcfg_));
+    }
+
+    void Async(lfs_size_t io_depth) {
+        cfg_.submit = lfs_emubd_submit;
+        cfg_.wait = lfs_emubd_wait;
+        cfg_.io_depth = io_depth;
+    }
+
+    lfs_size_t Size() {
+        return std::min<lfs_size_t>(6*cfg_.block_size,
+                (cfg_.block_count/4)*cfg_.block_size);
+    }
+
+    void Write(lfs_t *lfs, const char *path, lfs_size_t i) {
+        std::vector<uint8_t> data(Size());
+        for (lfs_size_t j = 0; j < data.size(); j++) {
+            data[j] = LfsPattern(i, j);
+        }
+
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path,
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC));
+        ASSERT_EQ(lfs_file_write(lfs, &file, data.data(), data.size()),
+                (lfs_ssize_t)data.size());
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+
+    // read a file sequentially in chunks
+    void Read(lfs_t *lfs, lfs_file_t *file, lfs_size_t i, lfs_size_t chunk) {
+        std::vector<uint8_t> buffer(chunk);
+        for (lfs_size_t j = 0; j < Size(); j += chunk) {
+            lfs_size_t n = std::min(chunk, Size()-j);
+            ASSERT_EQ(lfs_file_read(lfs, file, buffer.data(), chunk),
+                    (lfs_ssize_t)n);
+            for (lfs_size_t k = 0; k < n; k++) {
+                ASSERT_EQ(buffer[k], LfsPattern(i, j+k)) << "off " << j+k;
+            }
+        }
+        ASSERT_EQ(lfs_file_read(lfs, file, buffer.data(), chunk), 0);
+    }
+
+    // time reading two files sequentially, interleaved, in simulated
+    // nanoseconds
+    void Time(lfs_size_t readahead_size, lfs_emubd_ssleep_t *time) {
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        struct lfs_file_config filecfg;
+        memset(&filecfg, 0, sizeof(filecfg));
+        filecfg.readahead_size = readahead_size;
+
+        *time = lfs_emubd_time(&cfg_);
+        lfs_file_t files[2];
+        LFS_ASSERT_OK(lfs_file_opencfg(&lfs, &files[0], "file0",
+                LFS_O_RDONLY, &filecfg));
+        LFS_ASSERT_OK(lfs_file_opencfg(&lfs, &files[1], "file1",
+                LFS_O_RDONLY, &filecfg));
+        uint8_t buffer[16];
+        for (lfs_size_t j = 0; j < Size(); j += sizeof(buffer)) {
+            for (lfs_size_t i = 0; i < 2; i++) {
+                lfs_size_t n = std::min<lfs_size_t>(sizeof(buffer), Size()-j);
+                ASSERT_EQ(lfs_file_read(&lfs, &files[i],
+                        buffer, sizeof(buffer)), (lfs_ssize_t)n);
+                for (lfs_size_t k = 0; k < n; k++) {
+                    ASSERT_EQ(buffer[k], LfsPattern(i, j+k)) << "off " << j+k;
+                }
+            }
+        }
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &files[0]));
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &files[1]));
+        *time = lfs_emubd_time(&cfg_) - *time;
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+};
+
+// Sequential reads of any size should read the same data
+TEST_P(ReadaheadTest, Sequential) {
+    for (lfs_size_t io_depth : {(lfs_size_t)0, (lfs_size_t)2}) {
+        Async(io_depth);
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Write(&lfs, "file", 1);
+
+        for (lfs_size_t readahead_size : {2*cfg_.cache_size,
+                2*cfg_.block_size, 4*cfg_.block_size}) {
+            for (lfs_size_t chunk : {(lfs_size_t)1, (lfs_size_t)13,
+                    cfg_.cache_size, cfg_.block_size+3}) {
+                struct lfs_file_config filecfg;
+                memset(&filecfg, 0, sizeof(filecfg));
+                filecfg.readahead_size = readahead_size;
+                lfs_file_t file;
+                LFS_ASSERT_OK(lfs_file_opencfg(&lfs, &file, "file",
+                        LFS_O_RDONLY, &filecfg));
+                Read(&lfs, &file, 1, chunk);
+                LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+            }
+        }
+
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Seeks break sequential access, reads after a seek must still find the
+// right data
+TEST_P(ReadaheadTest, Seek) {
+    for (lfs_size_t io_depth : {(lfs_size_t)0, (lfs_size_t)2}) {
+        Async(io_depth);
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Write(&lfs, "file", 2);
+
+        struct lfs_file_config filecfg;
+        memset(&filecfg, 0, sizeof(filecfg));
+        filecfg.readahead_size = 2*cfg_.block_size;
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_opencfg(&lfs, &file, "file",
+                LFS_O_RDONLY, &filecfg));
+
+        uint32_t prng = 42;
+        uint8_t buffer[37];
+        for (int i = 0; i < 200; i++) {
+            // mostly keep reading, but sometimes jump somewhere else
+            lfs_off_t off = lfs_file_tell(&lfs, &file);
+            prng = prng*1103515245 + 12345;
+            if (off >= Size() || (prng >> 16) % 4 == 0) {
+                off = (prng >> 8) % Size();
+                ASSERT_EQ(lfs_file_seek(&lfs, &file, off, LFS_SEEK_SET),
+                        (lfs_soff_t)off);
+            }
+
+            lfs_size_t n = std::min<lfs_size_t>(sizeof(buffer), Size()-off);
+            ASSERT_EQ(lfs_file_read(&lfs, &file, buffer, sizeof(buffer)),
+                    (lfs_ssize_t)n);
+            for (lfs_size_t k = 0; k < n; k++) {
+                ASSERT_EQ(buffer[k], LfsPattern(2, off+k)) << "off " << off+k;
+            }
+        }
+
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Writing through the same handle must not leave stale read-ahead behind
+TEST_P(ReadaheadTest, ReadWrite) {
+    for (lfs_size_t io_depth : {(lfs_size_t)0, (lfs_size_t)2}) {
+        Async(io_depth);
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Write(&lfs, "file", 3);
+
+        std::vector<uint8_t> model(Size());
+        for (lfs_size_t j = 0; j < model.size(); j++) {
+            model[j] = LfsPattern(3, j);
+        }
+
+        struct lfs_file_config filecfg;
+        memset(&filecfg, 0, sizeof(filecfg));
+        filecfg.readahead_size = 2*cfg_.cache_size;
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_opencfg(&lfs, &file, "file",
+                LFS_O_RDWR, &filecfg));
+
+        // read a bit, overwrite what's ahead, and keep reading
+        uint8_t buffer[64];
+        ASSERT_EQ(lfs_file_read(&lfs, &file, buffer, 32), 32);
+        memset(buffer, 0xcc, sizeof(buffer));
+        ASSERT_EQ(lfs_file_write(&lfs, &file, buffer, sizeof(buffer)),
+                (lfs_ssize_t)sizeof(buffer));
+        memset(&model[32], 0xcc, sizeof(buffer));
+        ASSERT_EQ(lfs_file_seek(&lfs, &file, 0, LFS_SEEK_SET), 0);
+        for (lfs_size_t j = 0; j < Size(); j += sizeof(buffer)) {
+            lfs_size_t n = std::min<lfs_size_t>(sizeof(buffer), Size()-j);
+            ASSERT_EQ(lfs_file_read(&lfs, &file, buffer, sizeof(buffer)),
+                    (lfs_ssize_t)n);
+            for (lfs_size_t k = 0; k < n; k++) {
+                ASSERT_EQ(buffer[k], model[j+k]) << "off " << j+k;
+            }
+        }
+
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+// Reading ahead should cut the number of reads, and so the time spent on
+// read latency
+TEST_P(ReadaheadTest, Latency) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Write(&lfs, "file0", 0);
+    Write(&lfs, "file1", 1);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    lfs_emubd_ssleep_t none, ahead, async;
+    Time(0, &none);
+    Time(cfg_.block_size, &ahead);
+    EXPECT_LT(ahead, none);
+
+    // reading ahead with submit lets one file's reads overlap the other's
+    Async(2);
+    Time(2*cfg_.block_size, &async);
+    EXPECT_LT(async, ahead);
+}
+
+// A statically allocated read-ahead buffer works the same
+TEST_P(ReadaheadTest, StaticBuffer) {
+    for (lfs_size_t io_depth : {(lfs_size_t)0, (lfs_size_t)2}) {
+        Async(io_depth);
+        lfs_t lfs;
+        LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+        LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+        Write(&lfs, "file", 4);
+
+        std::vector<uint8_t> buffer(2*cfg_.cache_size);
+        struct lfs_file_config filecfg;
+        memset(&filecfg, 0, sizeof(filecfg));
+        filecfg.readahead_size = buffer.size();
+        filecfg.readahead_buffer = buffer.data();
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_opencfg(&lfs, &file, "file",
+                LFS_O_RDONLY, &filecfg));
+        Read(&lfs, &file, 4, 29);
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        LFS_ASSERT_OK(lfs_unmount(&lfs));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, ReadaheadTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,431 @@
+/*
+ * Readplus tests - batched directory reads with info and custom attributes,
+ * which must list the same entries as reading them one at a time
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class ReadplusTest : public LfsParametricTest {
+protected:
+    ReadplusTest() {
+        count_ = 48;
+        count_blocks_ = 2;
+    }
+
+    struct Entry {
+        std::string name;
+        uint8_t type;
+        lfs_size_t size;
+        std::vector<uint8_t> a;
+        std::vector<uint8_t> b;
+
+        bool operator==(const Entry &other) const {
+            return name == other.name && type == other.type
+                    && size == other.size && a == other.a && b == other.b;
+        }
+    };
+
+    static constexpr lfs_size_t ASIZE = 4;
+    static constexpr lfs_size_t BSIZE = 12;
+
+    // long enough that the directory spans several metadata pairs
+    static std::string Name(lfs_size_t i) {
+        char name[64];
+        snprintf(name, sizeof(name), "e%03u", (unsigned)i);
+        return name + std::string(16, 'e');
+    }
+
+    void Populate(lfs_t *lfs) {
+        LFS_ASSERT_OK(lfs_mkdir(lfs, "dir"));
+
+        // create out of order, mixing dirs, inline and outlined files, and
+        // attrs, so entries shift around inside metadata pairs
+        for (lfs_size_t i = 0; i < Count(); i++) {
+            lfs_size_t j = (i*7) % Count();
+            std::string path = "dir/" + Name(j);
+            if (j % 5 == 0) {
+                LFS_ASSERT_OK(lfs_mkdir(lfs, path.c_str()));
+            } else {
+                lfs_file_t file;
+                LFS_ASSERT_OK(lfs_file_open(lfs, &file, path.c_str(),
+                        LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+                lfs_size_t size = (j % 4 == 0) ? 2*cfg_.cache_size + j : j;
+                std::vector<uint8_t> data(size, (uint8_t)j);
+                ASSERT_EQ(lfs_file_write(lfs, &file, data.data(), size),
+                        (lfs_ssize_t)size);
+                LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+            }
+
+            if (j % 3 == 0) {
+                uint32_t a = 0x1000 + j;
+                LFS_ASSERT_OK(lfs_setattr(lfs, path.c_str(), 'a',
+                        &a, sizeof(a)));
+            }
+            if (j % 2 == 0) {
+                std::string b = "b" + std::to_string(j);
+                LFS_ASSERT_OK(lfs_setattr(lfs, path.c_str(), 'b',
+                        b.data(), b.size()));
+            }
+        }
+
+        // remove and rename entries, and update some attrs
+        for (lfs_size_t i = 1; i < Count(); i += 6) {
+            LFS_ASSERT_OK(lfs_remove(lfs, ("dir/" + Name(i)).c_str()));
+        }
+        for (lfs_size_t i = 2; i < Count(); i += 6) {
+            LFS_ASSERT_OK(lfs_rename(lfs, ("dir/" + Name(i)).c_str(),
+                    ("dir/r" + Name(i)).c_str()));
+        }
+        for (lfs_size_t i = 0; i < Count(); i += 9) {
+            std::string path = (i % 6 == 2) ? "dir/r" + Name(i)
+                    : "dir/" + Name(i);
+            LFS_ASSERT_OK(lfs_removeattr(lfs, path.c_str(), 'b'));
+        }
+    }
+
+    // list with read and getattr, one entry at a time
+    std::vector<Entry> List(lfs_t *lfs) {
+        std::vector<Entry> entries;
+        lfs_dir_t dir;
+        EXPECT_EQ(lfs_dir_open(lfs, &dir, "dir"), 0);
+        struct lfs_info info;
+        while (lfs_dir_read(lfs, &dir, &info) > 0) {
+            Entry entry = {info.name, info.type, info.size,
+                    std::vector<uint8_t>(ASIZE), std::vector<uint8_t>(BSIZE)};
+            if (entry.name != "." && entry.name != "..") {
+                std::string path = "dir/" + entry.name;
+                lfs_getattr(lfs, path.c_str(), 'a', entry.a.data(), ASIZE);
+                lfs_getattr(lfs, path.c_str(), 'b', entry.b.data(), BSIZE);
+            }
+            entries.push_back(entry);
+        }
+        EXPECT_EQ(lfs_dir_close(lfs, &dir), 0);
+        return entries;
+    }
+
+    // list with readplus, batch entries at a time
+    std::vector<Entry> ListPlus(lfs_t *lfs, lfs_size_t batch) {
+        std::vector<Entry> entries;
+        std::vector<struct lfs_info> infos(batch);
+        std::vector<uint8_t> a(batch*ASIZE);
+        std::vector<uint8_t> b(batch*BSIZE);
+        struct lfs_attr attrs[] = {
+            {'a', a.data(), ASIZE},
+            {'b', b.data(), BSIZE},
+        };
+
+        lfs_dir_t dir;
+        EXPECT_EQ(lfs_dir_open(lfs, &dir, "dir"), 0);
+        while (true) {
+            lfs_ssize_t res = lfs_dir_readplus(lfs, &dir,
+                    infos.data(), batch, attrs, 2);
+            EXPECT_GE(res, 0);
+            if (res <= 0) {
+                break;
+            }
+            EXPECT_LE(res, (lfs_ssize_t)batch);
+
+            for (lfs_ssize_t i = 0; i < res; i++) {
+                entries.push_back({infos[i].name, infos[i].type,
+                        infos[i].size,
+                        std::vector<uint8_t>(&a[i*ASIZE], &a[(i+1)*ASIZE]),
+                        std::vector<uint8_t>(&b[i*BSIZE], &b[(i+1)*BSIZE])});
+            }
+        }
+        EXPECT_EQ(lfs_dir_close(lfs, &dir), 0);
+        return entries;
+    }
+
+    // list in every window size, starting from every position, with read,
+    // so windows begin in the middle of metadata pairs
+    void Windows(lfs_t *lfs, const std::vector<Entry> &expected) {
+        for (lfs_size_t batch : {(lfs_size_t)1, (lfs_size_t)2,
+                (lfs_size_t)3, (lfs_size_t)5, (lfs_size_t)8,
+                (lfs_size_t)expected.size()}) {
+            ASSERT_EQ(ListPlus(lfs, batch), expected) << batch;
+
+            for (lfs_size_t start = 0; start < expected.size(); start++) {
+                std::vector<struct lfs_info> infos(batch);
+                lfs_dir_t dir;
+                LFS_ASSERT_OK(lfs_dir_open(lfs, &dir, "dir"));
+                struct lfs_info info;
+                for (lfs_size_t i = 0; i < start; i++) {
+                    ASSERT_EQ(lfs_dir_read(lfs, &dir, &info), 1);
+                }
+
+                lfs_size_t i = start;
+                while (true) {
+                    lfs_ssize_t res = lfs_dir_readplus(lfs, &dir,
+                            infos.data(), batch, NULL, 0);
+                    ASSERT_GE(res, 0);
+                    if (res == 0) {
+                        break;
+                    }
+
+                    for (lfs_ssize_t j = 0; j < res; j++, i++) {
+                        ASSERT_LT(i, expected.size());
+                        ASSERT_EQ(infos[j].name, expected[i].name)
+                                << start << "+" << batch;
+                        ASSERT_EQ(infos[j].type, expected[i].type);
+                        ASSERT_EQ(infos[j].size, expected[i].size);
+                    }
+                }
+                ASSERT_EQ(i, expected.size()) << start << "+" << batch;
+                LFS_ASSERT_OK(lfs_dir_close(lfs, &dir));
+            }
+        }
+    }
+};
+
+constexpr lfs_size_t ReadplusTest::ASIZE;
+constexpr lfs_size_t ReadplusTest::BSIZE;
+
+// Windows starting anywhere, of any size, should list the same things as
+// reading one entry at a time, however ids shifted under them in the log
+TEST_P(ReadplusTest, Windows) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Populate(&lfs);
+    std::vector<Entry> expected = List(&lfs);
+    ASSERT_EQ(expected.size(), 2 + Count() - (Count()+4)/6);
+
+    Windows(&lfs, expected);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+
+    // and from a fresh mount, with whatever the log looks like on disk
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    for (lfs_size_t batch : {(lfs_size_t)3, (lfs_size_t)1000}) {
+        ASSERT_EQ(ListPlus(&lfs, batch), expected) << batch;
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Creating names back to front splices every entry up an id, removing them
+// from the front splices them back down, each splice must carry whatever
+// the window already holds along with it
+TEST_P(ReadplusTest, Shifts) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+
+    // short names and few of them, so this all stays in one log without
+    // compacting into id order
+    for (lfs_size_t i = 0; i < 8; i++) {
+        std::string path = "dir/" + std::to_string(8-i);
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file, path.c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        ASSERT_EQ(lfs_file_write(&lfs, &file, &i, i % 4),
+                (lfs_ssize_t)(i % 4));
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        LFS_ASSERT_OK(lfs_setattr(&lfs, path.c_str(), 'a', &i, ASIZE));
+    }
+    for (lfs_size_t i = 1; i <= 2; i++) {
+        LFS_ASSERT_OK(lfs_remove(&lfs, ("dir/" + std::to_string(i)).c_str()));
+    }
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir/0"));
+
+    std::vector<Entry> expected = List(&lfs);
+    ASSERT_EQ(expected.size(), 2u + 7u);
+    Windows(&lfs, expected);
+    for (lfs_size_t batch : {(lfs_size_t)1, (lfs_size_t)3, (lfs_size_t)9}) {
+        ASSERT_EQ(ListPlus(&lfs, batch), expected) << batch;
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Attrs longer than their buffer are truncated, shorter ones and missing
+// ones are padded with zeros, and only the latest of each counts
+TEST_P(ReadplusTest, Attrs) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    for (lfs_size_t i = 0; i < Count(); i++) {
+        std::string path = "dir/" + Name(i);
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file, path.c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+
+        // shrink 'a' down from longer than its buffer, leaving old bytes
+        // behind in the log
+        uint8_t a[2*ASIZE];
+        for (lfs_size_t size = 2*ASIZE; size > i % (2*ASIZE); size--) {
+            memset(a, (int)(size + 16*i), sizeof(a));
+            LFS_ASSERT_OK(lfs_setattr(&lfs, path.c_str(), 'a', a, size));
+        }
+
+        // set 'b', and remove it again for some
+        std::string b(1 + i % (2*BSIZE), (char)('b' + i));
+        LFS_ASSERT_OK(lfs_setattr(&lfs, path.c_str(), 'b',
+                b.data(), b.size()));
+        if (i % 3 == 0) {
+            LFS_ASSERT_OK(lfs_removeattr(&lfs, path.c_str(), 'b'));
+        }
+    }
+
+    std::vector<Entry> expected = List(&lfs);
+    for (lfs_size_t batch : {(lfs_size_t)1, (lfs_size_t)4,
+            (lfs_size_t)1000}) {
+        ASSERT_EQ(ListPlus(&lfs, batch), expected) << batch;
+    }
+
+    // stale bytes in the caller's buffers must not leak through
+    std::vector<struct lfs_info> infos(Count()+2);
+    std::vector<uint8_t> buffer(infos.size()*BSIZE, 0xcc);
+    struct lfs_attr attrs[] = {{'b', buffer.data(), BSIZE}};
+    lfs_dir_t dir;
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &dir, "dir"));
+    ASSERT_EQ(lfs_dir_readplus(&lfs, &dir, infos.data(), infos.size(),
+            attrs, 1), (lfs_ssize_t)expected.size());
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &dir));
+    for (lfs_size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(std::vector<uint8_t>(&buffer[i*BSIZE],
+                &buffer[(i+1)*BSIZE]), expected[i].b) << expected[i].name;
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Creates, removes and renames between batches must move our place the
+// same way they move a directory being read one entry at a time
+TEST_P(ReadplusTest, Lockstep) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Populate(&lfs);
+
+    lfs_dir_t plus;
+    lfs_dir_t dir;
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &plus, "dir"));
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &dir, "dir"));
+    struct lfs_info infos[4];
+    struct lfs_info info;
+    for (lfs_size_t k = 0; ; k++) {
+        lfs_ssize_t res = lfs_dir_readplus(&lfs, &plus, infos, 4, NULL, 0);
+        ASSERT_GE(res, 0);
+        for (lfs_ssize_t i = 0; i < res; i++) {
+            ASSERT_EQ(lfs_dir_read(&lfs, &dir, &info), 1);
+            ASSERT_EQ(std::string(infos[i].name), info.name);
+            ASSERT_EQ(infos[i].type, info.type);
+            ASSERT_EQ(infos[i].size, info.size);
+        }
+        if (res == 0) {
+            ASSERT_EQ(lfs_dir_read(&lfs, &dir, &info), 0);
+            break;
+        }
+
+        // remove something we've listed and something we haven't, create
+        // names either side of our place, and rename one across it
+        std::string last = infos[res-1].name;
+        if (infos[res-1].type == LFS_TYPE_REG) {
+            LFS_ASSERT_OK(lfs_remove(&lfs, ("dir/" + last).c_str()));
+        }
+        std::string ahead = "dir/" + Name((7*k + 3) % Count());
+        if (lfs_stat(&lfs, ahead.c_str(), &info) == 0
+                && info.type == LFS_TYPE_REG) {
+            LFS_ASSERT_OK(lfs_remove(&lfs, ahead.c_str()));
+        }
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file,
+                ("dir/a" + std::to_string(k)).c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file,
+                ("dir/z" + std::to_string(k)).c_str(),
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+        LFS_ASSERT_OK(lfs_rename(&lfs, ("dir/a" + std::to_string(k)).c_str(),
+                ("dir/y" + std::to_string(k)).c_str()));
+    }
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &dir));
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &plus));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Readplus mixes with read, seek and tell, and an empty batch reads nothing
+TEST_P(ReadplusTest, Seek) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Populate(&lfs);
+    std::vector<Entry> expected = List(&lfs);
+
+    lfs_dir_t dir;
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &dir, "dir"));
+    struct lfs_info infos[5];
+    ASSERT_EQ(lfs_dir_readplus(&lfs, &dir, infos, 5, NULL, 0), 5);
+    for (lfs_size_t i = 0; i < 5; i++) {
+        ASSERT_EQ(infos[i].name, expected[i].name);
+        ASSERT_EQ(infos[i].size, expected[i].size);
+    }
+    struct lfs_info info;
+    ASSERT_EQ(lfs_dir_read(&lfs, &dir, &info), 1);
+    ASSERT_EQ(info.name, expected[5].name);
+    ASSERT_EQ(lfs_dir_tell(&lfs, &dir), 6);
+    ASSERT_EQ(lfs_dir_readplus(&lfs, &dir, infos, 1, NULL, 0), 1);
+    ASSERT_EQ(infos[0].name, expected[6].name);
+    LFS_ASSERT_OK(lfs_dir_seek(&lfs, &dir, 3));
+    ASSERT_EQ(lfs_dir_readplus(&lfs, &dir, infos, 2, NULL, 0), 2);
+    ASSERT_EQ(infos[0].name, expected[3].name);
+    ASSERT_EQ(infos[1].name, expected[4].name);
+    ASSERT_EQ(lfs_dir_readplus(&lfs, &dir, infos, 0, NULL, 0), 0);
+    ASSERT_EQ(lfs_dir_tell(&lfs, &dir), 5);
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &dir));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Listing a directory in batches should read less than reading each entry
+// on its own, which scans each metadata pair's log once per entry
+TEST_P(ReadplusTest, Readed) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    Populate(&lfs);
+
+    lfs_dir_t dir;
+    struct lfs_info info;
+    lfs_emubd_sio_t read = lfs_emubd_readed(&cfg_);
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &dir, "dir"));
+    while (lfs_dir_read(&lfs, &dir, &info) > 0) {
+    }
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &dir));
+    read = lfs_emubd_readed(&cfg_) - read;
+
+    std::vector<struct lfs_info> infos(Count()+2);
+    lfs_emubd_sio_t batched = lfs_emubd_readed(&cfg_);
+    LFS_ASSERT_OK(lfs_dir_open(&lfs, &dir, "dir"));
+    while (lfs_dir_readplus(&lfs, &dir,
+            infos.data(), infos.size(), NULL, 0) > 0) {
+    }
+    LFS_ASSERT_OK(lfs_dir_close(&lfs, &dir));
+    batched = lfs_emubd_readed(&cfg_) - batched;
+    EXPECT_LE(batched, read);
+
+    // unless the cache holds whole blocks, rescanning logs costs reads
+    if (cfg_.cache_size < cfg_.block_size) {
+        EXPECT_LT(batched, read);
+    }
+
+    // and attrs come along without looking up each entry again
+    lfs_emubd_sio_t listed = lfs_emubd_readed(&cfg_);
+    std::vector<Entry> expected = List(&lfs);
+    listed = lfs_emubd_readed(&cfg_) - listed;
+
+    batched = lfs_emubd_readed(&cfg_);
+    ASSERT_EQ(ListPlus(&lfs, Count()), expected);
+    batched = lfs_emubd_readed(&cfg_) - batched;
+    EXPECT_LT(batched, listed);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, ReadplusTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
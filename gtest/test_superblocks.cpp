@@ -64,7 +64,8 @@ TEST_P(SuperblocksTest, Stat) {
 
     struct lfs_fsinfo fsinfo;
     ASSERT_EQ(lfs_fs_stat(&lfs, &fsinfo), 0);
-    ASSERT_EQ(fsinfo.disk_version, LFS_DISK_VERSION);
+    // no free map or name hashes yet, so still lfs2.1
+    ASSERT_EQ(fsinfo.disk_version, 0x00020001u);
     ASSERT_EQ(fsinfo.name_max, LFS_NAME_MAX);
     ASSERT_EQ(fsinfo.file_max, LFS_FILE_MAX);
     ASSERT_EQ(fsinfo.attr_max, LFS_ATTR_MAX);
@@ -91,7 +92,8 @@ TEST_P(SuperblocksTest, StatTweaked) {
 
     struct lfs_fsinfo fsinfo;
     ASSERT_EQ(lfs_fs_stat(&lfs, &fsinfo), 0);
-    ASSERT_EQ(fsinfo.disk_version, LFS_DISK_VERSION);
+    // no free map or name hashes yet, so still lfs2.1
+    ASSERT_EQ(fsinfo.disk_version, 0x00020001u);
     ASSERT_EQ(fsinfo.name_max, TWEAKED_NAME_MAX);
     ASSERT_EQ(fsinfo.file_max, TWEAKED_FILE_MAX);
     ASSERT_EQ(fsinfo.attr_max, TWEAKED_ATTR_MAX);
@@ -0,0 +1,129 @@
+/*
+ * Traversal tests - lfs_fs_traverse and lfs_fs_traverserange
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <set>
+
+class TraverseTest : public LfsParametricTest {
+protected:
+    struct Ranges {
+        std::set<lfs_block_t> blocks;
+        lfs_size_t calls = 0;
+    };
+
+    static int Collect(void *data, lfs_block_t block) {
+        static_cast<std::set<lfs_block_t>*>(data)->insert(block);
+        return 0;
+    }
+
+    static int CollectRange(void *data, lfs_block_t block, lfs_size_t count) {
+        Ranges *ranges = static_cast<Ranges*>(data);
+        EXPECT_GT(count, 0u);
+        for (lfs_size_t i = 0; i < count; i++) {
+            ranges->blocks.insert(block + i);
+        }
+        ranges->calls += 1;
+        return 0;
+    }
+
+    int WriteFile(lfs_t *lfs, const char *path, lfs_size_t size) {
+        lfs_file_t file;
+        int err = lfs_file_open(lfs, &file, path,
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+        if (err) {
+            return err;
+        }
+
+        uint8_t buffer[64];
+        memset(buffer, 'x', sizeof(buffer));
+        for (lfs_size_t j = 0; j < size; j += sizeof(buffer)) {
+            lfs_size_t chunk = std::min<lfs_size_t>(sizeof(buffer), size-j);
+            lfs_ssize_t res = lfs_file_write(lfs, &file, buffer, chunk);
+            if (res < 0) {
+                lfs_file_close(lfs, &file);
+                return (int)res;
+            }
+        }
+        return lfs_file_close(lfs, &file);
+    }
+};
+
+// Ranges should cover exactly the blocks reported one at a time
+TEST_P(TraverseTest, Ranges) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mkdir(&lfs, "dir"));
+    LFS_ASSERT_OK(WriteFile(&lfs, "dir/small", 7));
+    LFS_ASSERT_OK(WriteFile(&lfs, "dir/big", 5*cfg_.block_size));
+
+    // interleave two files so their blocks aren't contiguous
+    const char *names[] = {"a", "b"};
+    lfs_file_t files[2];
+    for (int n = 0; n < 2; n++) {
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &files[n], names[n],
+                LFS_O_WRONLY | LFS_O_CREAT));
+    }
+    uint8_t buffer[64];
+    memset(buffer, 'y', sizeof(buffer));
+    for (lfs_size_t i = 0; i < 3*cfg_.block_size; i += sizeof(buffer)) {
+        for (int n = 0; n < 2; n++) {
+            ASSERT_EQ(lfs_file_write(&lfs, &files[n], buffer, sizeof(buffer)),
+                    (lfs_ssize_t)sizeof(buffer));
+        }
+    }
+
+    // note one file is left open and unsynced
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &files[0]));
+
+    std::set<lfs_block_t> blocks;
+    LFS_ASSERT_OK(lfs_fs_traverse(&lfs, Collect, &blocks));
+    Ranges ranges;
+    LFS_ASSERT_OK(lfs_fs_traverserange(&lfs, CollectRange, &ranges));
+    ASSERT_EQ(ranges.blocks, blocks);
+    for (lfs_block_t block : ranges.blocks) {
+        ASSERT_LT(block, cfg_.block_count);
+    }
+
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &files[1]));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// A sequentially allocated file should be reported in a handful of ranges
+TEST_P(TraverseTest, Coalesce) {
+    const lfs_size_t SIZE = (cfg_.block_count/2) * (cfg_.block_size-16);
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(WriteFile(&lfs, "big", SIZE));
+
+    Ranges ranges;
+    LFS_ASSERT_OK(lfs_fs_traverserange(&lfs, CollectRange, &ranges));
+    ASSERT_GE(ranges.blocks.size(), SIZE / cfg_.block_size);
+    EXPECT_LE(ranges.calls, 8u);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// Errors from the callback should stop the traversal
+TEST_P(TraverseTest, Error) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+    LFS_ASSERT_OK(WriteFile(&lfs, "big", 4*cfg_.block_size));
+
+    lfs_size_t calls = 0;
+    ASSERT_EQ(lfs_fs_traverserange(&lfs,
+            [](void *data, lfs_block_t, lfs_size_t) {
+                *static_cast<lfs_size_t*>(data) += 1;
+                return -12345;
+            }, &calls), -12345);
+    ASSERT_EQ(calls, 1u);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, TraverseTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,550 @@
+/*
+ * uringbd tests - file block device with positioned I/O, queued progs,
+ * and optional direct I/O
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include "bd/lfs_filebd.h"
+#include "bd/lfs_uringbd.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class UringbdTest : public LfsParametricTest {
+protected:
+    UringbdTest() {
+        count_ = 64;
+        count_blocks_ = 1;
+    }
+
+    std::string Path(const char *name) {
+        std::string path = ::testing::TempDir() + "lfs_test_uringbd_"
+                + name + "_" + GetParam().name;
+        remove(path.c_str());
+        return path;
+    }
+
+    // a buffer at shift bytes past a direct I/O aligned address, so we
+    // can pick whether direct I/O needs to go through the bounce buffer
+    static uint8_t *Aligned(std::vector<uint8_t> &raw, lfs_size_t size,
+            lfs_size_t shift) {
+        raw.resize(size + shift + 4096);
+        uintptr_t p = (uintptr_t)raw.data();
+        return (uint8_t*)(p + (4096 - p % 4096) % 4096 + shift);
+    }
+
+    // a pseudorandom mix of progs, reads, and syncs, progs continuing,
+    // overwriting, or landing apart from earlier ones, and every read
+    // checked against a model of the device
+    void Shuffle(const struct lfs_config *c, lfs_uringbd_t *bd,
+            uint32_t seed, lfs_size_t n, lfs_size_t shift,
+            std::vector<uint8_t> &model) {
+        uint32_t prng = seed;
+        auto next_rand = [&prng]() -> uint32_t {
+            prng = prng * 1103515245 + 12345;
+            return prng >> 8;
+        };
+
+        const lfs_block_t BLOCKS[] = {0, 1, cfg_.block_count-1};
+        lfs_block_t last = 0;
+        lfs_off_t end = cfg_.block_size;
+        std::vector<uint8_t> raw;
+        for (lfs_size_t k = 0; k < n; k++) {
+            uint32_t op = next_rand() % 8;
+            lfs_block_t block = BLOCKS[next_rand() % 3];
+            if (op < 4) {
+                // continue the last prog half of the time
+                lfs_off_t off = (next_rand() % (cfg_.block_size
+                        / cfg_.prog_size)) * cfg_.prog_size;
+                if (op < 2 && end < cfg_.block_size) {
+                    block = last;
+                    off = end;
+                }
+                // and now and then prog the rest of the block, which may
+                // not fit in the queue
+                lfs_size_t size = (next_rand() % 8 == 0)
+                        ? cfg_.block_size - off
+                        : std::min<lfs_size_t>(
+                            (1 + next_rand() % 4)*cfg_.prog_size,
+                            cfg_.block_size - off);
+
+                uint8_t *data = Aligned(raw, size, shift);
+                for (lfs_size_t j = 0; j < size; j++) {
+                    data[j] = LfsPattern(k, j);
+                    model[(size_t)block*cfg_.block_size + off+j] = data[j];
+                }
+                LFS_ASSERT_OK(c->prog(c, block, off, data, size));
+                last = block;
+                end = off + size;
+
+            } else if (op < 7) {
+                lfs_off_t off = (next_rand() % (cfg_.block_size
+                        / cfg_.read_size)) * cfg_.read_size;
+                lfs_size_t size = (1 + next_rand() % ((cfg_.block_size-off)
+                        / cfg_.read_size)) * cfg_.read_size;
+                uint8_t *data = Aligned(raw, size, shift);
+                LFS_ASSERT_OK(c->read(c, block, off, data, size));
+                ASSERT_TRUE(std::equal(data, data + size,
+                        &model[(size_t)block*cfg_.block_size + off]))
+                        << "op " << k << " block " << block
+                        << " off " << off << " size " << size;
+
+            } else {
+                LFS_ASSERT_OK(c->sync(c));
+            }
+
+            if (bd) {
+                ASSERT_LE(bd->queue_used, bd->cfg->queue_size);
+                ASSERT_LE(bd->queue_count,
+                        std::max<lfs_size_t>(bd->ring_entries, 1));
+            }
+        }
+    }
+
+    // read back a whole image, padded with zeros like the block devices
+    // read it
+    std::vector<uint8_t> Image(const std::string &path) {
+        std::vector<uint8_t> image(
+                (size_t)cfg_.block_size*cfg_.block_count);
+        FILE *f = fopen(path.c_str(), "rb");
+        EXPECT_TRUE(f != NULL);
+        if (f) {
+            size_t n = fread(image.data(), 1, image.size(), f);
+            (void)n;
+            fclose(f);
+        }
+        return image;
+    }
+
+    struct lfs_uringbd_config UringConfig(lfs_size_t queue_size,
+            bool direct) {
+        struct lfs_uringbd_config bdcfg;
+        memset(&bdcfg, 0, sizeof(bdcfg));
+        bdcfg.read_size = cfg_.read_size;
+        bdcfg.prog_size = cfg_.prog_size;
+        bdcfg.erase_size = cfg_.block_size;
+        bdcfg.erase_count = cfg_.block_count;
+        bdcfg.queue_size = queue_size;
+        bdcfg.direct = direct;
+        return bdcfg;
+    }
+
+    struct lfs_config UringLfsConfig(lfs_uringbd_t *bd) {
+        struct lfs_config ucfg = cfg_;
+        ucfg.context = bd;
+        ucfg.read = lfs_uringbd_read;
+        ucfg.prog = lfs_uringbd_prog;
+        ucfg.erase = lfs_uringbd_erase;
+        ucfg.sync = lfs_uringbd_sync;
+        return ucfg;
+    }
+};
+
+// Every queue size, from none to several blocks, should read back and
+// write out exactly what a plain file does
+TEST_P(UringbdTest, MatchesFilebd) {
+    std::string fpath = Path("filebd");
+    struct lfs_filebd_config filecfg;
+    memset(&filecfg, 0, sizeof(filecfg));
+    filecfg.read_size = cfg_.read_size;
+    filecfg.prog_size = cfg_.prog_size;
+    filecfg.erase_size = cfg_.block_size;
+    filecfg.erase_count = cfg_.block_count;
+
+    lfs_filebd_t filebd;
+    struct lfs_config fcfg = cfg_;
+    fcfg.context = &filebd;
+    fcfg.read = lfs_filebd_read;
+    fcfg.prog = lfs_filebd_prog;
+    fcfg.erase = lfs_filebd_erase;
+    fcfg.sync = lfs_filebd_sync;
+    LFS_ASSERT_OK(lfs_filebd_create(&fcfg, fpath.c_str(), &filecfg));
+
+    std::vector<uint8_t> expected(
+            (size_t)cfg_.block_size*cfg_.block_count, 0);
+    Shuffle(&fcfg, NULL, 42, 8*Count(), 0, expected);
+    LFS_ASSERT_OK(lfs_filebd_destroy(&fcfg));
+    ASSERT_TRUE(Image(fpath) == expected);
+    remove(fpath.c_str());
+
+    for (lfs_size_t queue_size : {(lfs_size_t)0, cfg_.prog_size,
+            3*cfg_.prog_size, cfg_.block_size, 4*cfg_.block_size}) {
+        std::string upath = Path("uringbd");
+        struct lfs_uringbd_config bdcfg = UringConfig(queue_size, false);
+        lfs_uringbd_t bd;
+        struct lfs_config ucfg = UringLfsConfig(&bd);
+        LFS_ASSERT_OK(lfs_uringbd_create(&ucfg, upath.c_str(), &bdcfg));
+
+        // destroy must write out whatever is still queued
+        std::vector<uint8_t> model(
+                (size_t)cfg_.block_size*cfg_.block_count, 0);
+        Shuffle(&ucfg, &bd, 42, 8*Count(), 0, model);
+        LFS_ASSERT_OK(lfs_uringbd_destroy(&ucfg));
+
+        EXPECT_TRUE(model == expected) << "queue_size " << queue_size;
+        EXPECT_TRUE(Image(upath) == expected) << "queue_size " << queue_size;
+        remove(upath.c_str());
+    }
+}
+// Reads must see queued progs, and progs must land in order even when
+// they overwrite each other
+TEST_P(UringbdTest, Queued) {
+    std::string path = Path("queued");
+    struct lfs_uringbd_config bdcfg = UringConfig(4*cfg_.block_size, false);
+    lfs_uringbd_t bd;
+    struct lfs_config ucfg = UringLfsConfig(&bd);
+    LFS_ASSERT_OK(lfs_uringbd_create(&ucfg, path.c_str(), &bdcfg));
+
+    std::vector<uint8_t> a(cfg_.block_size), b(cfg_.block_size);
+    for (lfs_size_t j = 0; j < cfg_.block_size; j++) {
+        a[j] = LfsPattern(1, j);
+        b[j] = LfsPattern(2, j);
+    }
+
+    // prog in prog_size chunks, these should all be merged
+    for (lfs_size_t j = 0; j < cfg_.block_size; j += cfg_.prog_size) {
+        LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 1, j,
+                &a[j], cfg_.prog_size));
+    }
+    EXPECT_EQ(bd.queue_count, 1u);
+
+    // overwrite the block before it's written out
+    LFS_ASSERT_OK(lfs_uringbd_erase(&ucfg, 1));
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 1, 0, b.data(), cfg_.block_size));
+
+    // read back before a sync, this should come from the queue, partial
+    // reads included
+    std::vector<uint8_t> buffer(cfg_.block_size);
+    LFS_ASSERT_OK(lfs_uringbd_read(&ucfg, 1, 0,
+            buffer.data(), cfg_.block_size));
+    EXPECT_TRUE(buffer == b);
+    lfs_size_t half = cfg_.block_size/2 - (cfg_.block_size/2)%cfg_.read_size;
+    LFS_ASSERT_OK(lfs_uringbd_read(&ucfg, 1, half,
+            buffer.data(), cfg_.block_size-half));
+    EXPECT_TRUE(std::equal(b.begin() + half, b.end(), buffer.begin()));
+    EXPECT_EQ(bd.queue_count, 1u);
+
+    // unwritten blocks read as zeros
+    LFS_ASSERT_OK(lfs_uringbd_read(&ucfg, cfg_.block_count-1, 0,
+            buffer.data(), cfg_.block_size));
+    EXPECT_TRUE(buffer == std::vector<uint8_t>(cfg_.block_size, 0));
+
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 0, 0, a.data(), cfg_.block_size));
+    LFS_ASSERT_OK(lfs_uringbd_sync(&ucfg));
+    LFS_ASSERT_OK(lfs_uringbd_destroy(&ucfg));
+
+    std::vector<uint8_t> image = Image(path);
+    EXPECT_TRUE(std::equal(a.begin(), a.end(), image.begin()));
+    EXPECT_TRUE(std::equal(b.begin(), b.end(),
+            image.begin() + cfg_.block_size));
+    remove(path.c_str());
+}
+
+// Extending the last queued prog must not reach into an earlier queued
+// prog, queued progs are unordered so the older bytes could win
+TEST_P(UringbdTest, Overlap) {
+    if (2*cfg_.prog_size > cfg_.block_size) {
+        GTEST_SKIP() << "needs two progs in a block";
+    }
+
+    std::string path = Path("overlap");
+    struct lfs_uringbd_config bdcfg = UringConfig(4*cfg_.block_size, false);
+    lfs_uringbd_t bd;
+    struct lfs_config ucfg = UringLfsConfig(&bd);
+    LFS_ASSERT_OK(lfs_uringbd_create(&ucfg, path.c_str(), &bdcfg));
+
+    lfs_size_t p = cfg_.prog_size;
+    std::vector<uint8_t> a(2*p), b(p);
+    for (lfs_size_t j = 0; j < 2*p; j++) {
+        a[j] = LfsPattern(1, j);
+    }
+    for (lfs_size_t j = 0; j < p; j++) {
+        b[j] = LfsPattern(2, j);
+    }
+
+    // queue the second half, then the first half, then reprogram the
+    // second half, which continues the last queued prog
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 1, p, &a[p], p));
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 1, 0, &a[0], p));
+    EXPECT_EQ(bd.queue_count, 2u);
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 1, p, b.data(), p));
+    EXPECT_EQ(bd.queue_count, 1u);
+
+    std::vector<uint8_t> buffer(2*p);
+    LFS_ASSERT_OK(lfs_uringbd_read(&ucfg, 1, 0, buffer.data(), 2*p));
+    EXPECT_TRUE(std::equal(a.begin(), a.begin() + p, buffer.begin()));
+    EXPECT_TRUE(std::equal(b.begin(), b.end(), buffer.begin() + p));
+
+    LFS_ASSERT_OK(lfs_uringbd_sync(&ucfg));
+    LFS_ASSERT_OK(lfs_uringbd_destroy(&ucfg));
+
+    std::vector<uint8_t> image = Image(path);
+    EXPECT_TRUE(std::equal(a.begin(), a.begin() + p,
+            image.begin() + cfg_.block_size));
+    EXPECT_TRUE(std::equal(b.begin(), b.end(),
+            image.begin() + cfg_.block_size + p));
+    remove(path.c_str());
+}
+
+// The queue is full when it runs out of entries or bytes, either way it
+// must be written out before the next prog is queued, and no sooner
+TEST_P(UringbdTest, Full) {
+    std::string path = Path("full");
+    // never zero, so written bytes can't pass for unwritten ones
+    std::vector<uint8_t> a(cfg_.block_size);
+    for (lfs_size_t j = 0; j < cfg_.block_size; j++) {
+        a[j] = LfsPattern(1, j) | 1;
+    }
+
+    // progs that don't continue each other each take an entry
+    {
+        struct lfs_uringbd_config bdcfg = UringConfig(
+                4*cfg_.block_size, false);
+        lfs_uringbd_t bd;
+        struct lfs_config ucfg = UringLfsConfig(&bd);
+        LFS_ASSERT_OK(lfs_uringbd_create(&ucfg, path.c_str(), &bdcfg));
+        lfs_size_t entries = std::min<lfs_size_t>(
+                4*cfg_.block_size/cfg_.prog_size, 256);
+        lfs_size_t slots = cfg_.block_size/cfg_.prog_size;
+        ASSERT_LE(2*entries, slots*cfg_.block_count);
+
+        // every other slot, so no prog is next to another
+        for (lfs_size_t i = 0; i <= entries; i++) {
+            lfs_size_t slot = 2*i;
+            LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, slot / slots,
+                    (slot % slots)*cfg_.prog_size,
+                    &a[(slot % slots)*cfg_.prog_size], cfg_.prog_size));
+            ASSERT_EQ(bd.queue_count, (i < entries) ? i+1 : 1);
+        }
+
+        // only the last prog is still queued, but reads see them all
+        std::vector<uint8_t> image = Image(path);
+        std::vector<uint8_t> buffer(cfg_.prog_size);
+        for (lfs_size_t i = 0; i <= entries; i++) {
+            lfs_size_t slot = 2*i;
+            lfs_off_t off = (slot % slots)*cfg_.prog_size;
+            size_t pos = (size_t)(slot / slots)*cfg_.block_size + off;
+            ASSERT_EQ(std::equal(a.begin() + off,
+                    a.begin() + off + cfg_.prog_size,
+                    image.begin() + pos), i < entries) << "slot " << slot;
+            LFS_ASSERT_OK(lfs_uringbd_read(&ucfg, slot / slots, off,
+                    buffer.data(), cfg_.prog_size));
+            ASSERT_TRUE(std::equal(buffer.begin(), buffer.end(),
+                    a.begin() + off)) << "slot " << slot;
+        }
+        LFS_ASSERT_OK(lfs_uringbd_destroy(&ucfg));
+        remove(path.c_str());
+    }
+
+    // progs that continue each other share an entry, until they run out
+    // of bytes
+    if (4*cfg_.prog_size <= cfg_.block_size) {
+        struct lfs_uringbd_config bdcfg = UringConfig(
+                3*cfg_.prog_size, false);
+        lfs_uringbd_t bd;
+        struct lfs_config ucfg = UringLfsConfig(&bd);
+        LFS_ASSERT_OK(lfs_uringbd_create(&ucfg, path.c_str(), &bdcfg));
+        for (lfs_size_t i = 0; i < 4; i++) {
+            LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 0, i*cfg_.prog_size,
+                    &a[i*cfg_.prog_size], cfg_.prog_size));
+            ASSERT_EQ(bd.queue_count, 1u);
+            ASSERT_EQ(bd.queue_used, ((i < 3) ? i+1 : 1)*cfg_.prog_size);
+        }
+
+        std::vector<uint8_t> image = Image(path);
+        EXPECT_TRUE(std::equal(a.begin(), a.begin() + 3*cfg_.prog_size,
+                image.begin()));
+        EXPECT_FALSE(std::equal(a.begin() + 3*cfg_.prog_size,
+                a.begin() + 4*cfg_.prog_size,
+                image.begin() + 3*cfg_.prog_size));
+        LFS_ASSERT_OK(lfs_uringbd_destroy(&ucfg));
+        remove(path.c_str());
+    }
+}
+
+// Progs too big for the queue are written straight away, which must not
+// let an older queued prog of the same bytes land on top of them later
+TEST_P(UringbdTest, Oversized) {
+    if (2*cfg_.prog_size > cfg_.block_size) {
+        GTEST_SKIP() << "needs two progs in a block";
+    }
+
+    std::string path = Path("oversized");
+    struct lfs_uringbd_config bdcfg = UringConfig(cfg_.prog_size, false);
+    lfs_uringbd_t bd;
+    struct lfs_config ucfg = UringLfsConfig(&bd);
+    LFS_ASSERT_OK(lfs_uringbd_create(&ucfg, path.c_str(), &bdcfg));
+
+    lfs_size_t p = cfg_.prog_size;
+    std::vector<uint8_t> a(p), b(2*p);
+    for (lfs_size_t j = 0; j < p; j++) {
+        a[j] = LfsPattern(1, j);
+    }
+    for (lfs_size_t j = 0; j < 2*p; j++) {
+        b[j] = LfsPattern(2, j);
+    }
+
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 1, p, a.data(), p));
+    ASSERT_EQ(bd.queue_count, 1u);
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 1, 0, b.data(), 2*p));
+    ASSERT_EQ(bd.queue_count, 0u);
+
+    std::vector<uint8_t> buffer(2*p);
+    LFS_ASSERT_OK(lfs_uringbd_read(&ucfg, 1, 0, buffer.data(), 2*p));
+    EXPECT_TRUE(buffer == b);
+    LFS_ASSERT_OK(lfs_uringbd_destroy(&ucfg));
+
+    std::vector<uint8_t> image = Image(path);
+    EXPECT_TRUE(std::equal(b.begin(), b.end(),
+            image.begin() + cfg_.block_size));
+    remove(path.c_str());
+}
+
+// Reads past the end of the file are zeros, but queued progs there, not
+// yet written, must still be seen, as must the file's last bytes
+TEST_P(UringbdTest, Eof) {
+    if (2*cfg_.prog_size > cfg_.block_size) {
+        GTEST_SKIP() << "needs two progs in a block";
+    }
+
+    std::string path = Path("eof");
+    struct lfs_uringbd_config bdcfg = UringConfig(cfg_.block_size, false);
+    lfs_uringbd_t bd;
+    struct lfs_config ucfg = UringLfsConfig(&bd);
+    LFS_ASSERT_OK(lfs_uringbd_create(&ucfg, path.c_str(), &bdcfg));
+
+    lfs_size_t p = cfg_.prog_size;
+    std::vector<uint8_t> a(p), b(p);
+    for (lfs_size_t j = 0; j < p; j++) {
+        a[j] = LfsPattern(1, j);
+        b[j] = LfsPattern(2, j);
+    }
+
+    // the file ends one prog into block 1, with a prog queued right
+    // after it and one at the very end of the device
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 1, 0, a.data(), p));
+    LFS_ASSERT_OK(lfs_uringbd_sync(&ucfg));
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, cfg_.block_count-1,
+            cfg_.block_size-p, b.data(), p));
+    LFS_ASSERT_OK(lfs_uringbd_prog(&ucfg, 1, p, b.data(), p));
+    ASSERT_EQ(bd.queue_count, 2u);
+
+    std::vector<uint8_t> expected(cfg_.block_size, 0);
+    std::copy(a.begin(), a.end(), expected.begin());
+    std::copy(b.begin(), b.end(), expected.begin() + p);
+    std::vector<uint8_t> buffer(cfg_.block_size, 0xcc);
+    LFS_ASSERT_OK(lfs_uringbd_read(&ucfg, 1, 0,
+            buffer.data(), cfg_.block_size));
+    EXPECT_TRUE(buffer == expected);
+
+    std::fill(buffer.begin(), buffer.end(), 0xcc);
+    LFS_ASSERT_OK(lfs_uringbd_read(&ucfg, cfg_.block_count-1, 0,
+            buffer.data(), cfg_.block_size));
+    EXPECT_TRUE(std::all_of(buffer.begin(), buffer.end()-p,
+            [](uint8_t x) { return x == 0; }));
+    EXPECT_TRUE(std::equal(b.begin(), b.end(), buffer.end()-p));
+
+    LFS_ASSERT_OK(lfs_uringbd_destroy(&ucfg));
+    std::vector<uint8_t> image = Image(path);
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(),
+            image.begin() + cfg_.block_size));
+    EXPECT_TRUE(std::equal(b.begin(), b.end(), image.end()-p));
+    remove(path.c_str());
+}
+
+// littlefs syncs before every commit, by then everything it has progged
+// must be in the file where anyone else can see it
+TEST_P(UringbdTest, Synced) {
+    std::string path = Path("synced");
+    struct lfs_uringbd_config bdcfg = UringConfig(4*cfg_.block_size, false);
+    lfs_uringbd_t bd;
+    struct lfs_config ucfg = UringLfsConfig(&bd);
+    LFS_ASSERT_OK(lfs_uringbd_create(&ucfg, path.c_str(), &bdcfg));
+
+    struct lfs_filebd_config filecfg;
+    memset(&filecfg, 0, sizeof(filecfg));
+    filecfg.read_size = cfg_.read_size;
+    filecfg.prog_size = cfg_.prog_size;
+    filecfg.erase_size = cfg_.block_size;
+    filecfg.erase_count = cfg_.block_count;
+    lfs_filebd_t filebd;
+    struct lfs_config fcfg = cfg_;
+    fcfg.context = &filebd;
+    fcfg.read = lfs_filebd_read;
+    fcfg.prog = lfs_filebd_prog;
+    fcfg.erase = lfs_filebd_erase;
+    fcfg.sync = lfs_filebd_sync;
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &ucfg));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &ucfg));
+    const lfs_size_t SIZES[] = {7, cfg_.block_size/3, cfg_.block_size+1};
+    for (lfs_size_t i = 0; i < 3; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "file%u", (unsigned)i);
+        std::vector<uint8_t> data(SIZES[i]);
+        for (lfs_size_t j = 0; j < data.size(); j++) {
+            data[j] = LfsPattern(i, j);
+        }
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(&lfs, &file, name,
+                LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        ASSERT_EQ(lfs_file_write(&lfs, &file, data.data(), data.size()),
+                (lfs_ssize_t)data.size());
+        LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+
+        // a second littlefs, reading the file directly
+        lfs_t other;
+        LFS_ASSERT_OK(lfs_filebd_create(&fcfg, path.c_str(), &filecfg));
+        LFS_ASSERT_OK(lfs_mount(&other, &fcfg));
+        LFS_ASSERT_OK(lfs_file_open(&other, &file, name, LFS_O_RDONLY));
+        std::vector<uint8_t> buffer(data.size());
+        ASSERT_EQ(lfs_file_read(&other, &file,
+                buffer.data(), buffer.size()),
+                (lfs_ssize_t)buffer.size());
+        ASSERT_TRUE(buffer == data) << name;
+        LFS_ASSERT_OK(lfs_file_close(&other, &file));
+        LFS_ASSERT_OK(lfs_unmount(&other));
+        LFS_ASSERT_OK(lfs_filebd_destroy(&fcfg));
+    }
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+    LFS_ASSERT_OK(lfs_uringbd_destroy(&ucfg));
+    remove(path.c_str());
+}
+
+// Direct I/O needs aligned sizes, and a host filesystem that supports it,
+// buffers that aren't aligned go through the bounce buffer
+TEST_P(UringbdTest, Direct) {
+    if (cfg_.read_size % 512 != 0 || cfg_.prog_size % 512 != 0) {
+        GTEST_SKIP() << "direct I/O needs 512-byte aligned reads and progs";
+    }
+
+    std::string path = Path("direct");
+    for (lfs_size_t queue_size : {(lfs_size_t)0, 4*cfg_.block_size}) {
+        for (lfs_size_t shift : {(lfs_size_t)0, (lfs_size_t)1}) {
+            struct lfs_uringbd_config bdcfg = UringConfig(queue_size, true);
+            lfs_uringbd_t bd;
+            struct lfs_config ucfg = UringLfsConfig(&bd);
+            int err = lfs_uringbd_create(&ucfg, path.c_str(), &bdcfg);
+            if (err == -EINVAL) {
+                remove(path.c_str());
+                GTEST_SKIP() << "host filesystem doesn't support O_DIRECT";
+            }
+            LFS_ASSERT_OK(err);
+
+            std::vector<uint8_t> model(
+                    (size_t)cfg_.block_size*cfg_.block_count, 0);
+            Shuffle(&ucfg, &bd, 42+shift, 4*Count(), shift, model);
+            LFS_ASSERT_OK(lfs_uringbd_destroy(&ucfg));
+            EXPECT_TRUE(Image(path) == model)
+                    << "queue_size " << queue_size << " shift " << shift;
+            remove(path.c_str());
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, UringbdTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
@@ -0,0 +1,173 @@
+/*
+ * Vectored I/O tests - lfs_file_readv and lfs_file_writev
+ */
+#include "lfs_test_fixture.h"
+#include "lfs_test_macros.h"
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+class VectoredTest : public LfsParametricTest {
+protected:
+    void CheckFile(lfs_t *lfs, const char *path,
+            const std::vector<uint8_t> &model) {
+        lfs_file_t file;
+        LFS_ASSERT_OK(lfs_file_open(lfs, &file, path, LFS_O_RDONLY));
+        ASSERT_EQ(lfs_file_size(lfs, &file), (lfs_soff_t)model.size());
+        uint8_t buffer[64];
+        for (lfs_size_t j = 0; j < model.size(); j += sizeof(buffer)) {
+            lfs_size_t n = std::min<lfs_size_t>(sizeof(buffer),
+                    model.size()-j);
+            ASSERT_EQ(lfs_file_read(lfs, &file, buffer, n), (lfs_ssize_t)n);
+            for (lfs_size_t k = 0; k < n; k++) {
+                ASSERT_EQ(buffer[k], model[j+k]) << "off " << j+k;
+            }
+        }
+        LFS_ASSERT_OK(lfs_file_close(lfs, &file));
+    }
+};
+
+// writev should write the same data as a write per segment, including
+// empty segments and segments crossing blocks
+TEST_P(VectoredTest, Writev) {
+    const lfs_size_t SIZES[] = {0, 1, 7, 0, 64, cfg_.block_size+3, 13};
+    std::vector<uint8_t> model;
+    for (lfs_size_t size : SIZES) {
+        model.resize(model.size() + size);
+    }
+    for (lfs_size_t j = 0; j < model.size(); j++) {
+        model[j] = LfsPattern(1, j);
+    }
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+
+    std::vector<struct lfs_iovec> iov;
+    lfs_size_t off = 0;
+    for (lfs_size_t size : SIZES) {
+        iov.push_back({&model[off], size});
+        off += size;
+    }
+
+    // write the whole thing twice, the second time appending
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+            LFS_O_WRONLY | LFS_O_CREAT));
+    ASSERT_EQ(lfs_file_writev(&lfs, &file, iov.data(), iov.size()),
+            (lfs_ssize_t)model.size());
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    CheckFile(&lfs, "file", model);
+
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+            LFS_O_WRONLY | LFS_O_APPEND));
+    ASSERT_EQ(lfs_file_writev(&lfs, &file, iov.data(), iov.size()),
+            (lfs_ssize_t)model.size());
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    std::vector<uint8_t> model2 = model;
+    model2.insert(model2.end(), model.begin(), model.end());
+    CheckFile(&lfs, "file", model2);
+
+    // no segments is a noop
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file", LFS_O_WRONLY));
+    ASSERT_EQ(lfs_file_writev(&lfs, &file, NULL, 0), 0);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    CheckFile(&lfs, "file", model2);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// writev past the end of the file fills the gap with zeros once
+TEST_P(VectoredTest, WritevPastEnd) {
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+
+    uint8_t a[3] = {'a', 'b', 'c'};
+    uint8_t b[5] = {'d', 'e', 'f', 'g', 'h'};
+    struct lfs_iovec iov[] = {{a, sizeof(a)}, {b, sizeof(b)}};
+    const lfs_off_t OFF = cfg_.block_size + 5;
+
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+            LFS_O_WRONLY | LFS_O_CREAT));
+    ASSERT_EQ(lfs_file_seek(&lfs, &file, OFF, LFS_SEEK_SET),
+            (lfs_soff_t)OFF);
+    ASSERT_EQ(lfs_file_writev(&lfs, &file, iov, 2), 8);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+
+    std::vector<uint8_t> model(OFF, 0);
+    model.insert(model.end(), a, a+sizeof(a));
+    model.insert(model.end(), b, b+sizeof(b));
+    CheckFile(&lfs, "file", model);
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// writev checks the file size limit against all segments together
+TEST_P(VectoredTest, WritevFbig) {
+    cfg_.file_max = 64;
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+
+    uint8_t buffer[40];
+    memset(buffer, 'x', sizeof(buffer));
+    struct lfs_iovec iov[] = {{buffer, 40}, {buffer, 24}, {buffer, 1}};
+
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+            LFS_O_WRONLY | LFS_O_CREAT));
+    ASSERT_EQ(lfs_file_writev(&lfs, &file, iov, 3), LFS_ERR_FBIG);
+    ASSERT_EQ(lfs_file_size(&lfs, &file), 0);
+    ASSERT_EQ(lfs_file_writev(&lfs, &file, iov, 2), 64);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+// readv fills segments in order and stops at the end of the file
+TEST_P(VectoredTest, Readv) {
+    const lfs_size_t SIZE = 2*cfg_.block_size + 11;
+    std::vector<uint8_t> model(SIZE);
+    for (lfs_size_t j = 0; j < SIZE; j++) {
+        model[j] = LfsPattern(1, j);
+    }
+
+    lfs_t lfs;
+    LFS_ASSERT_OK(lfs_format(&lfs, &cfg_));
+    LFS_ASSERT_OK(lfs_mount(&lfs, &cfg_));
+
+    lfs_file_t file;
+    LFS_ASSERT_OK(lfs_file_open(&lfs, &file, "file",
+            LFS_O_RDWR | LFS_O_CREAT));
+    ASSERT_EQ(lfs_file_write(&lfs, &file, model.data(), SIZE),
+            (lfs_ssize_t)SIZE);
+
+    // note this also flushes our pending write
+    ASSERT_EQ(lfs_file_seek(&lfs, &file, 5, LFS_SEEK_SET), 5);
+    std::vector<uint8_t> a(3), b(cfg_.block_size), c(0), d(SIZE);
+    struct lfs_iovec iov[] = {
+            {a.data(), (lfs_size_t)a.size()},
+            {b.data(), (lfs_size_t)b.size()},
+            {c.data(), (lfs_size_t)c.size()},
+            {d.data(), (lfs_size_t)d.size()},
+            {a.data(), (lfs_size_t)a.size()}};
+    ASSERT_EQ(lfs_file_readv(&lfs, &file, iov, 5), (lfs_ssize_t)(SIZE-5));
+    for (lfs_size_t k = 0; k < a.size(); k++) {
+        ASSERT_EQ(a[k], model[5+k]);
+    }
+    for (lfs_size_t k = 0; k < b.size(); k++) {
+        ASSERT_EQ(b[k], model[8+k]);
+    }
+    for (lfs_size_t k = 0; k < SIZE-8-b.size(); k++) {
+        ASSERT_EQ(d[k], model[8+b.size()+k]);
+    }
+
+    // at the end of the file there's nothing left
+    ASSERT_EQ(lfs_file_readv(&lfs, &file, iov, 5), 0);
+    LFS_ASSERT_OK(lfs_file_close(&lfs, &file));
+    LFS_ASSERT_OK(lfs_unmount(&lfs));
+}
+
+INSTANTIATE_TEST_SUITE_P(Geometries, VectoredTest,
+    ::testing::ValuesIn(AllGeometries()),
+    GeometryNameGenerator{});
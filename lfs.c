@@ -31,8 +31,64 @@ enum {
 static inline void lfs_cache_drop(lfs_t *lfs, lfs_cache_t *rcache) {
     // do not zero, cheaper if cache is readonly or only going to be
     // written with identical data (during relocates)
-    (void)lfs;
     rcache->block = LFS_BLOCK_NULL;
+
+    // dropping the read cache also drops any additional read cache lines
+    if (rcache == &lfs->rcache) {
+        for (lfs_size_t i = 0; i < lfs->rlines.sets*lfs->rlines.ways; i++) {
+            lfs->rlines.lines[i].block = LFS_BLOCK_NULL;
+        }
+    }
+}
+
+static inline lfs_cache_t *lfs_rlines_set(lfs_t *lfs, lfs_block_t block) {
+    return &lfs->rlines.lines[(block % lfs->rlines.sets)*lfs->rlines.ways];
+}
+
+static inline void lfs_rlines_drop(lfs_t *lfs, lfs_block_t block) {
+    if (lfs->rlines.ways) {
+        lfs_cache_t *set = lfs_rlines_set(lfs, block);
+        for (lfs_size_t i = 0; i < lfs->rlines.ways; i++) {
+            if (set[i].block == block) {
+                set[i].block = LFS_BLOCK_NULL;
+            }
+        }
+    }
+}
+
+static lfs_cache_t *lfs_rlines_find(lfs_t *lfs,
+        lfs_block_t block, lfs_off_t off, lfs_size_t *diff) {
+    lfs_cache_t *set = lfs_rlines_set(lfs, block);
+    for (lfs_size_t i = 0; i < lfs->rlines.ways; i++) {
+        if (block == set[i].block && off < set[i].off + set[i].size) {
+            if (off >= set[i].off) {
+                // hit, lines are kept in most-recently-used order for lru
+                if (lfs->cfg->read_cache_policy == LFS_READ_CACHE_LRU) {
+                    lfs_cache_t line = set[i];
+                    memmove(&set[1], &set[0], i*sizeof(lfs_cache_t));
+                    set[0] = line;
+                    return &set[0];
+                }
+
+                return &set[i];
+            }
+
+            // earlier lines take priority
+            *diff = lfs_min(*diff, set[i].off-off);
+        }
+    }
+
+    return NULL;
+}
+
+static lfs_cache_t *lfs_rlines_evict(lfs_t *lfs, lfs_block_t block) {
+    // evict the last line in the set, this is the least recently used
+    // line for lru, or the least recently filled line for fifo
+    lfs_cache_t *set = lfs_rlines_set(lfs, block);
+    lfs_cache_t line = set[lfs->rlines.ways-1];
+    memmove(&set[1], &set[0], (lfs->rlines.ways-1)*sizeof(lfs_cache_t));
+    set[0] = line;
+    return &set[0];
 }
 
 static inline void lfs_cache_zero(lfs_t *lfs, lfs_cache_t *pcache) {
@@ -41,6 +97,258 @@ static inline void lfs_cache_zero(lfs_t *lfs, lfs_cache_t *pcache) {
     pcache->block = LFS_BLOCK_NULL;
 }
 
+/// Asynchronous block device operations ///
+static bool lfs_ioq_isbad(const lfs_t *lfs, lfs_block_t block) {
+    for (lfs_size_t i = 0; i < lfs->ioq.badcount; i++) {
+        if (lfs->ioq.bad[i] == block) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// did an earlier operation on this block fail? if so we're about to report
+// it, so forget it
+static bool lfs_ioq_takebad(lfs_t *lfs, lfs_block_t block) {
+    for (lfs_size_t i = 0; i < lfs->ioq.badcount; i++) {
+        if (lfs->ioq.bad[i] == block) {
+            lfs->ioq.badcount -= 1;
+            lfs->ioq.bad[i] = lfs->ioq.bad[lfs->ioq.badcount];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// invalidate any read cache line or read-ahead a failed read was filling
+static void lfs_ioq_dropread(lfs_t *lfs, const void *buffer) {
+    for (lfs_size_t i = 0; i < lfs->rlines.sets*lfs->rlines.ways; i++) {
+        if (lfs->rlines.lines[i].buffer == buffer) {
+            lfs->rlines.lines[i].block = LFS_BLOCK_NULL;
+        }
+    }
+
+    for (struct lfs_mlist *m = lfs->mlist; m; m = m->next) {
+        lfs_file_t *file = (lfs_file_t*)m;
+        if (m->type == LFS_TYPE_REG
+                && file->ahead.cache[1].buffer == buffer) {
+            file->ahead.cache[1].block = LFS_BLOCK_NULL;
+        }
+    }
+}
+
+static int lfs_ioq_pop(lfs_t *lfs, lfs_block_t block) {
+    LFS_ASSERT(lfs->ioq.count > 0);
+    struct lfs_bd_io *io = &lfs->ioq.ios[lfs->ioq.head];
+    lfs->ioq.head = (lfs->ioq.head + 1) % lfs->cfg->io_depth;
+    lfs->ioq.count -= 1;
+
+    int err = lfs->cfg->wait(lfs->cfg, io);
+    LFS_ASSERT(err <= 0);
+    if (err && io->type == LFS_BD_IO_READ) {
+        // a failed read says nothing about later progs/erases, just forget
+        // whatever the read was filling, the next read will find the error
+        lfs_ioq_dropread(lfs, io->buffer);
+        return 0;
+    }
+
+    if (err == LFS_ERR_CORRUPT && io->block != block) {
+        // not the block we're waiting on, report the bad block the next
+        // time it's used
+        if (lfs_ioq_isbad(lfs, io->block)) {
+            return 0;
+        }
+
+        // if we have no room to remember it, we can't report it either,
+        // fail instead of losing track of a bad block
+        if (lfs->ioq.badcount == lfs->cfg->io_depth) {
+            LFS_ERROR("Lost bad block 0x%"PRIx32" in flight", io->block);
+            return LFS_ERR_IO;
+        }
+
+        lfs->ioq.bad[lfs->ioq.badcount] = io->block;
+        lfs->ioq.badcount += 1;
+        return 0;
+    }
+
+    return err;
+}
+
+// wait for in-flight operations on a block, or all in-flight operations
+// if block is LFS_BLOCK_NULL
+static int lfs_ioq_wait(lfs_t *lfs, lfs_block_t block) {
+    // operations complete in order, so find the last one we care about
+    lfs_size_t n = 0;
+    for (lfs_size_t i = 0; i < lfs->ioq.count; i++) {
+        const struct lfs_bd_io *io = &lfs->ioq.ios[
+                (lfs->ioq.head + i) % lfs->cfg->io_depth];
+        if (block == LFS_BLOCK_NULL || io->block == block) {
+            n = i+1;
+        }
+    }
+
+    int err = 0;
+    for (lfs_size_t i = 0; i < n; i++) {
+        int err_ = lfs_ioq_pop(lfs, block);
+        if (err_ && !err) {
+            err = err_;
+        }
+    }
+
+    // did an earlier operation on this block fail?
+    if (!err && block != LFS_BLOCK_NULL && lfs_ioq_takebad(lfs, block)) {
+        err = LFS_ERR_CORRUPT;
+    }
+
+    return err;
+}
+
+// wait for in-flight reads into a buffer, so the buffer can be reused
+static int lfs_ioq_waitbuffer(lfs_t *lfs, const void *buffer) {
+    lfs_size_t n = 0;
+    for (lfs_size_t i = 0; i < lfs->ioq.count; i++) {
+        const struct lfs_bd_io *io = &lfs->ioq.ios[
+                (lfs->ioq.head + i) % lfs->cfg->io_depth];
+        if (io->type == LFS_BD_IO_READ && io->buffer == buffer) {
+            n = i+1;
+        }
+    }
+
+    int err = 0;
+    for (lfs_size_t i = 0; i < n; i++) {
+        int err_ = lfs_ioq_pop(lfs, LFS_BLOCK_NULL);
+        if (err_ && !err) {
+            err = err_;
+        }
+    }
+
+    return err;
+}
+
+// do an operation and wait for it, emulated with submit/wait if the
+// block device has no synchronous operation
+static int lfs_bd_rawio(lfs_t *lfs, uint8_t type,
+        lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
+    int err = lfs_ioq_wait(lfs, block);
+    if (err) {
+        return err;
+    }
+
+    if (type == LFS_BD_IO_READ && lfs->cfg->read) {
+        err = lfs->cfg->read(lfs->cfg, block, off, buffer, size);
+#ifndef LFS_READONLY
+    } else if (type == LFS_BD_IO_PROG && lfs->cfg->prog) {
+        err = lfs->cfg->prog(lfs->cfg, block, off, buffer, size);
+    } else if (type == LFS_BD_IO_ERASE && lfs->cfg->erase) {
+        err = lfs->cfg->erase(lfs->cfg, block);
+#endif
+    } else {
+        struct lfs_bd_io io = {type, block, off, buffer, size, 0};
+        err = lfs->cfg->submit(lfs->cfg, &io);
+        LFS_ASSERT(err <= 0);
+        if (err) {
+            return err;
+        }
+
+        err = lfs->cfg->wait(lfs->cfg, &io);
+    }
+
+    LFS_ASSERT(err <= 0);
+    return err;
+}
+
+// submit an operation without waiting for it, prog buffers are copied
+// into the io queue, read buffers must stay valid until the read is
+// waited on
+static int lfs_ioq_submit(lfs_t *lfs, uint8_t type,
+        lfs_block_t block, lfs_off_t off,
+        void *buffer, lfs_size_t size) {
+    // did an earlier operation on this block fail? reads leave this for
+    // the next prog/erase to report
+    if (type != LFS_BD_IO_READ && lfs_ioq_takebad(lfs, block)) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    // make room
+    if (lfs->ioq.count == lfs->cfg->io_depth) {
+        int err = lfs_ioq_pop(lfs, block);
+        if (err) {
+            return err;
+        }
+    }
+
+    lfs_size_t i = (lfs->ioq.head + lfs->ioq.count) % lfs->cfg->io_depth;
+    struct lfs_bd_io *io = &lfs->ioq.ios[i];
+    io->type = type;
+    io->block = block;
+    io->off = off;
+    io->buffer = NULL;
+    io->size = size;
+    io->token = 0;
+    if (type == LFS_BD_IO_READ) {
+        io->buffer = buffer;
+    } else if (buffer) {
+        io->buffer = &lfs->ioq.buffer[i*lfs->cfg->cache_size];
+        memcpy(io->buffer, buffer, size);
+    }
+
+    int err = lfs->cfg->submit(lfs->cfg, io);
+    LFS_ASSERT(err <= 0);
+    if (err && type == LFS_BD_IO_READ) {
+        // reads are only ever speculative, treat this the same as a read
+        // that fails when waited on
+        lfs_ioq_dropread(lfs, buffer);
+        return 0;
+    } else if (err) {
+        return err;
+    }
+
+    lfs->ioq.count += 1;
+    return 0;
+}
+
+static int lfs_bd_map(lfs_t *lfs,
+        const lfs_cache_t *pcache,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size,
+        const uint8_t **map) {
+    *map = NULL;
+    if (off+size > lfs->cfg->block_size
+            || (lfs->block_count && block >= lfs->block_count)) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    if (!lfs->cfg->map) {
+        return 0;
+    }
+
+    // pcache takes priority, pending progs aren't in mapped memory yet
+    if (pcache && block == pcache->block &&
+            off < pcache->off + pcache->size &&
+            off+size > pcache->off) {
+        return 0;
+    }
+
+    // and so do in-flight operations
+    int err = lfs_ioq_wait(lfs, block);
+    if (err) {
+        return err;
+    }
+
+    const void *buffer;
+    err = lfs->cfg->map(lfs->cfg, block, &buffer);
+    LFS_ASSERT(err <= 0);
+    if (err) {
+        return err;
+    }
+
+    if (buffer) {
+        *map = (const uint8_t*)buffer + off;
+    }
+    return 0;
+}
+
 static int lfs_bd_read(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
         lfs_block_t block, lfs_off_t off,
@@ -51,6 +359,20 @@ static int lfs_bd_read(lfs_t *lfs,
         return LFS_ERR_CORRUPT;
     }
 
+    if (lfs->cfg->map) {
+        // block mapped into memory? read it directly
+        const uint8_t *map;
+        int err = lfs_bd_map(lfs, pcache, block, off, size, &map);
+        if (err) {
+            return err;
+        }
+
+        if (map) {
+            memcpy(data, map, size);
+            return 0;
+        }
+    }
+
     while (size > 0) {
         lfs_size_t diff = size;
 
@@ -88,12 +410,40 @@ static int lfs_bd_read(lfs_t *lfs,
             diff = lfs_min(diff, rcache->off-off);
         }
 
+        if (rcache == &lfs->rcache && lfs->rlines.ways) {
+            lfs_cache_t *line = lfs_rlines_find(lfs, block, off, &diff);
+            if (line) {
+                // lines may have been prefetched, wait for the read
+                if (lfs->ioq.count) {
+                    int err = lfs_ioq_wait(lfs, block);
+                    if (err) {
+                        line->block = LFS_BLOCK_NULL;
+                        return err;
+                    }
+
+                    // prefetch failed? read it again the slow way
+                    if (line->block != block) {
+                        continue;
+                    }
+                }
+
+                // is already in a read cache line?
+                diff = lfs_min(diff, line->size - (off-line->off));
+                memcpy(data, &line->buffer[off-line->off], diff);
+
+                data += diff;
+                off += diff;
+                size -= diff;
+                continue;
+            }
+        }
+
         if (size >= hint && off % lfs->cfg->read_size == 0 &&
                 size >= lfs->cfg->read_size) {
             // bypass cache?
             diff = lfs_aligndown(diff, lfs->cfg->read_size);
-            int err = lfs->cfg->read(lfs->cfg, block, off, data, diff);
-            LFS_ASSERT(err <= 0);
+            int err = lfs_bd_rawio(lfs, LFS_BD_IO_READ,
+                    block, off, data, diff);
             if (err) {
                 return err;
             }
@@ -106,17 +456,26 @@ static int lfs_bd_read(lfs_t *lfs,
 
         // load to cache, first condition can no longer fail
         LFS_ASSERT(!lfs->block_count || block < lfs->block_count);
-        rcache->block = block;
-        rcache->off = lfs_aligndown(off, lfs->cfg->read_size);
-        rcache->size = lfs_min(
+        lfs_cache_t *line = rcache;
+        if (rcache == &lfs->rcache && lfs->rlines.ways) {
+            line = lfs_rlines_evict(lfs, block);
+            int err = lfs_ioq_waitbuffer(lfs, line->buffer);
+            if (err) {
+                line->block = LFS_BLOCK_NULL;
+                return err;
+            }
+        }
+
+        line->block = block;
+        line->off = lfs_aligndown(off, lfs->cfg->read_size);
+        line->size = lfs_min(
                 lfs_min(
                     lfs_alignup(off+hint, lfs->cfg->read_size),
                     lfs->cfg->block_size)
-                - rcache->off,
+                - line->off,
                 lfs->cfg->cache_size);
-        int err = lfs->cfg->read(lfs->cfg, rcache->block,
-                rcache->off, rcache->buffer, rcache->size);
-        LFS_ASSERT(err <= 0);
+        int err = lfs_bd_rawio(lfs, LFS_BD_IO_READ, line->block,
+                line->off, line->buffer, line->size);
         if (err) {
             return err;
         }
@@ -125,25 +484,236 @@ static int lfs_bd_read(lfs_t *lfs,
     return 0;
 }
 
+// A cursor pins the cache line, or mapped memory, holding part of a block,
+// so a run of small reads can decode straight from the buffer and only go
+// back through the caches at line boundaries
+//
+// Note cursors are only valid until the caches are used without them, drop
+// them after anything that may read or prog
+struct lfs_bd_cursor {
+    lfs_block_t block;
+    lfs_off_t off;
+    lfs_size_t size;
+    const uint8_t *buffer;
+};
+
+#define LFS_BD_CURSOR ((struct lfs_bd_cursor){LFS_BLOCK_NULL, 0, 0, NULL})
+
+static inline void lfs_cursor_drop(struct lfs_bd_cursor *cur) {
+    cur->size = 0;
+}
+
+static inline bool lfs_cursor_has(const struct lfs_bd_cursor *cur,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size) {
+    return block == cur->block
+            && off >= cur->off && off+size <= cur->off + cur->size;
+}
+
+// find size bytes at off, returning a pointer to them and how many bytes
+// are available there, or 0 if they aren't contiguous in any one cache
+static lfs_ssize_t lfs_bd_peek(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
+        struct lfs_bd_cursor *cur, lfs_block_t block, lfs_off_t off,
+        lfs_size_t size, const uint8_t **buffer) {
+    // still in our pinned line?
+    if (lfs_cursor_has(cur, block, off, size)) {
+        *buffer = &cur->buffer[off-cur->off];
+        return cur->off + cur->size - off;
+    }
+
+    lfs_cursor_drop(cur);
+    if (off+size > lfs->cfg->block_size
+            || (lfs->block_count && block >= lfs->block_count)) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    // pcache takes priority, and hides anything it overlaps
+    const lfs_cache_t *line = NULL;
+    lfs_off_t lo = 0;
+    lfs_off_t hi = lfs->cfg->block_size;
+    if (pcache && block == pcache->block) {
+        if (off >= pcache->off && off+size <= pcache->off + pcache->size) {
+            line = pcache;
+        } else if (off+size <= pcache->off) {
+            hi = pcache->off;
+        } else if (off >= pcache->off + pcache->size) {
+            lo = pcache->off + pcache->size;
+        } else {
+            return 0;
+        }
+    }
+
+    if (!line && lfs->cfg->map) {
+        // block mapped into memory? pin that
+        const uint8_t *map;
+        int err = lfs_bd_map(lfs, NULL, block, lo, hi-lo, &map);
+        if (err) {
+            return err;
+        }
+
+        if (map) {
+            cur->block = block;
+            cur->off = lo;
+            cur->size = hi-lo;
+            cur->buffer = map;
+            *buffer = &cur->buffer[off-cur->off];
+            return cur->off + cur->size - off;
+        }
+    }
+
+    if (!line && block == rcache->block
+            && off >= rcache->off && off < rcache->off + rcache->size) {
+        // straddling caches? leave this to lfs_bd_read
+        if (off+size > rcache->off + rcache->size) {
+            return 0;
+        }
+
+        line = rcache;
+    }
+
+    if (!line && rcache == &lfs->rcache && lfs->rlines.ways) {
+        lfs_size_t diff = size;
+        lfs_cache_t *line_ = lfs_rlines_find(lfs, block, off, &diff);
+        if (line_ && off+size > line_->off + line_->size) {
+            return 0;
+        }
+
+        if (line_) {
+            // lines may have been prefetched, wait for the read
+            if (lfs->ioq.count) {
+                int err = lfs_ioq_wait(lfs, block);
+                if (err) {
+                    line_->block = LFS_BLOCK_NULL;
+                    return err;
+                }
+            }
+
+            // a failed prefetch leaves nothing to pin
+            if (line_->block == block) {
+                line = line_;
+            }
+        }
+    }
+
+    if (!line) {
+        // load to cache, same as lfs_bd_read, but only if our bytes fit
+        lfs_off_t loff = lfs_aligndown(off, lfs->cfg->read_size);
+        hint = lfs_min(lfs_max(hint, size), lfs->cfg->block_size);
+        lfs_size_t lsize = lfs_min(
+                lfs_min(
+                    lfs_alignup(off+hint, lfs->cfg->read_size),
+                    lfs->cfg->block_size)
+                - loff,
+                lfs->cfg->cache_size);
+        if (off+size > loff+lsize) {
+            return 0;
+        }
+
+        lfs_cache_t *line_ = rcache;
+        if (rcache == &lfs->rcache && lfs->rlines.ways) {
+            line_ = lfs_rlines_evict(lfs, block);
+            int err = lfs_ioq_waitbuffer(lfs, line_->buffer);
+            if (err) {
+                line_->block = LFS_BLOCK_NULL;
+                return err;
+            }
+        }
+
+        line_->block = block;
+        line_->off = loff;
+        line_->size = lsize;
+        int err = lfs_bd_rawio(lfs, LFS_BD_IO_READ, line_->block,
+                line_->off, line_->buffer, line_->size);
+        if (err) {
+            return err;
+        }
+
+        line = line_;
+    }
+
+    // pin the line, minus anything pcache hides
+    lfs_off_t start = lfs_max(line->off, lo);
+    lfs_off_t end = lfs_min(line->off + line->size, hi);
+    cur->block = block;
+    cur->off = start;
+    cur->size = end - start;
+    cur->buffer = &line->buffer[start - line->off];
+    *buffer = &cur->buffer[off-cur->off];
+    return cur->off + cur->size - off;
+}
+
+// lfs_bd_read through a cursor
+static int lfs_bd_cread(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
+        struct lfs_bd_cursor *cur, lfs_block_t block, lfs_off_t off,
+        void *buffer, lfs_size_t size) {
+    // bypassing the caches? leave this to lfs_bd_read
+    if (!lfs_cursor_has(cur, block, off, size)
+            && size >= hint
+            && off % lfs->cfg->read_size == 0
+            && size >= lfs->cfg->read_size) {
+        return lfs_bd_read(lfs, pcache, rcache, hint,
+                block, off, buffer, size);
+    }
+
+    const uint8_t *data;
+    lfs_ssize_t avail = lfs_bd_peek(lfs, pcache, rcache, hint,
+            cur, block, off, size, &data);
+    if (avail < 0) {
+        return (int)avail;
+    }
+
+    // not contiguous? fall back to a normal read
+    if (!avail) {
+        return lfs_bd_read(lfs, pcache, rcache, hint,
+                block, off, buffer, size);
+    }
+
+    memcpy(buffer, data, size);
+    return 0;
+}
+
+// lfs_bd_crc through a cursor
+static int lfs_bd_ccrc(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
+        struct lfs_bd_cursor *cur, lfs_block_t block, lfs_off_t off,
+        lfs_size_t size, uint32_t *crc) {
+    lfs_size_t diff = 0;
+    for (lfs_off_t i = 0; i < size; i += diff) {
+        const uint8_t *data;
+        lfs_ssize_t avail = lfs_bd_peek(lfs, pcache, rcache, hint-i,
+                cur, block, off+i, 1, &data);
+        if (avail < 0) {
+            return (int)avail;
+        }
+        // a single byte is always in one cache
+        LFS_ASSERT(avail > 0);
+
+        diff = lfs_min(size-i, avail);
+        *crc = lfs_crc(*crc, data, diff);
+    }
+
+    return 0;
+}
+
 static int lfs_bd_cmp(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
         lfs_block_t block, lfs_off_t off,
         const void *buffer, lfs_size_t size) {
-    const uint8_t *data = buffer;
+    // compare straight from the caches
+    struct lfs_bd_cursor cur = LFS_BD_CURSOR;
     lfs_size_t diff = 0;
-
     for (lfs_off_t i = 0; i < size; i += diff) {
-        uint8_t dat[8];
-
-        diff = lfs_min(size-i, sizeof(dat));
-        int err = lfs_bd_read(lfs,
-                pcache, rcache, hint-i,
-                block, off+i, &dat, diff);
-        if (err) {
-            return err;
+        const uint8_t *data;
+        lfs_ssize_t avail = lfs_bd_peek(lfs, pcache, rcache, hint-i,
+                &cur, block, off+i, 1, &data);
+        if (avail < 0) {
+            return (int)avail;
         }
+        LFS_ASSERT(avail > 0);
 
-        int res = memcmp(dat, data + i, diff);
+        diff = lfs_min(size-i, avail);
+        int res = memcmp(data, (const uint8_t*)buffer + i, diff);
         if (res) {
             return res < 0 ? LFS_CMP_LT : LFS_CMP_GT;
         }
@@ -155,22 +725,25 @@ static int lfs_bd_cmp(lfs_t *lfs,
 static int lfs_bd_crc(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
         lfs_block_t block, lfs_off_t off, lfs_size_t size, uint32_t *crc) {
-    lfs_size_t diff = 0;
+    // crc straight from the caches
+    struct lfs_bd_cursor cur = LFS_BD_CURSOR;
+    return lfs_bd_ccrc(lfs, pcache, rcache, hint,
+            &cur, block, off, size, crc);
+}
 
-    for (lfs_off_t i = 0; i < size; i += diff) {
-        uint8_t dat[8];
-        diff = lfs_min(size-i, sizeof(dat));
-        int err = lfs_bd_read(lfs,
-                pcache, rcache, hint-i,
-                block, off+i, &dat, diff);
-        if (err) {
-            return err;
+// forget any fetched metadata pairs using a block we're about to change
+static void lfs_mcache_drop(lfs_t *lfs, lfs_block_t block) {
+    struct lfs_mcache *mcache = &lfs->mcache;
+    lfs_size_t j = 0;
+    for (lfs_size_t i = 0; i < mcache->count; i++) {
+        if (mcache->entries[i].m.pair[0] != block
+                && mcache->entries[i].m.pair[1] != block) {
+            mcache->entries[j] = mcache->entries[i];
+            j += 1;
         }
-
-        *crc = lfs_crc(*crc, &dat, diff);
     }
 
-    return 0;
+    mcache->count = j;
 }
 
 #ifndef LFS_READONLY
@@ -178,10 +751,18 @@ static int lfs_bd_flush(lfs_t *lfs,
         lfs_cache_t *pcache, lfs_cache_t *rcache, bool validate) {
     if (pcache->block != LFS_BLOCK_NULL && pcache->block != LFS_BLOCK_INLINE) {
         LFS_ASSERT(pcache->block < lfs->block_count);
+        lfs_mcache_drop(lfs, pcache->block);
         lfs_size_t diff = lfs_alignup(pcache->size, lfs->cfg->prog_size);
-        int err = lfs->cfg->prog(lfs->cfg, pcache->block,
-                pcache->off, pcache->buffer, diff);
-        LFS_ASSERT(err <= 0);
+        int err;
+        if (!validate && lfs->cfg->io_depth) {
+            // unvalidated progs can be left in flight, metadata is checked
+            // by its crc after we sync
+            err = lfs_ioq_submit(lfs, LFS_BD_IO_PROG, pcache->block,
+                    pcache->off, pcache->buffer, diff);
+        } else {
+            err = lfs_bd_rawio(lfs, LFS_BD_IO_PROG, pcache->block,
+                    pcache->off, pcache->buffer, diff);
+        }
         if (err) {
             return err;
         }
@@ -218,6 +799,12 @@ static int lfs_bd_sync(lfs_t *lfs,
         return err;
     }
 
+    // wait for any in-flight operations
+    err = lfs_ioq_wait(lfs, LFS_BLOCK_NULL);
+    if (err) {
+        return err;
+    }
+
     err = lfs->cfg->sync(lfs->cfg);
     LFS_ASSERT(err <= 0);
     return err;
@@ -262,6 +849,40 @@ static int lfs_bd_prog(lfs_t *lfs,
         // entire block or manually flushing the pcache
         LFS_ASSERT(pcache->block == LFS_BLOCK_NULL);
 
+        if (block != LFS_BLOCK_INLINE &&
+                off % lfs->cfg->cache_size == 0 &&
+                size >= lfs->cfg->cache_size) {
+            // bypass cache? we stick to whole caches so pcache stays
+            // aligned
+            lfs_size_t diff = lfs_aligndown(size, lfs->cfg->cache_size);
+            lfs_mcache_drop(lfs, block);
+            int err = lfs_bd_rawio(lfs, LFS_BD_IO_PROG,
+                    block, off, (void*)data, diff);
+            if (err) {
+                return err;
+            }
+
+            if (validate) {
+                // check data on disk
+                lfs_cache_drop(lfs, rcache);
+                int res = lfs_bd_cmp(lfs,
+                        NULL, rcache, diff,
+                        block, off, data, diff);
+                if (res < 0) {
+                    return res;
+                }
+
+                if (res != LFS_CMP_EQ) {
+                    return LFS_ERR_CORRUPT;
+                }
+            }
+
+            data += diff;
+            off += diff;
+            size -= diff;
+            continue;
+        }
+
         // prepare pcache, first condition can no longer fail
         pcache->block = block;
         pcache->off = lfs_aligndown(off, lfs->cfg->prog_size);
@@ -272,12 +893,229 @@ static int lfs_bd_prog(lfs_t *lfs,
 }
 #endif
 
+#ifndef LFS_READONLY
+static int lfs_bd_copy(lfs_t *lfs,
+        lfs_cache_t *pcache, lfs_cache_t *rcache, bool validate,
+        lfs_block_t block, lfs_off_t off,
+        const lfs_cache_t *spcache, lfs_block_t sblock, lfs_off_t soff,
+        lfs_size_t size) {
+    LFS_ASSERT(block < lfs->block_count);
+    LFS_ASSERT(off + size <= lfs->cfg->block_size);
+
+    while (size > 0) {
+        // let the device copy whole pages itself? we can only do this if
+        // there's nothing pending in pcache and the source isn't dirty,
+        // and we stick to cache-sized chunks so pcache stays aligned
+        lfs_size_t diff = lfs_aligndown(size, lfs->cfg->cache_size);
+        if (spcache && sblock == spcache->block &&
+                soff + diff > spcache->off) {
+            diff = (soff < spcache->off)
+                    ? lfs_aligndown(spcache->off - soff, lfs->cfg->cache_size)
+                    : 0;
+        }
+
+        if (lfs->cfg->copy && diff > 0 &&
+                pcache->block == LFS_BLOCK_NULL &&
+                off % lfs->cfg->cache_size == 0 &&
+                soff % lfs->cfg->read_size == 0) {
+            // the device can't see in-flight operations
+            int err = lfs_ioq_wait(lfs, block);
+            if (err) {
+                return err;
+            }
+
+            err = lfs_ioq_wait(lfs, sblock);
+            if (err) {
+                return err;
+            }
+
+            err = lfs->cfg->copy(lfs->cfg, block, off, sblock, soff, diff);
+            LFS_ASSERT(err <= 0);
+            if (err) {
+                return err;
+            }
+
+            // read cache lines may hold the block even when rcache doesn't
+            if (rcache->block == block) {
+                lfs_cache_drop(lfs, rcache);
+            }
+            lfs_rlines_drop(lfs, block);
+
+            if (validate) {
+                // check data on disk
+                uint32_t crc[2] = {0xffffffff, 0xffffffff};
+                err = lfs_bd_crc(lfs,
+                        NULL, rcache, diff,
+                        block, off, diff, &crc[0]);
+                if (err) {
+                    return err;
+                }
+
+                err = lfs_bd_crc(lfs,
+                        NULL, rcache, diff,
+                        sblock, soff, diff, &crc[1]);
+                if (err) {
+                    return err;
+                }
+
+                if (crc[0] != crc[1]) {
+                    return LFS_ERR_CORRUPT;
+                }
+            }
+
+            off += diff;
+            soff += diff;
+            size -= diff;
+            continue;
+        }
+
+        if (!(block == pcache->block &&
+                off >= pcache->off &&
+                off < pcache->off + lfs->cfg->cache_size)) {
+            // pcache must have been flushed, see lfs_bd_prog
+            LFS_ASSERT(pcache->block == LFS_BLOCK_NULL);
+            pcache->block = block;
+            pcache->off = lfs_aligndown(off, lfs->cfg->prog_size);
+            pcache->size = 0;
+        }
+
+        // read as much as fits straight into pcache
+        diff = lfs_min(size, lfs->cfg->cache_size - (off-pcache->off));
+        int err = lfs_bd_read(lfs,
+                spcache, rcache, size,
+                sblock, soff, &pcache->buffer[off-pcache->off], diff);
+        if (err) {
+            return err;
+        }
+
+        off += diff;
+        soff += diff;
+        size -= diff;
+
+        pcache->size = lfs_max(pcache->size, off - pcache->off);
+        if (pcache->size == lfs->cfg->cache_size) {
+            // eagerly flush out pcache if we fill up
+            err = lfs_bd_flush(lfs, pcache, rcache, validate);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_bd_fill(lfs_t *lfs,
+        lfs_cache_t *pcache, lfs_cache_t *rcache, bool validate,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size) {
+    LFS_ASSERT(block == LFS_BLOCK_INLINE || block < lfs->block_count);
+    LFS_ASSERT(off + size <= lfs->cfg->block_size);
+
+    while (size > 0) {
+        // let the device fill whole pages itself? same rules as
+        // lfs_bd_copy
+        lfs_size_t diff = lfs_aligndown(size, lfs->cfg->cache_size);
+        if (lfs->cfg->fill && diff > 0 &&
+                block != LFS_BLOCK_INLINE &&
+                pcache->block == LFS_BLOCK_NULL &&
+                off % lfs->cfg->cache_size == 0) {
+            int err = lfs_ioq_wait(lfs, block);
+            if (err) {
+                return err;
+            }
+
+            err = lfs->cfg->fill(lfs->cfg, block, off, diff);
+            LFS_ASSERT(err <= 0);
+            if (err) {
+                return err;
+            }
+
+            // drop any lines before the readback below can hit them
+            if (rcache->block == block) {
+                lfs_cache_drop(lfs, rcache);
+            }
+            lfs_rlines_drop(lfs, block);
+
+            if (validate) {
+                // check data on disk
+                for (lfs_off_t i = 0; i < diff; i += 8) {
+                    uint8_t dat[8];
+                    lfs_size_t d = lfs_min(diff-i, sizeof(dat));
+                    err = lfs_bd_read(lfs,
+                            NULL, rcache, diff-i,
+                            block, off+i, &dat, d);
+                    if (err) {
+                        return err;
+                    }
+
+                    for (lfs_size_t j = 0; j < d; j++) {
+                        if (dat[j] != 0) {
+                            return LFS_ERR_CORRUPT;
+                        }
+                    }
+                }
+            }
+
+            off += diff;
+            size -= diff;
+            continue;
+        }
+
+        if (!(block == pcache->block &&
+                off >= pcache->off &&
+                off < pcache->off + lfs->cfg->cache_size)) {
+            // pcache must have been flushed, see lfs_bd_prog
+            LFS_ASSERT(pcache->block == LFS_BLOCK_NULL);
+            pcache->block = block;
+            pcache->off = lfs_aligndown(off, lfs->cfg->prog_size);
+            pcache->size = 0;
+        }
+
+        // zero as much as fits in pcache
+        diff = lfs_min(size, lfs->cfg->cache_size - (off-pcache->off));
+        memset(&pcache->buffer[off-pcache->off], 0, diff);
+
+        off += diff;
+        size -= diff;
+
+        pcache->size = lfs_max(pcache->size, off - pcache->off);
+        if (pcache->size == lfs->cfg->cache_size) {
+            // eagerly flush out pcache if we fill up
+            int err = lfs_bd_flush(lfs, pcache, rcache, validate);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return 0;
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_bd_erase(lfs_t *lfs, lfs_block_t block) {
     LFS_ASSERT(block < lfs->block_count);
-    int err = lfs->cfg->erase(lfs->cfg, block);
-    LFS_ASSERT(err <= 0);
-    return err;
+    // read cache lines can outlive the single rcache, so make sure we
+    // don't keep stale copies of erased blocks around
+    lfs_rlines_drop(lfs, block);
+
+    // the same goes for the metadata index and fetched metadata pairs
+    if (block == lfs->mindex.block) {
+        lfs->mindex.block = LFS_BLOCK_NULL;
+    }
+    lfs_mcache_drop(lfs, block);
+
+    if (lfs->cfg->io_depth) {
+        // erases can be left in flight, we wait for them before the block
+        // is used
+        return lfs_ioq_submit(lfs, LFS_BD_IO_ERASE,
+                block, 0, NULL, lfs->cfg->block_size);
+    }
+
+    return lfs_bd_rawio(lfs, LFS_BD_IO_ERASE,
+            block, 0, NULL, lfs->cfg->block_size);
 }
 #endif
 
@@ -309,6 +1147,11 @@ static inline bool lfs_pair_isnull(const lfs_block_t pair[2]) {
     return pair[0] == LFS_BLOCK_NULL || pair[1] == LFS_BLOCK_NULL;
 }
 
+// paths relative to a removed dir have nowhere to go
+static inline bool lfs_path_isremoved(const lfs_dir_t *at, const char *path) {
+    return at && path[0] != '/' && lfs_pair_isnull(at->head);
+}
+
 static inline int lfs_pair_cmp(
         const lfs_block_t paira[2],
         const lfs_block_t pairb[2]) {
@@ -504,6 +1347,49 @@ static inline void lfs_superblock_tole32(lfs_superblock_t *superblock) {
 }
 #endif
 
+#ifndef LFS_READONLY
+struct lfs_disk_freemap {
+    lfs_block_t head;
+    lfs_size_t size;
+    lfs_size_t block_count;
+    uint32_t mcrc;
+    uint32_t crc;
+};
+
+static inline void lfs_freemap_fromle32(struct lfs_disk_freemap *freemap) {
+    freemap->head        = lfs_fromle32(freemap->head);
+    freemap->size        = lfs_fromle32(freemap->size);
+    freemap->block_count = lfs_fromle32(freemap->block_count);
+    freemap->mcrc        = lfs_fromle32(freemap->mcrc);
+    freemap->crc         = lfs_fromle32(freemap->crc);
+}
+
+static inline void lfs_freemap_tole32(struct lfs_disk_freemap *freemap) {
+    freemap->head        = lfs_tole32(freemap->head);
+    freemap->size        = lfs_tole32(freemap->size);
+    freemap->block_count = lfs_tole32(freemap->block_count);
+    freemap->mcrc        = lfs_tole32(freemap->mcrc);
+    freemap->crc         = lfs_tole32(freemap->crc);
+}
+
+// fold an mdir into a fingerprint of which blocks are in use, any commit,
+// compaction, or relocation changes the fingerprint
+//
+// superblocks are the exception, this is where the free map lives, so we
+// only fold in their location here, and the structs in the superblock are
+// folded in separately
+static uint32_t lfs_freemap_fold(uint32_t mcrc,
+        const lfs_mdir_t *dir, bool superblock) {
+    uint32_t fold[4] = {
+        lfs_tole32(lfs_min(dir->pair[0], dir->pair[1])),
+        lfs_tole32(lfs_max(dir->pair[0], dir->pair[1])),
+        lfs_tole32((superblock) ? 0 : dir->rev),
+        lfs_tole32((superblock) ? 0 : dir->off),
+    };
+    return lfs_crc(mcrc, fold, sizeof(fold));
+}
+#endif
+
 #ifndef LFS_NO_ASSERT
 static bool lfs_mlist_isopen(struct lfs_mlist *head,
         struct lfs_mlist *node) {
@@ -553,6 +1439,28 @@ static uint16_t lfs_fs_disk_version_minor(lfs_t *lfs) {
     return 0xffff & (lfs_fs_disk_version(lfs) >> 0);
 }
 
+// name hashes were added in lfs2.2, so only write or trust these if we're
+// a >= lfs2.2 filesystem
+static lfs_size_t lfs_fs_namehashsize(lfs_t *lfs) {
+#ifdef LFS_MULTIVERSION
+    if (lfs_fs_disk_version(lfs) < 0x00020002) {
+        return 0;
+    }
+#endif
+    return lfs->cfg->name_hash_size;
+}
+
+// the oldest disk version that can describe what we write, lfs2.2 only
+// adds optional free map and name hash tags, so we stay on lfs2.1 until we
+// actually write one and lfs2.1 can keep mounting the disk until then
+static uint32_t lfs_fs_disk_version_needed(lfs_t *lfs) {
+    if (lfs_fs_namehashsize(lfs)) {
+        return lfs_fs_disk_version(lfs);
+    }
+
+    return lfs_min(lfs_fs_disk_version(lfs), 0x00020001);
+}
+
 
 /// Internal operations predeclared here ///
 #ifndef LFS_READONLY
@@ -584,11 +1492,12 @@ static void lfs_fs_prepsuperblock(lfs_t *lfs, bool needssuperblock);
 
 #ifdef LFS_MIGRATE
 static int lfs1_traverse(lfs_t *lfs,
-        int (*cb)(void*, lfs_block_t), void *data);
+        int (*cb)(void*, lfs_block_t, lfs_size_t), void *data);
 #endif
 
 static int lfs_dir_rewind_(lfs_t *lfs, lfs_dir_t *dir);
 
+static int lfs_file_aheaddrop(lfs_t *lfs, lfs_file_t *file);
 static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
         void *buffer, lfs_size_t size);
 static lfs_ssize_t lfs_file_read_(lfs_t *lfs, lfs_file_t *file,
@@ -598,8 +1507,14 @@ static lfs_soff_t lfs_file_size_(lfs_t *lfs, lfs_file_t *file);
 
 static lfs_ssize_t lfs_fs_size_(lfs_t *lfs);
 static int lfs_fs_traverse_(lfs_t *lfs,
-        int (*cb)(void *data, lfs_block_t block), void *data,
-        bool includeorphans);
+        int (*cb)(void *data, lfs_block_t block, lfs_size_t count),
+        void *data, bool includeorphans);
+
+#ifndef LFS_READONLY
+static int lfs_freemap_lookahead(lfs_t *lfs);
+static int lfs_freemap_load(lfs_t *lfs, const lfs_mdir_t *sdir,
+        uint32_t mcrc);
+#endif
 
 static int lfs_deinit(lfs_t *lfs);
 static int lfs_unmount_(lfs_t *lfs);
@@ -621,16 +1536,187 @@ static void lfs_alloc_drop(lfs_t *lfs) {
     lfs->lookahead.size = 0;
     lfs->lookahead.next = 0;
     lfs_alloc_ckpoint(lfs);
+
+    // we no longer know which blocks the free map or extents still describe
+    lfs->freemap.head = LFS_BLOCK_NULL;
+    lfs->freemap.size = 0;
+    lfs->freemap.avail = 0;
+    lfs->extents.size = 0;
+    lfs->extents.count = 0;
+}
+
+#ifndef LFS_READONLY
+// mark the blocks [begin, end) as in-use in a bitmap
+static void lfs_alloc_markrange(uint8_t *buffer,
+        lfs_block_t begin, lfs_block_t end) {
+    while (begin < end && begin % 8 != 0) {
+        buffer[begin / 8] |= 1U << (begin % 8);
+        begin += 1;
+    }
+
+    if (end - begin >= 8) {
+        memset(&buffer[begin / 8], 0xff, (end - begin) / 8);
+        begin += 8*((end - begin) / 8);
+    }
+
+    while (begin < end) {
+        buffer[begin / 8] |= 1U << (begin % 8);
+        begin += 1;
+    }
 }
+#endif
 
 #ifndef LFS_READONLY
-static int lfs_alloc_lookahead(void *p, lfs_block_t block) {
+static int lfs_alloc_lookahead(void *p, lfs_block_t block, lfs_size_t count) {
     lfs_t *lfs = (lfs_t*)p;
     lfs_block_t off = ((block - lfs->lookahead.start)
             + lfs->block_count) % lfs->block_count;
 
+    // ranges never wrap around the disk, but may wrap around the start of
+    // our window, in which case the rest of the range starts at offset 0
+    lfs_block_t n = lfs_min(count, lfs->block_count - off);
     if (off < lfs->lookahead.size) {
-        lfs->lookahead.buffer[off / 8] |= 1U << (off % 8);
+        lfs_alloc_markrange(lfs->lookahead.buffer,
+                off, lfs_min(off + n, lfs->lookahead.size));
+    }
+
+    if (count > n) {
+        lfs_alloc_markrange(lfs->lookahead.buffer,
+                0, lfs_min(count - n, lfs->lookahead.size));
+    }
+
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+// record the blocks [off, end) as in-use in our extents
+static void lfs_alloc_extentrange(lfs_t *lfs,
+        lfs_block_t off, lfs_block_t end) {
+    end = lfs_min(end, lfs->extents.size);
+    if (off >= end) {
+        return;
+    }
+
+    // find the first extent that ends at or after our range
+    struct lfs_extent *extents = lfs->extents.buffer;
+    lfs_size_t lo = 0;
+    lfs_size_t hi = lfs->extents.count;
+    while (lo < hi) {
+        lfs_size_t mid = lo + (hi-lo)/2;
+        if (extents[mid].off + extents[mid].size < off) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    lfs_size_t i = lo;
+
+    // and the first extent that starts after our range
+    lfs_size_t j = i;
+    while (j < lfs->extents.count && extents[j].off <= end) {
+        j += 1;
+    }
+
+    // overlaps or touches existing extents? merge them all into one
+    if (j > i) {
+        lfs_block_t nend = lfs_max(end, extents[j-1].off + extents[j-1].size);
+        extents[i].off = lfs_min(off, extents[i].off);
+        extents[i].size = nend - extents[i].off;
+        memmove(&extents[i+1], &extents[j],
+                (lfs->extents.count-j)*sizeof(struct lfs_extent));
+        lfs->extents.count -= j - (i+1);
+        return;
+    }
+
+    // out of extents? give up on the last extent, we no longer know which
+    // blocks are in use from there on
+    if (lfs->extents.count == lfs->cfg->lookahead_extents) {
+        lfs->extents.count -= 1;
+        lfs->extents.size = extents[lfs->extents.count].off;
+        end = lfs_min(end, lfs->extents.size);
+        if (off >= end) {
+            return;
+        }
+    }
+
+    memmove(&extents[i+1], &extents[i],
+            (lfs->extents.count-i)*sizeof(struct lfs_extent));
+    extents[i].off = off;
+    extents[i].size = end - off;
+    lfs->extents.count += 1;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_alloc_extent(void *p, lfs_block_t block, lfs_size_t count) {
+    lfs_t *lfs = (lfs_t*)p;
+    lfs_block_t off = ((block - lfs->extents.start)
+            + lfs->block_count) % lfs->block_count;
+
+    // ranges may wrap around the start of our extents, see
+    // lfs_alloc_lookahead
+    lfs_block_t n = lfs_min(count, lfs->block_count - off);
+    lfs_alloc_extentrange(lfs, off, off + n);
+    if (count > n) {
+        lfs_alloc_extentrange(lfs, 0, count - n);
+    }
+
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_alloc_extents(lfs_t *lfs) {
+    // have we moved past our extents? populate them with a new traversal
+    //
+    // note we only record blocks up to the checkpoint, any blocks after
+    // that may be in-flight, and we can't see these in the traversal
+    lfs_block_t off = lfs->extents.off;
+    if (off >= lfs->extents.size) {
+        lfs->extents.start = lfs->lookahead.start;
+        lfs->extents.size = lfs->lookahead.ckpoint;
+        lfs->extents.count = 0;
+        int err = lfs_fs_traverse_(lfs, lfs_alloc_extent, lfs, true);
+        if (err) {
+            lfs->extents.size = 0;
+            lfs->extents.count = 0;
+            return err;
+        }
+
+        lfs->extents.off = 0;
+        off = 0;
+
+        // too fragmented to record anything? fall back to traversing
+        // for this window
+        if (lfs->extents.size == 0) {
+            return lfs_fs_traverse_(lfs, lfs_alloc_lookahead, lfs, true);
+        }
+    }
+
+    // mark any in-use blocks in our window, the window may be smaller
+    // than usual if we run out of extents
+    lfs->lookahead.size = lfs_min(
+            lfs->lookahead.size,
+            lfs->extents.size - off);
+    const struct lfs_extent *extents = lfs->extents.buffer;
+    lfs_size_t lo = 0;
+    lfs_size_t hi = lfs->extents.count;
+    while (lo < hi) {
+        lfs_size_t mid = lo + (hi-lo)/2;
+        if (extents[mid].off + extents[mid].size <= off) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (lfs_size_t i = lo; i < lfs->extents.count
+            && extents[i].off < off + lfs->lookahead.size; i++) {
+        lfs_alloc_markrange(lfs->lookahead.buffer,
+                lfs_max(extents[i].off, off) - off,
+                lfs_min(extents[i].off + extents[i].size,
+                    off + lfs->lookahead.size) - off);
     }
 
     return 0;
@@ -645,50 +1731,121 @@ static int lfs_alloc_scan(lfs_t *lfs) {
     // checkpointed, this prevents the math in lfs_alloc from underflowing
     lfs->lookahead.start = (lfs->lookahead.start + lfs->lookahead.next) 
             % lfs->block_count;
+    lfs->freemap.avail -= lfs_min(lfs->freemap.avail, lfs->lookahead.next);
+    lfs->extents.off += lfs->lookahead.next;
     lfs->lookahead.next = 0;
     lfs->lookahead.size = lfs_min(
             8*lfs->cfg->lookahead_size,
             lfs->lookahead.ckpoint);
 
-    // find mask of free blocks from tree
+    // find mask of free blocks from the free map if it still covers the
+    // entire window, this avoids traversing the filesystem
     memset(lfs->lookahead.buffer, 0, lfs->cfg->lookahead_size);
-    int err = lfs_fs_traverse_(lfs, lfs_alloc_lookahead, lfs, true);
+    int err = LFS_ERR_CORRUPT;
+    if (lfs->freemap.avail > 0
+            && lfs->freemap.avail >= lfs->lookahead.size) {
+        err = lfs_freemap_lookahead(lfs);
+    }
+
+    // otherwise find mask of free blocks from tree, note an unreadable free
+    // map is not an error, we can always fall back to the tree
+    if (err == LFS_ERR_CORRUPT) {
+        lfs->freemap.head = LFS_BLOCK_NULL;
+        lfs->freemap.size = 0;
+        lfs->freemap.avail = 0;
+
+        memset(lfs->lookahead.buffer, 0, lfs->cfg->lookahead_size);
+        if (lfs->cfg->lookahead_extents) {
+            err = lfs_alloc_extents(lfs);
+        } else {
+            err = lfs_fs_traverse_(lfs, lfs_alloc_lookahead, lfs, true);
+        }
+    }
+
     if (err) {
         lfs_alloc_drop(lfs);
         return err;
     }
 
-    return 0;
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+// is off itself free? this is common in a mostly empty filesystem, so
+// lfs_alloc checks this inline before searching
+static inline bool lfs_alloc_isfree(const lfs_t *lfs, lfs_block_t off) {
+    return off < lfs->lookahead.size
+            && !(lfs->lookahead.buffer[off / 8] & (1U << (off % 8)));
+}
+
+// find the next free block in our lookahead buffer at or after off, or
+// lookahead.size if there are none
+//
+// this searches 32 bits at a time, skipping over fully used words
+static lfs_block_t lfs_alloc_findfree(lfs_t *lfs, lfs_block_t off) {
+    while (off < lfs->lookahead.size) {
+        // load the word containing off, padding any bytes past the end of
+        // our lookahead buffer with in-use blocks
+        lfs_size_t i = 4*(off / 32);
+        uint32_t word;
+        if (i+4 <= lfs->cfg->lookahead_size) {
+            memcpy(&word, &lfs->lookahead.buffer[i], 4);
+            word = lfs_fromle32(word);
+        } else {
+            word = 0xffffffff;
+            for (lfs_size_t j = 0; i+j < lfs->cfg->lookahead_size; j++) {
+                word &= ~((uint32_t)0xff << 8*j);
+                word |= (uint32_t)lfs->lookahead.buffer[i+j] << 8*j;
+            }
+        }
+
+        // mask out blocks before off and past the end of our window
+        uint32_t free = ~word >> (off % 32);
+        lfs_block_t n = lfs_min(32 - off % 32, lfs->lookahead.size - off);
+        if (n < 32) {
+            free &= ((uint32_t)1 << n) - 1;
+        }
+
+        if (free) {
+            return off + lfs_ctz(free);
+        }
+
+        off += n;
+    }
+
+    return lfs->lookahead.size;
 }
 #endif
 
 #ifndef LFS_READONLY
 static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
     while (true) {
-        // scan our lookahead buffer for free blocks
-        while (lfs->lookahead.next < lfs->lookahead.size) {
-            if (!(lfs->lookahead.buffer[lfs->lookahead.next / 8]
-                    & (1U << (lfs->lookahead.next % 8)))) {
-                // found a free block
-                *block = (lfs->lookahead.start + lfs->lookahead.next)
-                        % lfs->block_count;
-
-                // eagerly find next free block to maximize how many blocks
-                // lfs_alloc_ckpoint makes available for scanning
-                while (true) {
-                    lfs->lookahead.next += 1;
-                    lfs->lookahead.ckpoint -= 1;
-
-                    if (lfs->lookahead.next >= lfs->lookahead.size
-                            || !(lfs->lookahead.buffer[lfs->lookahead.next / 8]
-                                & (1U << (lfs->lookahead.next % 8)))) {
-                        return 0;
-                    }
-                }
-            }
-
-            lfs->lookahead.next += 1;
-            lfs->lookahead.ckpoint -= 1;
+        // scan our lookahead buffer for free blocks, usually our last
+        // eager search already left us on one
+        if (!lfs_alloc_isfree(lfs, lfs->lookahead.next)) {
+            lfs_block_t next = lfs_alloc_findfree(lfs, lfs->lookahead.next);
+            lfs->lookahead.ckpoint -= next - lfs->lookahead.next;
+            lfs->lookahead.next = next;
+        }
+
+        if (lfs->lookahead.next < lfs->lookahead.size) {
+            // found a free block, start and next are both less than
+            // block_count, so we can wrap without a division
+            *block = lfs->lookahead.start + lfs->lookahead.next;
+            if (*block >= lfs->block_count) {
+                *block -= lfs->block_count;
+            }
+
+            // eagerly find next free block to maximize how many blocks
+            // lfs_alloc_ckpoint makes available for scanning
+            lfs_block_t next = lfs->lookahead.next+1;
+            if (!lfs_alloc_isfree(lfs, next)) {
+                next = lfs_alloc_findfree(lfs, next);
+            }
+            lfs->lookahead.ckpoint -= next - lfs->lookahead.next;
+            lfs->lookahead.next = next;
+            return 0;
         }
 
         // In order to keep our block allocator from spinning forever when our
@@ -716,6 +1873,148 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
 #endif
 
 /// Metadata pair and directory operations ///
+
+// the metadata index keeps the latest tag for each type and id of one
+// mdir, sorted by id then type, with ids as of the end of the log
+static inline uint32_t lfs_mindex_key(lfs_tag_t tag) {
+    return ((uint32_t)lfs_tag_id(tag) << 11) | lfs_tag_type3(tag);
+}
+
+static lfs_size_t lfs_mindex_find(const struct lfs_mindex *mindex,
+        uint32_t key) {
+    lfs_size_t lo = 0;
+    lfs_size_t hi = mindex->count;
+    while (lo < hi) {
+        lfs_size_t mid = lo + (hi-lo)/2;
+        if (lfs_mindex_key(mindex->entries[mid].tag) < key) {
+            lo = mid+1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static void lfs_mindex_put(lfs_t *lfs, lfs_tag_t tag, lfs_off_t off) {
+    struct lfs_mindex *mindex = &lfs->mindex;
+    lfs_size_t i = lfs_mindex_find(mindex, lfs_mindex_key(tag));
+    if (i < mindex->count
+            && lfs_mindex_key(mindex->entries[i].tag) == lfs_mindex_key(tag)) {
+        // newer tags replace older ones
+        mindex->entries[i].tag = tag;
+        mindex->entries[i].off = off;
+        return;
+    }
+
+    if (mindex->count == lfs->cfg->metadata_index_size) {
+        // out of space, this mdir will have to be scanned
+        mindex->count = (lfs_size_t)-1;
+        return;
+    }
+
+    memmove(&mindex->entries[i+1], &mindex->entries[i],
+            (mindex->count-i)*sizeof(struct lfs_mindex_entry));
+    mindex->entries[i].tag = tag;
+    mindex->entries[i].off = off;
+    mindex->count += 1;
+}
+
+static void lfs_mindex_splice(lfs_t *lfs, lfs_tag_t tag) {
+    struct lfs_mindex *mindex = &lfs->mindex;
+    lfs_size_t i = lfs_mindex_find(mindex,
+            lfs_mindex_key(LFS_MKTAG(0, lfs_tag_id(tag), 0)));
+
+    // deleted? drop the id's tags
+    if (lfs_tag_splice(tag) < 0) {
+        lfs_size_t j = i;
+        while (j < mindex->count
+                && lfs_tag_id(mindex->entries[j].tag) == lfs_tag_id(tag)) {
+            j += 1;
+        }
+
+        memmove(&mindex->entries[i], &mindex->entries[j],
+                (mindex->count-j)*sizeof(struct lfs_mindex_entry));
+        mindex->count -= j-i;
+    }
+
+    // and shift any later ids
+    for (; i < mindex->count; i++) {
+        mindex->entries[i].tag += LFS_MKTAG(0, lfs_tag_splice(tag), 0);
+    }
+}
+
+// bring the metadata index up to date with an mdir, scanning only the
+// commits it hasn't seen yet, returns true if the mdir's tags are indexed
+static int lfs_dir_index(lfs_t *lfs, const lfs_mdir_t *dir) {
+    struct lfs_mindex *mindex = &lfs->mindex;
+    if (dir->pair[0] != mindex->block
+            || mindex->off + lfs_tag_dsize(mindex->ptag) > dir->off) {
+        // start over
+        mindex->block = dir->pair[0];
+        mindex->off = 0;
+        mindex->ptag = 0xffffffff;
+        mindex->count = 0;
+    }
+
+    struct lfs_bd_cursor cur = LFS_BD_CURSOR;
+    while (mindex->off + lfs_tag_dsize(mindex->ptag) < dir->off) {
+        lfs_off_t off = mindex->off + lfs_tag_dsize(mindex->ptag);
+        lfs_tag_t tag;
+        int err = lfs_bd_cread(lfs,
+                NULL, &lfs->rcache, lfs->cfg->block_size,
+                &cur, dir->pair[0], off, &tag, sizeof(tag));
+        if (err) {
+            mindex->block = LFS_BLOCK_NULL;
+            return err;
+        }
+
+        tag = (lfs_frombe32(tag) ^ mindex->ptag) | 0x80000000;
+        mindex->off = off;
+        mindex->ptag = tag;
+
+        // out of space? keep following the log so we don't start over
+        if (mindex->count > lfs->cfg->metadata_index_size) {
+            continue;
+        }
+
+        tag &= 0x7fffffff;
+        if (lfs_tag_id(tag) == 0x3ff) {
+            continue;
+        }
+
+        if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE) {
+            lfs_mindex_splice(lfs, tag);
+        } else if (lfs_tag_type1(tag) == LFS_TYPE_NAME
+                || lfs_tag_type1(tag) == LFS_TYPE_STRUCT
+                || lfs_tag_type1(tag) == LFS_TYPE_USERATTR) {
+            lfs_mindex_put(lfs, tag, off);
+        }
+    }
+
+    return mindex->count <= lfs->cfg->metadata_index_size;
+}
+
+// find the latest indexed tag matching gmask/gtag, gmask must match the
+// whole id and at least the type1 of gtag
+static const struct lfs_mindex_entry *lfs_dir_indexget(lfs_t *lfs,
+        lfs_tag_t gmask, lfs_tag_t gtag) {
+    struct lfs_mindex *mindex = &lfs->mindex;
+    const struct lfs_mindex_entry *best = NULL;
+    for (lfs_size_t i = lfs_mindex_find(mindex,
+                lfs_mindex_key(LFS_MKTAG(0, lfs_tag_id(gtag), 0)));
+            i < mindex->count
+                && lfs_tag_id(mindex->entries[i].tag) == lfs_tag_id(gtag);
+            i++) {
+        if ((gmask & mindex->entries[i].tag) == (gmask & gtag)
+                && (!best || mindex->entries[i].off > best->off)) {
+            best = &mindex->entries[i];
+        }
+    }
+
+    return best;
+}
+
 static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
         lfs_tag_t gmask, lfs_tag_t gtag,
         lfs_off_t goff, void *gbuffer, lfs_size_t gsize) {
@@ -733,13 +2032,53 @@ static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
         }
     }
 
+    // indexed? then we can find our tag without scanning
+    if (lfs->cfg->metadata_index_size
+            && lfs_tag_id(gmask) == 0x3ff
+            && lfs_tag_size(gmask) == 0
+            && lfs_tag_type1(gmask) == 0x700
+            && (lfs_tag_type1(gtag) == LFS_TYPE_NAME
+                || lfs_tag_type1(gtag) == LFS_TYPE_STRUCT
+                || lfs_tag_type1(gtag) == LFS_TYPE_USERATTR)) {
+        int res = lfs_dir_index(lfs, dir);
+        if (res < 0) {
+            return res;
+        }
+
+        if (res) {
+            const struct lfs_mindex_entry *entry = lfs_dir_indexget(lfs,
+                    gmask, gtag - gdiff);
+            if (!entry || lfs_tag_isdelete(entry->tag)) {
+                return LFS_ERR_NOENT;
+            }
+
+            lfs_size_t diff = lfs_min(lfs_tag_size(entry->tag), gsize);
+            int err = lfs_bd_read(lfs,
+                    NULL, &lfs->rcache, diff,
+                    dir->pair[0], entry->off+sizeof(lfs_tag_t)+goff,
+                    gbuffer, diff);
+            LFS_ASSERT(err <= 0);
+            if (err) {
+                return err;
+            }
+
+            memset((uint8_t*)gbuffer + diff, 0, gsize - diff);
+
+            return LFS_MKTAG(lfs_tag_type3(entry->tag), lfs_tag_id(gtag),
+                    lfs_tag_size(entry->tag));
+        }
+    }
+
+    // decode tags straight from the caches, or mapped memory
+    struct lfs_bd_cursor cur = LFS_BD_CURSOR;
+
     // iterate over dir block backwards (for faster lookups)
     while (off >= sizeof(lfs_tag_t) + lfs_tag_dsize(ntag)) {
         off -= lfs_tag_dsize(ntag);
         lfs_tag_t tag = ntag;
-        int err = lfs_bd_read(lfs,
+        int err = lfs_bd_cread(lfs,
                 NULL, &lfs->rcache, sizeof(ntag),
-                dir->pair[0], off, &ntag, sizeof(ntag));
+                &cur, dir->pair[0], off, &ntag, sizeof(ntag));
         LFS_ASSERT(err <= 0);
         if (err) {
             return err;
@@ -925,13 +2264,14 @@ static int lfs_dir_traverse(lfs_t *lfs,
     lfs_tag_t tag;
     const void *buffer;
     struct lfs_diskoff disk = {0};
+    struct lfs_bd_cursor cur = LFS_BD_CURSOR;
     while (true) {
         {
             if (off+lfs_tag_dsize(ptag) < dir->off) {
                 off += lfs_tag_dsize(ptag);
-                int err = lfs_bd_read(lfs,
+                int err = lfs_bd_cread(lfs,
                         NULL, &lfs->rcache, sizeof(tag),
-                        dir->pair[0], off, &tag, sizeof(tag));
+                        &cur, dir->pair[0], off, &tag, sizeof(tag));
                 if (err) {
                     return err;
                 }
@@ -1058,6 +2398,7 @@ popped:
                 const struct lfs_attr *a = buffer;
                 res = cb(data, LFS_MKTAG(LFS_TYPE_USERATTR + a[i].type,
                         lfs_tag_id(tag) + diff, a[i].size), a[i].buffer);
+                lfs_cursor_drop(&cur);
                 if (res < 0) {
                     return res;
                 }
@@ -1068,6 +2409,10 @@ popped:
             }
         } else {
             res = cb(data, tag + LFS_MKTAG(0, diff, 0), buffer);
+            // the callback may have used the caches, filtering doesn't
+            if (cb != lfs_dir_traverse_filter) {
+                lfs_cursor_drop(&cur);
+            }
             if (res < 0) {
                 return res;
             }
@@ -1104,14 +2449,54 @@ popped:
 }
 #endif
 
+// name hashes are a small bloom filter of the names in an mdir, each name
+// sets two bits picked from halves of its crc
+static inline lfs_size_t lfs_namehash_bit(lfs_t *lfs, uint32_t crc, int i) {
+    if (i) {
+        crc = (crc >> 16) | (crc << 16);
+    }
+
+    return crc % (8*lfs->cfg->name_hash_size);
+}
+
+// find a metadata pair we've fetched before, moving it to the front so
+// the least recently used pairs are forgotten first
+static struct lfs_mcache_entry *lfs_mcache_find(lfs_t *lfs,
+        const lfs_block_t pair[2]) {
+    struct lfs_mcache *mcache = &lfs->mcache;
+    for (lfs_size_t i = 0; i < mcache->count; i++) {
+        if (lfs_pair_issync(mcache->entries[i].m.pair, pair)) {
+            struct lfs_mcache_entry entry = mcache->entries[i];
+            memmove(&mcache->entries[1], &mcache->entries[0],
+                    i*sizeof(struct lfs_mcache_entry));
+            mcache->entries[0] = entry;
+            return &mcache->entries[0];
+        }
+    }
+
+    return NULL;
+}
+
+static void lfs_mcache_put(lfs_t *lfs, const lfs_mdir_t *dir,
+        lfs_off_t hoff) {
+    struct lfs_mcache *mcache = &lfs->mcache;
+    if (!lfs->cfg->mdir_cache_size) {
+        return;
+    }
+
+    lfs_size_t count = lfs_min(mcache->count, lfs->cfg->mdir_cache_size-1);
+    memmove(&mcache->entries[1], &mcache->entries[0],
+            count*sizeof(struct lfs_mcache_entry));
+    mcache->entries[0].m = *dir;
+    mcache->entries[0].hoff = hoff;
+    mcache->entries[0].fsize = 0;
+    mcache->count = count+1;
+}
+
 static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         lfs_mdir_t *dir, const lfs_block_t pair[2],
         lfs_tag_t fmask, lfs_tag_t ftag, uint16_t *id,
         int (*cb)(void *data, lfs_tag_t tag, const void *buffer), void *data) {
-    // we can find tag very efficiently during a fetch, since we're already
-    // scanning the entire directory
-    lfs_stag_t besttag = -1;
-
     // if either block address is invalid we return LFS_ERR_CORRUPT here,
     // otherwise later writes to the pair could fail
     if (lfs->block_count 
@@ -1119,21 +2504,47 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         return LFS_ERR_CORRUPT;
     }
 
+    // fetched this pair before? nothing has been written to it since, so
+    // we can skip the revision counts and crcs
+    const lfs_mdir_t *cached = NULL;
+    const struct lfs_mcache_entry *entry = lfs_mcache_find(lfs, pair);
+    if (entry) {
+        cached = &entry->m;
+    }
+
+    if (cached && !cb) {
+        *dir = *cached;
+        if (id) {
+            *id = dir->count;
+        }
+        return 0;
+    }
+
+refetch:;
+    // we can find tag very efficiently during a fetch, since we're already
+    // scanning the entire directory
+    lfs_stag_t besttag = -1;
+
     // find the block with the most recent revision
     uint32_t revs[2] = {0, 0};
     int r = 0;
-    for (int i = 0; i < 2; i++) {
-        int err = lfs_bd_read(lfs,
-                NULL, &lfs->rcache, sizeof(revs[i]),
-                pair[i], 0, &revs[i], sizeof(revs[i]));
-        revs[i] = lfs_fromle32(revs[i]);
-        if (err && err != LFS_ERR_CORRUPT) {
-            return err;
-        }
+    if (cached) {
+        r = (pair[0] == cached->pair[0]) ? 0 : 1;
+        revs[r] = cached->rev;
+    } else {
+        for (int i = 0; i < 2; i++) {
+            int err = lfs_bd_read(lfs,
+                    NULL, &lfs->rcache, sizeof(revs[i]),
+                    pair[i], 0, &revs[i], sizeof(revs[i]));
+            revs[i] = lfs_fromle32(revs[i]);
+            if (err && err != LFS_ERR_CORRUPT) {
+                return err;
+            }
 
-        if (err != LFS_ERR_CORRUPT &&
-                lfs_scmp(revs[i], revs[(i+1)%2]) > 0) {
-            r = i;
+            if (err != LFS_ERR_CORRUPT &&
+                    lfs_scmp(revs[i], revs[(i+1)%2]) > 0) {
+                r = i;
+            }
         }
     }
 
@@ -1152,6 +2563,10 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         bool tempsplit = false;
         lfs_stag_t tempbesttag = besttag;
 
+        // name hashes are only good until names change
+        lfs_off_t hoff = 0;
+        lfs_off_t temphoff = 0;
+
         // assume not erased until proven otherwise
         bool maybeerased = false;
         bool hasfcrc = false;
@@ -1161,13 +2576,21 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         uint32_t crc = lfs_crc(0xffffffff, &dir->rev, sizeof(dir->rev));
         dir->rev = lfs_fromle32(dir->rev);
 
+        // decode tags straight from the caches, or mapped memory
+        struct lfs_bd_cursor cur = LFS_BD_CURSOR;
+
         while (true) {
             // extract next tag
             lfs_tag_t tag;
             off += lfs_tag_dsize(ptag);
-            int err = lfs_bd_read(lfs,
+            if (cached && off >= cached->off) {
+                // already know where our commits end
+                break;
+            }
+
+            int err = lfs_bd_cread(lfs,
                     NULL, &lfs->rcache, lfs->cfg->block_size,
-                    dir->pair[0], off, &tag, sizeof(tag));
+                    &cur, dir->pair[0], off, &tag, sizeof(tag));
             if (err) {
                 if (err == LFS_ERR_CORRUPT) {
                     // can't continue?
@@ -1176,7 +2599,9 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 return err;
             }
 
-            crc = lfs_crc(crc, &tag, sizeof(tag));
+            if (!cached) {
+                crc = lfs_crc(crc, &tag, sizeof(tag));
+            }
             tag = lfs_frombe32(tag) ^ ptag;
 
             // next commit not yet programmed?
@@ -1192,32 +2617,35 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             ptag = tag;
 
             if (lfs_tag_type2(tag) == LFS_TYPE_CCRC) {
-                // check the crc attr
-                uint32_t dcrc;
-                err = lfs_bd_read(lfs,
-                        NULL, &lfs->rcache, lfs->cfg->block_size,
-                        dir->pair[0], off+sizeof(tag), &dcrc, sizeof(dcrc));
-                if (err) {
-                    if (err == LFS_ERR_CORRUPT) {
+                // check the crc attr, unless we checked it last time
+                if (!cached) {
+                    uint32_t dcrc;
+                    err = lfs_bd_cread(lfs,
+                            NULL, &lfs->rcache, lfs->cfg->block_size,
+                            &cur, dir->pair[0], off+sizeof(tag),
+                            &dcrc, sizeof(dcrc));
+                    if (err) {
+                        if (err == LFS_ERR_CORRUPT) {
+                            break;
+                        }
+                        return err;
+                    }
+                    dcrc = lfs_fromle32(dcrc);
+
+                    if (crc != dcrc) {
                         break;
                     }
-                    return err;
-                }
-                dcrc = lfs_fromle32(dcrc);
 
-                if (crc != dcrc) {
-                    break;
+                    // toss our crc into the filesystem seed for
+                    // pseudorandom numbers, note we use another crc here
+                    // as a collection function because it is sufficiently
+                    // random and convenient
+                    lfs->seed = lfs_crc(lfs->seed, &crc, sizeof(crc));
                 }
 
                 // reset the next bit if we need to
                 ptag ^= (lfs_tag_t)(lfs_tag_chunk(tag) & 1U) << 31;
 
-                // toss our crc into the filesystem seed for
-                // pseudorandom numbers, note we use another crc here
-                // as a collection function because it is sufficiently
-                // random and convenient
-                lfs->seed = lfs_crc(lfs->seed, &crc, sizeof(crc));
-
                 // update with what's found so far
                 besttag = tempbesttag;
                 dir->off = off + lfs_tag_dsize(tag);
@@ -1226,6 +2654,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 dir->tail[0] = temptail[0];
                 dir->tail[1] = temptail[1];
                 dir->split = tempsplit;
+                hoff = temphoff;
 
                 // reset crc, hasfcrc
                 crc = 0xffffffff;
@@ -1233,15 +2662,17 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             }
 
             // crc the entry first, hopefully leaving it in the cache
-            err = lfs_bd_crc(lfs,
-                    NULL, &lfs->rcache, lfs->cfg->block_size,
-                    dir->pair[0], off+sizeof(tag),
-                    lfs_tag_dsize(tag)-sizeof(tag), &crc);
-            if (err) {
-                if (err == LFS_ERR_CORRUPT) {
-                    break;
+            if (!cached) {
+                err = lfs_bd_ccrc(lfs,
+                        NULL, &lfs->rcache, lfs->cfg->block_size,
+                        &cur, dir->pair[0], off+sizeof(tag),
+                        lfs_tag_dsize(tag)-sizeof(tag), &crc);
+                if (err) {
+                    if (err == LFS_ERR_CORRUPT) {
+                        break;
+                    }
+                    return err;
                 }
-                return err;
             }
 
             // directory modification tags?
@@ -1250,8 +2681,10 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 if (lfs_tag_id(tag) >= tempcount) {
                     tempcount = lfs_tag_id(tag) + 1;
                 }
+                temphoff = 0;
             } else if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE) {
                 tempcount += lfs_tag_splice(tag);
+                temphoff = 0;
 
                 if (tag == (LFS_MKTAG(LFS_TYPE_DELETE, 0, 0) |
                         (LFS_MKTAG(0, 0x3ff, 0) & tempbesttag))) {
@@ -1263,9 +2696,9 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             } else if (lfs_tag_type1(tag) == LFS_TYPE_TAIL) {
                 tempsplit = (lfs_tag_chunk(tag) & 1);
 
-                err = lfs_bd_read(lfs,
+                err = lfs_bd_cread(lfs,
                         NULL, &lfs->rcache, lfs->cfg->block_size,
-                        dir->pair[0], off+sizeof(tag), &temptail, 8);
+                        &cur, dir->pair[0], off+sizeof(tag), &temptail, 8);
                 if (err) {
                     if (err == LFS_ERR_CORRUPT) {
                         break;
@@ -1274,9 +2707,9 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 }
                 lfs_pair_fromle32(temptail);
             } else if (lfs_tag_type3(tag) == LFS_TYPE_FCRC) {
-                err = lfs_bd_read(lfs,
+                err = lfs_bd_cread(lfs,
                         NULL, &lfs->rcache, lfs->cfg->block_size,
-                        dir->pair[0], off+sizeof(tag),
+                        &cur, dir->pair[0], off+sizeof(tag),
                         &fcrc, sizeof(fcrc));
                 if (err) {
                     if (err == LFS_ERR_CORRUPT) {
@@ -1287,12 +2720,17 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
 
                 lfs_fcrc_fromle32(&fcrc);
                 hasfcrc = true;
+            } else if (lfs_tag_type3(tag) == LFS_TYPE_NAMEHASH
+                    && lfs_tag_size(tag) == lfs_fs_namehashsize(lfs)) {
+                temphoff = off + sizeof(tag);
             }
 
             // found a match for our fetcher?
             if ((fmask & tag) == (fmask & ftag)) {
                 int res = cb(data, tag, &(struct lfs_diskoff){
                         dir->pair[0], off+sizeof(tag)});
+                // the callback may have used the caches
+                lfs_cursor_drop(&cur);
                 if (res < 0) {
                     if (res == LFS_ERR_CORRUPT) {
                         break;
@@ -1316,6 +2754,14 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             }
         }
 
+        // didn't end where we did last time? something's changed under
+        // us, forget what we knew and fetch from scratch
+        if (cached && dir->off != cached->off) {
+            lfs_mcache_drop(lfs, cached->pair[0]);
+            cached = NULL;
+            goto refetch;
+        }
+
         // found no valid commits?
         if (dir->off == 0) {
             // try the other block?
@@ -1326,7 +2772,9 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
 
         // did we end on a valid commit? we may have an erased block
         dir->erased = false;
-        if (maybeerased && dir->off % lfs->cfg->prog_size == 0) {
+        if (cached) {
+            dir->erased = cached->erased;
+        } else if (maybeerased && dir->off % lfs->cfg->prog_size == 0) {
         #ifdef LFS_MULTIVERSION
             // note versions < lfs2.1 did not have fcrc tags, if
             // we're < lfs2.1 treat missing fcrc as erased data
@@ -1355,6 +2803,11 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             }
         }
 
+        // remember what we found for next time
+        if (!cached) {
+            lfs_mcache_put(lfs, dir, hoff);
+        }
+
         // synthetic move
         if (lfs_gstate_hasmovehere(&lfs->gdisk, dir->pair)) {
             if (lfs_tag_id(lfs->gdisk.tag) == lfs_tag_id(besttag)) {
@@ -1392,6 +2845,48 @@ static int lfs_dir_fetch(lfs_t *lfs,
             (lfs_tag_t)-1, (lfs_tag_t)-1, NULL, NULL, NULL);
 }
 
+// start reading the revision counts and first cache lines of a metadata
+// pair we're about to fetch into spare read cache lines, this lets walks
+// over the tail list overlap their reads instead of waiting on each one
+static int lfs_dir_prefetch(lfs_t *lfs, const lfs_block_t pair[2]) {
+    if (!lfs->cfg->io_depth || !lfs->rlines.ways) {
+        return 0;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        // leave anything suspicious for the fetch to find
+        if (pair[i] >= lfs->block_count || lfs_ioq_isbad(lfs, pair[i])) {
+            continue;
+        }
+
+        // already cached?
+        lfs_size_t diff = lfs->cfg->cache_size;
+        if ((pair[i] == lfs->rcache.block && lfs->rcache.off == 0)
+                || lfs_rlines_find(lfs, pair[i], 0, &diff)) {
+            continue;
+        }
+
+        lfs_cache_t *line = lfs_rlines_evict(lfs, pair[i]);
+        int err = lfs_ioq_waitbuffer(lfs, line->buffer);
+        if (err) {
+            line->block = LFS_BLOCK_NULL;
+            return err;
+        }
+
+        line->block = pair[i];
+        line->off = 0;
+        line->size = lfs->cfg->cache_size;
+        err = lfs_ioq_submit(lfs, LFS_BD_IO_READ,
+                line->block, line->off, line->buffer, line->size);
+        if (err) {
+            line->block = LFS_BLOCK_NULL;
+            return err;
+        }
+    }
+
+    return 0;
+}
+
 static int lfs_dir_getgstate(lfs_t *lfs, const lfs_mdir_t *dir,
         lfs_gstate_t *gstate) {
     lfs_gstate_t temp;
@@ -1456,23 +2951,237 @@ static int lfs_dir_find_match(void *data,
     lfs_t *lfs = name->lfs;
     const struct lfs_diskoff *disk = buffer;
 
-    // compare with disk
-    lfs_size_t diff = lfs_min(name->size, lfs_tag_size(tag));
-    int res = lfs_bd_cmp(lfs,
-            NULL, &lfs->rcache, diff,
-            disk->block, disk->off, name->name, diff);
-    if (res != LFS_CMP_EQ) {
-        return res;
+    // compare with disk
+    lfs_size_t diff = lfs_min(name->size, lfs_tag_size(tag));
+    int res = lfs_bd_cmp(lfs,
+            NULL, &lfs->rcache, diff,
+            disk->block, disk->off, name->name, diff);
+    if (res != LFS_CMP_EQ) {
+        return res;
+    }
+
+    // only equal if our size is still the same
+    if (name->size != lfs_tag_size(tag)) {
+        return (name->size < lfs_tag_size(tag)) ? LFS_CMP_LT : LFS_CMP_GT;
+    }
+
+    // found a match!
+    return LFS_CMP_EQ;
+}
+
+// compare a remembered mdir's fence to a name the same way as
+// lfs_dir_find_match, LFS_CMP_LT if the fence sorts before the name,
+// LFS_CMP_GT if it doesn't, or LFS_CMP_EQ if we only have a prefix of the
+// fence and can't tell
+static int lfs_fence_cmp(const struct lfs_mcache_entry *entry,
+        const void *name, lfs_size_t size) {
+    if (!entry->fsize || !entry->m.split) {
+        return LFS_CMP_EQ;
+    }
+
+    lfs_size_t diff = lfs_min(size, entry->fsize);
+    int res = memcmp(entry->fence, name, lfs_min(diff, LFS_FENCE_MAX));
+    if (!res && diff > LFS_FENCE_MAX) {
+        return LFS_CMP_EQ;
+    }
+
+    return ((res) ? res > 0 : size >= entry->fsize)
+            ? LFS_CMP_GT
+            : LFS_CMP_LT;
+}
+
+// check if a remembered mdir's name hashes rule out a name, if so dir is
+// filled in as though we fetched it
+//
+// if the mdir's fence says our name can't be further down, our name can
+// only be here, so a miss means our name doesn't exist at all, unless
+// we're inserting it, in which case we need to fetch the mdir to find
+// where it goes anyways
+static int lfs_dir_hashmiss(lfs_t *lfs, lfs_mdir_t *dir,
+        const lfs_block_t pair[2], const void *name, lfs_size_t size,
+        bool insert) {
+    const struct lfs_mcache_entry *entry = lfs_mcache_find(lfs, pair);
+    if (!entry || !entry->hoff) {
+        return false;
+    }
+
+    bool bounded = (lfs_fence_cmp(entry, name, size) == LFS_CMP_GT);
+    if (bounded && insert) {
+        return false;
+    }
+
+    uint32_t crc = lfs_crc(0xffffffff, name, size);
+    for (int i = 0; i < 2; i++) {
+        lfs_size_t bit = lfs_namehash_bit(lfs, crc, i);
+        uint8_t byte;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, lfs->cfg->name_hash_size - bit/8,
+                entry->m.pair[0], entry->hoff + bit/8, &byte, 1);
+        if (err) {
+            return err;
+        }
+
+        if (!(byte & (1U << (bit%8)))) {
+            *dir = entry->m;
+            return (bounded) ? LFS_ERR_NOENT : true;
+        }
+    }
+
+    return false;
+}
+
+// names in a split directory are sorted across its metadata pairs, so if
+// a remembered mdir's fence, its last name, sorts before a name, the name
+// must be further down the directory
+//
+// if so dir is filled in as though we fetched it
+static bool lfs_dir_fenced(lfs_t *lfs, lfs_mdir_t *dir,
+        const lfs_block_t pair[2], const void *name, lfs_size_t size) {
+    const struct lfs_mcache_entry *entry = lfs_mcache_find(lfs, pair);
+    if (!entry || lfs_fence_cmp(entry, name, size) != LFS_CMP_LT) {
+        return false;
+    }
+
+    *dir = entry->m;
+    return true;
+}
+
+// remember the fence of a remembered mdir we just passed over
+static int lfs_dir_fence(lfs_t *lfs, const lfs_mdir_t *dir) {
+    struct lfs_mcache_entry *entry = lfs_mcache_find(lfs, dir->pair);
+    if (!entry || entry->fsize || !dir->split || dir->count == 0) {
+        return 0;
+    }
+
+    lfs_stag_t tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x780, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_NAME, dir->count-1, LFS_FENCE_MAX),
+            entry->fence);
+    if (tag < 0) {
+        // no name? the last id may be pending a move
+        return (tag == LFS_ERR_NOENT) ? 0 : tag;
+    }
+
+    entry->fsize = lfs_tag_size(tag);
+    return 0;
+}
+
+// find a remembered path component, moving it to the front so the least
+// recently used entries are forgotten first
+static const struct lfs_dcache_entry *lfs_dcache_find(lfs_t *lfs,
+        const lfs_block_t parent[2], const char *name, lfs_size_t size) {
+    struct lfs_dcache *dcache = &lfs->dcache;
+    for (lfs_size_t i = 0; i < dcache->count; i++) {
+        if (lfs_pair_issync(dcache->entries[i].parent, parent)
+                && lfs_tag_size(dcache->entries[i].tag) == size
+                && memcmp(dcache->entries[i].name, name, size) == 0) {
+            // a pending move may have removed this entry
+            if (lfs_gstate_hasmovehere(&lfs->gdisk,
+                    dcache->entries[i].pair)) {
+                return NULL;
+            }
+
+            struct lfs_dcache_entry entry = dcache->entries[i];
+            memmove(&dcache->entries[1], &dcache->entries[0],
+                    i*sizeof(struct lfs_dcache_entry));
+            dcache->entries[0] = entry;
+            return &dcache->entries[0];
+        }
+    }
+
+    return NULL;
+}
+
+static void lfs_dcache_put(lfs_t *lfs, const lfs_block_t parent[2],
+        const char *name, lfs_size_t size,
+        const lfs_mdir_t *dir, lfs_tag_t tag, const lfs_block_t tail[2]) {
+    struct lfs_dcache *dcache = &lfs->dcache;
+    // don't remember ids a pending move has shifted, commits won't fix
+    // these up correctly
+    if (!lfs->cfg->dentry_cache_size
+            || size > LFS_DENTRY_NAME_MAX
+            || lfs_gstate_hasmovehere(&lfs->gdisk, dir->pair)) {
+        return;
+    }
+
+    lfs_size_t count = lfs_min(dcache->count, lfs->cfg->dentry_cache_size-1);
+    memmove(&dcache->entries[1], &dcache->entries[0],
+            count*sizeof(struct lfs_dcache_entry));
+    struct lfs_dcache_entry *entry = &dcache->entries[0];
+    entry->parent[0] = parent[0];
+    entry->parent[1] = parent[1];
+    entry->pair[0] = dir->pair[0];
+    entry->pair[1] = dir->pair[1];
+    entry->tail[0] = (tail) ? tail[0] : LFS_BLOCK_NULL;
+    entry->tail[1] = (tail) ? tail[1] : LFS_BLOCK_NULL;
+    entry->tag = tag;
+    memcpy(entry->name, name, size);
+    dcache->count = count+1;
+}
+
+#ifndef LFS_READONLY
+// fix up remembered path components after a commit to oldpair, ids shift
+// the same way as our open files and dirs
+static void lfs_dcache_fix(lfs_t *lfs, const lfs_block_t oldpair[2],
+        const lfs_mdir_t *dir, const struct lfs_mattr *attrs, int attrcount) {
+    struct lfs_dcache *dcache = &lfs->dcache;
+    lfs_size_t j = 0;
+    for (lfs_size_t i = 0; i < dcache->count; i++) {
+        struct lfs_dcache_entry entry = dcache->entries[i];
+        if (lfs_pair_cmp(entry.pair, oldpair) == 0) {
+            uint16_t id = lfs_tag_id(entry.tag);
+            bool deleted = false;
+            for (int k = 0; k < attrcount; k++) {
+                if (lfs_tag_type3(attrs[k].tag) == LFS_TYPE_DELETE &&
+                        id == lfs_tag_id(attrs[k].tag)) {
+                    deleted = true;
+                    break;
+                } else if (lfs_tag_type3(attrs[k].tag) == LFS_TYPE_DELETE &&
+                        id > lfs_tag_id(attrs[k].tag)) {
+                    id -= 1;
+                } else if (lfs_tag_type3(attrs[k].tag) == LFS_TYPE_CREATE &&
+                        id >= lfs_tag_id(attrs[k].tag)) {
+                    id += 1;
+                }
+            }
+
+            // deleted? or split onto our tail? just forget it
+            if (deleted || id >= dir->count) {
+                continue;
+            }
+
+            entry.pair[0] = dir->pair[0];
+            entry.pair[1] = dir->pair[1];
+            entry.tag = (entry.tag & ~LFS_MKTAG(0, 0x3ff, 0))
+                    | LFS_MKTAG(0, id, 0);
+        }
+
+        dcache->entries[j] = entry;
+        j += 1;
     }
 
-    // only equal if our size is still the same
-    if (name->size != lfs_tag_size(tag)) {
-        return (name->size < lfs_tag_size(tag)) ? LFS_CMP_LT : LFS_CMP_GT;
-    }
+    dcache->count = j;
+}
+#endif
 
-    // found a match!
-    return LFS_CMP_EQ;
+#ifndef LFS_READONLY
+// update remembered path components that refer to a relocated directory
+static void lfs_dcache_relocate(lfs_t *lfs,
+        const lfs_block_t oldpair[2], const lfs_block_t newpair[2]) {
+    struct lfs_dcache *dcache = &lfs->dcache;
+    for (lfs_size_t i = 0; i < dcache->count; i++) {
+        struct lfs_dcache_entry *entry = &dcache->entries[i];
+        if (lfs_pair_cmp(entry->parent, oldpair) == 0) {
+            entry->parent[0] = newpair[0];
+            entry->parent[1] = newpair[1];
+        }
+
+        if (lfs_pair_cmp(entry->tail, oldpair) == 0) {
+            entry->tail[0] = newpair[0];
+            entry->tail[1] = newpair[1];
+        }
+    }
 }
+#endif
 
 // lfs_dir_find tries to set path and id even if file is not found
 //
@@ -1480,21 +3189,43 @@ static int lfs_dir_find_match(void *data,
 // - 0                  if file is found
 // - LFS_ERR_NOENT      if file or parent is not found
 // - LFS_ERR_NOTDIR     if parent is not a dir
-static lfs_stag_t lfs_dir_find(lfs_t *lfs, lfs_mdir_t *dir,
-        const char **path, uint16_t *id) {
+static lfs_stag_t lfs_dir_find(lfs_t *lfs, const lfs_dir_t *at,
+        lfs_mdir_t *dir, const char **path, uint16_t *id) {
     // we reduce path to a single name if we can find it
     const char *name = *path;
 
-    // default to root dir
+    // default to root dir, or the given dir for relative paths
     lfs_stag_t tag = LFS_MKTAG(LFS_TYPE_DIR, 0x3ff, 0);
-    dir->tail[0] = lfs->root[0];
-    dir->tail[1] = lfs->root[1];
+    lfs_block_t head[2] = {lfs->root[0], lfs->root[1]};
+    if (at && *name != '/') {
+        // nothing resolves relative to a removed directory
+        if (lfs_pair_isnull(at->head)) {
+            return LFS_ERR_NOENT;
+        }
+
+        head[0] = at->head[0];
+        head[1] = at->head[1];
+    }
+    dir->tail[0] = head[0];
+    dir->tail[1] = head[1];
 
     // empty paths are not allowed
     if (*name == '\0') {
         return LFS_ERR_INVAL;
     }
 
+    // we only need to look ahead for '..' if there are any
+    bool dotdot = strstr(name, "..");
+
+    // path components found in the dentry cache aren't fetched until we
+    // need them, and directories we find are remembered once we know
+    // where they point
+    bool remembered = false;
+    lfs_block_t rpair[2];
+    lfs_block_t parent[2];
+    const char *pname = NULL;
+    lfs_size_t pnamelen = 0;
+
     while (true) {
 nextname:
         // skip slashes if we're a directory
@@ -1518,7 +3249,7 @@ nextname:
         const char *suffix = name + namelen;
         lfs_size_t sufflen;
         int depth = 1;
-        while (true) {
+        while (dotdot) {
             suffix += strspn(suffix, "/");
             sufflen = strcspn(suffix, "/");
             if (sufflen == 0) {
@@ -1540,8 +3271,23 @@ nextname:
             suffix += sufflen;
         }
 
+        // fetch any remembered entry we stopped on
+        if (remembered && (*name == '\0'
+                || lfs_tag_type3(tag) != LFS_TYPE_DIR)) {
+            int err = lfs_dir_fetch(lfs, dir, rpair);
+            if (err) {
+                return err;
+            }
+        }
+
         // found path
         if (*name == '\0') {
+            // a dir other than root has no id we can return
+            if (lfs_tag_id(tag) == 0x3ff
+                    && lfs_pair_cmp(head, lfs->root) != 0) {
+                return LFS_ERR_INVAL;
+            }
+
             return tag;
         }
 
@@ -1553,33 +3299,111 @@ nextname:
             return LFS_ERR_NOTDIR;
         }
 
-        // grab the entry data
-        if (lfs_tag_id(tag) != 0x3ff) {
+        // grab the entry data, unless remembered
+        if (lfs_tag_id(tag) != 0x3ff && !remembered) {
             lfs_stag_t res = lfs_dir_get(lfs, dir, LFS_MKTAG(0x700, 0x3ff, 0),
                     LFS_MKTAG(LFS_TYPE_STRUCT, lfs_tag_id(tag), 8), dir->tail);
             if (res < 0) {
                 return res;
             }
             lfs_pair_fromle32(dir->tail);
+
+            // remember this directory for next time
+            lfs_dcache_put(lfs, parent, pname, pnamelen, dir, tag, dir->tail);
+        }
+        remembered = false;
+
+        // remembered this name?
+        parent[0] = dir->tail[0];
+        parent[1] = dir->tail[1];
+        const struct lfs_dcache_entry *dentry = lfs_dcache_find(lfs,
+                parent, name, namelen);
+        if (dentry) {
+            tag = dentry->tag;
+            if (id) {
+                *id = lfs_tag_id(tag);
+            }
+            rpair[0] = dentry->pair[0];
+            rpair[1] = dentry->pair[1];
+            dir->tail[0] = dentry->tail[0];
+            dir->tail[1] = dentry->tail[1];
+            remembered = true;
+            name += namelen;
+            continue;
         }
 
         // find entry matching name
+        //
+        // name hashes let us skip mdirs that can't contain our name, but
+        // skipping loses track of where our name would be inserted, so if
+        // we don't find it and our caller may insert it, we need to look
+        // again without skipping
+        bool hashed = lfs_fs_namehashsize(lfs);
+        bool insert = id && lfs_path_islast(name);
+        bool skipped = false;
         while (true) {
+            // skipping mdirs that sort before our name is always safe
+            if (lfs_dir_fenced(lfs, dir, dir->tail, name, namelen)) {
+                tag = 0;
+                goto next;
+            }
+
+            if (hashed) {
+                int res = lfs_dir_hashmiss(lfs, dir, dir->tail,
+                        name, namelen, insert);
+                if (res < 0) {
+                    return res;
+                }
+
+                if (res) {
+                    skipped = insert;
+                    tag = 0;
+                    goto next;
+                }
+            }
+
             tag = lfs_dir_fetchmatch(lfs, dir, dir->tail,
                     LFS_MKTAG(0x780, 0, 0),
                     LFS_MKTAG(LFS_TYPE_NAME, 0, namelen),
                     id,
                     lfs_dir_find_match, &(struct lfs_dir_find_match){
                         lfs, name, namelen});
-            if (tag < 0) {
+            if (tag < 0 && !(tag == LFS_ERR_NOENT && skipped)) {
                 return tag;
             }
 
-            if (tag) {
+            if (tag > 0) {
+                // remember files now, directories once we know where they
+                // point
+                if (lfs_tag_type3(tag) == LFS_TYPE_DIR) {
+                    pname = name;
+                    pnamelen = namelen;
+                } else {
+                    lfs_dcache_put(lfs, parent, name, namelen,
+                            dir, tag, NULL);
+                }
                 break;
             }
 
-            if (!dir->split) {
+        next:
+            // learn the fence of any mdir we passed over, including ones
+            // our name hashes skipped, so we can skip them sooner next time
+            if (tag == 0) {
+                int err = lfs_dir_fence(lfs, dir);
+                if (err) {
+                    return err;
+                }
+            }
+
+            if (tag == LFS_ERR_NOENT || !dir->split) {
+                if (skipped) {
+                    dir->tail[0] = parent[0];
+                    dir->tail[1] = parent[1];
+                    hashed = false;
+                    skipped = false;
+                    continue;
+                }
+
                 return LFS_ERR_NOENT;
             }
         }
@@ -1872,6 +3696,16 @@ static int lfs_dir_drop(lfs_t *lfs, lfs_mdir_t *dir, lfs_mdir_t *tail) {
         return err;
     }
 
+    // the dropped pair may be reused, so any open handles to it must
+    // forget where it was
+    for (struct lfs_mlist *d = lfs->mlist; d; d = d->next) {
+        if (d->type == LFS_TYPE_DIR
+                && lfs_pair_cmp(((lfs_dir_t*)d)->head, tail->pair) == 0) {
+            ((lfs_dir_t*)d)->head[0] = LFS_BLOCK_NULL;
+            ((lfs_dir_t*)d)->head[1] = LFS_BLOCK_NULL;
+        }
+    }
+
     return 0;
 }
 #endif
@@ -1903,6 +3737,7 @@ static int lfs_dir_split(lfs_t *lfs,
 
     // update root if needed
     if (lfs_pair_cmp(dir->pair, lfs->root) == 0 && split == 0) {
+        lfs_dcache_relocate(lfs, lfs->root, tail.pair);
         lfs->root[0] = tail.pair[0];
         lfs->root[1] = tail.pair[1];
     }
@@ -1925,13 +3760,40 @@ static int lfs_dir_commit_size(void *p, lfs_tag_t tag, const void *buffer) {
 struct lfs_dir_commit_commit {
     lfs_t *lfs;
     struct lfs_commit *commit;
+    uint8_t *namehash;
 };
 #endif
 
 #ifndef LFS_READONLY
 static int lfs_dir_commit_commit(void *p, lfs_tag_t tag, const void *buffer) {
     struct lfs_dir_commit_commit *commit = p;
-    return lfs_dir_commitattr(commit->lfs, commit->commit, tag, buffer);
+    lfs_t *lfs = commit->lfs;
+
+    // building name hashes?
+    if (commit->namehash && (LFS_MKTAG(0x780, 0, 0) & tag)
+            == LFS_MKTAG(LFS_TYPE_NAME, 0, 0)) {
+        uint32_t crc = 0xffffffff;
+        if (!(tag & 0x80000000)) {
+            // from memory
+            crc = lfs_crc(crc, buffer, lfs_tag_size(tag));
+        } else {
+            // from disk
+            const struct lfs_diskoff *disk = buffer;
+            int err = lfs_bd_crc(lfs,
+                    NULL, &lfs->rcache, lfs_tag_size(tag),
+                    disk->block, disk->off, lfs_tag_size(tag), &crc);
+            if (err) {
+                return err;
+            }
+        }
+
+        for (int i = 0; i < 2; i++) {
+            lfs_size_t bit = lfs_namehash_bit(lfs, crc, i);
+            commit->namehash[bit/8] |= 1U << (bit%8);
+        }
+    }
+
+    return lfs_dir_commitattr(lfs, commit->commit, tag, buffer);
 }
 #endif
 
@@ -1948,6 +3810,43 @@ static bool lfs_dir_needsrelocation(lfs_t *lfs, lfs_mdir_t *dir) {
 }
 #endif
 
+#ifndef LFS_READONLY
+static int lfs_dir_commitfreemap(lfs_t *lfs, struct lfs_commit *commit,
+        const struct lfs_mattr *attrs, int attrcount,
+        const lfs_mdir_t *source) {
+    // are we committing a new free map? otherwise bring over the old one
+    struct lfs_disk_freemap freemap;
+    const void *buffer = NULL;
+    for (int i = 0; i < attrcount; i++) {
+        if (lfs_tag_type3(attrs[i].tag) == LFS_TYPE_FREEMAP) {
+            buffer = attrs[i].buffer;
+        }
+    }
+
+    if (!buffer) {
+        lfs_stag_t tag = lfs_dir_get(lfs, source, LFS_MKTAG(0x7ff, 0, 0),
+                LFS_MKTAG(LFS_TYPE_FREEMAP, 0, sizeof(freemap)), &freemap);
+        if (tag < 0) {
+            return (tag == LFS_ERR_NOENT) ? 0 : tag;
+        }
+
+        if (lfs_tag_size(tag) != sizeof(freemap)) {
+            return 0;
+        }
+        buffer = &freemap;
+    }
+
+    // free maps are optional, so leave them out if they don't fit
+    int err = lfs_dir_commitattr(lfs, commit,
+            LFS_MKTAG(LFS_TYPE_FREEMAP, 0x3ff, sizeof(freemap)), buffer);
+    if (err && err != LFS_ERR_NOSPC) {
+        return err;
+    }
+
+    return 0;
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_dir_compact(lfs_t *lfs,
         lfs_mdir_t *dir, const struct lfs_mattr *attrs, int attrcount,
@@ -2012,14 +3911,20 @@ static int lfs_dir_compact(lfs_t *lfs,
                 return err;
             }
 
-            // traverse the directory, this time writing out all unique tags
+            // traverse the directory, this time writing out all unique tags,
+            // and hashing names as we go
+            if (lfs_fs_namehashsize(lfs)) {
+                memset(lfs->namehash, 0, lfs->cfg->name_hash_size);
+            }
+
             err = lfs_dir_traverse(lfs,
                     source, 0, 0xffffffff, attrs, attrcount,
                     LFS_MKTAG(0x400, 0x3ff, 0),
                     LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
                     begin, end, -begin,
                     lfs_dir_commit_commit, &(struct lfs_dir_commit_commit){
-                        lfs, &commit});
+                        lfs, &commit,
+                        (lfs_fs_namehashsize(lfs)) ? lfs->namehash : NULL});
             if (err) {
                 if (err == LFS_ERR_CORRUPT) {
                     goto relocate;
@@ -2069,6 +3974,33 @@ static int lfs_dir_compact(lfs_t *lfs,
                 }
             }
 
+            // the free map lives in the root but isn't tied to any entry,
+            // so we need to bring it over ourselves
+            if (lfs_pair_cmp(dir->pair, lfs->root) == 0) {
+                err = lfs_dir_commitfreemap(lfs, &commit,
+                        attrs, attrcount, source);
+                if (err) {
+                    if (err == LFS_ERR_CORRUPT) {
+                        goto relocate;
+                    }
+                    return err;
+                }
+            }
+
+            // write out name hashes? these are optional, so leave them out
+            // if they don't fit
+            if (lfs_fs_namehashsize(lfs)) {
+                err = lfs_dir_commitattr(lfs, &commit,
+                        LFS_MKTAG(LFS_TYPE_NAMEHASH, 0x3ff,
+                            lfs->cfg->name_hash_size), lfs->namehash);
+                if (err && err != LFS_ERR_NOSPC) {
+                    if (err == LFS_ERR_CORRUPT) {
+                        goto relocate;
+                    }
+                    return err;
+                }
+            }
+
             // complete commit with crc
             err = lfs_dir_commitcrc(lfs, &commit);
             if (err) {
@@ -2153,15 +4085,19 @@ static int lfs_dir_splittingcompact(lfs_t *lfs, lfs_mdir_t *dir,
             // - crc:          4+4   = 8 bytes
             //                 total = 40 bytes
             //
-            // And we cap at half a block to avoid degenerate cases with
+            // Plus 4+name_hash_size bytes for name hashes if enabled. And we
+            // cap at half a block to avoid degenerate cases with
             // nearly-full metadata blocks.
             //
             lfs_size_t metadata_max = (lfs->cfg->metadata_max)
                     ? lfs->cfg->metadata_max
                     : lfs->cfg->block_size;
+            lfs_size_t reserved = 40 + ((lfs_fs_namehashsize(lfs))
+                    ? sizeof(lfs_tag_t) + lfs->cfg->name_hash_size
+                    : 0);
             if (end - split < 0xff
                     && size <= lfs_min(
-                        metadata_max - 40,
+                        metadata_max - reserved,
                         lfs_alignup(
                             metadata_max/2,
                             lfs->cfg->prog_size))) {
@@ -2287,7 +4223,7 @@ static int lfs_dir_relocatingcommit(lfs_t *lfs, lfs_mdir_t *dir,
                 dir, dir->off, dir->etag, attrs, attrcount,
                 0, 0, 0, 0, 0,
                 lfs_dir_commit_commit, &(struct lfs_dir_commit_commit){
-                    lfs, &commit});
+                    lfs, &commit, NULL});
         lfs_pair_fromle32(dir->tail);
         if (err) {
             if (err == LFS_ERR_NOSPC || err == LFS_ERR_CORRUPT) {
@@ -2361,6 +4297,7 @@ fixmlist:;
     // we need to copy the pair so they don't get clobbered if we refetch
     // our mdir.
     lfs_block_t oldpair[2] = {pair[0], pair[1]};
+    lfs_dcache_fix(lfs, oldpair, dir, attrs, attrcount);
     for (struct lfs_mlist *d = lfs->mlist; d; d = d->next) {
         if (lfs_pair_cmp(d->m.pair, oldpair) == 0) {
             d->m = *dir;
@@ -2482,6 +4419,9 @@ static int lfs_dir_orphaningcommit(lfs_t *lfs, lfs_mdir_t *dir,
             lfs->root[1] = ldir.pair[1];
         }
 
+        // update remembered path components
+        lfs_dcache_relocate(lfs, lpair, ldir.pair);
+
         // update internally tracked dirs
         for (struct lfs_mlist *d = lfs->mlist; d; d = d->next) {
             if (lfs_pair_cmp(lpair, d->m.pair) == 0) {
@@ -2622,17 +4562,22 @@ static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
 
 /// Top level directory operations ///
 #ifndef LFS_READONLY
-static int lfs_mkdir_(lfs_t *lfs, const char *path) {
+static int lfs_mkdir_(lfs_t *lfs, const lfs_dir_t *at, const char *path) {
     // deorphan if we haven't yet, needed at most once after poweron
     int err = lfs_fs_forceconsistency(lfs);
     if (err) {
         return err;
     }
 
+    // can't create anything in a removed dir
+    if (lfs_path_isremoved(at, path)) {
+        return LFS_ERR_NOENT;
+    }
+
     struct lfs_mlist cwd;
     cwd.next = lfs->mlist;
     uint16_t id;
-    err = lfs_dir_find(lfs, &cwd.m, &path, &id);
+    err = lfs_dir_find(lfs, at, &cwd.m, &path, &id);
     if (!(err == LFS_ERR_NOENT && lfs_path_islast(path))) {
         return (err < 0) ? err : LFS_ERR_EXIST;
     }
@@ -2718,77 +4663,301 @@ static int lfs_mkdir_(lfs_t *lfs, const char *path) {
 }
 #endif
 
-static int lfs_dir_open_(lfs_t *lfs, lfs_dir_t *dir, const char *path) {
-    lfs_stag_t tag = lfs_dir_find(lfs, &dir->m, &path, NULL);
+static int lfs_dir_open_(lfs_t *lfs, const lfs_dir_t *at,
+        lfs_dir_t *dir, const char *path) {
+    lfs_stag_t tag = lfs_dir_find(lfs, at, &dir->m, &path, NULL);
     if (tag < 0) {
         return tag;
     }
 
-    if (lfs_tag_type3(tag) != LFS_TYPE_DIR) {
-        return LFS_ERR_NOTDIR;
-    }
+    if (lfs_tag_type3(tag) != LFS_TYPE_DIR) {
+        return LFS_ERR_NOTDIR;
+    }
+
+    lfs_block_t pair[2];
+    if (lfs_tag_id(tag) == 0x3ff) {
+        // handle root dir separately
+        pair[0] = lfs->root[0];
+        pair[1] = lfs->root[1];
+    } else {
+        // get dir pair from parent
+        lfs_stag_t res = lfs_dir_get(lfs, &dir->m, LFS_MKTAG(0x700, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_STRUCT, lfs_tag_id(tag), 8), pair);
+        if (res < 0) {
+            return res;
+        }
+        lfs_pair_fromle32(pair);
+    }
+
+    // fetch first pair
+    int err = lfs_dir_fetch(lfs, &dir->m, pair);
+    if (err) {
+        return err;
+    }
+
+    // setup entry
+    dir->head[0] = dir->m.pair[0];
+    dir->head[1] = dir->m.pair[1];
+    dir->id = 0;
+    dir->pos = 0;
+
+    // add to list of mdirs
+    dir->type = LFS_TYPE_DIR;
+    lfs_mlist_append(lfs, (struct lfs_mlist *)dir);
+
+    return 0;
+}
+
+static int lfs_dir_close_(lfs_t *lfs, lfs_dir_t *dir) {
+    // remove from list of mdirs
+    lfs_mlist_remove(lfs, (struct lfs_mlist *)dir);
+
+    return 0;
+}
+
+static int lfs_dir_read_(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
+    memset(info, 0, sizeof(*info));
+
+    // special offset for '.' and '..'
+    if (dir->pos == 0) {
+        info->type = LFS_TYPE_DIR;
+        strcpy(info->name, ".");
+        dir->pos += 1;
+        return true;
+    } else if (dir->pos == 1) {
+        info->type = LFS_TYPE_DIR;
+        strcpy(info->name, "..");
+        dir->pos += 1;
+        return true;
+    }
+
+    while (true) {
+        if (dir->id == dir->m.count) {
+            if (!dir->m.split) {
+                return false;
+            }
+
+            int err = lfs_dir_fetch(lfs, &dir->m, dir->m.tail);
+            if (err) {
+                return err;
+            }
+
+            dir->id = 0;
+        }
+
+        int err = lfs_dir_getinfo(lfs, &dir->m, dir->id, info);
+        if (err && err != LFS_ERR_NOENT) {
+            return err;
+        }
+
+        dir->id += 1;
+        if (err != LFS_ERR_NOENT) {
+            break;
+        }
+    }
+
+    dir->pos += 1;
+    return true;
+}
+
+// readplus keeps its window of entries in the caller's buffers, these
+// move and clear entries as creates and deletes shift ids around
+static void lfs_dir_plusmove(struct lfs_info *info,
+        const struct lfs_attr *attrs, lfs_size_t attrcount,
+        lfs_size_t to, lfs_size_t from, lfs_size_t count) {
+    memmove(&info[to], &info[from], count*sizeof(struct lfs_info));
+    for (lfs_size_t j = 0; j < attrcount; j++) {
+        memmove((uint8_t*)attrs[j].buffer + to*attrs[j].size,
+                (uint8_t*)attrs[j].buffer + from*attrs[j].size,
+                count*attrs[j].size);
+    }
+}
+
+static void lfs_dir_plusclear(struct lfs_info *info,
+        const struct lfs_attr *attrs, lfs_size_t attrcount,
+        lfs_size_t k, uint8_t type) {
+    memset(&info[k], 0, sizeof(struct lfs_info));
+    info[k].type = type;
+    for (lfs_size_t j = 0; j < attrcount; j++) {
+        memset((uint8_t*)attrs[j].buffer + k*attrs[j].size, 0,
+                attrs[j].size);
+    }
+}
+
+// fill in entries k in [base, base+size) with the info and attrs of ids
+// starting at id, in one forward pass over the mdir's log
+//
+// ids that shift into our window from outside it are marked lost (type
+// 0xff) and looked up separately, entries without names are left with
+// type 0
+static int lfs_dir_getinfos(lfs_t *lfs, lfs_mdir_t *dir, uint16_t id,
+        struct lfs_info *info,
+        const struct lfs_attr *attrs, lfs_size_t attrcount,
+        lfs_size_t base, lfs_size_t size) {
+    // pending moves hide an id from us, leave these to lfs_dir_getinfo
+    bool moving = lfs_gstate_hasmovehere(&lfs->gdisk, dir->pair);
+
+    // nothing exists before the log starts
+    for (lfs_size_t k = base; k < base+size; k++) {
+        lfs_dir_plusclear(info, attrs, attrcount, k, (moving) ? 0xff : 0);
+    }
+
+    struct lfs_bd_cursor cur = LFS_BD_CURSOR;
+    lfs_off_t off = 0;
+    lfs_tag_t ptag = 0xffffffff;
+    uint16_t count = 0;
+    while (!moving && off + lfs_tag_dsize(ptag) < dir->off) {
+        off += lfs_tag_dsize(ptag);
+        lfs_tag_t tag;
+        int err = lfs_bd_cread(lfs,
+                NULL, &lfs->rcache, lfs->cfg->block_size,
+                &cur, dir->pair[0], off, &tag, sizeof(tag));
+        if (err) {
+            return err;
+        }
+
+        tag = (lfs_frombe32(tag) ^ ptag) | 0x80000000;
+        ptag = tag;
+        tag &= 0x7fffffff;
+        if (lfs_tag_id(tag) == 0x3ff) {
+            continue;
+        }
+
+        bool below = lfs_tag_id(tag) < id;
+        bool within = !below && (lfs_size_t)(lfs_tag_id(tag) - id) < size;
+        lfs_size_t k = (below) ? base : base + (lfs_tag_id(tag) - id);
+        if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE) {
+            if ((below || within) && lfs_tag_splice(tag) > 0) {
+                // created, later entries shift up, and if we're created
+                // below our window the id before it shifts in
+                lfs_dir_plusmove(info, attrs, attrcount,
+                        k+1, k, base+size-1 - k);
+                lfs_dir_plusclear(info, attrs, attrcount, k,
+                        (below && id-1 < count) ? 0xff : 0);
+            } else if (below || within) {
+                // deleted, later entries shift down, and the id after our
+                // window shifts in
+                lfs_dir_plusmove(info, attrs, attrcount,
+                        k, k+1, base+size-1 - k);
+                lfs_dir_plusclear(info, attrs, attrcount, base+size-1,
+                        (id+size < count) ? 0xff : 0);
+            }
+
+            count += lfs_tag_splice(tag);
+            continue;
+        }
+
+        if (lfs_tag_type1(tag) == LFS_TYPE_NAME
+                && lfs_tag_id(tag) >= count) {
+            count = lfs_tag_id(tag) + 1;
+        }
+
+        if (!within || info[k].type == 0xff) {
+            continue;
+        }
+
+        if (lfs_tag_type1(tag) == LFS_TYPE_NAME) {
+            // only regs and dirs are listed
+            if ((lfs_tag_type3(tag) & 0x780) != LFS_TYPE_NAME) {
+                continue;
+            }
+
+            memset(info[k].name, 0, sizeof(info[k].name));
+            err = lfs_bd_cread(lfs,
+                    NULL, &lfs->rcache, lfs->cfg->block_size,
+                    &cur, dir->pair[0], off+sizeof(tag),
+                    info[k].name, lfs_min(lfs_tag_size(tag), lfs->name_max));
+            if (err) {
+                return err;
+            }
+
+            info[k].type = lfs_tag_type3(tag);
+        } else if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT) {
+            struct lfs_ctz ctz;
+            err = lfs_bd_cread(lfs,
+                    NULL, &lfs->rcache, lfs->cfg->block_size,
+                    &cur, dir->pair[0], off+sizeof(tag),
+                    &ctz, sizeof(ctz));
+            if (err) {
+                return err;
+            }
+            lfs_ctz_fromle32(&ctz);
+
+            info[k].size = ctz.size;
+        } else if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
+            info[k].size = lfs_tag_size(tag);
+        } else if (lfs_tag_type1(tag) == LFS_TYPE_USERATTR) {
+            for (lfs_size_t j = 0; j < attrcount; j++) {
+                if (lfs_tag_type3(tag) != LFS_TYPE_USERATTR + attrs[j].type) {
+                    continue;
+                }
+
+                // removed attrs read as zeros
+                uint8_t *buffer = (uint8_t*)attrs[j].buffer
+                        + k*attrs[j].size;
+                memset(buffer, 0, attrs[j].size);
+                if (!lfs_tag_isdelete(tag)) {
+                    err = lfs_bd_cread(lfs,
+                            NULL, &lfs->rcache, lfs->cfg->block_size,
+                            &cur, dir->pair[0], off+sizeof(tag),
+                            buffer, lfs_min(lfs_tag_size(tag), attrs[j].size));
+                    if (err) {
+                        return err;
+                    }
+                }
+            }
+        }
+    }
+
+    // look up any entries we lost track of
+    for (lfs_size_t k = base;
+            k < base + lfs_min(size, dir->count - id); k++) {
+        if (info[k].type != 0xff) {
+            continue;
+        }
 
-    lfs_block_t pair[2];
-    if (lfs_tag_id(tag) == 0x3ff) {
-        // handle root dir separately
-        pair[0] = lfs->root[0];
-        pair[1] = lfs->root[1];
-    } else {
-        // get dir pair from parent
-        lfs_stag_t res = lfs_dir_get(lfs, &dir->m, LFS_MKTAG(0x700, 0x3ff, 0),
-                LFS_MKTAG(LFS_TYPE_STRUCT, lfs_tag_id(tag), 8), pair);
-        if (res < 0) {
-            return res;
+        uint16_t kid = id + (k - base);
+        lfs_dir_plusclear(info, attrs, attrcount, k, 0);
+        int err = lfs_dir_getinfo(lfs, dir, kid, &info[k]);
+        if (err) {
+            info[k].type = 0;
+            if (err == LFS_ERR_NOENT) {
+                continue;
+            }
+            return err;
         }
-        lfs_pair_fromle32(pair);
-    }
 
-    // fetch first pair
-    int err = lfs_dir_fetch(lfs, &dir->m, pair);
-    if (err) {
-        return err;
+        for (lfs_size_t j = 0; j < attrcount; j++) {
+            lfs_stag_t res = lfs_dir_get(lfs, dir, LFS_MKTAG(0x7ff, 0x3ff, 0),
+                    LFS_MKTAG(LFS_TYPE_USERATTR + attrs[j].type,
+                        kid, lfs_min(attrs[j].size, lfs->attr_max)),
+                    (uint8_t*)attrs[j].buffer + k*attrs[j].size);
+            if (res < 0 && res != LFS_ERR_NOENT) {
+                return res;
+            }
+        }
     }
 
-    // setup entry
-    dir->head[0] = dir->m.pair[0];
-    dir->head[1] = dir->m.pair[1];
-    dir->id = 0;
-    dir->pos = 0;
-
-    // add to list of mdirs
-    dir->type = LFS_TYPE_DIR;
-    lfs_mlist_append(lfs, (struct lfs_mlist *)dir);
-
-    return 0;
-}
-
-static int lfs_dir_close_(lfs_t *lfs, lfs_dir_t *dir) {
-    // remove from list of mdirs
-    lfs_mlist_remove(lfs, (struct lfs_mlist *)dir);
-
     return 0;
 }
 
-static int lfs_dir_read_(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
-    memset(info, 0, sizeof(*info));
+static lfs_ssize_t lfs_dir_readplus_(lfs_t *lfs, lfs_dir_t *dir,
+        struct lfs_info *info, lfs_size_t count,
+        const struct lfs_attr *attrs, lfs_size_t attrcount) {
+    lfs_size_t n = 0;
 
     // special offset for '.' and '..'
-    if (dir->pos == 0) {
-        info->type = LFS_TYPE_DIR;
-        strcpy(info->name, ".");
-        dir->pos += 1;
-        return true;
-    } else if (dir->pos == 1) {
-        info->type = LFS_TYPE_DIR;
-        strcpy(info->name, "..");
+    while (n < count && dir->pos < 2) {
+        lfs_dir_plusclear(info, attrs, attrcount, n, LFS_TYPE_DIR);
+        strcpy(info[n].name, (dir->pos == 0) ? "." : "..");
         dir->pos += 1;
-        return true;
+        n += 1;
     }
 
-    while (true) {
+    while (n < count) {
         if (dir->id == dir->m.count) {
             if (!dir->m.split) {
-                return false;
+                break;
             }
 
             int err = lfs_dir_fetch(lfs, &dir->m, dir->m.tail);
@@ -2799,19 +4968,30 @@ static int lfs_dir_read_(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
             dir->id = 0;
         }
 
-        int err = lfs_dir_getinfo(lfs, &dir->m, dir->id, info);
-        if (err && err != LFS_ERR_NOENT) {
+        // fill as many entries as we have room for, any extra room helps
+        // keep track of ids that shift around
+        int err = lfs_dir_getinfos(lfs, &dir->m, dir->id,
+                info, attrs, attrcount, n, count-n);
+        if (err) {
             return err;
         }
 
-        dir->id += 1;
-        if (err != LFS_ERR_NOENT) {
-            break;
+        // drop entries without names
+        lfs_size_t size = lfs_min(count-n, dir->m.count - dir->id);
+        lfs_size_t found = n;
+        for (lfs_size_t k = n; k < n+size; k++) {
+            if (info[k].type) {
+                lfs_dir_plusmove(info, attrs, attrcount, found, k, 1);
+                found += 1;
+            }
         }
+
+        dir->id += size;
+        dir->pos += found - n;
+        n = found;
     }
 
-    dir->pos += 1;
-    return true;
+    return n;
 }
 
 static int lfs_dir_seek_(lfs_t *lfs, lfs_dir_t *dir, lfs_off_t off) {
@@ -2857,6 +5037,11 @@ static lfs_soff_t lfs_dir_tell_(lfs_t *lfs, lfs_dir_t *dir) {
 }
 
 static int lfs_dir_rewind_(lfs_t *lfs, lfs_dir_t *dir) {
+    // removed while open?
+    if (lfs_pair_isnull(dir->head)) {
+        return LFS_ERR_NOENT;
+    }
+
     // reload the head dir
     int err = lfs_dir_fetch(lfs, &dir->m, dir->head);
     if (err) {
@@ -2883,7 +5068,32 @@ static int lfs_ctz_index(lfs_t *lfs, lfs_off_t *off) {
     return i;
 }
 
-static int lfs_ctz_find(lfs_t *lfs,
+// remember which block holds the given index of a file's skip-list
+static void lfs_file_indexput(struct lfs_file_index *index,
+        lfs_off_t i, lfs_block_t block) {
+    if (index->size == 0) {
+        return;
+    }
+
+    // hash our index, blocks with many skip-pointers are found at
+    // multiples of large powers of two, and we don't want these to collide
+    lfs_size_t slot = (lfs_size_t)(
+            ((uint64_t)(i * 0x9e3779b9) * index->size) >> 32);
+    index->buffer[slot].index = i;
+    index->buffer[slot].block = block;
+}
+
+// forget any remembered blocks at or after the given index, these are
+// about to be rewritten
+static void lfs_file_indexdrop(struct lfs_file_index *index, lfs_off_t i) {
+    for (lfs_size_t j = 0; j < index->size; j++) {
+        if (index->buffer[j].index >= i) {
+            index->buffer[j].block = LFS_BLOCK_NULL;
+        }
+    }
+}
+
+static int lfs_ctz_find(lfs_t *lfs, struct lfs_file_index *index,
         const lfs_cache_t *pcache, lfs_cache_t *rcache,
         lfs_block_t head, lfs_size_t size,
         lfs_size_t pos, lfs_block_t *block, lfs_off_t *off) {
@@ -2896,6 +5106,18 @@ static int lfs_ctz_find(lfs_t *lfs,
     lfs_off_t current = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
     lfs_off_t target = lfs_ctz_index(lfs, &pos);
 
+    // start from the nearest remembered block at or after our target
+    if (index) {
+        for (lfs_size_t i = 0; i < index->size; i++) {
+            if (index->buffer[i].block != LFS_BLOCK_NULL
+                    && index->buffer[i].index >= target
+                    && index->buffer[i].index < current) {
+                current = index->buffer[i].index;
+                head = index->buffer[i].block;
+            }
+        }
+    }
+
     while (current > target) {
         lfs_size_t skip = lfs_min(
                 lfs_npw2(current-target+1) - 1,
@@ -2910,6 +5132,9 @@ static int lfs_ctz_find(lfs_t *lfs,
         }
 
         current -= 1 << skip;
+        if (index) {
+            lfs_file_indexput(index, current, head);
+        }
     }
 
     *block = head;
@@ -2951,24 +5176,15 @@ static int lfs_ctz_extend(lfs_t *lfs,
 
             // just copy out the last block if it is incomplete
             if (noff != lfs->cfg->block_size) {
-                for (lfs_off_t i = 0; i < noff; i++) {
-                    uint8_t data;
-                    err = lfs_bd_read(lfs,
-                            NULL, rcache, noff-i,
-                            head, i, &data, 1);
-                    if (err) {
-                        return err;
-                    }
-
-                    err = lfs_bd_prog(lfs,
-                            pcache, rcache, true,
-                            nblock, i, &data, 1);
-                    if (err) {
-                        if (err == LFS_ERR_CORRUPT) {
-                            goto relocate;
-                        }
-                        return err;
+                err = lfs_bd_copy(lfs,
+                        pcache, rcache, true,
+                        nblock, 0,
+                        NULL, head, 0, noff);
+                if (err) {
+                    if (err == LFS_ERR_CORRUPT) {
+                        goto relocate;
                     }
+                    return err;
                 }
 
                 *block = nblock;
@@ -2976,31 +5192,29 @@ static int lfs_ctz_extend(lfs_t *lfs,
                 return 0;
             }
 
-            // append block
+            // append block, gathering our skip-pointers so we can write
+            // them out in one prog
             index += 1;
             lfs_size_t skips = lfs_ctz(index) + 1;
-            lfs_block_t nhead = head;
-            for (lfs_off_t i = 0; i < skips; i++) {
-                nhead = lfs_tole32(nhead);
-                err = lfs_bd_prog(lfs, pcache, rcache, true,
-                        nblock, 4*i, &nhead, 4);
-                nhead = lfs_fromle32(nhead);
+            lfs_block_t nheads[32];
+            nheads[0] = lfs_tole32(head);
+            for (lfs_off_t i = 1; i < skips; i++) {
+                err = lfs_bd_read(lfs,
+                        NULL, rcache, sizeof(nheads[i]),
+                        lfs_fromle32(nheads[i-1]), 4*(i-1),
+                        &nheads[i], sizeof(nheads[i]));
                 if (err) {
-                    if (err == LFS_ERR_CORRUPT) {
-                        goto relocate;
-                    }
                     return err;
                 }
+            }
 
-                if (i != skips-1) {
-                    err = lfs_bd_read(lfs,
-                            NULL, rcache, sizeof(nhead),
-                            nhead, 4*i, &nhead, sizeof(nhead));
-                    nhead = lfs_fromle32(nhead);
-                    if (err) {
-                        return err;
-                    }
+            err = lfs_bd_prog(lfs, pcache, rcache, true,
+                    nblock, 0, nheads, 4*skips);
+            if (err) {
+                if (err == LFS_ERR_CORRUPT) {
+                    goto relocate;
                 }
+                return err;
             }
 
             *block = nblock;
@@ -3020,50 +5234,57 @@ relocate:
 static int lfs_ctz_traverse(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache,
         lfs_block_t head, lfs_size_t size,
-        int (*cb)(void*, lfs_block_t), void *data) {
+        int (*cb)(void*, lfs_block_t, lfs_size_t), void *data) {
     if (size == 0) {
         return 0;
     }
 
     lfs_off_t index = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
 
-    while (true) {
-        int err = cb(data, head);
-        if (err) {
-            return err;
-        }
-
-        if (index == 0) {
-            return 0;
-        }
-
+    // coalesce contiguous blocks into ranges, note we traverse the
+    // skip-list backwards, so sequentially allocated blocks are descending
+    lfs_block_t block = head;
+    lfs_size_t count = 1;
+    while (index > 0) {
         lfs_block_t heads[2];
-        int count = 2 - (index & 1);
-        err = lfs_bd_read(lfs,
-                pcache, rcache, count*sizeof(head),
-                head, 0, &heads, count*sizeof(head));
+        int skips = 2 - (index & 1);
+        int err = lfs_bd_read(lfs,
+                pcache, rcache, skips*sizeof(head),
+                head, 0, &heads, skips*sizeof(head));
         heads[0] = lfs_fromle32(heads[0]);
         heads[1] = lfs_fromle32(heads[1]);
         if (err) {
             return err;
         }
 
-        for (int i = 0; i < count-1; i++) {
-            err = cb(data, heads[i]);
-            if (err) {
-                return err;
+        for (int i = 0; i < skips; i++) {
+            if (heads[i] + 1 == block) {
+                block -= 1;
+                count += 1;
+            } else if (heads[i] == block + count) {
+                count += 1;
+            } else {
+                err = cb(data, block, count);
+                if (err) {
+                    return err;
+                }
+
+                block = heads[i];
+                count = 1;
             }
         }
 
-        head = heads[count-1];
-        index -= count;
+        head = heads[skips-1];
+        index -= skips;
     }
+
+    return cb(data, block, count);
 }
 
 
 /// Top level file operations ///
-static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
-        const char *path, int flags,
+static int lfs_file_opencfg_(lfs_t *lfs, const lfs_dir_t *at,
+        lfs_file_t *file, const char *path, int flags,
         const struct lfs_file_config *cfg) {
 #ifndef LFS_READONLY
     // deorphan if we haven't yet, needed at most once after poweron
@@ -3077,6 +5298,11 @@ static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
     LFS_ASSERT((flags & LFS_O_RDONLY) == LFS_O_RDONLY);
 #endif
 
+    // can't open anything in a removed dir
+    if (lfs_path_isremoved(at, path)) {
+        return LFS_ERR_NOENT;
+    }
+
     // setup simple file details
     int err;
     file->cfg = cfg;
@@ -3084,9 +5310,17 @@ static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
     file->pos = 0;
     file->off = 0;
     file->cache.buffer = NULL;
+    file->index.size = 0;
+    file->index.buffer = NULL;
+    file->ahead.size = 0;
+    file->ahead.pos = 0;
+    file->ahead.buffer = NULL;
+    file->ahead.cache[0].block = LFS_BLOCK_NULL;
+    file->ahead.cache[1].block = LFS_BLOCK_NULL;
+    file->ahead.nblock = LFS_BLOCK_NULL;
 
     // allocate entry for file if it doesn't exist
-    lfs_stag_t tag = lfs_dir_find(lfs, &file->m, &path, &file->id);
+    lfs_stag_t tag = lfs_dir_find(lfs, at, &file->m, &path, &file->id);
     if (tag < 0 && !(tag == LFS_ERR_NOENT && lfs_path_islast(path))) {
         err = tag;
         goto cleanup;
@@ -3200,6 +5434,48 @@ static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
     // zero to avoid information leak
     lfs_cache_zero(lfs, &file->cache);
 
+    // allocate index if requested
+    if (file->cfg->index_size) {
+        if (file->cfg->index_buffer) {
+            file->index.buffer = file->cfg->index_buffer;
+        } else {
+            file->index.buffer = lfs_malloc(file->cfg->index_size
+                    * sizeof(struct lfs_file_index_entry));
+            if (!file->index.buffer) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+
+        file->index.size = file->cfg->index_size;
+        lfs_file_indexdrop(&file->index, 0);
+    }
+
+    // allocate read-ahead buffer if requested
+    if (file->cfg->readahead_size) {
+        LFS_ASSERT(file->cfg->readahead_size % lfs->cfg->read_size == 0);
+        if (file->cfg->readahead_buffer) {
+            file->ahead.buffer = file->cfg->readahead_buffer;
+        } else {
+            file->ahead.buffer = lfs_malloc(file->cfg->readahead_size);
+            if (!file->ahead.buffer) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+
+        file->ahead.size = file->cfg->readahead_size;
+        file->ahead.cache[0].buffer = file->ahead.buffer;
+        if (lfs->cfg->io_depth) {
+            // read into one half while the other half is consumed
+            LFS_ASSERT(file->cfg->readahead_size
+                    % (2*lfs->cfg->read_size) == 0);
+            file->ahead.size = file->cfg->readahead_size / 2;
+            file->ahead.cache[1].buffer
+                    = file->ahead.buffer + file->ahead.size;
+        }
+    }
+
     if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
         // load inline files
         file->ctz.head = LFS_BLOCK_INLINE;
@@ -3235,10 +5511,10 @@ cleanup:
 }
 
 #ifndef LFS_NO_MALLOC
-static int lfs_file_open_(lfs_t *lfs, lfs_file_t *file,
-        const char *path, int flags) {
+static int lfs_file_open_(lfs_t *lfs, const lfs_dir_t *at,
+        lfs_file_t *file, const char *path, int flags) {
     static const struct lfs_file_config defaults = {0};
-    int err = lfs_file_opencfg_(lfs, file, path, flags, &defaults);
+    int err = lfs_file_opencfg_(lfs, at, file, path, flags, &defaults);
     return err;
 }
 #endif
@@ -3253,11 +5529,25 @@ static int lfs_file_close_(lfs_t *lfs, lfs_file_t *file) {
     // remove from list of mdirs
     lfs_mlist_remove(lfs, (struct lfs_mlist*)file);
 
+    // wait for any in-flight read-ahead before we free it
+    int err_ = lfs_file_aheaddrop(lfs, file);
+    if (err_ && !err) {
+        err = err_;
+    }
+
     // clean up memory
     if (!file->cfg->buffer) {
         lfs_free(file->cache.buffer);
     }
 
+    if (!file->cfg->index_buffer) {
+        lfs_free(file->index.buffer);
+    }
+
+    if (!file->cfg->readahead_buffer) {
+        lfs_free(file->ahead.buffer);
+    }
+
     return err;
 }
 
@@ -3280,37 +5570,40 @@ static int lfs_file_relocate(lfs_t *lfs, lfs_file_t *file) {
             return err;
         }
 
-        // either read from dirty cache or disk
-        for (lfs_off_t i = 0; i < file->off; i++) {
-            uint8_t data;
-            if (file->flags & LFS_F_INLINE) {
-                err = lfs_dir_getread(lfs, &file->m,
-                        // note we evict inline files before they can be dirty
-                        NULL, &file->cache, file->off-i,
-                        LFS_MKTAG(0xfff, 0x1ff, 0),
-                        LFS_MKTAG(LFS_TYPE_INLINESTRUCT, file->id, 0),
-                        i, &data, 1);
-                if (err) {
-                    return err;
-                }
-            } else {
-                err = lfs_bd_read(lfs,
-                        &file->cache, &lfs->rcache, file->off-i,
-                        file->block, i, &data, 1);
-                if (err) {
-                    return err;
-                }
+        if (file->flags & LFS_F_INLINE) {
+            // inline files always fit in our cache, so we can read them
+            // straight into pcache
+            LFS_ASSERT(file->off <= lfs->cfg->cache_size);
+            lfs->pcache.block = nblock;
+            lfs->pcache.off = 0;
+            lfs->pcache.size = file->off;
+            err = lfs_dir_getread(lfs, &file->m,
+                    // note we evict inline files before they can be dirty
+                    NULL, &file->cache, file->off,
+                    LFS_MKTAG(0xfff, 0x1ff, 0),
+                    LFS_MKTAG(LFS_TYPE_INLINESTRUCT, file->id, 0),
+                    0, lfs->pcache.buffer, file->off);
+            if (err) {
+                lfs_cache_drop(lfs, &lfs->pcache);
+                return err;
             }
 
-            err = lfs_bd_prog(lfs,
+            if (lfs->pcache.size == lfs->cfg->cache_size) {
+                // eagerly flush out pcache if we fill up
+                err = lfs_bd_flush(lfs, &lfs->pcache, &lfs->rcache, true);
+            }
+        } else {
+            // either read from dirty cache or disk
+            err = lfs_bd_copy(lfs,
                     &lfs->pcache, &lfs->rcache, true,
-                    nblock, i, &data, 1);
-            if (err) {
-                if (err == LFS_ERR_CORRUPT) {
-                    goto relocate;
-                }
-                return err;
+                    nblock, 0,
+                    &file->cache, file->block, 0, file->off);
+        }
+        if (err) {
+            if (err == LFS_ERR_CORRUPT) {
+                goto relocate;
             }
+            return err;
         }
 
         // copy over new state of file
@@ -3327,25 +5620,182 @@ static int lfs_file_relocate(lfs_t *lfs, lfs_file_t *file) {
 relocate:
         LFS_DEBUG("Bad block at 0x%"PRIx32, nblock);
 
-        // just clear cache and try a new block
-        lfs_cache_drop(lfs, &lfs->pcache);
-    }
-}
-#endif
+        // just clear cache and try a new block
+        lfs_cache_drop(lfs, &lfs->pcache);
+    }
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_file_outline(lfs_t *lfs, lfs_file_t *file) {
+    file->off = file->pos;
+    lfs_file_indexdrop(&file->index, 0);
+    lfs_alloc_ckpoint(lfs);
+    int err = lfs_file_relocate(lfs, file);
+    if (err) {
+        return err;
+    }
+
+    file->flags &= ~LFS_F_INLINE;
+    return 0;
+}
+#endif
+
+// forget any read-ahead, waiting for in-flight reads so the buffer can be
+// reused
+static int lfs_file_aheaddrop(lfs_t *lfs, lfs_file_t *file) {
+    int err = 0;
+    if (file->ahead.cache[1].block != LFS_BLOCK_NULL) {
+        err = lfs_ioq_wait(lfs, file->ahead.cache[1].block);
+    }
+
+    file->ahead.cache[0].block = LFS_BLOCK_NULL;
+    file->ahead.cache[1].block = LFS_BLOCK_NULL;
+    file->ahead.nblock = LFS_BLOCK_NULL;
+    return err;
+}
+
+// submit a read of whatever follows our current read-ahead, crossing into
+// the next block if needed, so it's hopefully ready by the time we get
+// there, pos is the file position of off in the current read-ahead
+static int lfs_file_aheadsubmit(lfs_t *lfs, lfs_file_t *file,
+        lfs_off_t pos, lfs_off_t off) {
+    lfs_cache_t *ahead = file->ahead.cache;
+    LFS_ASSERT(ahead[1].block == LFS_BLOCK_NULL);
+    if (!lfs->cfg->io_depth) {
+        return 0;
+    }
+
+    lfs_off_t npos = pos + (ahead[0].off + ahead[0].size - off);
+    if (npos >= file->ctz.size) {
+        // nothing left to read
+        return 0;
+    }
+
+    lfs_block_t nblock = ahead[0].block;
+    lfs_off_t noff = ahead[0].off + ahead[0].size;
+    if (noff == lfs->cfg->block_size) {
+        // find the next block now, and remember it so we don't need to
+        // find it again when we get there
+        int err = lfs_ctz_find(lfs, &file->index, NULL, &file->cache,
+                file->ctz.head, file->ctz.size,
+                npos, &nblock, &noff);
+        if (err) {
+            return err;
+        }
+
+        if (lfs->block_count && nblock >= lfs->block_count) {
+            return LFS_ERR_CORRUPT;
+        }
+
+        file->ahead.npos = npos;
+        file->ahead.nblock = nblock;
+        file->ahead.noff = noff;
+    }
+
+    ahead[1].off = lfs_aligndown(noff, lfs->cfg->read_size);
+    ahead[1].size = lfs_min(file->ahead.size,
+            lfs_min(
+                lfs_alignup(noff + (file->ctz.size - npos),
+                    lfs->cfg->read_size),
+                lfs->cfg->block_size)
+            - ahead[1].off);
+    ahead[1].block = nblock;
+    int err = lfs_ioq_submit(lfs, LFS_BD_IO_READ,
+            nblock, ahead[1].off, ahead[1].buffer, ahead[1].size);
+    if (err) {
+        ahead[1].block = LFS_BLOCK_NULL;
+        return err;
+    }
+
+    return 0;
+}
+
+// read file data through the file's read-ahead buffers
+static int lfs_file_aheadread(lfs_t *lfs, lfs_file_t *file,
+        bool sequential, uint8_t *data, lfs_size_t size) {
+    lfs_cache_t *ahead = file->ahead.cache;
+    lfs_off_t pos = file->pos;
+    lfs_block_t block = file->block;
+    lfs_off_t off = file->off;
+
+    while (size > 0) {
+        if (block == ahead[1].block
+                && off >= ahead[1].off
+                && off < ahead[1].off + ahead[1].size) {
+            // reached our in-flight read-ahead? wait for it, and start
+            // reading what comes next
+            int err = lfs_ioq_wait(lfs, block);
+            ahead[0].block = LFS_BLOCK_NULL;
+            lfs_cache_t cache = ahead[0];
+            ahead[0] = ahead[1];
+            ahead[1] = cache;
+            if (err) {
+                ahead[0].block = LFS_BLOCK_NULL;
+                return err;
+            }
+
+            // read-ahead failed? fall back to reading it ourselves
+            if (ahead[0].block != LFS_BLOCK_NULL) {
+                err = lfs_file_aheadsubmit(lfs, file, pos, off);
+                if (err) {
+                    return err;
+                }
+            }
+        }
+
+        if (block == ahead[0].block
+                && off >= ahead[0].off
+                && off < ahead[0].off + ahead[0].size) {
+            // is already in our read-ahead?
+            lfs_size_t diff = lfs_min(size,
+                    ahead[0].size - (off-ahead[0].off));
+            memcpy(data, &ahead[0].buffer[off-ahead[0].off], diff);
+
+            pos += diff;
+            off += diff;
+            data += diff;
+            size -= diff;
+            continue;
+        }
+
+        if (!sequential) {
+            // random reads don't benefit from read-ahead
+            return lfs_bd_read(lfs,
+                    NULL, &file->cache, lfs->cfg->block_size,
+                    block, off, data, size);
+        }
+
+        // read ahead as much of the rest of the block as we can, anything
+        // in flight is no longer useful
+        int err = lfs_file_aheaddrop(lfs, file);
+        if (err) {
+            return err;
+        }
+
+        ahead[0].off = lfs_aligndown(off, lfs->cfg->read_size);
+        ahead[0].size = lfs_min(file->ahead.size,
+                lfs_min(
+                    lfs_alignup(off + (file->ctz.size - pos),
+                        lfs->cfg->read_size),
+                    lfs->cfg->block_size)
+                - ahead[0].off);
+        err = lfs_bd_read(lfs,
+                NULL, &file->cache, ahead[0].size,
+                block, ahead[0].off, ahead[0].buffer, ahead[0].size);
+        if (err) {
+            return err;
+        }
+        ahead[0].block = block;
 
-#ifndef LFS_READONLY
-static int lfs_file_outline(lfs_t *lfs, lfs_file_t *file) {
-    file->off = file->pos;
-    lfs_alloc_ckpoint(lfs);
-    int err = lfs_file_relocate(lfs, file);
-    if (err) {
-        return err;
+        err = lfs_file_aheadsubmit(lfs, file, pos, off);
+        if (err) {
+            return err;
+        }
     }
 
-    file->flags &= ~LFS_F_INLINE;
     return 0;
 }
-#endif
 
 static int lfs_file_flush(lfs_t *lfs, lfs_file_t *file) {
     if (file->flags & LFS_F_READING) {
@@ -3353,6 +5803,12 @@ static int lfs_file_flush(lfs_t *lfs, lfs_file_t *file) {
             lfs_cache_drop(lfs, &file->cache);
         }
         file->flags &= ~LFS_F_READING;
+
+        // wait for any in-flight read-ahead
+        int err = lfs_file_aheaddrop(lfs, file);
+        if (err) {
+            return err;
+        }
     }
 
 #ifndef LFS_READONLY
@@ -3360,35 +5816,59 @@ static int lfs_file_flush(lfs_t *lfs, lfs_file_t *file) {
         lfs_off_t pos = file->pos;
 
         if (!(file->flags & LFS_F_INLINE)) {
-            // copy over anything after current branch
-            lfs_file_t orig = {
-                .ctz.head = file->ctz.head,
-                .ctz.size = file->ctz.size,
-                .flags = LFS_O_RDONLY,
-                .pos = file->pos,
-                .cache = lfs->rcache,
-            };
-            lfs_cache_drop(lfs, &lfs->rcache);
-
+            // copy over anything after current branch, a block at a time
             while (file->pos < file->ctz.size) {
-                // copy over a byte at a time, leave it up to caching
-                // to make this efficient
-                uint8_t data;
-                lfs_ssize_t res = lfs_file_flushedread(lfs, &orig, &data, 1);
-                if (res < 0) {
-                    return res;
+                if (file->off == lfs->cfg->block_size) {
+                    // extend file with new blocks
+                    lfs_alloc_ckpoint(lfs);
+                    int err = lfs_ctz_extend(lfs, &file->cache, &lfs->rcache,
+                            file->block, file->pos,
+                            &file->block, &file->off);
+                    if (err) {
+                        file->flags |= LFS_F_ERRED;
+                        return err;
+                    }
                 }
 
-                res = lfs_file_flushedwrite(lfs, file, &data, 1);
-                if (res < 0) {
-                    return res;
+                // find the same offset in our original skip-list, note
+                // our new blocks share the same layout
+                lfs_block_t oblock;
+                lfs_off_t ooff;
+                int err = lfs_ctz_find(lfs, NULL,
+                        NULL, &lfs->rcache,
+                        file->ctz.head, file->ctz.size,
+                        file->pos, &oblock, &ooff);
+                if (err) {
+                    file->flags |= LFS_F_ERRED;
+                    return err;
                 }
+                LFS_ASSERT(ooff == file->off);
+
+                lfs_size_t diff = lfs_min(file->ctz.size - file->pos,
+                        lfs->cfg->block_size - file->off);
+                while (true) {
+                    err = lfs_bd_copy(lfs,
+                            &file->cache, &lfs->rcache, true,
+                            file->block, file->off,
+                            NULL, oblock, ooff, diff);
+                    if (err != LFS_ERR_CORRUPT) {
+                        break;
+                    }
 
-                // keep our reference to the rcache in sync
-                if (lfs->rcache.block != LFS_BLOCK_NULL) {
-                    lfs_cache_drop(lfs, &orig.cache);
-                    lfs_cache_drop(lfs, &lfs->rcache);
+                    LFS_DEBUG("Bad block at 0x%"PRIx32, file->block);
+                    err = lfs_file_relocate(lfs, file);
+                    if (err) {
+                        break;
+                    }
+                }
+                if (err) {
+                    file->flags |= LFS_F_ERRED;
+                    return err;
                 }
+
+                file->pos += diff;
+                file->off += diff;
+                lfs_alloc_ckpoint(lfs);
             }
 
             // write out what we have
@@ -3502,12 +5982,21 @@ static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
     size = lfs_min(size, file->ctz.size - file->pos);
     nsize = size;
 
+    // only read ahead if we're continuing where we left off
+    bool sequential = (file->pos == file->ahead.pos);
+
     while (nsize > 0) {
         // check if we need a new block
         if (!(file->flags & LFS_F_READING) ||
                 file->off == lfs->cfg->block_size) {
-            if (!(file->flags & LFS_F_INLINE)) {
-                int err = lfs_ctz_find(lfs, NULL, &file->cache,
+            if (!(file->flags & LFS_F_INLINE)
+                    && file->ahead.nblock != LFS_BLOCK_NULL
+                    && file->pos == file->ahead.npos) {
+                // already found by read-ahead?
+                file->block = file->ahead.nblock;
+                file->off = file->ahead.noff;
+            } else if (!(file->flags & LFS_F_INLINE)) {
+                int err = lfs_ctz_find(lfs, &file->index, NULL, &file->cache,
                         file->ctz.head, file->ctz.size,
                         file->pos, &file->block, &file->off);
                 if (err) {
@@ -3532,6 +6021,11 @@ static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
             if (err) {
                 return err;
             }
+        } else if (file->ahead.size) {
+            int err = lfs_file_aheadread(lfs, file, sequential, data, diff);
+            if (err) {
+                return err;
+            }
         } else {
             int err = lfs_bd_read(lfs,
                     NULL, &file->cache, lfs->cfg->block_size,
@@ -3547,12 +6041,52 @@ static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
         nsize -= diff;
     }
 
+    file->ahead.pos = file->pos;
+    return size;
+}
+
+static lfs_ssize_t lfs_file_readv_(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, lfs_size_t count) {
+    LFS_ASSERT((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY);
+
+#ifndef LFS_READONLY
+    if (file->flags & LFS_F_WRITING) {
+        // flush out any writes
+        int err = lfs_file_flush(lfs, file);
+        if (err) {
+            return err;
+        }
+    }
+#endif
+
+    lfs_size_t size = 0;
+    for (lfs_size_t i = 0; i < count; i++) {
+        lfs_ssize_t res = lfs_file_flushedread(lfs, file,
+                iov[i].buffer, iov[i].size);
+        if (res < 0) {
+            return res;
+        }
+
+        size += res;
+        if ((lfs_size_t)res < iov[i].size) {
+            // end of file
+            break;
+        }
+    }
+
     return size;
 }
 
 static lfs_ssize_t lfs_file_read_(lfs_t *lfs, lfs_file_t *file,
         void *buffer, lfs_size_t size) {
+    return lfs_file_readv_(lfs, file,
+            &(struct lfs_iovec){buffer, size}, 1);
+}
+
+static lfs_ssize_t lfs_file_borrow_(lfs_t *lfs, lfs_file_t *file,
+        const void **buffer, lfs_size_t size) {
     LFS_ASSERT((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY);
+    *buffer = NULL;
 
 #ifndef LFS_READONLY
     if (file->flags & LFS_F_WRITING) {
@@ -3564,11 +6098,75 @@ static lfs_ssize_t lfs_file_read_(lfs_t *lfs, lfs_file_t *file,
     }
 #endif
 
-    return lfs_file_flushedread(lfs, file, buffer, size);
+    if (file->pos >= file->ctz.size || size == 0) {
+        // eof if past end
+        return 0;
+    }
+
+    size = lfs_min(size, file->ctz.size - file->pos);
+
+    // check if we need a new block
+    if (!(file->flags & LFS_F_READING) ||
+            file->off == lfs->cfg->block_size) {
+        if (!(file->flags & LFS_F_INLINE)) {
+            int err = lfs_ctz_find(lfs, &file->index, NULL, &file->cache,
+                    file->ctz.head, file->ctz.size,
+                    file->pos, &file->block, &file->off);
+            if (err) {
+                return err;
+            }
+        } else {
+            file->block = LFS_BLOCK_INLINE;
+            file->off = file->pos;
+        }
+
+        file->flags |= LFS_F_READING;
+    }
+
+    // borrow as much as we can in current block
+    lfs_size_t diff = lfs_min(size, lfs->cfg->block_size - file->off);
+    if (file->flags & LFS_F_INLINE) {
+        // inline files always fit in our file cache, reading a byte makes
+        // sure the cache holds our position
+        uint8_t dat;
+        int err = lfs_dir_getread(lfs, &file->m,
+                NULL, &file->cache, lfs->cfg->block_size,
+                LFS_MKTAG(0xfff, 0x1ff, 0),
+                LFS_MKTAG(LFS_TYPE_INLINESTRUCT, file->id, 0),
+                file->off, &dat, 1);
+        if (err) {
+            return err;
+        }
+
+        LFS_ASSERT(file->cache.block == LFS_BLOCK_INLINE
+                && file->off >= file->cache.off
+                && file->off < file->cache.off + file->cache.size);
+        diff = lfs_min(diff,
+                file->cache.size - (file->off - file->cache.off));
+        *buffer = &file->cache.buffer[file->off - file->cache.off];
+    } else {
+        const uint8_t *map;
+        int err = lfs_bd_map(lfs, NULL,
+                file->block, file->off, diff, &map);
+        if (err) {
+            return err;
+        }
+
+        if (!map) {
+            // block isn't mapped into memory, can't borrow
+            return LFS_ERR_INVAL;
+        }
+        *buffer = map;
+    }
+
+    file->pos += diff;
+    file->off += diff;
+    return diff;
 }
 
 
 #ifndef LFS_READONLY
+// note a NULL buffer writes zeros
 static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
         const void *buffer, lfs_size_t size) {
     const uint8_t *data = buffer;
@@ -3591,7 +6189,8 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
             if (!(file->flags & LFS_F_INLINE)) {
                 if (!(file->flags & LFS_F_WRITING) && file->pos > 0) {
                     // find out which block we're extending from
-                    int err = lfs_ctz_find(lfs, NULL, &file->cache,
+                    int err = lfs_ctz_find(lfs, &file->index,
+                            NULL, &file->cache,
                             file->ctz.head, file->ctz.size,
                             file->pos-1, &file->block, &(lfs_off_t){0});
                     if (err) {
@@ -3603,6 +6202,14 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
                     lfs_cache_zero(lfs, &file->cache);
                 }
 
+                if (!(file->flags & LFS_F_WRITING)) {
+                    // any blocks we remember from the block we're extending
+                    // onwards are about to be rewritten
+                    lfs_file_indexdrop(&file->index, (file->pos > 0)
+                            ? lfs_ctz_index(lfs, &(lfs_off_t){file->pos-1})
+                            : 0);
+                }
+
                 // extend file with new blocks
                 lfs_alloc_ckpoint(lfs);
                 int err = lfs_ctz_extend(lfs, &file->cache, &lfs->rcache,
@@ -3623,8 +6230,11 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
         // program as much as we can in current block
         lfs_size_t diff = lfs_min(nsize, lfs->cfg->block_size - file->off);
         while (true) {
-            int err = lfs_bd_prog(lfs, &file->cache, &lfs->rcache, true,
-                    file->block, file->off, data, diff);
+            int err = (data)
+                    ? lfs_bd_prog(lfs, &file->cache, &lfs->rcache, true,
+                        file->block, file->off, data, diff)
+                    : lfs_bd_fill(lfs, &file->cache, &lfs->rcache, true,
+                        file->block, file->off, diff);
             if (err) {
                 if (err == LFS_ERR_CORRUPT) {
                     goto relocate;
@@ -3644,7 +6254,9 @@ relocate:
 
         file->pos += diff;
         file->off += diff;
-        data += diff;
+        if (data) {
+            data += diff;
+        }
         nsize -= diff;
 
         lfs_alloc_ckpoint(lfs);
@@ -3653,8 +6265,8 @@ relocate:
     return size;
 }
 
-static lfs_ssize_t lfs_file_write_(lfs_t *lfs, lfs_file_t *file,
-        const void *buffer, lfs_size_t size) {
+static lfs_ssize_t lfs_file_writev_(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, lfs_size_t count) {
     LFS_ASSERT((file->flags & LFS_O_WRONLY) == LFS_O_WRONLY);
 
     if (file->flags & LFS_F_READING) {
@@ -3669,6 +6281,15 @@ static lfs_ssize_t lfs_file_write_(lfs_t *lfs, lfs_file_t *file,
         file->pos = file->ctz.size;
     }
 
+    lfs_size_t size = 0;
+    for (lfs_size_t i = 0; i < count; i++) {
+        if (iov[i].size > lfs->file_max - size) {
+            // Larger than file limit?
+            return LFS_ERR_FBIG;
+        }
+        size += iov[i].size;
+    }
+
     if (file->pos + size > lfs->file_max) {
         // Larger than file limit?
         return LFS_ERR_FBIG;
@@ -3679,21 +6300,30 @@ static lfs_ssize_t lfs_file_write_(lfs_t *lfs, lfs_file_t *file,
         lfs_off_t pos = file->pos;
         file->pos = file->ctz.size;
 
-        while (file->pos < pos) {
-            lfs_ssize_t res = lfs_file_flushedwrite(lfs, file, &(uint8_t){0}, 1);
-            if (res < 0) {
-                return res;
-            }
+        lfs_ssize_t res = lfs_file_flushedwrite(lfs, file,
+                NULL, pos - file->pos);
+        if (res < 0) {
+            return res;
         }
     }
 
-    lfs_ssize_t nsize = lfs_file_flushedwrite(lfs, file, buffer, size);
-    if (nsize < 0) {
-        return nsize;
+    for (lfs_size_t i = 0; i < count; i++) {
+        lfs_ssize_t res = lfs_file_flushedwrite(lfs, file,
+                iov[i].buffer, iov[i].size);
+        if (res < 0) {
+            return res;
+        }
     }
 
     file->flags &= ~LFS_F_ERRED;
-    return nsize;
+    return size;
+}
+
+static lfs_ssize_t lfs_file_write_(lfs_t *lfs, lfs_file_t *file,
+        const void *buffer, lfs_size_t size) {
+    // note a NULL buffer writes zeros, see lfs_file_flushedwrite
+    return lfs_file_writev_(lfs, file,
+            &(struct lfs_iovec){(void*)buffer, size}, 1);
 }
 #endif
 
@@ -3779,6 +6409,7 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
             file->ctz.head = LFS_BLOCK_INLINE;
             file->ctz.size = size;
             file->flags |= LFS_F_DIRTY | LFS_F_READING | LFS_F_INLINE;
+            lfs_file_indexdrop(&file->index, 0);
             file->cache.block = file->ctz.head;
             file->cache.off = 0;
             file->cache.size = lfs->cfg->cache_size;
@@ -3792,7 +6423,7 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
             }
 
             // lookup new head in ctz skip list
-            err = lfs_ctz_find(lfs, NULL, &file->cache,
+            err = lfs_ctz_find(lfs, &file->index, NULL, &file->cache,
                     file->ctz.head, file->ctz.size,
                     size-1, &file->block, &(lfs_off_t){0});
             if (err) {
@@ -3814,11 +6445,9 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
         }
 
         // fill with zeros
-        while (file->pos < size) {
-            res = lfs_file_write_(lfs, file, &(uint8_t){0}, 1);
-            if (res < 0) {
-                return (int)res;
-            }
+        res = lfs_file_write_(lfs, file, NULL, size - file->pos);
+        if (res < 0) {
+            return (int)res;
         }
     }
 
@@ -3860,9 +6489,10 @@ static lfs_soff_t lfs_file_size_(lfs_t *lfs, lfs_file_t *file) {
 
 
 /// General fs operations ///
-static int lfs_stat_(lfs_t *lfs, const char *path, struct lfs_info *info) {
+static int lfs_stat_(lfs_t *lfs, const lfs_dir_t *at,
+        const char *path, struct lfs_info *info) {
     lfs_mdir_t cwd;
-    lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &path, NULL);
+    lfs_stag_t tag = lfs_dir_find(lfs, at, &cwd, &path, NULL);
     if (tag < 0) {
         return (int)tag;
     }
@@ -3877,7 +6507,7 @@ static int lfs_stat_(lfs_t *lfs, const char *path, struct lfs_info *info) {
 }
 
 #ifndef LFS_READONLY
-static int lfs_remove_(lfs_t *lfs, const char *path) {
+static int lfs_remove_(lfs_t *lfs, const lfs_dir_t *at, const char *path) {
     // deorphan if we haven't yet, needed at most once after poweron
     int err = lfs_fs_forceconsistency(lfs);
     if (err) {
@@ -3885,7 +6515,7 @@ static int lfs_remove_(lfs_t *lfs, const char *path) {
     }
 
     lfs_mdir_t cwd;
-    lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &path, NULL);
+    lfs_stag_t tag = lfs_dir_find(lfs, at, &cwd, &path, NULL);
     if (tag < 0 || lfs_tag_id(tag) == 0x3ff) {
         return (tag < 0) ? (int)tag : LFS_ERR_INVAL;
     }
@@ -3958,7 +6588,9 @@ static int lfs_remove_(lfs_t *lfs, const char *path) {
 #endif
 
 #ifndef LFS_READONLY
-static int lfs_rename_(lfs_t *lfs, const char *oldpath, const char *newpath) {
+static int lfs_rename_(lfs_t *lfs,
+        const lfs_dir_t *oldat, const char *oldpath,
+        const lfs_dir_t *newat, const char *newpath) {
     // deorphan if we haven't yet, needed at most once after poweron
     int err = lfs_fs_forceconsistency(lfs);
     if (err) {
@@ -3967,15 +6599,20 @@ static int lfs_rename_(lfs_t *lfs, const char *oldpath, const char *newpath) {
 
     // find old entry
     lfs_mdir_t oldcwd;
-    lfs_stag_t oldtag = lfs_dir_find(lfs, &oldcwd, &oldpath, NULL);
+    lfs_stag_t oldtag = lfs_dir_find(lfs, oldat, &oldcwd, &oldpath, NULL);
     if (oldtag < 0 || lfs_tag_id(oldtag) == 0x3ff) {
         return (oldtag < 0) ? (int)oldtag : LFS_ERR_INVAL;
     }
 
+    // can't move anything into a removed dir
+    if (lfs_path_isremoved(newat, newpath)) {
+        return LFS_ERR_NOENT;
+    }
+
     // find new entry
     lfs_mdir_t newcwd;
     uint16_t newid;
-    lfs_stag_t prevtag = lfs_dir_find(lfs, &newcwd, &newpath, &newid);
+    lfs_stag_t prevtag = lfs_dir_find(lfs, newat, &newcwd, &newpath, &newid);
     if ((prevtag < 0 || lfs_tag_id(prevtag) == 0x3ff) &&
             !(prevtag == LFS_ERR_NOENT && lfs_path_islast(newpath))) {
         return (prevtag < 0) ? (int)prevtag : LFS_ERR_INVAL;
@@ -4104,10 +6741,10 @@ static int lfs_rename_(lfs_t *lfs, const char *oldpath, const char *newpath) {
 }
 #endif
 
-static lfs_ssize_t lfs_getattr_(lfs_t *lfs, const char *path,
-        uint8_t type, void *buffer, lfs_size_t size) {
+static lfs_ssize_t lfs_getattr_(lfs_t *lfs, const lfs_dir_t *at,
+        const char *path, uint8_t type, void *buffer, lfs_size_t size) {
     lfs_mdir_t cwd;
-    lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &path, NULL);
+    lfs_stag_t tag = lfs_dir_find(lfs, at, &cwd, &path, NULL);
     if (tag < 0) {
         return tag;
     }
@@ -4141,7 +6778,7 @@ static lfs_ssize_t lfs_getattr_(lfs_t *lfs, const char *path,
 static int lfs_commitattr(lfs_t *lfs, const char *path,
         uint8_t type, const void *buffer, lfs_size_t size) {
     lfs_mdir_t cwd;
-    lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &path, NULL);
+    lfs_stag_t tag = lfs_dir_find(lfs, NULL, &cwd, &path, NULL);
     if (tag < 0) {
         return tag;
     }
@@ -4215,11 +6852,13 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     // which littlefs currently does not support
     LFS_ASSERT((bool)0x80000000);
 
-    // check that the required io functions are provided
-    LFS_ASSERT(lfs->cfg->read != NULL);
+    // check that the required io functions are provided, read/prog/erase
+    // can be emulated with submit/wait
+    LFS_ASSERT((lfs->cfg->submit == NULL) == (lfs->cfg->wait == NULL));
+    LFS_ASSERT(lfs->cfg->read != NULL || lfs->cfg->submit != NULL);
 #ifndef LFS_READONLY
-    LFS_ASSERT(lfs->cfg->prog != NULL);
-    LFS_ASSERT(lfs->cfg->erase != NULL);
+    LFS_ASSERT(lfs->cfg->prog != NULL || lfs->cfg->submit != NULL);
+    LFS_ASSERT(lfs->cfg->erase != NULL || lfs->cfg->submit != NULL);
     LFS_ASSERT(lfs->cfg->sync != NULL);
 #endif
 
@@ -4268,6 +6907,25 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     LFS_ASSERT(!lfs->cfg->metadata_max
             || lfs->cfg->block_size % lfs->cfg->metadata_max == 0);
 
+    // no additional read cache lines, extents, or io queue until allocated
+    lfs->rlines.lines = NULL;
+    lfs->rlines.sets = 0;
+    lfs->rlines.ways = 0;
+    lfs->mindex.block = LFS_BLOCK_NULL;
+    lfs->mindex.entries = NULL;
+    lfs->mcache.entries = NULL;
+    lfs->mcache.count = 0;
+    lfs->namehash = NULL;
+    lfs->dcache.entries = NULL;
+    lfs->dcache.count = 0;
+    lfs->extents.buffer = NULL;
+    lfs->ioq.ios = NULL;
+    lfs->ioq.buffer = NULL;
+    lfs->ioq.head = 0;
+    lfs->ioq.count = 0;
+    lfs->ioq.bad = NULL;
+    lfs->ioq.badcount = 0;
+
     // setup read cache
     if (lfs->cfg->read_buffer) {
         lfs->rcache.buffer = lfs->cfg->read_buffer;
@@ -4279,6 +6937,69 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
         }
     }
 
+    // setup additional read cache lines
+    if (lfs->cfg->read_cache_lines) {
+        LFS_ASSERT(lfs->cfg->read_cache_ways <= lfs->cfg->read_cache_lines);
+        LFS_ASSERT(!lfs->cfg->read_cache_ways
+                || lfs->cfg->read_cache_lines
+                    % lfs->cfg->read_cache_ways == 0);
+        LFS_ASSERT(lfs->cfg->read_cache_policy == LFS_READ_CACHE_LRU
+                || lfs->cfg->read_cache_policy == LFS_READ_CACHE_FIFO);
+        lfs->rlines.ways = (lfs->cfg->read_cache_ways)
+                ? lfs->cfg->read_cache_ways
+                : lfs->cfg->read_cache_lines;
+        lfs->rlines.sets = lfs->cfg->read_cache_lines / lfs->rlines.ways;
+
+        // line state is stored in front of the line buffers
+        uint8_t *buffer;
+        if (lfs->cfg->read_cache_buffer) {
+            buffer = lfs->cfg->read_cache_buffer;
+        } else {
+            buffer = lfs_malloc(lfs->cfg->read_cache_lines
+                    * (sizeof(lfs_cache_t) + lfs->cfg->cache_size));
+            if (!buffer) {
+                lfs->rlines.sets = 0;
+                lfs->rlines.ways = 0;
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+
+        lfs->rlines.lines = (lfs_cache_t*)buffer;
+        buffer += lfs->cfg->read_cache_lines*sizeof(lfs_cache_t);
+        for (lfs_size_t i = 0; i < lfs->cfg->read_cache_lines; i++) {
+            lfs->rlines.lines[i].buffer = buffer + i*lfs->cfg->cache_size;
+            lfs_cache_zero(lfs, &lfs->rlines.lines[i]);
+        }
+    }
+
+    // setup io queue for in-flight operations
+    if (lfs->cfg->io_depth) {
+        LFS_ASSERT(lfs->cfg->submit != NULL);
+
+        // operation state and bad blocks are stored in front of the
+        // operation buffers
+        uint8_t *buffer;
+        if (lfs->cfg->io_buffer) {
+            buffer = lfs->cfg->io_buffer;
+        } else {
+            buffer = lfs_malloc(lfs->cfg->io_depth
+                    * (sizeof(struct lfs_bd_io) + sizeof(lfs_block_t)
+                        + lfs->cfg->cache_size));
+            if (!buffer) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+
+        lfs->ioq.ios = (struct lfs_bd_io*)buffer;
+        lfs->ioq.bad = (lfs_block_t*)(buffer
+                + lfs->cfg->io_depth*sizeof(struct lfs_bd_io));
+        lfs->ioq.buffer = buffer
+                + lfs->cfg->io_depth*(sizeof(struct lfs_bd_io)
+                    + sizeof(lfs_block_t));
+    }
+
     // setup program cache
     if (lfs->cfg->prog_buffer) {
         lfs->pcache.buffer = lfs->cfg->prog_buffer;
@@ -4307,6 +7028,88 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
         }
     }
 
+    // setup fetched metadata pair cache
+    if (lfs->cfg->mdir_cache_size) {
+        if (lfs->cfg->mdir_cache_buffer) {
+            lfs->mcache.entries = lfs->cfg->mdir_cache_buffer;
+        } else {
+            lfs->mcache.entries = lfs_malloc(lfs->cfg->mdir_cache_size
+                    * sizeof(struct lfs_mcache_entry));
+            if (!lfs->mcache.entries) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+    }
+
+    // setup dentry cache
+    if (lfs->cfg->dentry_cache_size) {
+        if (lfs->cfg->dentry_cache_buffer) {
+            lfs->dcache.entries = lfs->cfg->dentry_cache_buffer;
+        } else {
+            lfs->dcache.entries = lfs_malloc(lfs->cfg->dentry_cache_size
+                    * sizeof(struct lfs_dcache_entry));
+            if (!lfs->dcache.entries) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+    }
+
+    // setup name hash buffer
+    LFS_ASSERT(lfs->cfg->name_hash_size <= 0x3fe);
+    if (lfs->cfg->name_hash_size) {
+        if (lfs->cfg->name_hash_buffer) {
+            lfs->namehash = lfs->cfg->name_hash_buffer;
+        } else {
+            lfs->namehash = lfs_malloc(lfs->cfg->name_hash_size);
+            if (!lfs->namehash) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+    }
+
+    // setup metadata index
+    if (lfs->cfg->metadata_index_size) {
+        if (lfs->cfg->metadata_index_buffer) {
+            lfs->mindex.entries = lfs->cfg->metadata_index_buffer;
+        } else {
+            lfs->mindex.entries = lfs_malloc(lfs->cfg->metadata_index_size
+                    * sizeof(struct lfs_mindex_entry));
+            if (!lfs->mindex.entries) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+    }
+
+    // setup allocator extents
+    if (lfs->cfg->lookahead_extents) {
+        if (lfs->cfg->lookahead_extents_buffer) {
+            lfs->extents.buffer = lfs->cfg->lookahead_extents_buffer;
+        } else {
+            lfs->extents.buffer = lfs_malloc(lfs->cfg->lookahead_extents
+                    * sizeof(struct lfs_extent));
+            if (!lfs->extents.buffer) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+    }
+    lfs->extents.start = 0;
+    lfs->extents.off = 0;
+    lfs->extents.size = 0;
+    lfs->extents.count = 0;
+
+    // no free map until we find one during mount
+    lfs->freemap.head = LFS_BLOCK_NULL;
+    lfs->freemap.size = 0;
+    lfs->freemap.avail = 0;
+
+    // mount replaces this with what's on disk
+    lfs->disk_version = lfs_fs_disk_version_needed(lfs);
+
     // check that the size limits are sane
     LFS_ASSERT(lfs->cfg->name_max <= LFS_NAME_MAX);
     lfs->name_max = lfs->cfg->name_max;
@@ -4369,11 +7172,19 @@ cleanup:
 }
 
 static int lfs_deinit(lfs_t *lfs) {
+    // wait for in-flight operations, a failure here is our last chance to
+    // report it, but we still need to clean up
+    int err = lfs_ioq_wait(lfs, LFS_BLOCK_NULL);
+
     // free allocated memory
     if (!lfs->cfg->read_buffer) {
         lfs_free(lfs->rcache.buffer);
     }
 
+    if (!lfs->cfg->read_cache_buffer) {
+        lfs_free(lfs->rlines.lines);
+    }
+
     if (!lfs->cfg->prog_buffer) {
         lfs_free(lfs->pcache.buffer);
     }
@@ -4382,7 +7193,31 @@ static int lfs_deinit(lfs_t *lfs) {
         lfs_free(lfs->lookahead.buffer);
     }
 
-    return 0;
+    if (!lfs->cfg->metadata_index_buffer) {
+        lfs_free(lfs->mindex.entries);
+    }
+
+    if (!lfs->cfg->mdir_cache_buffer) {
+        lfs_free(lfs->mcache.entries);
+    }
+
+    if (!lfs->cfg->name_hash_buffer) {
+        lfs_free(lfs->namehash);
+    }
+
+    if (!lfs->cfg->dentry_cache_buffer) {
+        lfs_free(lfs->dcache.entries);
+    }
+
+    if (!lfs->cfg->lookahead_extents_buffer) {
+        lfs_free(lfs->extents.buffer);
+    }
+
+    if (!lfs->cfg->io_buffer) {
+        lfs_free(lfs->ioq.ios);
+    }
+
+    return err;
 }
 
 
@@ -4415,7 +7250,7 @@ static int lfs_format_(lfs_t *lfs, const struct lfs_config *cfg) {
 
         // write one superblock
         lfs_superblock_t superblock = {
-            .version     = lfs_fs_disk_version(lfs),
+            .version     = lfs->disk_version,
             .block_size  = lfs->cfg->block_size,
             .block_count = lfs->block_count,
             .name_max    = lfs->name_max,
@@ -4492,6 +7327,10 @@ static int lfs_mount_(lfs_t *lfs, const struct lfs_config *cfg) {
         .i = 1,
         .period = 1,
     };
+#ifndef LFS_READONLY
+    lfs_mdir_t sdir;
+    uint32_t mcrc = 0xffffffff;
+#endif
     while (!lfs_pair_isnull(dir.tail)) {
         err = lfs_tortoise_detectcycles(&dir, &tortoise);
         if (err < 0) {
@@ -4510,12 +7349,29 @@ static int lfs_mount_(lfs_t *lfs, const struct lfs_config *cfg) {
             goto cleanup;
         }
 
+        // start reading the next mdir while we look at this one
+        err = lfs_dir_prefetch(lfs, dir.tail);
+        if (err) {
+            goto cleanup;
+        }
+
+#ifndef LFS_READONLY
+        // fingerprint our metadata in case we find a free map
+        mcrc = lfs_freemap_fold(mcrc, &dir, tag && !lfs_tag_isdelete(tag));
+#endif
+
         // has superblock?
         if (tag && !lfs_tag_isdelete(tag)) {
             // update root
             lfs->root[0] = dir.pair[0];
             lfs->root[1] = dir.pair[1];
 
+#ifndef LFS_READONLY
+            // keep track of any free map, we need to wait until we've seen
+            // all metadata before we know if it's up-to-date
+            sdir = dir;
+#endif
+
             // grab superblock
             lfs_superblock_t superblock;
             tag = lfs_dir_get(lfs, &dir, LFS_MKTAG(0x7ff, 0x3ff, 0),
@@ -4542,17 +7398,20 @@ static int lfs_mount_(lfs_t *lfs, const struct lfs_config *cfg) {
                 goto cleanup;
             }
 
-            // found older minor version? set an in-device only bit in the
-            // gstate so we know we need to rewrite the superblock before
-            // the first write
+            // found older minor version than we write? set an in-device
+            // only bit in the gstate so we know we need to rewrite the
+            // superblock before the first write
             bool needssuperblock = false;
-            if (minor_version < lfs_fs_disk_version_minor(lfs)) {
+            lfs->disk_version = superblock.version;
+            if (superblock.version < lfs_fs_disk_version_needed(lfs)) {
                 LFS_DEBUG("Found older minor version "
                         "v%"PRIu16".%"PRIu16" < v%"PRIu16".%"PRIu16,
                         major_version,
                         minor_version,
                         lfs_fs_disk_version_major(lfs),
-                        lfs_fs_disk_version_minor(lfs));
+                        (uint16_t)(0xffff
+                            & lfs_fs_disk_version_needed(lfs)));
+                lfs->disk_version = lfs_fs_disk_version_needed(lfs);
                 needssuperblock = true;
             }
             // note this bit is reserved on disk, so fetching more gstate
@@ -4637,6 +7496,17 @@ static int lfs_mount_(lfs_t *lfs, const struct lfs_config *cfg) {
     lfs->lookahead.start = lfs->seed % lfs->block_count;
     lfs_alloc_drop(lfs);
 
+#ifndef LFS_READONLY
+    // found a free map in the superblock? we can use this instead of
+    // traversing the filesystem if it's still up-to-date
+    if (!lfs_pair_isnull(lfs->root)) {
+        err = lfs_freemap_load(lfs, &sdir, mcrc);
+        if (err) {
+            goto cleanup;
+        }
+    }
+#endif
+
     return 0;
 
 cleanup:
@@ -4651,10 +7521,9 @@ static int lfs_unmount_(lfs_t *lfs) {
 
 /// Filesystem filesystem operations ///
 static int lfs_fs_stat_(lfs_t *lfs, struct lfs_fsinfo *fsinfo) {
-    // if the superblock is up-to-date, we must be on the most recent
-    // minor version of littlefs
+    // if the superblock is up-to-date, we know the minor version on disk
     if (!lfs_gstate_needssuperblock(&lfs->gstate)) {
-        fsinfo->disk_version = lfs_fs_disk_version(lfs);
+        fsinfo->disk_version = lfs->disk_version;
 
     // otherwise we need to read the minor version on disk
     } else {
@@ -4690,9 +7559,26 @@ static int lfs_fs_stat_(lfs_t *lfs, struct lfs_fsinfo *fsinfo) {
     return 0;
 }
 
+// report both blocks of a metadata pair, as one range if contiguous
+static int lfs_pair_traverse(const lfs_block_t pair[2],
+        int (*cb)(void*, lfs_block_t, lfs_size_t), void *data) {
+    if (pair[1] == pair[0] + 1) {
+        return cb(data, pair[0], 2);
+    } else if (pair[0] == pair[1] + 1) {
+        return cb(data, pair[1], 2);
+    }
+
+    int err = cb(data, pair[0], 1);
+    if (err) {
+        return err;
+    }
+
+    return cb(data, pair[1], 1);
+}
+
 int lfs_fs_traverse_(lfs_t *lfs,
-        int (*cb)(void *data, lfs_block_t block), void *data,
-        bool includeorphans) {
+        int (*cb)(void *data, lfs_block_t block, lfs_size_t count),
+        void *data, bool includeorphans) {
     // iterate over metadata pairs
     lfs_mdir_t dir = {.tail = {0, 1}};
 
@@ -4721,15 +7607,13 @@ int lfs_fs_traverse_(lfs_t *lfs,
             return LFS_ERR_CORRUPT;
         }
 
-        for (int i = 0; i < 2; i++) {
-            int err = cb(data, dir.tail[i]);
-            if (err) {
-                return err;
-            }
+        int err = lfs_pair_traverse(dir.tail, cb, data);
+        if (err) {
+            return err;
         }
 
         // iterate through ids in directory
-        int err = lfs_dir_fetch(lfs, &dir, dir.tail);
+        err = lfs_dir_fetch(lfs, &dir, dir.tail);
         if (err) {
             return err;
         }
@@ -4752,16 +7636,22 @@ int lfs_fs_traverse_(lfs_t *lfs,
                 if (err) {
                     return err;
                 }
-            } else if (includeorphans &&
-                    lfs_tag_type3(tag) == LFS_TYPE_DIRSTRUCT) {
-                for (int i = 0; i < 2; i++) {
-                    err = cb(data, (&ctz.head)[i]);
-                    if (err) {
-                        return err;
-                    }
+            } else if (includeorphans &&
+                    lfs_tag_type3(tag) == LFS_TYPE_DIRSTRUCT) {
+                err = lfs_pair_traverse(
+                        (const lfs_block_t[2]){ctz.head, ctz.size},
+                        cb, data);
+                if (err) {
+                    return err;
                 }
             }
         }
+
+        // start reading the next mdir
+        err = lfs_dir_prefetch(lfs, dir.tail);
+        if (err) {
+            return err;
+        }
     }
 
 #ifndef LFS_READONLY
@@ -4787,6 +7677,15 @@ int lfs_fs_traverse_(lfs_t *lfs,
             }
         }
     }
+
+    // iterate over the free map if we're still allocating from it
+    if (lfs->freemap.head != LFS_BLOCK_NULL) {
+        int err = lfs_ctz_traverse(lfs, NULL, &lfs->rcache,
+                lfs->freemap.head, lfs->freemap.size, cb, data);
+        if (err) {
+            return err;
+        }
+    }
 #endif
 
     return 0;
@@ -4818,6 +7717,12 @@ static int lfs_fs_pred(lfs_t *lfs,
         if (err) {
             return err;
         }
+
+        // start reading the next mdir before we need it
+        err = lfs_dir_prefetch(lfs, pdir->tail);
+        if (err) {
+            return err;
+        }
     }
 
     return LFS_ERR_NOENT;
@@ -4879,6 +7784,12 @@ static lfs_stag_t lfs_fs_parent(lfs_t *lfs, const lfs_block_t pair[2],
         if (tag && tag != LFS_ERR_NOENT) {
             return tag;
         }
+
+        // start reading the next mdir before we need it
+        err = lfs_dir_prefetch(lfs, parent->tail);
+        if (err) {
+            return err;
+        }
     }
 
     return LFS_ERR_NOENT;
@@ -4930,7 +7841,7 @@ static int lfs_fs_desuperblock(lfs_t *lfs) {
 
     // write a new superblock
     lfs_superblock_t superblock = {
-        .version     = lfs_fs_disk_version(lfs),
+        .version     = lfs->disk_version,
         .block_size  = lfs->cfg->block_size,
         .block_count = lfs->block_count,
         .name_max    = lfs->name_max,
@@ -5169,10 +8080,10 @@ static int lfs_fs_mkconsistent_(lfs_t *lfs) {
 }
 #endif
 
-static int lfs_fs_size_count(void *p, lfs_block_t block) {
+static int lfs_fs_size_count(void *p, lfs_block_t block, lfs_size_t count) {
     (void)block;
     lfs_size_t *size = p;
-    *size += 1;
+    *size += count;
     return 0;
 }
 
@@ -5210,6 +8121,12 @@ static int lfs_fs_gc_(lfs_t *lfs) {
                 return err;
             }
 
+            // start reading the next mdir while we look at this one
+            err = lfs_dir_prefetch(lfs, mdir.tail);
+            if (err) {
+                return err;
+            }
+
             // not erased? exceeds our compaction threshold?
             if (!mdir.erased || ((lfs->cfg->compact_thresh == 0)
                     ? mdir.off > lfs->cfg->block_size - lfs->cfg->block_size/8
@@ -5241,64 +8158,485 @@ static int lfs_fs_gc_(lfs_t *lfs) {
 
 #ifndef LFS_READONLY
 #ifdef LFS_SHRINKNONRELOCATING
-static int lfs_shrink_checkblock(void *data, lfs_block_t block) {
+static int lfs_shrink_checkblock(void *data,
+        lfs_block_t block, lfs_size_t count) {
     lfs_size_t threshold = *((lfs_size_t*)data);
-    if (block >= threshold) {
+    if (block + count > threshold) {
         return LFS_ERR_NOTEMPTY;
     }
     return 0;
 }
 #endif
 
-static int lfs_fs_grow_(lfs_t *lfs, lfs_size_t block_count) {
-    int err;
+static int lfs_fs_grow_(lfs_t *lfs, lfs_size_t block_count) {
+    int err;
+
+    if (block_count == lfs->block_count) {
+        return 0;
+    }
+
+    
+#ifndef LFS_SHRINKNONRELOCATING
+    // shrinking is not supported
+    LFS_ASSERT(block_count >= lfs->block_count);
+#endif
+
+    // the free map and extents no longer cover every block
+    lfs->freemap.head = LFS_BLOCK_NULL;
+    lfs->freemap.size = 0;
+    lfs->freemap.avail = 0;
+    lfs->extents.size = 0;
+    lfs->extents.count = 0;
+#ifdef LFS_SHRINKNONRELOCATING
+    if (block_count < lfs->block_count) {
+        err = lfs_fs_traverse_(lfs, lfs_shrink_checkblock, &block_count, true);
+        if (err) {
+            return err;
+        }
+    }
+#endif
+
+    lfs->block_count = block_count;
+
+    // fetch the root
+    lfs_mdir_t root;
+    err = lfs_dir_fetch(lfs, &root, lfs->root);
+    if (err) {
+        return err;
+    }
+
+    // update the superblock
+    lfs_superblock_t superblock;
+    lfs_stag_t tag = lfs_dir_get(lfs, &root, LFS_MKTAG(0x7ff, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)),
+            &superblock);
+    if (tag < 0) {
+        return tag;
+    }
+    lfs_superblock_fromle32(&superblock);
+
+    superblock.block_count = lfs->block_count;
+
+    lfs_superblock_tole32(&superblock);
+    err = lfs_dir_commit(lfs, &root, LFS_MKATTRS(
+            {tag, &superblock}));
+    if (err) {
+        return err;
+    }
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+struct lfs_freemap_mark {
+    uint8_t *buffer;
+    lfs_block_t start;
+    lfs_block_t size;
+};
+
+static int lfs_freemap_mark(void *p, lfs_block_t block, lfs_size_t count) {
+    struct lfs_freemap_mark *mark = p;
+    lfs_block_t begin = lfs_max(block, mark->start);
+    lfs_block_t end = lfs_min(block + count, mark->start + mark->size);
+    if (begin < end) {
+        lfs_alloc_markrange(mark->buffer,
+                begin - mark->start, end - mark->start);
+    }
+
+    return 0;
+}
+
+static int lfs_freemap_lookahead(lfs_t *lfs) {
+    // copy in-use bits from the free map into the lookahead buffer, keeping
+    // track of which block of the free map we're in so we only need to
+    // search the skip-list once per block
+    lfs_block_t mblock = LFS_BLOCK_NULL;
+    lfs_off_t moff = 0;
+    lfs_off_t mstart = 0;
+    lfs_off_t mend = 0;
+    for (lfs_block_t i = 0; i < lfs->lookahead.size;) {
+        lfs_block_t block = (lfs->lookahead.start + i) % lfs->block_count;
+        lfs_off_t pos = block / 8;
+        if (pos < mstart || pos >= mend) {
+            int err = lfs_ctz_find(lfs, NULL, NULL, &lfs->rcache,
+                    lfs->freemap.head, lfs->freemap.size,
+                    pos, &mblock, &moff);
+            if (err) {
+                return err;
+            }
+
+            mstart = pos;
+            mend = pos + (lfs->cfg->block_size - moff);
+        }
+
+        uint8_t bits;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, mend - pos,
+                mblock, moff + (pos - mstart), &bits, 1);
+        if (err) {
+            return err;
+        }
+
+        lfs_block_t n = lfs_min(lfs_min(
+                    8 - block % 8,
+                    lfs->lookahead.size - i),
+                lfs->block_count - block);
+        for (lfs_block_t j = 0; j < n; j++) {
+            if (bits & (1U << (block % 8 + j))) {
+                lfs->lookahead.buffer[(i+j) / 8] |= 1U << ((i+j) % 8);
+            }
+        }
+        i += n;
+    }
+
+    // the free map doesn't include its own blocks
+    return lfs_ctz_traverse(lfs, NULL, &lfs->rcache,
+            lfs->freemap.head, lfs->freemap.size,
+            lfs_alloc_lookahead, lfs);
+}
+
+// fold the superblock's structs into our metadata fingerprint, these
+// are the only things in the superblock that can change which blocks are
+// in use without changing the superblock's location
+static int lfs_freemap_digest(lfs_t *lfs,
+        const lfs_mdir_t *sdir, uint32_t *mcrc) {
+    for (uint16_t id = 0; id < sdir->count; id++) {
+        struct lfs_ctz ctz;
+        lfs_stag_t tag = lfs_dir_get(lfs, sdir, LFS_MKTAG(0x700, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_STRUCT, id, sizeof(ctz)), &ctz);
+        if (tag < 0) {
+            if (tag == LFS_ERR_NOENT) {
+                continue;
+            }
+            return tag;
+        }
+
+        // inline files don't use any blocks
+        if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT
+                || lfs_tag_type3(tag) == LFS_TYPE_DIRSTRUCT) {
+            uint32_t type = lfs_tole32(lfs_tag_type3(tag));
+            *mcrc = lfs_crc(*mcrc, &type, sizeof(type));
+            *mcrc = lfs_crc(*mcrc, &ctz, sizeof(ctz));
+        }
+    }
+
+    return 0;
+}
+
+static int lfs_freemap_load(lfs_t *lfs, const lfs_mdir_t *sdir,
+        uint32_t mcrc) {
+#ifdef LFS_MULTIVERSION
+    // free maps were added in lfs2.2
+    if (lfs_fs_disk_version(lfs) < 0x00020002) {
+        return 0;
+    }
+#endif
+
+    struct lfs_disk_freemap freemap;
+    lfs_stag_t tag = lfs_dir_get(lfs, sdir, LFS_MKTAG(0x7ff, 0, 0),
+            LFS_MKTAG(LFS_TYPE_FREEMAP, 0, sizeof(freemap)), &freemap);
+    if (tag < 0) {
+        return (tag == LFS_ERR_NOENT) ? 0 : tag;
+    }
+
+    if (lfs_tag_size(tag) != sizeof(freemap)) {
+        return 0;
+    }
+    lfs_freemap_fromle32(&freemap);
+
+    int err = lfs_freemap_digest(lfs, sdir, &mcrc);
+    if (err) {
+        return err;
+    }
+
+    // has any metadata changed since the free map was written?
+    if (freemap.block_count != lfs->block_count
+            || freemap.size != (lfs->block_count+7) / 8
+            || freemap.mcrc != mcrc) {
+        LFS_DEBUG("Found stale free map 0x{%"PRIx32", %"PRIx32"}",
+                sdir->pair[0], sdir->pair[1]);
+        return 0;
+    }
+
+    // have the free map's blocks been reused?
+    uint32_t crc = 0xffffffff;
+    for (lfs_off_t pos = 0; pos < freemap.size;) {
+        lfs_block_t block;
+        lfs_off_t boff;
+        err = lfs_ctz_find(lfs, NULL, NULL, &lfs->rcache,
+                freemap.head, freemap.size, pos, &block, &boff);
+        if (err && err != LFS_ERR_CORRUPT) {
+            return err;
+        }
+
+        lfs_size_t diff = lfs_min(
+                freemap.size - pos,
+                lfs->cfg->block_size - boff);
+        if (!err) {
+            err = lfs_bd_crc(lfs,
+                    NULL, &lfs->rcache, diff,
+                    block, boff, diff, &crc);
+            if (err && err != LFS_ERR_CORRUPT) {
+                return err;
+            }
+        }
+
+        if (err) {
+            LFS_DEBUG("Found corrupted free map 0x{%"PRIx32", %"PRIx32"}",
+                    sdir->pair[0], sdir->pair[1]);
+            return 0;
+        }
+
+        pos += diff;
+    }
+
+    if (crc != freemap.crc) {
+        LFS_DEBUG("Found corrupted free map 0x{%"PRIx32", %"PRIx32"}",
+                sdir->pair[0], sdir->pair[1]);
+        return 0;
+    }
+
+    // free map is good, the block allocator can use it until it has
+    // looked at every block once
+    lfs->freemap.head = freemap.head;
+    lfs->freemap.size = freemap.size;
+    lfs->freemap.avail = lfs->block_count;
+    return 0;
+}
+
+static int lfs_fs_mcrc(lfs_t *lfs, uint32_t *mcrc) {
+    *mcrc = 0xffffffff;
+    lfs_mdir_t dir = {.tail = {0, 1}};
+    struct lfs_tortoise_t tortoise = {
+        .pair = {LFS_BLOCK_NULL, LFS_BLOCK_NULL},
+        .i = 1,
+        .period = 1,
+    };
+    while (!lfs_pair_isnull(dir.tail)) {
+        int err = lfs_tortoise_detectcycles(&dir, &tortoise);
+        if (err < 0) {
+            return LFS_ERR_CORRUPT;
+        }
+
+        // we need to know which mdirs have superblocks, same as mount
+        lfs_stag_t tag = lfs_dir_fetchmatch(lfs, &dir, dir.tail,
+                LFS_MKTAG(0x7ff, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_SUPERBLOCK, 0, 8),
+                NULL,
+                lfs_dir_find_match, &(struct lfs_dir_find_match){
+                    lfs, "littlefs", 8});
+        if (tag < 0) {
+            return tag;
+        }
+
+        *mcrc = lfs_freemap_fold(*mcrc, &dir,
+                tag && !lfs_tag_isdelete(tag));
+    }
+
+    lfs_mdir_t root;
+    int err = lfs_dir_fetch(lfs, &root, lfs->root);
+    if (err) {
+        return err;
+    }
+
+    return lfs_freemap_digest(lfs, &root, mcrc);
+}
+
+// how many times we rebuild a free map that went stale during its own
+// commit before giving up, usually one rebuild is enough since the
+// compaction leaves room for the next commit
+#define LFS_FREEMAP_RETRIES 3
+
+static int lfs_fs_mkfreemap_(lfs_t *lfs) {
+#ifdef LFS_MULTIVERSION
+    // free maps were added in lfs2.2
+    if (lfs_fs_disk_version(lfs) < 0x00020002) {
+        return LFS_ERR_INVAL;
+    }
+#endif
+
+    // flush any pending gstate, we don't want anything else riding along
+    // with our commit
+    int err = lfs_fs_mkconsistent_(lfs);
+    if (err) {
+        return err;
+    }
+
+    // we're replacing any existing free map, so its blocks can be reused
+    lfs_alloc_drop(lfs);
+
+    const lfs_size_t size = (lfs->block_count+7) / 8;
+    int stale = 0;
+    while (true) {
+        // write the free map out in chunks, we borrow the lookahead buffer
+        // to build each chunk, note this is a bit tricky since we also need
+        // to allocate blocks for the free map
+        //
+        // to make this work we only build chunks that fit in the current
+        // block, and force the block allocator to rescan its window before
+        // the next allocation
+        lfs_block_t head = LFS_BLOCK_NULL;
+        lfs_off_t off = 0;
+        uint32_t crc = 0xffffffff;
+        lfs_off_t pos = 0;
+        while (pos < size) {
+            if (pos == 0 || off == lfs->cfg->block_size) {
+                err = lfs_ctz_extend(lfs, &lfs->pcache, &lfs->rcache,
+                        head, pos, &head, &off);
+                if (err) {
+                    goto cleanup;
+                }
+            }
+
+            lfs->lookahead.start = (lfs->lookahead.start + lfs->lookahead.next)
+                    % lfs->block_count;
+            lfs->extents.off += lfs->lookahead.next;
+            lfs->lookahead.next = 0;
+            lfs->lookahead.size = 0;
+
+            lfs_size_t chunk = lfs_min(lfs_min(
+                        lfs->cfg->lookahead_size,
+                        lfs->cfg->block_size - off),
+                    size - pos);
+            memset(lfs->lookahead.buffer, 0, chunk);
+            err = lfs_fs_traverse_(lfs, lfs_freemap_mark,
+                    &(struct lfs_freemap_mark){
+                        lfs->lookahead.buffer, 8*pos, 8*chunk},
+                    true);
+            if (err) {
+                goto cleanup;
+            }
+
+            // mark any padding as in-use
+            if (pos + chunk == size) {
+                for (lfs_block_t b = lfs->block_count; b < 8*size; b++) {
+                    lfs->lookahead.buffer[(b - 8*pos) / 8] |= 1U << (b % 8);
+                }
+            }
+
+            crc = lfs_crc(crc, lfs->lookahead.buffer, chunk);
+            err = lfs_bd_prog(lfs, &lfs->pcache, &lfs->rcache, true,
+                    head, off, lfs->lookahead.buffer, chunk);
+            if (err) {
+                if (err == LFS_ERR_CORRUPT) {
+                    goto relocate;
+                }
+                goto cleanup;
+            }
+
+            off += chunk;
+            pos += chunk;
+        }
+
+        err = lfs_bd_flush(lfs, &lfs->pcache, &lfs->rcache, true);
+        if (err) {
+            if (err == LFS_ERR_CORRUPT) {
+                goto relocate;
+            }
+            goto cleanup;
+        }
+
+        // fingerprint our metadata
+        uint32_t mcrc;
+        err = lfs_fs_mcrc(lfs, &mcrc);
+        if (err) {
+            goto cleanup;
+        }
+
+        // commit the free map to the superblock's metadata pair
+        lfs_mdir_t root;
+        err = lfs_dir_fetch(lfs, &root, lfs->root);
+        if (err) {
+            goto cleanup;
+        }
+
+        struct lfs_disk_freemap freemap = {
+            .head = head,
+            .size = size,
+            .block_count = lfs->block_count,
+            .mcrc = mcrc,
+            .crc = crc,
+        };
+        lfs_freemap_tole32(&freemap);
+
+        // free maps need lfs2.2, so bump an older superblock in the same
+        // commit, this doesn't change the fingerprint
+        bool bump = lfs->disk_version < 0x00020002;
+        lfs_superblock_t superblock = {
+            .version     = lfs_fs_disk_version(lfs),
+            .block_size  = lfs->cfg->block_size,
+            .block_count = lfs->block_count,
+            .name_max    = lfs->name_max,
+            .file_max    = lfs->file_max,
+            .attr_max    = lfs->attr_max,
+        };
+        lfs_superblock_tole32(&superblock);
+
+        err = lfs_dir_commit(lfs, &root, LFS_MKATTRS(
+                {LFS_MKTAG(LFS_TYPE_FREEMAP, 0x3ff, sizeof(freemap)),
+                    &freemap},
+                {LFS_MKTAG_IF(bump,
+                    LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)),
+                    &superblock}));
+        if (err) {
+            goto cleanup;
+        }
 
-    if (block_count == lfs->block_count) {
-        return 0;
-    }
+        if (bump) {
+            lfs->disk_version = lfs_fs_disk_version(lfs);
+        }
 
-    
-#ifndef LFS_SHRINKNONRELOCATING
-    // shrinking is not supported
-    LFS_ASSERT(block_count >= lfs->block_count);
-#endif
-#ifdef LFS_SHRINKNONRELOCATING
-    if (block_count < lfs->block_count) {
-        err = lfs_fs_traverse_(lfs, lfs_shrink_checkblock, &block_count, true);
+        // if our commit compacted or relocated any metadata, the free map
+        // is already stale, and may even be missing blocks, try again
+        uint32_t ncrc;
+        err = lfs_fs_mcrc(lfs, &ncrc);
         if (err) {
-            return err;
+            goto cleanup;
         }
-    }
-#endif
 
-    lfs->block_count = block_count;
+        // compaction doesn't copy the free map either, so make sure it
+        // actually made it to disk
+        err = lfs_dir_fetch(lfs, &root, lfs->root);
+        if (err) {
+            goto cleanup;
+        }
 
-    // fetch the root
-    lfs_mdir_t root;
-    err = lfs_dir_fetch(lfs, &root, lfs->root);
-    if (err) {
-        return err;
-    }
+        lfs_stag_t tag = lfs_dir_get(lfs, &root, LFS_MKTAG(0x7ff, 0, 0),
+                LFS_MKTAG(LFS_TYPE_FREEMAP, 0, sizeof(freemap)), &freemap);
+        if (tag < 0 && tag != LFS_ERR_NOENT) {
+            err = tag;
+            goto cleanup;
+        }
 
-    // update the superblock
-    lfs_superblock_t superblock;
-    lfs_stag_t tag = lfs_dir_get(lfs, &root, LFS_MKTAG(0x7ff, 0x3ff, 0),
-            LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)),
-            &superblock);
-    if (tag < 0) {
-        return tag;
-    }
-    lfs_superblock_fromle32(&superblock);
+        if (ncrc == mcrc && tag != LFS_ERR_NOENT) {
+            // start allocating from our new free map
+            lfs_alloc_drop(lfs);
+            lfs->freemap.head = head;
+            lfs->freemap.size = size;
+            lfs->freemap.avail = lfs->block_count;
+            return 0;
+        }
 
-    superblock.block_count = lfs->block_count;
+        // each rebuild can compact again, so don't chase the metadata
+        // forever
+        stale += 1;
+        if (stale > LFS_FREEMAP_RETRIES) {
+            LFS_ERROR("Free map keeps going stale during commit");
+            err = LFS_ERR_NOSPC;
+            goto cleanup;
+        }
 
-    lfs_superblock_tole32(&superblock);
-    err = lfs_dir_commit(lfs, &root, LFS_MKATTRS(
-            {tag, &superblock}));
-    if (err) {
-        return err;
+        LFS_DEBUG("Free map went stale during commit, rebuilding");
+        continue;
+
+relocate:
+        LFS_DEBUG("Bad block at 0x%"PRIx32, head);
+        lfs_cache_drop(lfs, &lfs->pcache);
     }
-    return 0;
+
+cleanup:
+    lfs_cache_drop(lfs, &lfs->pcache);
+    return err;
 }
 #endif
 
@@ -5545,7 +8883,8 @@ static int lfs1_dir_next(lfs_t *lfs, lfs1_dir_t *dir, lfs1_entry_t *entry) {
 }
 
 /// littlefs v1 specific operations ///
-int lfs1_traverse(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data) {
+int lfs1_traverse(lfs_t *lfs,
+        int (*cb)(void*, lfs_block_t, lfs_size_t), void *data) {
     if (lfs_pair_isnull(lfs->lfs1->root)) {
         return 0;
     }
@@ -5556,14 +8895,12 @@ int lfs1_traverse(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data) {
     lfs_block_t cwd[2] = {0, 1};
 
     while (true) {
-        for (int i = 0; i < 2; i++) {
-            int err = cb(data, cwd[i]);
-            if (err) {
-                return err;
-            }
+        int err = lfs_pair_traverse(cwd, cb, data);
+        if (err) {
+            return err;
         }
 
-        int err = lfs1_dir_fetch(lfs, &dir, cwd);
+        err = lfs1_dir_fetch(lfs, &dir, cwd);
         if (err) {
             return err;
         }
@@ -5595,11 +8932,9 @@ int lfs1_traverse(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data) {
                 break;
             }
 
-            for (int i = 0; i < 2; i++) {
-                err = cb(data, dir2.pair[i]);
-                if (err) {
-                    return err;
-                }
+            err = lfs_pair_traverse(dir2.pair, cb, data);
+            if (err) {
+                return err;
             }
         }
 
@@ -5810,7 +9145,8 @@ static int lfs_migrate_(lfs_t *lfs, const struct lfs_config *cfg) {
                 }
 
                 uint16_t id;
-                err = lfs_dir_find(lfs, &dir2, &(const char*){name}, &id);
+                err = lfs_dir_find(lfs, NULL, &dir2,
+                        &(const char*){name}, &id);
                 if (!(err == LFS_ERR_NOENT && id != 0x3ff)) {
                     err = (err < 0) ? err : LFS_ERR_EXIST;
                     goto cleanup;
@@ -5913,7 +9249,7 @@ static int lfs_migrate_(lfs_t *lfs, const struct lfs_config *cfg) {
         dir2.split = true;
 
         lfs_superblock_t superblock = {
-            .version     = LFS_DISK_VERSION,
+            .version     = lfs->disk_version,
             .block_size  = lfs->cfg->block_size,
             .block_count = lfs->cfg->block_count,
             .name_max    = lfs->name_max,
@@ -6049,7 +9385,7 @@ int lfs_remove(lfs_t *lfs, const char *path) {
     }
     LFS_TRACE("lfs_remove(%p, \"%s\")", (void*)lfs, path);
 
-    err = lfs_remove_(lfs, path);
+    err = lfs_remove_(lfs, NULL, path);
 
     LFS_TRACE("lfs_remove -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -6065,7 +9401,7 @@ int lfs_rename(lfs_t *lfs, const char *oldpath, const char *newpath) {
     }
     LFS_TRACE("lfs_rename(%p, \"%s\", \"%s\")", (void*)lfs, oldpath, newpath);
 
-    err = lfs_rename_(lfs, oldpath, newpath);
+    err = lfs_rename_(lfs, NULL, oldpath, NULL, newpath);
 
     LFS_TRACE("lfs_rename -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -6080,7 +9416,7 @@ int lfs_stat(lfs_t *lfs, const char *path, struct lfs_info *info) {
     }
     LFS_TRACE("lfs_stat(%p, \"%s\", %p)", (void*)lfs, path, (void*)info);
 
-    err = lfs_stat_(lfs, path, info);
+    err = lfs_stat_(lfs, NULL, path, info);
 
     LFS_TRACE("lfs_stat -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -6096,7 +9432,7 @@ lfs_ssize_t lfs_getattr(lfs_t *lfs, const char *path,
     LFS_TRACE("lfs_getattr(%p, \"%s\", %"PRIu8", %p, %"PRIu32")",
             (void*)lfs, path, type, buffer, size);
 
-    lfs_ssize_t res = lfs_getattr_(lfs, path, type, buffer, size);
+    lfs_ssize_t res = lfs_getattr_(lfs, NULL, path, type, buffer, size);
 
     LFS_TRACE("lfs_getattr -> %"PRId32, res);
     LFS_UNLOCK(lfs->cfg);
@@ -6147,7 +9483,7 @@ int lfs_file_open(lfs_t *lfs, lfs_file_t *file, const char *path, int flags) {
             (void*)lfs, (void*)file, path, (unsigned)flags);
     LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
-    err = lfs_file_open_(lfs, file, path, flags);
+    err = lfs_file_open_(lfs, NULL, file, path, flags);
 
     LFS_TRACE("lfs_file_open -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -6168,7 +9504,7 @@ int lfs_file_opencfg(lfs_t *lfs, lfs_file_t *file,
             (void*)cfg, cfg->buffer, (void*)cfg->attrs, cfg->attr_count);
     LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
-    err = lfs_file_opencfg_(lfs, file, path, flags, cfg);
+    err = lfs_file_opencfg_(lfs, NULL, file, path, flags, cfg);
 
     LFS_TRACE("lfs_file_opencfg -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -6243,6 +9579,59 @@ lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file,
 }
 #endif
 
+lfs_ssize_t lfs_file_readv(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, lfs_size_t count) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_readv(%p, %p, %p, %"PRIu32")",
+            (void*)lfs, (void*)file, (void*)iov, count);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    lfs_ssize_t res = lfs_file_readv_(lfs, file, iov, count);
+
+    LFS_TRACE("lfs_file_readv -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+
+lfs_ssize_t lfs_file_borrow(lfs_t *lfs, lfs_file_t *file,
+        const void **buffer, lfs_size_t size) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_borrow(%p, %p, %p, %"PRIu32")",
+            (void*)lfs, (void*)file, (void*)buffer, size);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    lfs_ssize_t res = lfs_file_borrow_(lfs, file, buffer, size);
+
+    LFS_TRACE("lfs_file_borrow -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+
+#ifndef LFS_READONLY
+lfs_ssize_t lfs_file_writev(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, lfs_size_t count) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_writev(%p, %p, %p, %"PRIu32")",
+            (void*)lfs, (void*)file, (void*)iov, count);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    lfs_ssize_t res = lfs_file_writev_(lfs, file, iov, count);
+
+    LFS_TRACE("lfs_file_writev -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+#endif
+
 lfs_soff_t lfs_file_seek(lfs_t *lfs, lfs_file_t *file,
         lfs_soff_t off, int whence) {
     int err = LFS_LOCK(lfs->cfg);
@@ -6330,7 +9719,7 @@ int lfs_mkdir(lfs_t *lfs, const char *path) {
     }
     LFS_TRACE("lfs_mkdir(%p, \"%s\")", (void*)lfs, path);
 
-    err = lfs_mkdir_(lfs, path);
+    err = lfs_mkdir_(lfs, NULL, path);
 
     LFS_TRACE("lfs_mkdir -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -6346,7 +9735,7 @@ int lfs_dir_open(lfs_t *lfs, lfs_dir_t *dir, const char *path) {
     LFS_TRACE("lfs_dir_open(%p, %p, \"%s\")", (void*)lfs, (void*)dir, path);
     LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)dir));
 
-    err = lfs_dir_open_(lfs, dir, path);
+    err = lfs_dir_open_(lfs, NULL, dir, path);
 
     LFS_TRACE("lfs_dir_open -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -6382,6 +9771,25 @@ int lfs_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
     return err;
 }
 
+lfs_ssize_t lfs_dir_readplus(lfs_t *lfs, lfs_dir_t *dir,
+        struct lfs_info *info, lfs_size_t count,
+        const struct lfs_attr *attrs, lfs_size_t attr_count) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_dir_readplus(%p, %p, %p, %"PRIu32", %p, %"PRIu32")",
+            (void*)lfs, (void*)dir, (void*)info, count,
+            (void*)attrs, attr_count);
+
+    lfs_ssize_t res = lfs_dir_readplus_(lfs, dir, info, count,
+            attrs, attr_count);
+
+    LFS_TRACE("lfs_dir_readplus -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+
 int lfs_dir_seek(lfs_t *lfs, lfs_dir_t *dir, lfs_off_t off) {
     int err = LFS_LOCK(lfs->cfg);
     if (err) {
@@ -6425,6 +9833,155 @@ int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir) {
     return err;
 }
 
+#ifndef LFS_NO_MALLOC
+int lfs_file_openat(lfs_t *lfs, lfs_dir_t *at, lfs_file_t *file,
+        const char *path, int flags) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_openat(%p, %p, %p, \"%s\", %x)",
+            (void*)lfs, (void*)at, (void*)file, path, (unsigned)flags);
+    LFS_ASSERT(!at || lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)at));
+    LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    err = lfs_file_open_(lfs, at, file, path, flags);
+
+    LFS_TRACE("lfs_file_openat -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+int lfs_file_opencfgat(lfs_t *lfs, lfs_dir_t *at, lfs_file_t *file,
+        const char *path, int flags,
+        const struct lfs_file_config *cfg) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_opencfgat(%p, %p, %p, \"%s\", %x, %p {"
+                 ".buffer=%p, .attrs=%p, .attr_count=%"PRIu32"})",
+            (void*)lfs, (void*)at, (void*)file, path, (unsigned)flags,
+            (void*)cfg, cfg->buffer, (void*)cfg->attrs, cfg->attr_count);
+    LFS_ASSERT(!at || lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)at));
+    LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    err = lfs_file_opencfg_(lfs, at, file, path, flags, cfg);
+
+    LFS_TRACE("lfs_file_opencfgat -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_dir_openat(lfs_t *lfs, lfs_dir_t *at, lfs_dir_t *dir,
+        const char *path) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_dir_openat(%p, %p, %p, \"%s\")",
+            (void*)lfs, (void*)at, (void*)dir, path);
+    LFS_ASSERT(!at || lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)at));
+    LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)dir));
+
+    err = lfs_dir_open_(lfs, at, dir, path);
+
+    LFS_TRACE("lfs_dir_openat -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+#ifndef LFS_READONLY
+int lfs_mkdirat(lfs_t *lfs, lfs_dir_t *at, const char *path) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_mkdirat(%p, %p, \"%s\")", (void*)lfs, (void*)at, path);
+    LFS_ASSERT(!at || lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)at));
+
+    err = lfs_mkdir_(lfs, at, path);
+
+    LFS_TRACE("lfs_mkdirat -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+#ifndef LFS_READONLY
+int lfs_removeat(lfs_t *lfs, lfs_dir_t *at, const char *path) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_removeat(%p, %p, \"%s\")", (void*)lfs, (void*)at, path);
+    LFS_ASSERT(!at || lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)at));
+
+    err = lfs_remove_(lfs, at, path);
+
+    LFS_TRACE("lfs_removeat -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+#ifndef LFS_READONLY
+int lfs_renameat(lfs_t *lfs, lfs_dir_t *oldat, const char *oldpath,
+        lfs_dir_t *newat, const char *newpath) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_renameat(%p, %p, \"%s\", %p, \"%s\")",
+            (void*)lfs, (void*)oldat, oldpath, (void*)newat, newpath);
+    LFS_ASSERT(!oldat
+            || lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)oldat));
+    LFS_ASSERT(!newat
+            || lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)newat));
+
+    err = lfs_rename_(lfs, oldat, oldpath, newat, newpath);
+
+    LFS_TRACE("lfs_renameat -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+int lfs_statat(lfs_t *lfs, lfs_dir_t *at,
+        const char *path, struct lfs_info *info) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_statat(%p, %p, \"%s\", %p)",
+            (void*)lfs, (void*)at, path, (void*)info);
+    LFS_ASSERT(!at || lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)at));
+
+    err = lfs_stat_(lfs, at, path, info);
+
+    LFS_TRACE("lfs_statat -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+lfs_ssize_t lfs_getattrat(lfs_t *lfs, lfs_dir_t *at, const char *path,
+        uint8_t type, void *buffer, lfs_size_t size) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_getattrat(%p, %p, \"%s\", %"PRIu8", %p, %"PRIu32")",
+            (void*)lfs, (void*)at, path, type, buffer, size);
+    LFS_ASSERT(!at || lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)at));
+
+    lfs_ssize_t res = lfs_getattr_(lfs, at, path, type, buffer, size);
+
+    LFS_TRACE("lfs_getattrat -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+
 int lfs_fs_stat(lfs_t *lfs, struct lfs_fsinfo *fsinfo) {
     int err = LFS_LOCK(lfs->cfg);
     if (err) {
@@ -6453,6 +10010,24 @@ lfs_ssize_t lfs_fs_size(lfs_t *lfs) {
     return res;
 }
 
+struct lfs_fs_traverse_blocks {
+    int (*cb)(void*, lfs_block_t);
+    void *data;
+};
+
+static int lfs_fs_traverse_blocks(void *p,
+        lfs_block_t block, lfs_size_t count) {
+    struct lfs_fs_traverse_blocks *blocks = p;
+    for (lfs_size_t i = 0; i < count; i++) {
+        int err = blocks->cb(blocks->data, block + i);
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
 int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void *, lfs_block_t), void *data) {
     int err = LFS_LOCK(lfs->cfg);
     if (err) {
@@ -6461,13 +10036,30 @@ int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void *, lfs_block_t), void *data) {
     LFS_TRACE("lfs_fs_traverse(%p, %p, %p)",
             (void*)lfs, (void*)(uintptr_t)cb, data);
 
-    err = lfs_fs_traverse_(lfs, cb, data, true);
+    err = lfs_fs_traverse_(lfs, lfs_fs_traverse_blocks,
+            &(struct lfs_fs_traverse_blocks){cb, data}, true);
 
     LFS_TRACE("lfs_fs_traverse -> %d", err);
     LFS_UNLOCK(lfs->cfg);
     return err;
 }
 
+int lfs_fs_traverserange(lfs_t *lfs,
+        int (*cb)(void *, lfs_block_t, lfs_size_t), void *data) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_traverserange(%p, %p, %p)",
+            (void*)lfs, (void*)(uintptr_t)cb, data);
+
+    err = lfs_fs_traverse_(lfs, cb, data, true);
+
+    LFS_TRACE("lfs_fs_traverserange -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
 #ifndef LFS_READONLY
 int lfs_fs_mkconsistent(lfs_t *lfs) {
     int err = LFS_LOCK(lfs->cfg);
@@ -6516,6 +10108,22 @@ int lfs_fs_grow(lfs_t *lfs, lfs_size_t block_count) {
 }
 #endif
 
+#ifndef LFS_READONLY
+int lfs_fs_mkfreemap(lfs_t *lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_mkfreemap(%p)", (void*)lfs);
+
+    err = lfs_fs_mkfreemap_(lfs);
+
+    LFS_TRACE("lfs_fs_mkfreemap -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
 #ifdef LFS_MIGRATE
 int lfs_migrate(lfs_t *lfs, const struct lfs_config *cfg) {
     int err = LFS_LOCK(cfg);
@@ -28,7 +28,11 @@ extern "C"
 // Version of On-disk data structures
 // Major (top-nibble), incremented on backwards incompatible changes
 // Minor (bottom-nibble), incremented on feature additions
-#define LFS_DISK_VERSION 0x00020001
+//
+// This is the newest version we can mount. Disks are only stamped lfs2.2
+// once a free map or name hash is written to them, until then they stay
+// lfs2.1 so older drivers can still mount them
+#define LFS_DISK_VERSION 0x00020002
 #define LFS_DISK_VERSION_MAJOR (0xffff & (LFS_DISK_VERSION >> 16))
 #define LFS_DISK_VERSION_MINOR (0xffff & (LFS_DISK_VERSION >>  0))
 
@@ -65,6 +69,21 @@ typedef uint32_t lfs_block_t;
 #define LFS_ATTR_MAX 1022
 #endif
 
+// Maximum number of bytes of the last name in a remembered metadata pair kept
+// as a fence, may be redefined. Lookups in large directories skip remembered
+// metadata pairs whose fence sorts before their name. Longer fences tell
+// apart names with longer common prefixes, at the cost of a larger mdir
+// cache.
+#ifndef LFS_FENCE_MAX
+#define LFS_FENCE_MAX 16
+#endif
+
+// Maximum name size in bytes kept in the dentry cache, may be redefined.
+// Path components with longer names are always looked up on disk.
+#ifndef LFS_DENTRY_NAME_MAX
+#define LFS_DENTRY_NAME_MAX 32
+#endif
+
 // Possible error codes, these are negative to allow
 // valid positive return values
 enum lfs_error {
@@ -113,6 +132,8 @@ enum lfs_type {
     LFS_TYPE_MOVESTATE      = 0x7ff,
     LFS_TYPE_CCRC           = 0x500,
     LFS_TYPE_FCRC           = 0x5ff,
+    LFS_TYPE_FREEMAP        = 0x5fd,
+    LFS_TYPE_NAMEHASH       = 0x5fe,
 
     // internal chip sources
     LFS_FROM_NOOP           = 0x000,
@@ -145,6 +166,12 @@ enum lfs_open_flags {
     LFS_F_INLINE  = 0x100000, // Currently inlined in directory entry
 };
 
+// Read cache replacement policies
+enum lfs_read_cache_policy {
+    LFS_READ_CACHE_LRU  = 0, // Evict the least recently used line
+    LFS_READ_CACHE_FIFO = 1, // Evict the least recently filled line
+};
+
 // File seek flags
 enum lfs_whence_flags {
     LFS_SEEK_SET = 0,   // Seek relative to an absolute position
@@ -152,6 +179,30 @@ enum lfs_whence_flags {
     LFS_SEEK_END = 2,   // Seek relative to the end of the file
 };
 
+// Asynchronous block device operation types
+enum lfs_bd_io_type {
+    LFS_BD_IO_READ  = 1, // Read size bytes at off into buffer
+    LFS_BD_IO_PROG  = 2, // Program size bytes at off from buffer
+    LFS_BD_IO_ERASE = 3, // Erase the block
+};
+
+// Asynchronous block device operation, see submit in lfs_config
+struct lfs_bd_io {
+    // Type of operation, one of enum lfs_bd_io_type
+    uint8_t type;
+
+    // Block, offset, and buffer of the operation, off, buffer and size are
+    // unused for erases
+    lfs_block_t block;
+    lfs_off_t off;
+    void *buffer;
+    lfs_size_t size;
+
+    // Completion token, free for use by the block device until the
+    // operation is waited on
+    uintptr_t token;
+};
+
 
 // Configuration provided during initialization of the littlefs
 struct lfs_config {
@@ -180,6 +231,49 @@ struct lfs_config {
     // are propagated to the user.
     int (*sync)(const struct lfs_config *c);
 
+    // Optional, copy a region from one block to another without passing
+    // through littlefs's caches, for devices that can copy pages on-chip.
+    // The destination block must have previously been erased. off and size
+    // are a multiple of cache_size, src_off is a multiple of read_size.
+    // Negative error codes are propagated to the user.
+    // May return LFS_ERR_CORRUPT if the block should be considered bad.
+    // Defaults to reading and programming through the caches when NULL.
+    int (*copy)(const struct lfs_config *c, lfs_block_t block,
+            lfs_off_t off, lfs_block_t src_block, lfs_off_t src_off,
+            lfs_size_t size);
+
+    // Optional, program a region in a block with zeros without passing
+    // through littlefs's caches. The block must have previously been
+    // erased. off and size are a multiple of cache_size. Negative error
+    // codes are propagated to the user.
+    // May return LFS_ERR_CORRUPT if the block should be considered bad.
+    // Defaults to programming zeros through the caches when NULL.
+    int (*fill)(const struct lfs_config *c, lfs_block_t block,
+            lfs_off_t off, lfs_size_t size);
+
+    // Optional, map a block into memory for direct reads. On success sets
+    // buffer to the start of the block's data, which must stay readable
+    // and reflect any progs and erases until the filesystem is unmounted.
+    // Setting buffer to NULL falls back to read for that block. Negative
+    // error codes are propagated to the user.
+    // Defaults to reading through the caches when NULL.
+    int (*map)(const struct lfs_config *c, lfs_block_t block,
+            const void **buffer);
+
+    // Optional, start a read, prog, or erase without waiting for it to
+    // complete. io and its buffer stay valid until wait returns for it.
+    // Operations on the same block must complete in the order they are
+    // submitted. read, prog, and erase may be NULL when submit and wait
+    // are provided, in which case they are emulated with submit and wait.
+    // Negative error codes are propagated to the user.
+    int (*submit)(const struct lfs_config *c, struct lfs_bd_io *io);
+
+    // Optional, wait for a submitted operation to complete, returning the
+    // result of the operation. Negative error codes are propagated to the
+    // user.
+    // May return LFS_ERR_CORRUPT if the block should be considered bad.
+    int (*wait)(const struct lfs_config *c, struct lfs_bd_io *io);
+
 #ifdef LFS_THREADSAFE
     // Lock the underlying block device. Negative error codes
     // are propagated to the user.
@@ -283,6 +377,111 @@ struct lfs_config {
     // Set to -1 to disable inlined files.
     lfs_size_t inline_max;
 
+    // Optional number of additional read cache lines. Each line buffers a
+    // cache_size portion of a block, in addition to the read cache, so
+    // metadata and data reads don't keep evicting each other. Must be a
+    // multiple of read_cache_ways. Defaults to no additional lines when zero.
+    lfs_size_t read_cache_lines;
+
+    // Optional associativity of the additional read cache lines. Lines are
+    // grouped into sets of read_cache_ways lines, and each block may only be
+    // cached in the set it hashes to. Defaults to read_cache_lines, a fully
+    // associative cache, when zero.
+    lfs_size_t read_cache_ways;
+
+    // Policy used to choose which line in a set to evict when the set is
+    // full. Defaults to LFS_READ_CACHE_LRU when zero.
+    enum lfs_read_cache_policy read_cache_policy;
+
+    // Optional statically allocated buffer for the additional read cache
+    // lines. Must be read_cache_lines*(sizeof(lfs_cache_t)+cache_size) bytes
+    // and aligned for lfs_cache_t. By default lfs_malloc is used to allocate
+    // this buffer.
+    void *read_cache_buffer;
+
+    // Optional number of tags to index for the most recently used metadata
+    // pair. Lookups in an indexed metadata pair find their tag directly
+    // instead of scanning the commit log backwards, and the index follows
+    // new commits. Metadata pairs with more tags than fit are scanned as
+    // usual. Defaults to no index when zero.
+    lfs_size_t metadata_index_size;
+
+    // Optional statically allocated buffer for the metadata index. Must be
+    // metadata_index_size*8 bytes. By default lfs_malloc is used to allocate
+    // this buffer.
+    void *metadata_index_buffer;
+
+    // Optional number of fetched metadata pairs to remember. Fetching a
+    // remembered metadata pair again skips reading its revision counts and
+    // checking its crcs, as long as nothing has written to it since.
+    // Remembered pairs in split directories also remember the last name
+    // they contain, so path lookups can skip pairs that sort before a name.
+    // Defaults to always fetching from scratch when zero.
+    lfs_size_t mdir_cache_size;
+
+    // Optional statically allocated buffer for remembered metadata pairs.
+    // Must be mdir_cache_size*sizeof(struct lfs_mcache_entry) bytes. By
+    // default lfs_malloc is used to allocate this buffer.
+    void *mdir_cache_buffer;
+
+    // Optional size of the name hashes written to metadata pairs in bytes,
+    // at most 1022. When set, compacting a metadata pair also writes a
+    // small bloom filter of its names, which lets path lookups skip
+    // remembered metadata pairs that can't contain a name without scanning
+    // them, and answer lookups of missing names. Only useful with
+    // mdir_cache_size. Name hashes need on-disk version lfs2.2 or later,
+    // an older disk is bumped to lfs2.2 on the first write. Defaults to no
+    // name hashes when zero.
+    lfs_size_t name_hash_size;
+
+    // Optional statically allocated buffer for building name hashes. Must be
+    // name_hash_size bytes. By default lfs_malloc is used to allocate this
+    // buffer.
+    void *name_hash_buffer;
+
+    // Optional number of resolved path components to remember. Each entry
+    // maps a directory and name to where the entry lives, so path lookups
+    // only go to disk for components they haven't seen before. Entries are
+    // fixed up as commits shift or relocate them. Defaults to resolving
+    // every path from the root when zero.
+    lfs_size_t dentry_cache_size;
+
+    // Optional statically allocated buffer for the dentry cache. Must be
+    // dentry_cache_size*sizeof(struct lfs_dcache_entry) bytes. By default
+    // lfs_malloc is used to allocate this buffer.
+    void *dentry_cache_buffer;
+
+    // Optional number of in-use block extents the block allocator may cache.
+    // When set, each traversal of the filesystem records as many in-use
+    // blocks as fit as a sorted list of extents, and later lookahead windows
+    // are populated from these extents instead of traversing the filesystem
+    // again. Defaults to traversing the filesystem for every lookahead window
+    // when zero.
+    lfs_size_t lookahead_extents;
+
+    // Optional statically allocated buffer for the block allocator's
+    // extents. Must be lookahead_extents*8 bytes. By default lfs_malloc is
+    // used to allocate this buffer.
+    void *lookahead_extents_buffer;
+
+    // Optional number of operations littlefs may keep in flight with
+    // submit. Erases and unvalidated metadata progs are submitted without
+    // waiting, and only waited on before their block is read or progged
+    // synchronously, when the queue is full, or on sync. Metadata progs
+    // queue up behind the erase of their own block, so compactions don't
+    // wait on erases. File data is validated, so the first prog to a new
+    // file block still waits for its erase, blocks are not erased ahead of
+    // time. With read_cache_lines, walks over the metadata list also read
+    // the next metadata pair into spare lines ahead of time. Requires
+    // submit and wait. Defaults to waiting for every operation when zero.
+    lfs_size_t io_depth;
+
+    // Optional statically allocated buffer for in-flight operations. Must
+    // be io_depth*(sizeof(struct lfs_bd_io)+sizeof(lfs_block_t)+cache_size)
+    // bytes and aligned for struct lfs_bd_io. By default lfs_malloc is used
+    // to allocate this buffer.
+    void *io_buffer;
+
 #ifdef LFS_MULTIVERSION
     // On-disk version to use when writing in the form of 16-bit major version
     // + 16-bit minor version. This limiting metadata to what is supported by
@@ -342,6 +541,16 @@ struct lfs_attr {
     lfs_size_t size;
 };
 
+// Scatter/gather buffer, used to describe one segment of a vectored
+// read or write.
+struct lfs_iovec {
+    // Pointer to buffer containing the segment
+    void *buffer;
+
+    // Size of segment in bytes
+    lfs_size_t size;
+};
+
 // Optional configuration provided during lfs_file_opencfg
 struct lfs_file_config {
     // Optional statically allocated file buffer. Must be cache_size.
@@ -363,6 +572,31 @@ struct lfs_file_config {
 
     // Number of custom attributes in the list
     lfs_size_t attr_count;
+
+    // Optional number of block indices to cache for this file. When set,
+    // blocks found while searching the file's skip-list are remembered, and
+    // later searches start from the nearest remembered block instead of the
+    // end of the file. This speeds up seeks and random reads in large files.
+    // Defaults to searching from the end of the file when zero.
+    lfs_size_t index_size;
+
+    // Optional statically allocated index buffer. Must be index_size*8
+    // bytes. By default lfs_malloc is used to allocate this buffer.
+    void *index_buffer;
+
+    // Optional size of the file's read-ahead buffer in bytes. When the file
+    // is read sequentially, the rest of the current block is read into this
+    // buffer with as few reads as possible. With io_depth, the buffer is
+    // split in half, and the next half is read ahead with submit, crossing
+    // into the file's next block, while the current half is consumed. Must
+    // be a multiple of read_size, or 2*read_size with io_depth. Defaults to
+    // reading through the file's cache when zero.
+    lfs_size_t readahead_size;
+
+    // Optional statically allocated read-ahead buffer. Must be
+    // readahead_size bytes. By default lfs_malloc is used to allocate this
+    // buffer.
+    void *readahead_buffer;
 };
 
 
@@ -414,6 +648,24 @@ typedef struct lfs_file {
     lfs_off_t off;
     lfs_cache_t cache;
 
+    struct lfs_file_index {
+        lfs_size_t size;
+        struct lfs_file_index_entry {
+            lfs_off_t index;
+            lfs_block_t block;
+        } *buffer;
+    } index;
+
+    struct lfs_file_ahead {
+        lfs_size_t size;
+        lfs_off_t pos;
+        uint8_t *buffer;
+        lfs_cache_t cache[2];
+        lfs_off_t npos;
+        lfs_block_t nblock;
+        lfs_off_t noff;
+    } ahead;
+
     const struct lfs_file_config *cfg;
 } lfs_file_t;
 
@@ -436,6 +688,45 @@ typedef struct lfs {
     lfs_cache_t rcache;
     lfs_cache_t pcache;
 
+    struct lfs_rlines {
+        lfs_cache_t *lines;
+        lfs_size_t sets;
+        lfs_size_t ways;
+    } rlines;
+
+    struct lfs_mindex {
+        lfs_block_t block;
+        lfs_off_t off;
+        uint32_t ptag;
+        lfs_size_t count;
+        struct lfs_mindex_entry {
+            uint32_t tag;
+            lfs_off_t off;
+        } *entries;
+    } mindex;
+
+    struct lfs_mcache {
+        struct lfs_mcache_entry {
+            lfs_mdir_t m;
+            lfs_off_t hoff;
+            lfs_size_t fsize;
+            uint8_t fence[LFS_FENCE_MAX];
+        } *entries;
+        lfs_size_t count;
+    } mcache;
+    uint8_t *namehash;
+
+    struct lfs_dcache {
+        struct lfs_dcache_entry {
+            lfs_block_t parent[2];
+            lfs_block_t pair[2];
+            lfs_block_t tail[2];
+            uint32_t tag;
+            uint8_t name[LFS_DENTRY_NAME_MAX];
+        } *entries;
+        lfs_size_t count;
+    } dcache;
+
     lfs_block_t root[2];
     struct lfs_mlist {
         struct lfs_mlist *next;
@@ -457,12 +748,39 @@ typedef struct lfs {
         uint8_t *buffer;
     } lookahead;
 
+    struct lfs_extents {
+        lfs_block_t start;
+        lfs_block_t off;
+        lfs_block_t size;
+        lfs_size_t count;
+        struct lfs_extent {
+            lfs_block_t off;
+            lfs_block_t size;
+        } *buffer;
+    } extents;
+
+    struct lfs_freemap {
+        lfs_block_t head;
+        lfs_size_t size;
+        lfs_block_t avail;
+    } freemap;
+
+    struct lfs_ioq {
+        struct lfs_bd_io *ios;
+        uint8_t *buffer;
+        lfs_size_t head;
+        lfs_size_t count;
+        lfs_block_t *bad;
+        lfs_size_t badcount;
+    } ioq;
+
     const struct lfs_config *cfg;
     lfs_size_t block_count;
     lfs_size_t name_max;
     lfs_size_t file_max;
     lfs_size_t attr_max;
     lfs_size_t inline_max;
+    uint32_t disk_version;
 
 #ifdef LFS_MIGRATE
     struct lfs1 *lfs1;
@@ -624,6 +942,42 @@ lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file,
         const void *buffer, lfs_size_t size);
 #endif
 
+// Read data from file into multiple buffers
+//
+// Takes an array of count segments, which are filled in order as though
+// by consecutive calls to read. Stops early at the end of the file.
+// Returns the number of bytes read, or a negative error code on failure.
+lfs_ssize_t lfs_file_readv(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, lfs_size_t count);
+
+// Borrow data from file without copying
+//
+// Sets buffer to point directly at up to size bytes of the file at the
+// current position, and advances the position past them. Fewer bytes may
+// be borrowed than requested, borrows never cross a block boundary. The
+// pointer is only valid until the next operation on the filesystem.
+//
+// Borrowing requires a block device with a map callback, except for
+// inline files, which are borrowed from the file's cache.
+//
+// Returns the number of bytes borrowed, 0 at the end of the file, or a
+// negative error code on failure. Returns LFS_ERR_INVAL if the data can't
+// be borrowed.
+lfs_ssize_t lfs_file_borrow(lfs_t *lfs, lfs_file_t *file,
+        const void **buffer, lfs_size_t size);
+
+#ifndef LFS_READONLY
+// Write data to file from multiple buffers
+//
+// Takes an array of count segments, which are written in order as though
+// by consecutive calls to write. The segments are written as one write,
+// so LFS_O_APPEND and the file size limit apply to them as a whole.
+//
+// Returns the number of bytes written, or a negative error code on failure.
+lfs_ssize_t lfs_file_writev(lfs_t *lfs, lfs_file_t *file,
+        const struct lfs_iovec *iov, lfs_size_t count);
+#endif
+
 // Change the position of the file
 //
 // The change in position is determined by the offset and whence flag.
@@ -685,6 +1039,23 @@ int lfs_dir_close(lfs_t *lfs, lfs_dir_t *dir);
 // or a negative error code on failure.
 int lfs_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info);
 
+// Read multiple entries in the directory
+//
+// Fills out up to count info structures, in the same order as repeated
+// calls to read, reading each metadata pair's log only once where
+// possible.
+//
+// If attr_count is non-zero, the custom attributes of each type in attrs
+// are read as well. Each attribute's buffer holds count attributes of the
+// attribute's size, and entry i's attribute is stored at buffer + i*size.
+// Missing attributes are filled with zeros, and '.' and '..' have none.
+//
+// Returns the number of entries read, 0 at the end of directory, or a
+// negative error code on failure.
+lfs_ssize_t lfs_dir_readplus(lfs_t *lfs, lfs_dir_t *dir,
+        struct lfs_info *info, lfs_size_t count,
+        const struct lfs_attr *attrs, lfs_size_t attr_count);
+
 // Change the position of the directory
 //
 // The new off must be a value previous returned from tell and specifies
@@ -707,6 +1078,78 @@ lfs_soff_t lfs_dir_tell(lfs_t *lfs, lfs_dir_t *dir);
 int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir);
 
 
+/// Directory-relative operations ///
+
+// These work like the operations above, except relative paths are looked up
+// from an already open directory instead of from the root. This saves
+// looking up the directory again for each entry when working through a
+// directory.
+//
+// Paths starting with '/' are still looked up from the root, as are all
+// paths if the directory is NULL. Paths that leave the directory through
+// '..', or that refer to the directory itself, return LFS_ERR_INVAL.
+//
+// Relative lookups share the dentry cache with absolute ones, entries are
+// keyed by the directory's metadata pair either way. With a dentry cache,
+// absolute paths through recently used directories skip the walk too, so
+// the relative operations mostly save parsing the path.
+
+#ifndef LFS_NO_MALLOC
+// Open a file relative to an open directory
+//
+// Returns a negative error code on failure.
+int lfs_file_openat(lfs_t *lfs, lfs_dir_t *at, lfs_file_t *file,
+        const char *path, int flags);
+#endif
+
+// Open a file with extra configuration relative to an open directory
+//
+// Returns a negative error code on failure.
+int lfs_file_opencfgat(lfs_t *lfs, lfs_dir_t *at, lfs_file_t *file,
+        const char *path, int flags,
+        const struct lfs_file_config *config);
+
+// Open a directory relative to an open directory
+//
+// Returns a negative error code on failure.
+int lfs_dir_openat(lfs_t *lfs, lfs_dir_t *at, lfs_dir_t *dir,
+        const char *path);
+
+#ifndef LFS_READONLY
+// Create a directory relative to an open directory
+//
+// Returns a negative error code on failure.
+int lfs_mkdirat(lfs_t *lfs, lfs_dir_t *at, const char *path);
+#endif
+
+#ifndef LFS_READONLY
+// Removes a file or directory relative to an open directory
+//
+// Returns a negative error code on failure.
+int lfs_removeat(lfs_t *lfs, lfs_dir_t *at, const char *path);
+#endif
+
+#ifndef LFS_READONLY
+// Rename or move a file or directory relative to open directories
+//
+// Returns a negative error code on failure.
+int lfs_renameat(lfs_t *lfs, lfs_dir_t *oldat, const char *oldpath,
+        lfs_dir_t *newat, const char *newpath);
+#endif
+
+// Find info about a file or directory relative to an open directory
+//
+// Returns a negative error code on failure.
+int lfs_statat(lfs_t *lfs, lfs_dir_t *at,
+        const char *path, struct lfs_info *info);
+
+// Get a custom attribute relative to an open directory
+//
+// Returns the size of the attribute, or a negative error code on failure.
+lfs_ssize_t lfs_getattrat(lfs_t *lfs, lfs_dir_t *at, const char *path,
+        uint8_t type, void *buffer, lfs_size_t size);
+
+
 /// Filesystem-level filesystem operations
 
 // Find on-disk info about the filesystem
@@ -732,6 +1175,17 @@ lfs_ssize_t lfs_fs_size(lfs_t *lfs);
 // Returns a negative error code on failure.
 int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data);
 
+// Traverse through all blocks in use by the filesystem as ranges
+//
+// Like lfs_fs_traverse, but the provided callback is called with ranges of
+// count contiguous blocks starting at block. This is much cheaper for
+// large, sequentially allocated files. Blocks may be reported more than
+// once, and contiguous blocks may be split across multiple ranges.
+//
+// Returns a negative error code on failure.
+int lfs_fs_traverserange(lfs_t *lfs,
+        int (*cb)(void*, lfs_block_t, lfs_size_t), void *data);
+
 #ifndef LFS_READONLY
 // Attempt to make the filesystem consistent and ready for writing
 //
@@ -776,6 +1230,25 @@ int lfs_fs_gc(lfs_t *lfs);
 int lfs_fs_grow(lfs_t *lfs, lfs_size_t block_count);
 #endif
 
+#ifndef LFS_READONLY
+// Writes a snapshot of the block allocator's free map to disk
+//
+// The free map is a bitmap of in-use blocks committed atomically with the
+// superblock. On mount, if no metadata has changed since the free map was
+// written, the block allocator populates its lookahead windows from the
+// free map instead of traversing the filesystem, until it has scanned every
+// block once. If the free map is missing or stale, littlefs falls back to
+// traversing the filesystem as usual.
+//
+// Building the free map costs roughly one full traversal per lookahead
+// window, so this is best called before unmounting a mostly idle
+// filesystem. Free maps need on-disk version lfs2.2 or later, an older
+// disk is bumped to lfs2.2 first.
+//
+// Returns a negative error code on failure.
+int lfs_fs_mkfreemap(lfs_t *lfs);
+#endif
+
 #ifndef LFS_READONLY
 #ifdef LFS_MIGRATE
 // Attempts to migrate a previous version of littlefs
@@ -230,6 +230,11 @@ static inline uint32_t lfs_tobe32(uint32_t a) {
 }
 
 // Calculate CRC-32 with polynomial = 0x04c11db7
+//
+// By default this uses a small nibble table. Define LFS_FAST_CRC to use
+// slice-by-8 tables (8KiB of rodata) instead, which also enables PCLMULQDQ
+// folding on x86-64 (detected at runtime) and the ARMv8 CRC32 instructions
+// (when compiled with them) unless LFS_NO_INTRINSICS is defined.
 #ifdef LFS_CRC
 static inline uint32_t lfs_crc(uint32_t crc, const void *buffer, size_t size) {
     return LFS_CRC(crc, buffer, size);
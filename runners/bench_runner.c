@@ -566,17 +566,21 @@ static struct lfs_config *bench_cfg = NULL;
 static lfs_emubd_io_t bench_last_readed = 0;
 static lfs_emubd_io_t bench_last_proged = 0;
 static lfs_emubd_io_t bench_last_erased = 0;
+static lfs_emubd_sleep_t bench_last_waited = 0;
 lfs_emubd_io_t bench_readed = 0;
 lfs_emubd_io_t bench_proged = 0;
 lfs_emubd_io_t bench_erased = 0;
+lfs_emubd_sleep_t bench_waited = 0;
 
 void bench_reset(void) {
     bench_readed = 0;
     bench_proged = 0;
     bench_erased = 0;
+    bench_waited = 0;
     bench_last_readed = 0;
     bench_last_proged = 0;
     bench_last_erased = 0;
+    bench_last_waited = 0;
 }
 
 void bench_start(void) {
@@ -587,10 +591,13 @@ void bench_start(void) {
     assert(proged >= 0);
     lfs_emubd_sio_t erased = lfs_emubd_erased(bench_cfg);
     assert(erased >= 0);
+    lfs_emubd_ssleep_t waited = lfs_emubd_time(bench_cfg);
+    assert(waited >= 0);
 
     bench_last_readed = readed;
     bench_last_proged = proged;
     bench_last_erased = erased;
+    bench_last_waited = waited;
 }
 
 void bench_stop(void) {
@@ -601,10 +608,13 @@ void bench_stop(void) {
     assert(proged >= 0);
     lfs_emubd_sio_t erased = lfs_emubd_erased(bench_cfg);
     assert(erased >= 0);
+    lfs_emubd_ssleep_t waited = lfs_emubd_time(bench_cfg);
+    assert(waited >= 0);
 
     bench_readed += readed - bench_last_readed;
     bench_proged += proged - bench_last_proged;
     bench_erased += erased - bench_last_erased;
+    bench_waited += waited - bench_last_waited;
 }
 
 
@@ -1343,6 +1353,9 @@ void perm_run(
         .read_sleep         = bench_read_sleep,
         .prog_sleep         = bench_prog_sleep,
         .erase_sleep        = bench_erase_sleep,
+        .read_latency       = READ_LATENCY,
+        .prog_latency       = PROG_LATENCY,
+        .erase_latency      = ERASE_LATENCY,
     };
 
     int err = lfs_emubd_create(&cfg, &bdcfg);
@@ -1362,10 +1375,11 @@ void perm_run(
 
     printf("finished ");
     perm_printid(suite, case_);
-    printf(" %"PRIu64" %"PRIu64" %"PRIu64,
+    printf(" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64,
         bench_readed,
         bench_proged,
-        bench_erased);
+        bench_erased,
+        bench_waited);
     printf("\n");
 
     // cleanup
@@ -103,6 +103,9 @@ intmax_t bench_define(size_t define);
 #define ERASE_CYCLES_i       13
 #define BADBLOCK_BEHAVIOR_i  14
 #define POWERLOSS_BEHAVIOR_i 15
+#define READ_LATENCY_i       16
+#define PROG_LATENCY_i       17
+#define ERASE_LATENCY_i      18
 
 #define READ_SIZE           bench_define(READ_SIZE_i)
 #define PROG_SIZE           bench_define(PROG_SIZE_i)
@@ -120,6 +123,9 @@ intmax_t bench_define(size_t define);
 #define ERASE_CYCLES        bench_define(ERASE_CYCLES_i)
 #define BADBLOCK_BEHAVIOR   bench_define(BADBLOCK_BEHAVIOR_i)
 #define POWERLOSS_BEHAVIOR  bench_define(POWERLOSS_BEHAVIOR_i)
+#define READ_LATENCY        bench_define(READ_LATENCY_i)
+#define PROG_LATENCY        bench_define(PROG_LATENCY_i)
+#define ERASE_LATENCY       bench_define(ERASE_LATENCY_i)
 
 #define BENCH_IMPLICIT_DEFINES \
     BENCH_DEF(READ_SIZE,          PROG_SIZE) \
@@ -137,10 +143,13 @@ intmax_t bench_define(size_t define);
     BENCH_DEF(ERASE_VALUE,        0xff) \
     BENCH_DEF(ERASE_CYCLES,       0) \
     BENCH_DEF(BADBLOCK_BEHAVIOR,  LFS_EMUBD_BADBLOCK_PROGERROR) \
-    BENCH_DEF(POWERLOSS_BEHAVIOR, LFS_EMUBD_POWERLOSS_NOOP)
+    BENCH_DEF(POWERLOSS_BEHAVIOR, LFS_EMUBD_POWERLOSS_NOOP) \
+    BENCH_DEF(READ_LATENCY,       0) \
+    BENCH_DEF(PROG_LATENCY,       0) \
+    BENCH_DEF(ERASE_LATENCY,      0)
 
 #define BENCH_GEOMETRY_DEFINE_COUNT 4
-#define BENCH_IMPLICIT_DEFINE_COUNT 16
+#define BENCH_IMPLICIT_DEFINE_COUNT 19
 
 
 #endif
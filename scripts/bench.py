@@ -766,6 +766,7 @@ def run_stage(name, runner_, ids, stdout_, trace_, output_, **args):
     readed = 0
     proged = 0
     erased = 0
+    waited = 0
     failures = []
     killed = False
 
@@ -775,6 +776,7 @@ def run_stage(name, runner_, ids, stdout_, trace_, output_, **args):
                 '(?: (?P<readed>\d+))?'
                 '(?: (?P<proged>\d+))?'
                 '(?: (?P<erased>\d+))?'
+                '(?: (?P<waited>\d+))?'
             '|' '(?P<path>[^:]+):(?P<lineno>\d+):(?P<op_>assert):'
                 ' *(?P<message>.*)'
         ')$')
@@ -788,6 +790,7 @@ def run_stage(name, runner_, ids, stdout_, trace_, output_, **args):
         nonlocal readed
         nonlocal proged
         nonlocal erased
+        nonlocal waited
         nonlocal locals
 
         # run the benches!
@@ -837,12 +840,14 @@ def run_stage(name, runner_, ids, stdout_, trace_, output_, **args):
                         readed_ = int(m.group('readed'))
                         proged_ = int(m.group('proged'))
                         erased_ = int(m.group('erased'))
+                        waited_ = int(m.group('waited') or 0)
                         passed_suite_perms[suite] += 1
                         passed_case_perms[case] += 1
                         passed_perms += 1
                         readed += readed_
                         proged += proged_
                         erased += erased_
+                        waited += waited_
                         if output_:
                             # get defines and write to csv
                             defines = find_defines(
@@ -853,6 +858,7 @@ def run_stage(name, runner_, ids, stdout_, trace_, output_, **args):
                                 'bench_readed': readed_,
                                 'bench_proged': proged_,
                                 'bench_erased': erased_,
+                                'bench_waited': waited_,
                                 **defines})
                     elif op == 'skipped':
                         locals.seen_perms += 1
@@ -996,6 +1002,7 @@ def run_stage(name, runner_, ids, stdout_, trace_, output_, **args):
         readed,
         proged,
         erased,
+        waited,
         failures,
         killed)
 
@@ -1031,7 +1038,8 @@ def run(runner, bench_ids=[], **args):
     if args.get('output'):
         output = BenchOutput(args['output'],
             ['suite', 'case'],
-            ['bench_readed', 'bench_proged', 'bench_erased'])
+            ['bench_readed', 'bench_proged', 'bench_erased',
+                'bench_waited'])
 
     # measure runtime
     start = time.time()
@@ -1042,6 +1050,7 @@ def run(runner, bench_ids=[], **args):
     readed = 0
     proged = 0
     erased = 0
+    waited = 0
     failures = []
     for by in (bench_ids if bench_ids
             else expected_case_perms.keys() if args.get('by_cases')
@@ -1053,6 +1062,7 @@ def run(runner, bench_ids=[], **args):
             readed_,
             proged_,
             erased_,
+            waited_,
             failures_,
             killed) = run_stage(
                 by or 'benches',
@@ -1068,6 +1078,7 @@ def run(runner, bench_ids=[], **args):
         readed += readed_
         proged += proged_
         erased += erased_
+        waited += waited_
         failures.extend(failures_)
         if (failures and not args.get('keep_going')) or killed:
             break
@@ -1097,6 +1108,7 @@ def run(runner, bench_ids=[], **args):
             '%d readed' % readed,
             '%d proged' % proged,
             '%d erased' % erased,
+            '%d waited' % waited if waited else None,
             'in %.2fs' % (stop-start)]))))
     print()
 